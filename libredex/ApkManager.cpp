@@ -2,11 +2,15 @@
 
 #include "ApkManager.h"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 
+#include "RedexResources.h"
+#include "Trace.h"
+
 namespace {
 
 void check_directory(std::string& dir) {
@@ -19,6 +23,17 @@ void check_directory(std::string& dir) {
 
 }
 
+ApkManager::ApkManager(std::string&& apk_dir) : m_apk_dir(apk_dir) {}
+
+ApkManager::~ApkManager() {
+  for (auto& fd : m_files) {
+    if (*fd != nullptr) {
+      fclose(*fd);
+      fd = nullptr;
+    }
+  }
+}
+
 std::shared_ptr<FILE*> ApkManager::new_asset_file(const char* filename) {
   check_directory(m_apk_dir);
   std::ostringstream path;
@@ -35,3 +50,42 @@ std::shared_ptr<FILE*> ApkManager::new_asset_file(const char* filename) {
     throw new std::runtime_error("Error creating new asset file");
   }
 }
+
+XmlEditSession& ApkManager::xml_edits() {
+  if (!m_xml_edits) {
+    auto xml_files = get_xml_files(m_apk_dir + "/res");
+    m_xml_files.assign(xml_files.begin(), xml_files.end());
+    std::sort(m_xml_files.begin(), m_xml_files.end());
+    m_xml_edits = std::make_unique<XmlEditSession>(m_xml_files);
+  }
+  return *m_xml_edits;
+}
+
+void ApkManager::commit_xml_edits() {
+  if (!m_xml_edits) {
+    return;
+  }
+  auto stats = m_xml_edits->commit();
+  XmlEditSession::FileStats total;
+  for (size_t i = 0; i < m_xml_files.size(); ++i) {
+    const auto& file = stats[i];
+    if (file.strings_renamed + file.values_remapped + file.values_inlined ==
+        0) {
+      continue;
+    }
+    TRACE(PM, 3,
+          "Edited %s: %zu strings renamed, %zu values remapped, %zu values "
+          "inlined, delta %zi bytes\n",
+          m_xml_files[i].c_str(), file.strings_renamed, file.values_remapped,
+          file.values_inlined, file.size_delta);
+    total.strings_renamed += file.strings_renamed;
+    total.values_remapped += file.values_remapped;
+    total.values_inlined += file.values_inlined;
+    total.size_delta += file.size_delta;
+  }
+  TRACE(PM, 1,
+        "Edited XML resources: %zu strings renamed, %zu values remapped, "
+        "%zu values inlined, delta %zi bytes\n",
+        total.strings_renamed, total.values_remapped, total.values_inlined,
+        total.size_delta);
+}
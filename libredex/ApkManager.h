@@ -6,24 +6,26 @@
 #include <vector>
 #include <memory>
 
+class XmlEditSession;
+
 class ApkManager {
  public:
-   ApkManager(std::string&& apk_dir)
-      : m_apk_dir(apk_dir) {
-   }
-
-   virtual ~ApkManager() {
-     for (auto& fd : m_files) {
-       if (*fd != nullptr) {
-         fclose(*fd);
-         fd = nullptr;
-       }
-     }
-   }
+   ApkManager(std::string&& apk_dir);
+
+   virtual ~ApkManager();
 
    std::shared_ptr<FILE*> new_asset_file(const char* filename);
 
+   // The edit session for the binary XML files under res/, shared by all
+   // passes of the run.
+   XmlEditSession& xml_edits();
+
+   // Applies the edits queued on xml_edits() so far.
+   void commit_xml_edits();
+
  private:
    std::vector<std::shared_ptr<FILE*>> m_files;
    std::string m_apk_dir;
+   std::vector<std::string> m_xml_files;
+   std::unique_ptr<XmlEditSession> m_xml_edits;
 };
@@ -9,8 +9,11 @@
 
 #include "CallGraph.h"
 
+#include <limits>
+
 #include "VirtualScope.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -32,8 +35,10 @@ class SingleCalleeStrategy final : public BuildStrategy {
     for (auto& mie : InstructionIterable(code)) {
       auto insn = mie.insn;
       if (is_invoke(insn->opcode())) {
-        auto callee = resolve_method(
-            insn->get_method(), opcode_to_search(insn), m_resolved_refs);
+        // Callsites are gathered concurrently, so we resolve without going
+        // through a shared MethodRefCache.
+        auto callee =
+            resolve_method(insn->get_method(), opcode_to_search(insn));
         if (callee == nullptr || is_definitely_virtual(callee)) {
           continue;
         }
@@ -63,7 +68,6 @@ class SingleCalleeStrategy final : public BuildStrategy {
 
   const Scope& m_scope;
   std::unordered_set<DexMethod*> m_non_virtual;
-  mutable MethodRefCache m_resolved_refs;
 };
 
 } // namespace
@@ -78,49 +82,97 @@ Edge::Edge(DexMethod* caller, DexMethod* callee, IRList::iterator invoke_it)
     : m_caller(caller), m_callee(callee), m_invoke_it(invoke_it) {}
 
 Graph::Graph(const BuildStrategy& strat) {
-  // Add edges from the single "ghost" entry node to all the "real" entry
-  // nodes in the graph.
-  auto roots = strat.get_roots();
-  for (DexMethod* root : roots) {
-    auto edge = std::make_shared<Edge>(nullptr, root, IRList::iterator());
-    m_entry.m_successors.emplace_back(edge);
-    make_node(root).m_predecessors.emplace_back(edge);
+  // Node 0 is the single "ghost" entry node, with an edge to each of the
+  // "real" entry nodes in the graph.
+  m_methods.emplace_back(nullptr);
+  std::vector<DexMethod*> frontier;
+  std::vector<CallSites> callsites(1);
+  for (DexMethod* root : strat.get_roots()) {
+    intern(root, &frontier);
+    callsites[0].emplace_back(root, IRList::iterator());
   }
 
-  // Obtain the callsites of each method recursively, building the graph in the
-  // process.
-  std::unordered_set<const DexMethod*> visited;
-  std::function<void(DexMethod*)> visit = [&](auto* caller) {
-    if (visited.count(caller) != 0) {
-      return;
+  // Obtain the callsites of each frontier in parallel, one breadth-first
+  // layer at a time. Each method writes only to its own slot, and new callees
+  // are interned serially afterwards in callsite order, so the numbering does
+  // not depend on scheduling.
+  static constexpr size_t MIN_PARALLEL_FRONTIER = 64;
+  while (!frontier.empty()) {
+    size_t first = callsites.size();
+    callsites.resize(first + frontier.size());
+    auto gather = [&](size_t i) {
+      callsites[first + i] = strat.get_callsites(frontier[i]);
+    };
+    if (frontier.size() < MIN_PARALLEL_FRONTIER) {
+      for (size_t i = 0; i < frontier.size(); ++i) {
+        gather(i);
+      }
+    } else {
+      auto wq = workqueue_foreach<size_t>(
+          gather,
+          std::min(walk::parallel::default_num_threads(),
+                   static_cast<unsigned int>(frontier.size())));
+      for (size_t i = 0; i < frontier.size(); ++i) {
+        wq.add_item(i);
+      }
+      wq.run_all();
     }
-    visited.emplace(caller);
-    for (const auto& callsite : strat.get_callsites(caller)) {
-      this->add_edge(caller, callsite.callee, callsite.invoke);
-      visit(callsite.callee);
+    std::vector<DexMethod*> next;
+    for (size_t id = first; id < callsites.size(); ++id) {
+      for (const auto& callsite : callsites[id]) {
+        intern(callsite.callee, &next);
+      }
     }
-  };
+    frontier.swap(next);
+  }
 
-  for (DexMethod* root : roots) {
-    visit(root);
+  // Lay the edges out by caller, then bucket them by callee.
+  size_t total_nodes = m_methods.size();
+  size_t total_edges = 0;
+  for (const auto& sites : callsites) {
+    total_edges += sites.size();
+  }
+  always_assert(total_edges <= std::numeric_limits<uint32_t>::max());
+  m_edges.reserve(total_edges);
+  m_succ_offsets.reserve(total_nodes + 1);
+  std::vector<uint32_t> callee_ids;
+  callee_ids.reserve(total_edges);
+  for (size_t id = 0; id < total_nodes; ++id) {
+    m_succ_offsets.emplace_back(m_edges.size());
+    for (const auto& callsite : callsites[id]) {
+      m_edges.emplace_back(m_methods[id], callsite.callee, callsite.invoke);
+      callee_ids.emplace_back(m_node_ids.at(callsite.callee));
+    }
+    CallSites().swap(callsites[id]);
+  }
+  m_succ_offsets.emplace_back(m_edges.size());
+
+  m_succs.reserve(total_edges);
+  for (const auto& edge : m_edges) {
+    m_succs.emplace_back(&edge);
   }
-}
 
-Node& Graph::make_node(DexMethod* m) {
-  auto it = m_nodes.find(m);
-  if (it != m_nodes.end()) {
-    return it->second;
+  m_pred_offsets.assign(total_nodes + 1, 0);
+  for (auto callee_id : callee_ids) {
+    ++m_pred_offsets[callee_id + 1];
+  }
+  for (size_t id = 0; id < total_nodes; ++id) {
+    m_pred_offsets[id + 1] += m_pred_offsets[id];
+  }
+  m_preds.resize(total_edges);
+  std::vector<uint32_t> fill(m_pred_offsets.begin(), m_pred_offsets.end() - 1);
+  for (size_t i = 0; i < total_edges; ++i) {
+    m_preds[fill[callee_ids[i]]++] = &m_edges[i];
   }
-  m_nodes.emplace(m, Node(m));
-  return m_nodes.at(m);
 }
 
-void Graph::add_edge(DexMethod* caller,
-                     DexMethod* callee,
-                     IRList::iterator invoke_it) {
-  auto edge = std::make_shared<Edge>(caller, callee, invoke_it);
-  make_node(caller).m_successors.emplace_back(edge);
-  make_node(callee).m_predecessors.emplace_back(edge);
+uint32_t Graph::intern(DexMethod* m, std::vector<DexMethod*>* frontier) {
+  auto result = m_node_ids.emplace(m, m_methods.size());
+  if (result.second) {
+    m_methods.emplace_back(m);
+    frontier->emplace_back(m);
+  }
+  return result.first->second;
 }
 
 } // namespace call_graph
@@ -9,8 +9,8 @@
 
 #pragma once
 
-#include <boost/functional/hash.hpp>
 #include <unordered_map>
+#include <vector>
 
 #include "DexClass.h"
 #include "FixpointIterators.h"
@@ -53,7 +53,7 @@ using CallSites = std::vector<CallSite>;
  * from the roots and invoke get_callsites() on each returned method
  * recursively until the graph is fully mapped out. One can think of the
  * BuildStrategy as implicitly encoding the graph structure, with the Graph
- * constructor reifying it.
+ * constructor reifying it. get_callsites() is called from multiple threads.
  */
 class BuildStrategy {
  public:
@@ -77,63 +77,126 @@ class Edge {
   IRList::iterator m_invoke_it;
 };
 
-using Edges = std::vector<std::shared_ptr<Edge>>;
+/*
+ * Edges are owned by the Graph and live in one contiguous array, so they can
+ * be handed out as plain pointers that stay valid for the graph's lifetime.
+ */
+using EdgeId = const Edge*;
+
+/*
+ * A view onto a contiguous slice of the graph's adjacency arrays.
+ */
+class Edges {
+ public:
+  using iterator = const EdgeId*;
+  using const_iterator = iterator;
+
+  Edges(iterator begin, iterator end) : m_begin(begin), m_end(end) {}
+  iterator begin() const { return m_begin; }
+  iterator end() const { return m_end; }
+  size_t size() const { return m_end - m_begin; }
+  bool empty() const { return m_begin == m_end; }
+
+ private:
+  iterator m_begin;
+  iterator m_end;
+};
 
 class Node {
  public:
-  /* implicit */
-  Node(DexMethod* m) : m_method(m) {}
-  DexMethod* method() const { return m_method; }
-  bool operator==(const Node& that) const { return method() == that.method(); }
-  const Edges& callers() const { return m_predecessors; }
-  const Edges& callees() const { return m_successors; }
+  DexMethod* method() const;
+  bool operator==(const Node& that) const {
+    return m_graph == that.m_graph && m_id == that.m_id;
+  }
+  Edges callers() const;
+  Edges callees() const;
 
  private:
-  DexMethod* m_method;
-  Edges m_predecessors;
-  Edges m_successors;
+  Node(const Graph* graph, uint32_t id) : m_graph(graph), m_id(id) {}
+
+  const Graph* m_graph;
+  uint32_t m_id;
 
   friend class Graph;
 };
 
-inline size_t hash_value(const Node& node) {
-  return reinterpret_cast<size_t>(node.method());
-}
-
 } // namespace call_graph
 
 namespace call_graph {
 
+/*
+ * The graph is stored in compressed sparse row form: every reachable method
+ * gets a dense id (the ghost entry node is id 0), all edges live in a single
+ * array ordered by caller, and the callees / callers of node i are the slices
+ * [offsets[i], offsets[i + 1]) of the successor / predecessor lists.
+ *
+ * Construction visits the graph breadth-first from the roots and queries the
+ * BuildStrategy for the callsites of each frontier in parallel, so
+ * get_callsites() must be safe to call concurrently. Ids are assigned in
+ * discovery order, which keeps the layout deterministic regardless of the
+ * number of threads.
+ *
+ * Edge pointers refer into the graph's own storage, so graphs can be moved
+ * but not copied.
+ */
 class Graph final {
  public:
   Graph(const BuildStrategy&);
 
-  const Node& entry() const { return m_entry; }
+  Graph(Graph&&) = default;
+  Graph& operator=(Graph&&) = default;
+  Graph(const Graph&) = delete;
+  Graph& operator=(const Graph&) = delete;
 
-  const Node& node(const DexMethod* m) const {
+  Node entry() const { return Node(this, 0); }
+
+  Node node(const DexMethod* m) const {
     if (m == nullptr) {
-      return m_entry;
+      return entry();
     }
-    return m_nodes.at(const_cast<DexMethod*>(m));
+    return Node(this, m_node_ids.at(m));
   }
 
+  size_t num_nodes() const { return m_methods.size(); }
+
+  size_t num_edges() const { return m_edges.size(); }
+
  private:
-  Node& make_node(DexMethod*);
+  uint32_t intern(DexMethod*, std::vector<DexMethod*>* frontier);
 
-  void add_edge(DexMethod* caller,
-                DexMethod* callee,
-                IRList::iterator invoke_it);
+  // Indexed by node id.
+  std::vector<DexMethod*> m_methods;
+  std::unordered_map<const DexMethod*, uint32_t> m_node_ids;
 
-  Node m_entry = Node(nullptr);
-  std::unordered_map<DexMethod*, Node, boost::hash<Node>> m_nodes;
+  std::vector<Edge> m_edges;
+  std::vector<uint32_t> m_succ_offsets;
+  std::vector<EdgeId> m_succs;
+  std::vector<uint32_t> m_pred_offsets;
+  std::vector<EdgeId> m_preds;
+
+  friend class Node;
 };
 
+inline DexMethod* Node::method() const { return m_graph->m_methods[m_id]; }
+
+inline Edges Node::callers() const {
+  const auto* preds = m_graph->m_preds.data();
+  return Edges(preds + m_graph->m_pred_offsets[m_id],
+               preds + m_graph->m_pred_offsets[m_id + 1]);
+}
+
+inline Edges Node::callees() const {
+  const auto* succs = m_graph->m_succs.data();
+  return Edges(succs + m_graph->m_succ_offsets[m_id],
+               succs + m_graph->m_succ_offsets[m_id + 1]);
+}
+
 // A static-method-only API for use with the monotonic fixpoint iterator.
 class GraphInterface {
  public:
   using Graph = call_graph::Graph;
   using NodeId = DexMethod*;
-  using EdgeId = std::shared_ptr<Edge>;
+  using EdgeId = call_graph::EdgeId;
 
   static const NodeId entry(const Graph& graph) {
     return graph.entry().method();
@@ -145,10 +208,10 @@ class GraphInterface {
     return graph.node(m).callees();
   }
   static const NodeId source(const Graph& graph, const EdgeId& e) {
-    return graph.node(e->caller()).method();
+    return e->caller();
   }
   static const NodeId target(const Graph& graph, const EdgeId& e) {
-    return graph.node(e->callee()).method();
+    return e->callee();
   }
 };
 
@@ -12,6 +12,7 @@
 #include "DexUtil.h"
 #include "Timer.h"
 #include "Resolver.h"
+#include "Walkers.h"
 
 namespace {
 
@@ -108,11 +109,35 @@ void build_interface_map(InterfaceMap& interfaces,
 }
 
 ClassHierarchy build_type_hierarchy(const Scope& scope) {
-  ClassHierarchy hierarchy;
-  // build the type hierarchy
-  for (const auto& cls : scope) {
-    if (is_interface(cls)) continue;
-    build_class_hierarchy(hierarchy, cls);
+  // Each worker builds the hierarchy of a slice of the scope, and the slices
+  // are merged afterwards. Children are kept in ordered sets, so the result
+  // doesn't depend on how the scope was split.
+  static constexpr size_t MIN_CLASSES_PER_THREAD = 1024;
+  size_t num_slices = std::max<size_t>(
+      1,
+      std::min<size_t>(walk::parallel::default_num_threads(),
+                       scope.size() / MIN_CLASSES_PER_THREAD));
+  std::vector<ClassHierarchy> slices(num_slices);
+  auto build_slice = [&](size_t slice) {
+    for (size_t i = slice; i < scope.size(); i += num_slices) {
+      if (is_interface(scope[i])) continue;
+      build_class_hierarchy(slices[slice], scope[i]);
+    }
+  };
+  if (num_slices == 1) {
+    build_slice(0);
+  } else {
+    auto wq = workqueue_foreach<size_t>(build_slice, num_slices);
+    for (size_t slice = 0; slice < num_slices; ++slice) {
+      wq.add_item(slice);
+    }
+    wq.run_all();
+  }
+  ClassHierarchy hierarchy = std::move(slices[0]);
+  for (size_t slice = 1; slice < num_slices; ++slice) {
+    for (auto& entry : slices[slice]) {
+      hierarchy[entry.first].insert(entry.second.begin(), entry.second.end());
+    }
   }
   build_external_hierarchy(hierarchy);
   return hierarchy;
@@ -7,13 +7,18 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <json/json.h>
+#include <limits>
 
 #include "DexClass.h"
 #include "DexPosition.h"
 #include "DexUtil.h"
+#include "Walkers.h"
+#include "WorkQueue.h"
 
 DexPosition::DexPosition(uint32_t line) : line(line), parent(nullptr) {}
 
@@ -46,15 +51,6 @@ uint32_t RealPositionMapper::position_to_line(DexPosition* pos) {
 }
 
 void RealPositionMapper::write_map() {
-  if (m_filename != "") {
-    write_map_v1();
-  }
-  if (m_filename_v2 != "") {
-    write_map_v2();
-  }
-}
-
-void RealPositionMapper::write_map_v1() {
   // to ensure that the line numbers in the Dex are as compact as possible,
   // we put the emitted positions at the start of the list and rest at the end
   for (auto item : m_pos_line_map) {
@@ -65,6 +61,29 @@ void RealPositionMapper::write_map_v1() {
       m_pos_line_map[item.first] = idx;
     }
   }
+  if (m_filename != "") {
+    write_map_v1();
+  }
+  if (m_filename_v2 != "") {
+    write_map_v2();
+  }
+  if (m_filename_v3 != "") {
+    write_map_v3();
+  }
+}
+
+uint32_t RealPositionMapper::get_parent_line(DexPosition* pos) {
+  uint32_t parent_line = 0;
+  try {
+    parent_line = pos->parent == nullptr ? 0 : get_line(pos->parent);
+  } catch (std::out_of_range& e) {
+    std::cerr << "Parent position " << show(pos->parent) << " of "
+              << show(pos) << " was not registered" << std::endl;
+  }
+  return parent_line;
+}
+
+void RealPositionMapper::write_map_v1() {
   /*
    * Map file layout:
    * 0xfaceb000 (magic number)
@@ -83,13 +102,7 @@ void RealPositionMapper::write_map_v1() {
   std::vector<DexString*> string_pool;
 
   for (auto pos : m_positions) {
-    uint32_t parent_line = 0;
-    try {
-      parent_line = pos->parent == nullptr ? 0 : get_line(pos->parent);
-    } catch (std::out_of_range& e) {
-      std::cerr << "Parent position " << show(pos->parent) << " of "
-                << show(pos) << " was not registered" << std::endl;
-    }
+    uint32_t parent_line = get_parent_line(pos);
     if (string_ids.find(pos->file) == string_ids.end()) {
       string_ids[pos->file] = string_pool.size();
       string_pool.push_back(pos->file);
@@ -119,16 +132,6 @@ void RealPositionMapper::write_map_v1() {
 }
 
 void RealPositionMapper::write_map_v2() {
-  // to ensure that the line numbers in the Dex are as compact as possible,
-  // we put the emitted positions at the start of the list and rest at the end
-  for (auto item : m_pos_line_map) {
-    auto line = item.second;
-    if (line == -1) {
-      auto idx = m_positions.size();
-      m_positions.emplace_back(item.first);
-      m_pos_line_map[item.first] = idx;
-    }
-  }
   /*
    * Map file layout:
    * 0xfaceb000 (magic number)
@@ -155,13 +158,7 @@ void RealPositionMapper::write_map_v2() {
   };
 
   for (auto pos : m_positions) {
-    uint32_t parent_line = 0;
-    try {
-      parent_line = pos->parent == nullptr ? 0 : get_line(pos->parent);
-    } catch (std::out_of_range& e) {
-      std::cerr << "Parent position " << show(pos->parent) << " of "
-                << show(pos) << " was not registered" << std::endl;
-    }
+    uint32_t parent_line = get_parent_line(pos);
     // of the form "class_name.method_name:(arg_types)return_type"
     auto full_method_name = pos->method->get_deobfuscated_name();
     // strip out the args and return type
@@ -199,15 +196,207 @@ void RealPositionMapper::write_map_v2() {
   ofs << pos_out.str();
 }
 
+namespace {
+
+/*
+ * Calls fn(i) for every i in [0, size), in parallel over chunks of the range.
+ */
+template <typename Fn>
+void parallel_for(size_t size, Fn fn) {
+  constexpr size_t CHUNK_SIZE = 4096;
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t begin) {
+        auto end = std::min(begin + CHUNK_SIZE, size);
+        for (size_t i = begin; i < end; ++i) {
+          fn(i);
+        }
+      },
+      walk::parallel::default_num_threads());
+  for (size_t begin = 0; begin < size; begin += CHUNK_SIZE) {
+    wq.add_item(begin);
+  }
+  wq.run_all();
+}
+
+/*
+ * Splits a deobfuscated method name, of the form
+ * "class_name.method_name:(arg_types)return_type", into the external class
+ * name and the method name.
+ */
+void split_method_name(const std::string& full_method_name,
+                       std::string* class_name,
+                       std::string* method_name) {
+  auto end = std::min(full_method_name.find(':'), full_method_name.size());
+  auto dot = full_method_name.rfind('.', end);
+  if (dot == std::string::npos) {
+    auto qualified_method_name = full_method_name.substr(0, end);
+    *class_name = JavaNameUtil::internal_to_external(qualified_method_name);
+    *method_name = qualified_method_name;
+    return;
+  }
+  *class_name =
+      JavaNameUtil::internal_to_external(full_method_name.substr(0, dot));
+  method_name->assign(full_method_name, dot + 1, end - dot - 1);
+}
+
+template <typename T>
+void write_raw(std::ofstream& ofs, const T& value) {
+  ofs.write((const char*)&value, sizeof(value));
+}
+
+} // namespace
+
+void RealPositionMapper::write_map_v3() {
+  /*
+   * Map file layout:
+   * 0xfaceb000 (magic number)
+   * version (4 bytes)
+   * string_count (4 bytes)
+   * positions_count (4 bytes)
+   * string_offsets_start (8 bytes)
+   * string_data_start (8 bytes)
+   * positions_start (8 bytes)
+   * string_offsets[string_count + 1] (4 bytes each)
+   * string_data
+   * positions[positions_count] (20 bytes each)
+   *
+   * All the *_start fields are offsets from the beginning of the file, so
+   * that a reader can map the file and use the tables in place. The strings
+   * are sorted and unique. String i is made of the bytes of string_data
+   * between string_offsets[i] and string_offsets[i + 1], with no terminator.
+   * The positions table starts on a 4-byte boundary and each position is
+   * encoded as follows:
+   * class_id (4 bytes)
+   * method_id (4 bytes)
+   * file_id (4 bytes)
+   * line (4 bytes)
+   * parent_line (4 bytes)
+   */
+  std::unordered_map<DexMethod*, uint32_t> method_ids;
+  std::vector<DexMethod*> methods;
+  std::unordered_map<DexString*, uint32_t> file_ids;
+  std::vector<DexString*> files;
+  for (auto pos : m_positions) {
+    if (method_ids.emplace(pos->method, methods.size()).second) {
+      methods.push_back(pos->method);
+    }
+    if (file_ids.emplace(pos->file, files.size()).second) {
+      files.push_back(pos->file);
+    }
+  }
+
+  // The names are computed once per method rather than once per position.
+  std::vector<std::string> class_names(methods.size());
+  std::vector<std::string> method_names(methods.size());
+  parallel_for(methods.size(), [&](size_t i) {
+    split_method_name(methods[i]->get_deobfuscated_name(),
+                      &class_names[i],
+                      &method_names[i]);
+  });
+
+  std::vector<const char*> string_pool;
+  string_pool.reserve(2 * methods.size() + files.size());
+  for (size_t i = 0; i < methods.size(); ++i) {
+    string_pool.push_back(class_names[i].c_str());
+    string_pool.push_back(method_names[i].c_str());
+  }
+  for (auto file : files) {
+    string_pool.push_back(file->c_str());
+  }
+  auto str_less = [](const char* a, const char* b) {
+    return strcmp(a, b) < 0;
+  };
+  std::sort(string_pool.begin(), string_pool.end(), str_less);
+  string_pool.erase(std::unique(string_pool.begin(),
+                                string_pool.end(),
+                                [](const char* a, const char* b) {
+                                  return strcmp(a, b) == 0;
+                                }),
+                    string_pool.end());
+  auto id_of_string = [&](const char* s) -> uint32_t {
+    return std::lower_bound(
+               string_pool.begin(), string_pool.end(), s, str_less) -
+           string_pool.begin();
+  };
+
+  std::vector<uint32_t> class_ids(methods.size());
+  std::vector<uint32_t> method_name_ids(methods.size());
+  parallel_for(methods.size(), [&](size_t i) {
+    class_ids[i] = id_of_string(class_names[i].c_str());
+    method_name_ids[i] = id_of_string(method_names[i].c_str());
+  });
+  std::vector<uint32_t> file_name_ids(files.size());
+  parallel_for(files.size(), [&](size_t i) {
+    file_name_ids[i] = id_of_string(files[i]->c_str());
+  });
+
+  constexpr size_t POSITION_WORDS = 5;
+  std::vector<uint32_t> positions(m_positions.size() * POSITION_WORDS);
+  parallel_for(m_positions.size(), [&](size_t i) {
+    auto pos = m_positions[i];
+    auto method = method_ids.at(pos->method);
+    auto record = &positions[i * POSITION_WORDS];
+    record[0] = class_ids[method];
+    record[1] = method_name_ids[method];
+    record[2] = file_name_ids[file_ids.at(pos->file)];
+    record[3] = pos->line;
+    record[4] = get_parent_line(pos);
+  });
+
+  std::vector<uint32_t> string_offsets;
+  string_offsets.reserve(string_pool.size() + 1);
+  uint64_t string_data_size = 0;
+  for (auto s : string_pool) {
+    string_offsets.push_back(string_data_size);
+    string_data_size += strlen(s);
+  }
+  always_assert_log(string_data_size <= std::numeric_limits<uint32_t>::max(),
+                    "Line map strings don't fit in 4GB");
+  string_offsets.push_back(string_data_size);
+
+  uint32_t magic = 0xfaceb000; // serves as endianess check
+  uint32_t version = 3;
+  uint32_t spool_count = string_pool.size();
+  uint32_t pos_count = m_positions.size();
+  uint64_t string_offsets_start = 2 * sizeof(uint32_t) + 2 * sizeof(uint32_t) +
+                                  3 * sizeof(uint64_t);
+  uint64_t string_data_start =
+      string_offsets_start + string_offsets.size() * sizeof(uint32_t);
+  uint64_t positions_start = string_data_start + string_data_size;
+  uint32_t padding = (4 - positions_start % 4) % 4;
+  positions_start += padding;
+
+  std::ofstream ofs(m_filename_v3.c_str(),
+                    std::ofstream::out | std::ofstream::trunc |
+                        std::ofstream::binary);
+  write_raw(ofs, magic);
+  write_raw(ofs, version);
+  write_raw(ofs, spool_count);
+  write_raw(ofs, pos_count);
+  write_raw(ofs, string_offsets_start);
+  write_raw(ofs, string_data_start);
+  write_raw(ofs, positions_start);
+  ofs.write((const char*)string_offsets.data(),
+            string_offsets.size() * sizeof(uint32_t));
+  for (auto s : string_pool) {
+    ofs.write(s, strlen(s));
+  }
+  const char zeros[4] = {0, 0, 0, 0};
+  ofs.write(zeros, padding);
+  ofs.write((const char*)positions.data(), positions.size() * sizeof(uint32_t));
+}
+
 PositionMapper* PositionMapper::make(const std::string& map_filename,
-                                     const std::string& map_filename_v2) {
-  if (map_filename == "" && map_filename_v2 == "") {
+                                     const std::string& map_filename_v2,
+                                     const std::string& map_filename_v3) {
+  if (map_filename == "" && map_filename_v2 == "" && map_filename_v3 == "") {
     // If no path is provided for the map, just pass the original line numbers
     // through to the output. This does mean that the line numbers will be
     // incorrect for inlined code.
     return new NoopPositionMapper();
   } else {
-    return new RealPositionMapper(map_filename, map_filename_v2);
+    return new RealPositionMapper(
+        map_filename, map_filename_v2, map_filename_v3);
   }
 }
 
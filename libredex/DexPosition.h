@@ -40,7 +40,8 @@ class PositionMapper {
   virtual void register_position(DexPosition* pos) = 0;
   virtual void write_map() = 0;
   static PositionMapper* make(const std::string& map_filename,
-                              const std::string& map_filename_v2);
+                              const std::string& map_filename_v2,
+                              const std::string& map_filename_v3 = "");
 };
 
 /*
@@ -53,16 +54,22 @@ class PositionMapper {
 class RealPositionMapper : public PositionMapper {
   std::string m_filename;
   std::string m_filename_v2;
+  std::string m_filename_v3;
   std::vector<DexPosition*> m_positions;
   std::unordered_map<DexPosition*, int64_t> m_pos_line_map;
  protected:
   uint32_t get_line(DexPosition*);
+  uint32_t get_parent_line(DexPosition*);
   void write_map_v1();
   void write_map_v2();
+  void write_map_v3();
  public:
   RealPositionMapper(const std::string& filename,
-                     const std::string& filename_v2)
-      : m_filename(filename), m_filename_v2(filename_v2) {}
+                     const std::string& filename_v2,
+                     const std::string& filename_v3 = "")
+      : m_filename(filename),
+        m_filename_v2(filename_v2),
+        m_filename_v3(filename_v3) {}
   virtual DexString* get_source_file(const DexClass*);
   virtual uint32_t position_to_line(DexPosition*);
   virtual void register_position(DexPosition* pos);
@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "HierarchyService.h"
+
+#include <algorithm>
+
+#include "Timer.h"
+#include "Trace.h"
+#include "VirtualScope.h"
+
+HierarchyService::HierarchyService() {}
+
+HierarchyService::~HierarchyService() {}
+
+void HierarchyService::sync_scope(const Scope& scope) {
+  Scope classes(scope);
+  std::sort(classes.begin(), classes.end());
+  if (classes == m_classes) {
+    return;
+  }
+  if (m_hierarchy != nullptr) {
+    TRACE(PM, 2, "Scope changed, dropping the cached hierarchy\n");
+  }
+  invalidate(HA_ALL);
+  m_classes = std::move(classes);
+}
+
+std::shared_ptr<const ClassHierarchy> HierarchyService::class_hierarchy(
+    const Scope& scope) {
+  sync_scope(scope);
+  if (m_hierarchy == nullptr) {
+    Timer t("Building class hierarchy");
+    m_hierarchy =
+        std::make_shared<const ClassHierarchy>(build_type_hierarchy(scope));
+  }
+  return m_hierarchy;
+}
+
+std::shared_ptr<const ClassScopes> HierarchyService::class_scopes(
+    const Scope& scope) {
+  sync_scope(scope);
+  if (m_class_scopes == nullptr) {
+    Timer t("Building class scopes");
+    m_class_scopes = std::make_shared<const ClassScopes>(scope);
+    if (m_hierarchy == nullptr) {
+      m_hierarchy = std::shared_ptr<const ClassHierarchy>(
+          m_class_scopes, &m_class_scopes->get_class_hierarchy());
+    }
+  }
+  return m_class_scopes;
+}
+
+void HierarchyService::prepare(const Scope& scope, uint32_t analyses) {
+  if (analyses & HA_CLASS_SCOPES) {
+    class_scopes(scope);
+  } else if (analyses & HA_CLASS_HIERARCHY) {
+    class_hierarchy(scope);
+  }
+}
+
+void HierarchyService::invalidate(uint32_t analyses) {
+  if (analyses & HA_CLASS_HIERARCHY) {
+    m_hierarchy = nullptr;
+    m_class_scopes = nullptr;
+    return;
+  }
+  if ((analyses & HA_CLASS_SCOPES) && m_class_scopes != nullptr) {
+    if (m_hierarchy.get() == &m_class_scopes->get_class_hierarchy()) {
+      // The hierarchy is still valid but lives inside the class scopes being
+      // dropped; keep a copy of it rather than the whole scopes alive.
+      m_hierarchy = std::make_shared<const ClassHierarchy>(*m_hierarchy);
+    }
+    m_class_scopes = nullptr;
+  }
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "ClassHierarchy.h"
+#include "DexClass.h"
+
+class ClassScopes;
+
+/**
+ * The analyses of the type hierarchy that the HierarchyService caches. The
+ * virtual scopes are built on top of the class hierarchy, so invalidating
+ * the hierarchy invalidates them too.
+ *
+ * A pass that adds, removes or re-parents classes, or changes the interfaces
+ * they implement, writes HA_CLASS_HIERARCHY. A pass that only adds, removes
+ * or renames virtual methods writes HA_CLASS_SCOPES.
+ */
+enum HierarchyAnalysis : uint32_t {
+  HA_NONE = 0,
+  HA_CLASS_HIERARCHY = 1 << 0,
+  HA_CLASS_SCOPES = 1 << 1,
+  HA_ALL = HA_CLASS_HIERARCHY | HA_CLASS_SCOPES,
+};
+
+/**
+ * Builds the class hierarchy and the virtual scopes (ClassScopes) of a scope
+ * on demand and keeps them until they are invalidated, so that passes that
+ * don't change them can share them. The PassManager owns one and invalidates
+ * what each pass declares it writes (see Pass::hierarchy_writes).
+ *
+ * The analyses are handed out as shared pointers to const and are never
+ * modified once built. Dropping or rebuilding an analysis never affects a
+ * pass that still holds the old one; what a pass gets reflects the state of
+ * the scope at the time it was built.
+ *
+ * Each lookup checks that it is asked about the same set of classes that the
+ * cached analyses were built for, and rebuilds them otherwise. Changes that
+ * don't show in the set of classes, like a new super class or renamed
+ * methods, have to be declared by the pass.
+ */
+class HierarchyService {
+ public:
+  HierarchyService();
+  ~HierarchyService();
+
+  std::shared_ptr<const ClassHierarchy> class_hierarchy(const Scope& scope);
+  std::shared_ptr<const ClassScopes> class_scopes(const Scope& scope);
+
+  /**
+   * Builds the given analyses of :scope ahead of time. The class hierarchy
+   * is built as part of the class scopes when both are asked for.
+   */
+  void prepare(const Scope& scope, uint32_t analyses);
+
+  /**
+   * Drops the given analyses and the ones that depend on them.
+   */
+  void invalidate(uint32_t analyses = HA_ALL);
+
+ private:
+  void sync_scope(const Scope& scope);
+
+  // The classes the cached analyses were built for, sorted by address.
+  Scope m_classes;
+
+  std::shared_ptr<const ClassHierarchy> m_hierarchy;
+  std::shared_ptr<const ClassScopes> m_class_scopes;
+};
@@ -154,9 +154,13 @@ class TypeInference final
         m_cfg(cfg),
         m_enable_polymorphic_constants(enable_polymorphic_constants),
         m_verify_moves(verify_moves),
-        m_inference(true) {}
+        m_inference(true),
+        m_keep_type_envs(true) {}
 
-  void run(DexMethod* dex_method) {
+  // Unless :keep_type_envs is set, only the environments at the entry of each
+  // block are kept, and the environments at each instruction are recomputed
+  // by replaying the block whenever they are needed.
+  void run(DexMethod* dex_method, bool keep_type_envs) {
     // We need to compute the initial environment by assigning the parameter
     // registers their correct types derived from the method's signature. The
     // IOPCODE_LOAD_PARAM_* instructions are pseudo-operations that are used to
@@ -212,7 +216,10 @@ class TypeInference final
     }
   done:
     MonotonicFixpointIterator::run(init_state);
-    populate_type_environments();
+    m_keep_type_envs = keep_type_envs;
+    if (m_keep_type_envs) {
+      populate_type_environments();
+    }
     // We turn off the type inference mode. All subsequent calls to
     // analyze_instruction will perform type checking.
     m_inference = false;
@@ -850,30 +857,66 @@ class TypeInference final
     }
   }
 
-  void print(std::ostream& output) const {
+  // Walks the instructions of each block, starting from the entry state of the
+  // block, and calls visitor(insn, state) with the type environment that holds
+  // right before insn, until the visitor returns false. The visitor is called
+  // in the current mode (inference or checking), while the environment is
+  // always moved past insn in inference mode.
+  template <typename Visitor>
+  void replay(Visitor visitor) {
+    const bool inference = m_inference;
     for (cfg::Block* block : m_cfg.blocks()) {
+      TypeEnvironment current_state = get_entry_state_at(block);
       for (auto& mie : InstructionIterable(block)) {
         IRInstruction* insn = mie.insn;
-        auto it = m_type_envs.find(insn);
-        always_assert(it != m_type_envs.end());
-        output << SHOW(insn) << " -- " << it->second << std::endl;
+        if (!visitor(insn, &current_state)) {
+          return;
+        }
+        // The transfer function never throws in inference mode.
+        m_inference = true;
+        analyze_instruction(insn, &current_state);
+        m_inference = inference;
       }
     }
   }
 
+  IRType get_type(IRInstruction* insn, register_t reg) {
+    if (m_keep_type_envs) {
+      auto it = m_type_envs.find(insn);
+      if (it == m_type_envs.end()) {
+        // The instruction doesn't belong to this method. We treat this as
+        // unreachable code and return BOTTOM.
+        return BOTTOM;
+      }
+      return it->second.get(reg).element();
+    }
+    IRType type = BOTTOM;
+    replay([&](IRInstruction* current, TypeEnvironment* state) {
+      if (current != insn) {
+        return true;
+      }
+      type = state->get(reg).element();
+      return false;
+    });
+    return type;
+  }
+
+  void print(std::ostream& output) {
+    replay([&](IRInstruction* insn, TypeEnvironment* state) {
+      output << SHOW(insn) << " -- " << *state << std::endl;
+      return true;
+    });
+  }
+
  private:
   void populate_type_environments() {
     // We reserve enough space for the map in order to avoid repeated rehashing
     // during the computation.
     m_type_envs.reserve(m_cfg.blocks().size() * 16);
-    for (cfg::Block* block : m_cfg.blocks()) {
-      TypeEnvironment current_state = get_entry_state_at(block);
-      for (auto& mie : InstructionIterable(block)) {
-        IRInstruction* insn = mie.insn;
-        m_type_envs.emplace(insn, current_state);
-        analyze_instruction(insn, &current_state);
-      }
-    }
+    replay([this](IRInstruction* insn, TypeEnvironment* state) {
+      m_type_envs.emplace(insn, *state);
+      return true;
+    });
   }
 
   void set_type(TypeEnvironment* state,
@@ -1163,6 +1206,7 @@ class TypeInference final
   bool m_enable_polymorphic_constants;
   bool m_verify_moves;
   bool m_inference;
+  bool m_keep_type_envs;
   std::unordered_map<IRInstruction*, TypeEnvironment> m_type_envs;
 
   friend class ::IRTypeChecker;
@@ -1271,6 +1315,7 @@ IRTypeChecker::IRTypeChecker(DexMethod* dex_method)
       m_complete(false),
       m_enable_polymorphic_constants(false),
       m_verify_moves(false),
+      m_streaming(false),
       m_good(true),
       m_what("OK") {}
 
@@ -1301,40 +1346,45 @@ void IRTypeChecker::run() {
   const cfg::ControlFlowGraph& cfg = code->cfg();
   m_type_inference = std::make_unique<irtc_impl::TypeInference>(
       cfg, m_enable_polymorphic_constants, m_verify_moves);
-  m_type_inference->run(m_dex_method);
+  m_type_inference->run(m_dex_method, /* keep_type_envs */ !m_streaming);
 
   // Finally, we use the inferred types to type-check each instruction in the
   // method. We stop at the first type error encountered.
-  auto& type_envs = m_type_inference->m_type_envs;
-  for (const MethodItemEntry& mie : InstructionIterable(code)) {
-    IRInstruction* insn = mie.insn;
-    try {
-      auto it = type_envs.find(insn);
-      always_assert(it != type_envs.end());
-      m_type_inference->analyze_instruction(insn, &it->second);
-    } catch (const irtc_impl::TypeCheckingException& e) {
-      m_good = false;
-      std::ostringstream out;
-      out << "Type error in method " << m_dex_method->get_deobfuscated_name()
-          << " at instruction '" << SHOW(insn) << "' for " << e.what();
-      m_what = out.str();
-      m_complete = true;
-      return;
+  IRInstruction* insn = nullptr;
+  try {
+    if (m_streaming) {
+      // The environment at each instruction is derived from the entry state
+      // of its block as we go.
+      m_type_inference->replay(
+          [&](IRInstruction* current, irtc_impl::TypeEnvironment* state) {
+            insn = current;
+            m_type_inference->analyze_instruction(insn, state);
+            return true;
+          });
+    } else {
+      auto& type_envs = m_type_inference->m_type_envs;
+      for (const MethodItemEntry& mie : InstructionIterable(code)) {
+        insn = mie.insn;
+        auto it = type_envs.find(insn);
+        always_assert(it != type_envs.end());
+        m_type_inference->analyze_instruction(insn, &it->second);
+      }
     }
+  } catch (const irtc_impl::TypeCheckingException& e) {
+    m_good = false;
+    std::ostringstream out;
+    out << "Type error in method " << m_dex_method->get_deobfuscated_name()
+        << " at instruction '" << SHOW(insn) << "' for " << e.what();
+    m_what = out.str();
+    m_complete = true;
+    return;
   }
   m_complete = true;
 }
 
 IRType IRTypeChecker::get_type(IRInstruction* insn, uint16_t reg) const {
   check_completion();
-  auto& type_envs = m_type_inference->m_type_envs;
-  auto it = type_envs.find(insn);
-  if (it == type_envs.end()) {
-    // The instruction doesn't belong to this method. We treat this as
-    // unreachable code and return BOTTOM.
-    return BOTTOM;
-  }
-  return it->second.get(reg).element();
+  return m_type_inference->get_type(insn, reg);
 }
 
 std::ostream& operator<<(std::ostream& output, const IRTypeChecker& checker) {
@@ -195,6 +195,22 @@ class IRTypeChecker final {
     }
   }
 
+  /*
+   * By default, the type checker keeps the type environment at every
+   * instruction of the method, so that `get_type` is a simple lookup. In
+   * streaming mode, only the environments at the entry of the basic blocks
+   * are kept and each instruction is checked as the environment of its block
+   * is moved forward. This saves most of the memory used by the type checker
+   * when all we need is a verdict, at the cost of replaying a basic block for
+   * every call to `get_type` or when printing the type environments.
+   */
+  void enable_streaming() {
+    if (!m_complete) {
+      // We can only set this parameter before running the type checker.
+      m_streaming = true;
+    }
+  }
+
   void run();
 
   bool good() const {
@@ -239,6 +255,7 @@ class IRTypeChecker final {
   bool m_complete;
   bool m_enable_polymorphic_constants;
   bool m_verify_moves;
+  bool m_streaming;
   bool m_good;
   std::string m_what;
   std::unique_ptr<irtc_impl::TypeInference> m_type_inference;
@@ -169,6 +169,14 @@ MultiMethodInliner::MultiMethodInliner(
         , xstores(stores)
         , m_scope(scope)
         , m_config(config) {
+  if (config.parallel) {
+    // resolvers are usually backed by a MethodRefCache which is not safe to
+    // update concurrently
+    resolver = [this, resolve_fn](DexMethodRef* method, MethodSearch search) {
+      std::lock_guard<std::mutex> lock(m_resolver_mutex);
+      return resolve_fn(method, search);
+    };
+  }
   // walk every opcode in scope looking for calls to inlinable candidates
   // and build a map of callers to callees and the reverse callees to callers
   walk::opcodes(scope, [](DexMethod* meth) { return true; },
@@ -187,44 +195,90 @@ MultiMethodInliner::MultiMethodInliner(
 void MultiMethodInliner::inline_methods() {
   // we want to inline bottom up, so as a first step we identify all the
   // top level callers, then we recurse into all inlinable callees until we
-  // hit a leaf and we start inlining from there
+  // hit a leaf and schedule callers from there. Every caller lands in the
+  // layer right above its highest callee, so a layer only depends on the
+  // layers below it
+  std::vector<std::vector<CallerCallees>> layers;
+  std::unordered_map<DexMethod*, size_t> layer_of;
   for (auto it : caller_callee) {
     auto caller = it.first;
-    TraceContext context(caller->get_deobfuscated_name());
     // if the caller is not a top level keep going, it will be traversed
-    // when inlining a top level caller
+    // when scheduling a top level caller
     if (callee_caller.find(caller) != callee_caller.end()) continue;
-    std::unordered_set<DexMethod*> visited;
-    visited.insert(caller);
-    caller_inline(caller, it.second, visited);
+    std::unordered_set<DexMethod*> visiting;
+    visiting.insert(caller);
+    schedule_caller(caller, it.second, visiting, layer_of, layers);
+  }
+
+  auto inline_caller = [this](const CallerCallees* caller_callees) {
+    auto caller = caller_callees->first;
+    TraceContext context(caller->get_deobfuscated_name());
+    inline_callees(caller, caller_callees->second);
+  };
+  for (const auto& layer : layers) {
+    TRACE(MMINL, 3, "inlining layer of %ld callers\n", layer.size());
+    if (!m_config.parallel || layer.size() == 1) {
+      for (const auto& caller_callees : layer) {
+        inline_caller(&caller_callees);
+      }
+      continue;
+    }
+    auto wq = workqueue_foreach<const CallerCallees*>(
+        inline_caller, walk::parallel::default_num_threads());
+    for (const auto& caller_callees : layer) {
+      wq.add_item(&caller_callees);
+    }
+    m_defer_visibility = true;
+    wq.run_all();
+    m_defer_visibility = false;
+    // change_visibility rewrites the callee code other callers of the layer
+    // were reading, so it only runs once they are all done
+    for (auto callee : m_visibility_changes) {
+      change_visibility(callee);
+    }
+    m_visibility_changes.clear();
   }
 }
 
-void MultiMethodInliner::caller_inline(
+size_t MultiMethodInliner::schedule_caller(
     DexMethod* caller,
     const std::vector<DexMethod*>& callees,
-    std::unordered_set<DexMethod*>& visited) {
+    std::unordered_set<DexMethod*>& visiting,
+    std::unordered_map<DexMethod*, size_t>& layer_of,
+    std::vector<std::vector<CallerCallees>>& layers) {
   std::vector<DexMethod*> nonrecursive_callees;
   nonrecursive_callees.reserve(callees.size());
   // recurse into the callees in case they have something to inline on
   // their own. We want to inline bottom up so that a callee is
   // completely resolved by the time it is inlined.
+  size_t layer = 0;
   for (auto callee : callees) {
     // if the call chain hits a call loop, ignore and keep going
-    if (visited.count(callee) > 0) {
+    if (visiting.count(callee) > 0) {
       info.recursive++;
       continue;
     }
     nonrecursive_callees.push_back(callee);
 
     auto maybe_caller = caller_callee.find(callee);
-    if (maybe_caller != caller_callee.end()) {
-      visited.insert(callee);
-      caller_inline(callee, maybe_caller->second, visited);
-      visited.erase(callee);
+    if (maybe_caller == caller_callee.end()) continue;
+    auto scheduled = layer_of.find(callee);
+    if (scheduled != layer_of.end()) {
+      layer = std::max(layer, scheduled->second + 1);
+      continue;
     }
+    visiting.insert(callee);
+    auto callee_layer = schedule_caller(
+        callee, maybe_caller->second, visiting, layer_of, layers);
+    visiting.erase(callee);
+    layer = std::max(layer, callee_layer + 1);
+  }
+  if (layers.size() <= layer) {
+    layers.resize(layer + 1);
   }
-  inline_callees(caller, nonrecursive_callees);
+  layers[layer].emplace_back(caller, std::move(nonrecursive_callees));
+  layer_of.emplace(caller, layer);
+  return layer;
 }
 
 void MultiMethodInliner::inline_callees(
@@ -283,6 +337,7 @@ void MultiMethodInliner::inline_inlinables(
     const std::vector<std::pair<DexMethod*, IRList::iterator>>& inlinables) {
   // attempt to inline all inlinable candidates
   size_t estimated_insn_size = caller->get_code()->sum_opcode_sizes();
+  bool inlined_any = false;
   for (auto inlinable : inlinables) {
     auto callee = inlinable.first;
     auto insn = inlinable.second;
@@ -297,34 +352,153 @@ void MultiMethodInliner::inline_inlinables(
         callee->get_code()->get_registers_size());
     inliner::inline_method(caller->get_code(), callee->get_code(), insn);
     TRACE(INL, 2, "caller: %s\tcallee: %s\n", SHOW(caller), SHOW(callee));
-    estimated_insn_size += callee->get_code()->sum_opcode_sizes();
+    estimated_insn_size += get_summary(callee).size;
+    update_summary(caller, callee);
+    inlined_any = true;
     TRACE(MMINL,
           6,
           "checking visibility usage of members in %s\n",
           SHOW(callee));
-    change_visibility(callee);
+    if (m_defer_visibility) {
+      std::lock_guard<std::mutex> lock(m_visibility_mutex);
+      m_visibility_changes.insert(callee);
+    } else {
+      change_visibility(callee);
+    }
     info.calls_inlined++;
+    std::lock_guard<std::mutex> lock(m_inlined_mutex);
     inlined.insert(callee);
   }
+  if (inlined_any) {
+    // The estimate above only ever grows; callers of this method in later
+    // layers need its actual size.
+    auto size = caller->get_code()->sum_opcode_sizes();
+    std::lock_guard<std::mutex> lock(m_summaries_mutex);
+    auto it = m_summaries.find(caller);
+    if (it != m_summaries.end()) {
+      it->second.size = size;
+    }
+  }
+}
+
+MultiMethodInliner::CalleeSummary MultiMethodInliner::get_summary(
+    const DexMethod* callee) {
+  {
+    std::lock_guard<std::mutex> lock(m_summaries_mutex);
+    auto it = m_summaries.find(callee);
+    if (it != m_summaries.end()) {
+      return it->second;
+    }
+  }
+  CalleeSummary summary;
+  summary.size = callee->get_code()->sum_opcode_sizes();
+  summary.cross_store = cross_store_reference(callee);
+  summary.blacklisted = is_blacklisted(callee);
+  summary.external_catch = has_external_catch(callee);
+  std::lock_guard<std::mutex> lock(m_summaries_mutex);
+  // another thread may have summarized the same callee in the meantime
+  return m_summaries.emplace(callee, std::move(summary)).first->second;
+}
+
+bool MultiMethodInliner::summary_cannot_inline_opcodes(
+    const DexMethod* caller, const DexMethod* callee) {
+  bool same_class = caller->get_class() == callee->get_class();
+  auto summary = get_summary(callee);
+  const auto& cached = same_class ? summary.same_class_opcodes
+                                  : summary.other_class_opcodes;
+  if (cached) {
+    return *cached;
+  }
+  bool cannot_inline = cannot_inline_opcodes(caller, callee);
+  std::lock_guard<std::mutex> lock(m_summaries_mutex);
+  // the summary may have been invalidated in the meantime
+  auto it = m_summaries.find(callee);
+  if (it != m_summaries.end()) {
+    auto& slot = same_class ? it->second.same_class_opcodes
+                            : it->second.other_class_opcodes;
+    if (!slot) {
+      slot = cannot_inline;
+    }
+  }
+  return cannot_inline;
+}
+
+void MultiMethodInliner::update_summary(const DexMethod* caller,
+                                        const DexMethod* callee) {
+  std::lock_guard<std::mutex> lock(m_summaries_mutex);
+  auto caller_it = m_summaries.find(caller);
+  if (caller_it == m_summaries.end()) {
+    return;
+  }
+  // references that were legal in the callee store may not be in the
+  // caller one, start over
+  if (xstores.get_store_idx(caller->get_class()) !=
+      xstores.get_store_idx(callee->get_class())) {
+    m_summaries.erase(caller_it);
+    return;
+  }
+  // the callee summary may have been invalidated since it was inlined
+  auto callee_it = m_summaries.find(callee);
+  if (callee_it == m_summaries.end()) {
+    m_summaries.erase(caller_it);
+    return;
+  }
+  auto& caller_summary = caller_it->second;
+  const auto& callee_summary = callee_it->second;
+  caller_summary.external_catch |= callee_summary.external_catch;
+  // the callee opcodes are checked against the caller class from now on,
+  // which is the same check as against the callee class when both are in the
+  // same class. Unknown facts stay unknown
+  auto merge = [](boost::optional<bool>& into,
+                  const boost::optional<bool>& from) {
+    if (into && *into) return;
+    if (!from) {
+      into = boost::none;
+    } else if (into) {
+      into = *from;
+    }
+  };
+  if (caller->get_class() == callee->get_class()) {
+    merge(caller_summary.same_class_opcodes,
+          callee_summary.same_class_opcodes);
+    merge(caller_summary.other_class_opcodes,
+          callee_summary.other_class_opcodes);
+  } else {
+    // the callee passed the stricter other class checks, so its opcodes are
+    // fine in any context
+    merge(caller_summary.same_class_opcodes,
+          callee_summary.other_class_opcodes);
+    merge(caller_summary.other_class_opcodes,
+          callee_summary.other_class_opcodes);
+  }
+}
+
+void MultiMethodInliner::invalidate_summary(const DexMethod* method) {
+  std::lock_guard<std::mutex> lock(m_summaries_mutex);
+  m_summaries.erase(method);
 }
 
 /**
  * Defines the set of rules that determine whether a function is inlinable.
+ * The callee facts come from its summary so a callsite is checked without
+ * rescanning the callee code.
  */
 bool MultiMethodInliner::is_inlinable(const DexMethod* caller,
                                       const DexMethod* callee,
                                       size_t estimated_insn_size) {
+  auto summary = get_summary(callee);
   // don't inline cross store references
-  if (cross_store_reference(callee)) {
+  if (summary.cross_store) {
     return false;
   }
-  if (is_blacklisted(callee)) return false;
+  if (summary.blacklisted) return false;
   if (caller_is_blacklisted(caller)) return false;
-  if (has_external_catch(callee)) return false;
-  if (cannot_inline_opcodes(caller, callee)) {
+  if (summary.external_catch) return false;
+  if (summary_cannot_inline_opcodes(caller, callee)) {
     return false;
   }
-  if (caller_too_large(caller->get_class(), estimated_insn_size, callee)) {
+  if (caller_too_large(caller->get_class(), estimated_insn_size,
+                       summary.size)) {
     return false;
   }
 
@@ -353,12 +527,11 @@ bool MultiMethodInliner::is_blacklisted(const DexMethod* callee) {
 }
 
 bool MultiMethodInliner::is_estimate_over_max(uint64_t estimated_caller_size,
-                                              const DexMethod* callee,
+                                              uint64_t callee_size,
                                               uint64_t max) {
   // INSTRUCTION_BUFFER is added because the final method size is often larger
   // than our estimate -- during the sync phase, we may have to pick larger
   // branch opcodes to encode large jumps.
-  auto callee_size = callee->get_code()->sum_opcode_sizes();
   if (estimated_caller_size + callee_size > max - INSTRUCTION_BUFFER) {
     info.caller_too_large++;
     return true;
@@ -368,8 +541,8 @@ bool MultiMethodInliner::is_estimate_over_max(uint64_t estimated_caller_size,
 
 bool MultiMethodInliner::caller_too_large(DexType* caller_type,
                                           size_t estimated_caller_size,
-                                          const DexMethod* callee) {
-  if (is_estimate_over_max(estimated_caller_size, callee,
+                                          size_t callee_size) {
+  if (is_estimate_over_max(estimated_caller_size, callee_size,
                            HARD_MAX_INSTRUCTION_SIZE)) {
     return true;
   }
@@ -382,7 +555,7 @@ bool MultiMethodInliner::caller_too_large(DexType* caller_type,
     return false;
   }
 
-  if (is_estimate_over_max(estimated_caller_size, callee,
+  if (is_estimate_over_max(estimated_caller_size, callee_size,
                            SOFT_MAX_INSTRUCTION_SIZE)) {
     return true;
   }
@@ -469,6 +642,7 @@ bool MultiMethodInliner::create_vmethod(IRInstruction* insn) {
       return false;
     }
     if (!is_native(method) && !keep(method)) {
+      std::lock_guard<std::mutex> lock(m_make_static_mutex);
       m_make_static.insert(method);
     } else {
       info.need_vmethod++;
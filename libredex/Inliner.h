@@ -9,11 +9,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <set>
 #include <vector>
 
+#include <boost/optional.hpp>
+
 #include "DexClass.h"
 #include "DexStore.h"
 #include "IRCode.h"
@@ -58,12 +62,16 @@ void inline_method(IRCode* caller,
  * Not all methods may be inlined both for restriction on the caller or the
  * callee.
  * Perform inlining bottom up.
+ * Callers are grouped in layers such that all the callees of a caller are
+ * finalized in an earlier layer; callers in the same layer are independent
+ * and are inlined concurrently when `Config::parallel` is set.
  */
 class MultiMethodInliner {
  public:
   struct Config {
     bool throws_inline;
     bool enforce_method_size_limit{true};
+    bool parallel{false};
     std::unordered_set<DexType*> black_list;
     std::unordered_set<DexType*> caller_black_list;
     std::unordered_set<DexType*> whitelist_no_method_limit;
@@ -105,16 +113,63 @@ class MultiMethodInliner {
   void inline_callees(DexMethod* caller,
                       const std::unordered_set<IRInstruction*>& insns);
 
+  /**
+   * Drop the cached inlining facts of a method whose code was changed
+   * outside of this inliner.
+   */
+  void invalidate_summary(const DexMethod* method);
+
  private:
+  using CallerCallees = std::pair<DexMethod*, std::vector<DexMethod*>>;
+
   /**
-   * Inline all callees into caller.
-   * Recurse in a callee if that has inlinable candidates of its own.
-   * Inlining is bottom up.
+   * Schedule caller after all its callees.
+   * Recurse in a callee if that has inlinable candidates of its own, dropping
+   * callees that close a call loop. The caller is appended to the layer
+   * right above its highest callee, and its layer index is returned.
    */
-  void caller_inline(
+  size_t schedule_caller(
       DexMethod* caller,
       const std::vector<DexMethod*>& callees,
-      std::unordered_set<DexMethod*>& visited);
+      std::unordered_set<DexMethod*>& visiting,
+      std::unordered_map<DexMethod*, size_t>& layer_of,
+      std::vector<std::vector<CallerCallees>>& layers);
+
+  /**
+   * Facts about a callee that do not depend on the callsite. They are computed
+   * the first time the callee is considered for inlining and patched as code
+   * gets inlined into the callee, so that checking a callsite does not rescan
+   * the callee code.
+   */
+  struct CalleeSummary {
+    size_t size{0};
+    bool blacklisted{false};
+    bool external_catch{false};
+    bool cross_store{false};
+    // cannot_inline_opcodes() for a caller in the same class as the callee
+    // and for a caller in a different class, computed on demand
+    boost::optional<bool> same_class_opcodes;
+    boost::optional<bool> other_class_opcodes;
+  };
+
+  /**
+   * Return a copy of the summary of the callee, computing it if needed.
+   * Summaries are patched and invalidated as code changes, so they are never
+   * handed out by reference.
+   */
+  CalleeSummary get_summary(const DexMethod* callee);
+
+  /**
+   * Cached cannot_inline_opcodes().
+   */
+  bool summary_cannot_inline_opcodes(const DexMethod* caller,
+                                     const DexMethod* callee);
+
+  /**
+   * Patch the summary of `caller`, if any, after `callee` got inlined into it.
+   * The size is updated separately, once all callees are inlined.
+   */
+  void update_summary(const DexMethod* caller, const DexMethod* callee);
 
   /**
    * Return true if the callee is inlinable into the caller.
@@ -200,7 +255,7 @@ class MultiMethodInliner {
   bool cross_store_reference(const DexMethod* context);
 
   bool is_estimate_over_max(uint64_t estimated_insn_size,
-                            const DexMethod* callee,
+                            uint64_t callee_size,
                             uint64_t max);
 
   /**
@@ -213,7 +268,7 @@ class MultiMethodInliner {
    */
   bool caller_too_large(DexType* caller_type,
                         size_t estimated_caller_size,
-                        const DexMethod* callee);
+                        size_t callee_size);
 
   /**
    * Staticize required methods (stored in `m_make_static`) and update
@@ -240,6 +295,31 @@ class MultiMethodInliner {
    */
   std::unordered_set<DexMethod*> inlined;
 
+  //
+  // Guards for the state shared by callers inlined concurrently: the inlined
+  // set, the methods to staticize, the callees whose visibility changes are
+  // pending and the (usually caching) resolver.
+  //
+  std::mutex m_inlined_mutex;
+  std::mutex m_make_static_mutex;
+  std::mutex m_visibility_mutex;
+  std::mutex m_resolver_mutex;
+
+  /**
+   * While a layer is inlined concurrently, the callees whose referenced
+   * members must be made public. change_visibility rewrites the callee code,
+   * so it is applied after the layer rather than while other callers of the
+   * layer may be inlining the same callee.
+   */
+  bool m_defer_visibility{false};
+  std::unordered_set<DexMethod*> m_visibility_changes;
+
+  /**
+   * Inlining facts per callee, see CalleeSummary.
+   */
+  std::unordered_map<const DexMethod*, CalleeSummary> m_summaries;
+  std::mutex m_summaries_mutex;
+
   //
   // Maps from callee to callers and reverse map from caller to callees.
   // Those are used to perform bottom up inlining.
@@ -253,24 +333,25 @@ class MultiMethodInliner {
  private:
   /**
    * Info about inlining.
+   * Counters are atomic as callers in the same layer are inlined concurrently.
    */
   struct InliningInfo {
-    size_t calls_inlined{0};
-    size_t recursive{0};
-    size_t not_found{0};
-    size_t blacklisted{0};
-    size_t throws{0};
-    size_t multi_ret{0};
-    size_t need_vmethod{0};
-    size_t invoke_super{0};
-    size_t write_over_ins{0};
-    size_t escaped_virtual{0};
-    size_t non_pub_virtual{0};
-    size_t escaped_field{0};
-    size_t non_pub_field{0};
-    size_t non_pub_ctor{0};
-    size_t cross_store{0};
-    size_t caller_too_large{0};
+    std::atomic<size_t> calls_inlined{0};
+    std::atomic<size_t> recursive{0};
+    std::atomic<size_t> not_found{0};
+    std::atomic<size_t> blacklisted{0};
+    std::atomic<size_t> throws{0};
+    std::atomic<size_t> multi_ret{0};
+    std::atomic<size_t> need_vmethod{0};
+    std::atomic<size_t> invoke_super{0};
+    std::atomic<size_t> write_over_ins{0};
+    std::atomic<size_t> escaped_virtual{0};
+    std::atomic<size_t> non_pub_virtual{0};
+    std::atomic<size_t> escaped_field{0};
+    std::atomic<size_t> non_pub_field{0};
+    std::atomic<size_t> non_pub_ctor{0};
+    std::atomic<size_t> cross_store{0};
+    std::atomic<size_t> caller_too_large{0};
   };
   InliningInfo info;
 
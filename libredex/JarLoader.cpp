@@ -7,9 +7,12 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <boost/filesystem.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 
 #include <cstdint>
+#include <fstream>
+#include <unordered_map>
 #include <vector>
 #include <zlib.h>
 
@@ -24,6 +27,7 @@
 #include "DexClass.h"
 #include "JarLoader.h"
 #include "Util.h"
+#include "WorkQueue.h"
 
 /******************
  * Begin Class Loading code.
@@ -68,17 +72,6 @@ struct cp_entry {
     };
   };
 };
-
-struct cp_field_info {
-  uint16_t aflags;
-  uint16_t nameNdx;
-  uint16_t descNdx;
-};
-struct cp_method_info {
-  uint16_t aflags;
-  uint16_t nameNdx;
-  uint16_t descNdx;
-};
 }
 
 #define CP_CONST_UTF8         (1)
@@ -148,31 +141,64 @@ static void skip_attributes(uint8_t* &buffer) {
   }
 }
 #define MAX_CLASS_NAMELEN (8 * 1024)
-static DexType *make_dextype_from_cref(std::vector<cp_entry> &cpool,
-                                       uint16_t cref) {
-  char nbuffer[MAX_CLASS_NAMELEN];
+
+namespace {
+
+/*
+ * A field or method as declared in a class file, before anything is interned.
+ */
+struct member_info {
+  uint16_t aflags;
+  std::string name;
+  std::string desc;
+  // The member's attributes in the class file. Only valid while the class
+  // file buffer is alive, and null for classes read from a snapshot.
+  uint8_t* attributes{nullptr};
+};
+
+/*
+ * A class file decoded into plain data. Decoding does not touch the
+ * RedexContext, so it can run concurrently; define_class() interns the
+ * result afterwards.
+ */
+struct class_info {
+  uint16_t aflags;
+  std::string name;
+  // Empty if the class has no superclass.
+  std::string super_name;
+  std::vector<std::string> interfaces;
+  std::vector<member_info> fields;
+  std::vector<member_info> methods;
+  // Refers into the class file buffer; only used to name attributes for the
+  // attribute hook.
+  std::vector<cp_entry> cpool;
+};
+}
+
+static bool class_name_from_cref(const std::vector<cp_entry> &cpool,
+                                 uint16_t cref, std::string *out) {
   if (cpool[cref].tag != CP_CONST_CLASS) {
     fprintf(stderr, "Non-class ref in get_class_name, Bailing\n");
-    return nullptr;
+    return false;
   }
   uint16_t utf8ref = cpool[cref].s0;
   const cp_entry &utf8cpe = cpool[utf8ref];
   if (utf8cpe.tag != CP_CONST_UTF8) {
     fprintf(stderr, "Non-utf8 ref in get_utf8, Bailing\n");
-    return nullptr;
+    return false;
   }
   if (utf8cpe.len > (MAX_CLASS_NAMELEN + 3)) {
     fprintf(stderr, "classname is greater than max, bailing");
-    return nullptr;
+    return false;
   }
-  nbuffer[0] = 'L';
-  memcpy(nbuffer+1, utf8cpe.data, utf8cpe.len);
-  nbuffer[1+utf8cpe.len] = ';';
-  nbuffer[2+utf8cpe.len] = '\0';
-  return DexType::make_type(nbuffer);
+  out->reserve(utf8cpe.len + 2);
+  out->assign(1, 'L');
+  out->append(reinterpret_cast<const char*>(utf8cpe.data), utf8cpe.len);
+  out->push_back(';');
+  return true;
 }
 
-static bool extract_utf8(std::vector<cp_entry> &cpool, uint16_t utf8ref,
+static bool extract_utf8(const std::vector<cp_entry> &cpool, uint16_t utf8ref,
                          char *out, uint32_t size) {
   const cp_entry &utf8cpe = cpool[utf8ref];
   if (utf8cpe.tag != CP_CONST_UTF8) {
@@ -188,23 +214,39 @@ static bool extract_utf8(std::vector<cp_entry> &cpool, uint16_t utf8ref,
   return true;
 }
 
-static DexField *make_dexfield(std::vector<cp_entry> &cpool,
-                               DexType *self, cp_field_info &finfo) {
-  char dbuffer[MAX_CLASS_NAMELEN];
-  char nbuffer[MAX_CLASS_NAMELEN];
-  if (!extract_utf8(cpool, finfo.nameNdx, nbuffer, MAX_CLASS_NAMELEN) ||
-     !extract_utf8(cpool, finfo.descNdx, dbuffer, MAX_CLASS_NAMELEN)) {
-    return nullptr;
+static bool extract_utf8(const std::vector<cp_entry> &cpool, uint16_t utf8ref,
+                         std::string *out) {
+  const cp_entry &utf8cpe = cpool[utf8ref];
+  if (utf8cpe.tag != CP_CONST_UTF8) {
+    fprintf(stderr, "Non-utf8 ref in get_utf8, bailing\n");
+    return false;
   }
-  DexString *name = DexString::make_string(nbuffer);
-  DexType *desc = DexType::make_type(dbuffer);
+  if (utf8cpe.len > (MAX_CLASS_NAMELEN - 1)) {
+    fprintf(stderr, "Name is greater (%hu) than max (%u), bailing\n",
+            utf8cpe.len, MAX_CLASS_NAMELEN);
+    return false;
+  }
+  out->assign(reinterpret_cast<const char*>(utf8cpe.data), utf8cpe.len);
+  return true;
+}
+
+static DexField* make_external_field(DexType* self,
+                                     DexString* name,
+                                     DexType* type,
+                                     uint32_t aflags) {
   DexField *field =
-      static_cast<DexField*>(DexField::make_field(self, name, desc));
-  field->set_access((DexAccessFlags)finfo.aflags);
+      static_cast<DexField*>(DexField::make_field(self, name, type));
+  field->set_access((DexAccessFlags)aflags);
   field->set_external();
   return field;
 }
 
+static DexField *make_dexfield(DexType *self, const member_info &finfo) {
+  DexString *name = DexString::make_string(finfo.name.c_str());
+  DexType *desc = DexType::make_type(finfo.desc.c_str());
+  return make_external_field(self, name, desc, finfo.aflags);
+}
+
 static DexType *simpleTypeB;
 static DexType *simpleTypeC;
 static DexType *simpleTypeD;
@@ -227,64 +269,79 @@ static void init_basic_types() {
   simpleTypeV = DexType::make_type("V");
 }
 
-static DexType *parse_type(const char* &buf) {
-  char typebuffer[MAX_CLASS_NAMELEN];
-  char desc = *buf++;
-  switch(desc) {
+/*
+ * Length of the type descriptor at the start of the NUL-terminated `buf`, or
+ * 0 if it doesn't start with one. Never reads past the terminating NUL.
+ */
+static size_t type_desc_length(const char* buf) {
+  size_t len = 0;
+  while (buf[len] == '[') {
+    len++;
+  }
+  switch (buf[len]) {
+  case 'V':
+    return len == 0 ? 1 : 0;
   case 'B':
-    return simpleTypeB;
   case 'C':
-    return simpleTypeC;
   case 'D':
-    return simpleTypeD;
   case 'F':
-    return simpleTypeF;
   case 'I':
-    return simpleTypeI;
   case 'J':
-    return simpleTypeJ;
   case 'S':
-    return simpleTypeS;
   case 'Z':
-    return simpleTypeZ;
-  case 'V':
-    return simpleTypeV;
-  case 'L':
-    {
-      char *tpout = typebuffer;
-      *tpout++ = desc;
-      while(*buf != ';') {
-        *tpout++ = *buf++;
-      }
-      *tpout++ = *buf++;
-      *tpout = '\0';
-      return DexType::make_type(typebuffer);
-      break;
-    }
-  case '[':
-    {
-      char *tpout = typebuffer;
-      *tpout++ = desc;
-      while(*buf == '[') {
-        *tpout++ = *buf++;
-      }
-      if (*buf == 'L') {
-        while(*buf != ';') {
-          *tpout++ = *buf++;
-        }
-        *tpout++ = *buf++;
-      } else {
-        *tpout++= *buf++;
-      }
-      *tpout++ = '\0';
-      return DexType::make_type(typebuffer);
+    return len + 1;
+  case 'L': {
+    const char* end = strchr(buf + len, ';');
+    return end == nullptr ? 0 : end - buf + 1;
+  }
+  }
+  return 0;
+}
+
+static DexType *parse_type(const char* &buf) {
+  size_t len = type_desc_length(buf);
+  if (len == 0) {
+    fprintf(stderr, "Invalid parse-type '%c', bailing\n", *buf);
+    return nullptr;
+  }
+  if (len == 1) {
+    switch (*buf++) {
+    case 'B':
+      return simpleTypeB;
+    case 'C':
+      return simpleTypeC;
+    case 'D':
+      return simpleTypeD;
+    case 'F':
+      return simpleTypeF;
+    case 'I':
+      return simpleTypeI;
+    case 'J':
+      return simpleTypeJ;
+    case 'S':
+      return simpleTypeS;
+    case 'Z':
+      return simpleTypeZ;
+    case 'V':
+      return simpleTypeV;
     }
   }
-  fprintf(stderr, "Invalid parse-type '%c', bailing\n", desc);
-  return nullptr;
+  if (len >= MAX_CLASS_NAMELEN) {
+    fprintf(stderr, "Type descriptor is greater than max, bailing\n");
+    return nullptr;
+  }
+  char typebuffer[MAX_CLASS_NAMELEN];
+  memcpy(typebuffer, buf, len);
+  typebuffer[len] = '\0';
+  buf += len;
+  return DexType::make_type(typebuffer);
 }
 
 static DexTypeList *extract_arguments(const char* &buf) {
+  if (*buf != '(') {
+    fprintf(stderr, "Invalid method descriptor, bailing\n");
+    return nullptr;
+  }
   buf++;
   if (*buf == ')') {
     buf++;
@@ -305,23 +362,10 @@ static DexTypeList *extract_arguments(const char* &buf) {
   return DexTypeList::make_type_list(std::move(args));
 }
 
-static DexMethod *make_dexmethod(std::vector<cp_entry> &cpool,
-                               DexType *self, cp_method_info &finfo) {
-  char dbuffer[MAX_CLASS_NAMELEN];
-  char nbuffer[MAX_CLASS_NAMELEN];
-  if (!extract_utf8(cpool, finfo.nameNdx, nbuffer, MAX_CLASS_NAMELEN) ||
-     !extract_utf8(cpool, finfo.descNdx, dbuffer, MAX_CLASS_NAMELEN)) {
-    return nullptr;
-  }
-  DexString *name = DexString::make_string(nbuffer);
-  const char *ptr = dbuffer;
-  DexTypeList *tlist = extract_arguments(ptr);
-  if (tlist == nullptr)
-    return nullptr;
-  DexType *rtype = parse_type(ptr);
-  if (rtype == nullptr)
-    return nullptr;
-  DexProto *proto = DexProto::make_proto(rtype, tlist);
+static DexMethod* make_external_method(DexType* self,
+                                       DexString* name,
+                                       DexProto* proto,
+                                       uint32_t access) {
   DexMethod *method = static_cast<DexMethod*>(
       DexMethod::make_method(self, name, proto));
   if (method->is_concrete()) {
@@ -329,7 +373,7 @@ static DexMethod *make_dexmethod(std::vector<cp_entry> &cpool,
         SHOW(method));
     return nullptr;
   }
-  uint32_t access = finfo.aflags;
+  const char *nbuffer = name->c_str();
   bool is_virt = true;
   if (nbuffer[0] == '<') {
     is_virt = false;
@@ -344,9 +388,39 @@ static DexMethod *make_dexmethod(std::vector<cp_entry> &cpool,
   return method;
 }
 
-static bool parse_class(uint8_t* buffer,
-                        Scope* classes,
-                        attribute_hook_t attr_hook) {
+static DexMethod *make_dexmethod(DexType *self, const member_info &finfo) {
+  DexString *name = DexString::make_string(finfo.name.c_str());
+  const char *ptr = finfo.desc.c_str();
+  DexTypeList *tlist = extract_arguments(ptr);
+  if (tlist == nullptr)
+    return nullptr;
+  DexType *rtype = parse_type(ptr);
+  if (rtype == nullptr)
+    return nullptr;
+  DexProto *proto = DexProto::make_proto(rtype, tlist);
+  return make_external_method(self, name, proto, finfo.aflags);
+}
+
+static bool decode_members(uint8_t* &buffer,
+                           const std::vector<cp_entry> &cpool,
+                           std::vector<member_info> &members) {
+  uint16_t count = read16(buffer);
+  members.resize(count);
+  for (auto &member : members) {
+    member.aflags = read16(buffer);
+    uint16_t nameNdx = read16(buffer);
+    uint16_t descNdx = read16(buffer);
+    member.attributes = buffer;
+    skip_attributes(buffer);
+    if (!extract_utf8(cpool, nameNdx, &member.name) ||
+        !extract_utf8(cpool, descNdx, &member.desc)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool decode_class(uint8_t* buffer, class_info* info) {
   uint32_t magic = read32(buffer);
   uint16_t vminor DEBUG_ONLY = read16(buffer);
   uint16_t vmajor DEBUG_ONLY = read16(buffer);
@@ -355,7 +429,7 @@ static bool parse_class(uint8_t* buffer,
     fprintf(stderr, "Bad class magic %08x, Bailing\n", magic);
     return false;
   }
-  std::vector<cp_entry> cpool;
+  std::vector<cp_entry> &cpool = info->cpool;
   cpool.resize(cp_count);
   /* The zero'th entry is always empty.  Java is annoying. */
   for (int i=1; i<cp_count; i++) {
@@ -367,29 +441,46 @@ static bool parse_class(uint8_t* buffer,
       i++;
     }
   }
-  uint16_t aflags = read16(buffer);
+  info->aflags = read16(buffer);
   uint16_t clazz = read16(buffer);
   uint16_t super = read16(buffer);
   uint16_t ifcount = read16(buffer);
-  DexType *self = make_dextype_from_cref(cpool, clazz);
+  if (!class_name_from_cref(cpool, clazz, &info->name)) {
+    return false;
+  }
+  if (super != 0 &&
+      !class_name_from_cref(cpool, super, &info->super_name)) {
+    return false;
+  }
+  info->interfaces.resize(ifcount);
+  for (int i=0; i < ifcount; i++) {
+    uint16_t iface = read16(buffer);
+    if (!class_name_from_cref(cpool, iface, &info->interfaces[i])) {
+      return false;
+    }
+  }
+  return decode_members(buffer, cpool, info->fields) &&
+         decode_members(buffer, cpool, info->methods);
+}
+
+static bool define_class(const class_info &info,
+                         Scope* classes,
+                         attribute_hook_t attr_hook) {
+  DexType *self = DexType::make_type(info.name.c_str());
   if (type_class(self)) {
     return true;
   }
   ClassCreator cc(self);
   cc.set_external();
-  if (super != 0) {
-    DexType *sclazz = make_dextype_from_cref(cpool, super);
+  if (!info.super_name.empty()) {
+    DexType *sclazz = DexType::make_type(info.super_name.c_str());
     cc.set_super(sclazz);
   }
-  cc.set_access((DexAccessFlags)aflags);
-  if (ifcount) {
-    for (int i=0; i < ifcount; i++) {
-      uint16_t iface = read16(buffer);
-      DexType *iftype = make_dextype_from_cref(cpool, iface);
-      cc.add_interface(iftype);
-    }
+  cc.set_access((DexAccessFlags)info.aflags);
+  for (const auto &iface : info.interfaces) {
+    DexType *iftype = DexType::make_type(iface.c_str());
+    cc.add_interface(iftype);
   }
-  uint16_t fcount = read16(buffer);
 
   auto invoke_attr_hook = [&](
       boost::variant<DexField*, DexMethod*> field_or_method, uint8_t* attrPtr) {
@@ -401,8 +492,10 @@ static bool parse_class(uint8_t* buffer,
       uint16_t attribute_name_index = read16(attrPtr);
       uint32_t attribute_length = read32(attrPtr);
       char attribute_name[MAX_CLASS_NAMELEN];
-      if (extract_utf8(
-              cpool, attribute_name_index, attribute_name, MAX_CLASS_NAMELEN)) {
+      if (extract_utf8(info.cpool,
+                       attribute_name_index,
+                       attribute_name,
+                       MAX_CLASS_NAMELEN)) {
         attr_hook(field_or_method, attribute_name, attrPtr);
       } else {
         always_assert_log(
@@ -414,36 +507,20 @@ static bool parse_class(uint8_t* buffer,
     }
   };
 
-  for (int i=0; i < fcount; i++) {
-    cp_field_info cpfield;
-    cpfield.aflags = read16(buffer);
-    cpfield.nameNdx = read16(buffer);
-    cpfield.descNdx = read16(buffer);
-    uint8_t* attrPtr = buffer;
-    skip_attributes(buffer);
-    DexField *field = make_dexfield(cpool, self, cpfield);
+  for (const auto &finfo : info.fields) {
+    DexField *field = make_dexfield(self, finfo);
     if (field == nullptr)
       return false;
     cc.add_field(field);
-    invoke_attr_hook({field}, attrPtr);
+    invoke_attr_hook({field}, finfo.attributes);
   }
 
-  uint16_t mcount = read16(buffer);
-  if (mcount) {
-    for (int i=0; i < mcount; i++) {
-      cp_method_info cpmethod;
-      cpmethod.aflags = read16(buffer);
-      cpmethod.nameNdx = read16(buffer);
-      cpmethod.descNdx = read16(buffer);
-
-      uint8_t* attrPtr = buffer;
-      skip_attributes(buffer);
-      DexMethod *method = make_dexmethod(cpool, self, cpmethod);
-      if (method == nullptr)
-        return false;
-      cc.add_method(method);
-      invoke_attr_hook({method}, attrPtr);
-    }
+  for (const auto &minfo : info.methods) {
+    DexMethod *method = make_dexmethod(self, minfo);
+    if (method == nullptr)
+      return false;
+    cc.add_method(method);
+    invoke_attr_hook({method}, minfo.attributes);
   }
   DexClass *dc = cc.create();
   if (classes != nullptr) {
@@ -481,6 +558,13 @@ static bool parse_class(uint8_t* buffer,
   return true;
 }
 
+static bool parse_class(uint8_t* buffer,
+                        Scope* classes,
+                        attribute_hook_t attr_hook) {
+  class_info info;
+  return decode_class(buffer, &info) && define_class(info, classes, attr_hook);
+}
+
 bool load_class_file(const std::string& filename, Scope* classes) {
   // It's not exactly efficient to call init_basic_types repeatedly for each
   // class file that we load, but load_class_file should typically only be used
@@ -717,17 +801,42 @@ static bool decompress_class(jar_entry &file, const uint8_t *mapping,
   return true;
 }
 
-static const int kStartBufferSize = 128 * 1024;
+/*
+ * Number of class entries inflated per parallel batch. This bounds how many
+ * uncompressed classes are alive at once.
+ */
+static const size_t kInflateBatchSize = 1024;
+
+namespace {
+
+// A class file entry of one of the jars being loaded.
+struct class_entry {
+  size_t jar;
+  const uint8_t* mapping;
+  jar_entry* file;
+};
+
+class jar_snapshot;
 
-static bool process_jar_entries(std::vector<jar_entry>& files,
-                                const uint8_t* mapping,
-                                Scope* classes,
-                                attribute_hook_t attr_hook) {
-  ssize_t bufsize = kStartBufferSize;
-  uint8_t *outbuffer = (uint8_t*)malloc(bufsize);
+struct mapped_jar {
+  std::string location;
+  boost::iostreams::mapped_file file;
+  std::vector<jar_entry> files;
+  // Where this jar's snapshot lives, if snapshots are enabled.
+  std::string snapshot_path;
+  // The jar's up-to-date snapshot, if there is one.
+  std::unique_ptr<jar_snapshot> snapshot;
+  // Classes decoded from the jar, to be written out as its snapshot.
+  std::vector<class_info> decoded;
+};
+}
+
+static void collect_class_entries(size_t jar,
+                                  const uint8_t* mapping,
+                                  std::vector<jar_entry>& files,
+                                  std::vector<class_entry>& entries) {
   static char classEndString[] = ".class";
   static size_t classEndStringLen = strlen(classEndString);
-  init_basic_types();
   for (auto &file : files) {
     if (file.cd_entry.ucomp_size == 0)
       continue;
@@ -740,62 +849,624 @@ static bool process_jar_entries(std::vector<jar_entry>& files,
     if (memcmp(endcomp, classEndString, classEndStringLen) != 0)
       continue;
 
-    // Resize output if necessary.
-    if (bufsize < file.cd_entry.ucomp_size) {
-      while(bufsize < file.cd_entry.ucomp_size)
-        bufsize *= 2;
-      free(outbuffer);
-      outbuffer = (uint8_t*)malloc(bufsize);
-    }
+    entries.push_back(class_entry{jar, mapping, &file});
+  }
+}
 
-    if (!decompress_class(file, mapping, outbuffer, bufsize)) {
-      free(outbuffer);
-      return false;
+/*
+ * Inflating and decoding are independent per entry, so each batch of entries
+ * is handled on a work queue, every entry in its own buffer. The decoded
+ * classes are then handed to `define` on the calling thread in entry order:
+ * defining interns into RedexContext, and the first definition of a class
+ * wins, so this keeps the result identical to loading the entries one by
+ * one. On failure, *failed_jar is set to the jar of the offending entry.
+ */
+static bool process_class_entries(
+    const std::vector<class_entry>& entries,
+    const std::function<bool(size_t, class_info&)>& define,
+    size_t* failed_jar) {
+  std::vector<std::vector<uint8_t>> buffers;
+  std::vector<class_info> infos;
+  for (size_t begin = 0; begin < entries.size(); begin += kInflateBatchSize) {
+    size_t end = std::min(entries.size(), begin + kInflateBatchSize);
+    buffers.clear();
+    buffers.resize(end - begin);
+    infos.clear();
+    infos.resize(end - begin);
+    std::vector<char> decoded(end - begin);
+    auto wq = workqueue_foreach<size_t>([&](size_t i) {
+      const auto& entry = entries[begin + i];
+      auto& buffer = buffers[i];
+      buffer.resize(entry.file->cd_entry.ucomp_size);
+      decoded[i] = decompress_class(*entry.file, entry.mapping, buffer.data(),
+                                    buffer.size()) &&
+                   decode_class(buffer.data(), &infos[i]);
+    });
+    for (size_t i = 0; i < end - begin; ++i) {
+      wq.add_item(i);
     }
+    wq.run_all();
 
-    if (!parse_class(outbuffer, classes, attr_hook)) {
-      free(outbuffer);
-      return false;
+    for (size_t i = 0; i < end - begin; ++i) {
+      if (!decoded[i] || !define(entries[begin + i].jar, infos[i])) {
+        *failed_jar = entries[begin + i].jar;
+        return false;
+      }
     }
   }
-  free(outbuffer);
   return true;
 }
 
-static bool process_jar(const uint8_t* mapping,
-                        ssize_t size,
-                        Scope* classes,
-                        attribute_hook_t attr_hook) {
-  pk_cdir_end pce;
-  std::vector<jar_entry> files;
+static bool read_jar_entries(const uint8_t* mapping,
+                             ssize_t size,
+                             pk_cdir_end& pce,
+                             std::vector<jar_entry>& files) {
   if (!find_central_directory(mapping, size, pce))
     return false;
   if (!validate_pce(pce, size))
     return false;
   if (!get_jar_entries(mapping, pce, files))
     return false;
-  if (!process_jar_entries(files, mapping, classes, attr_hook)) {
-    return false;
-  }
   return true;
 }
 
-bool load_jar_file(const char* location,
-                   Scope* classes,
-                   attribute_hook_t attr_hook) {
-  boost::iostreams::mapped_file file;
-  file.open(location, boost::iostreams::mapped_file::readonly);
-  if (!file.is_open()) {
-    fprintf(stderr, "error: cannot open jar file: %s\n", location);
-    return false;
+/******************
+ * Library class snapshots.
+ *
+ * A snapshot holds the decoded classes of one jar as a flat file of 32-bit
+ * words, laid out so that it can be interned straight from its mapping:
+ *
+ *   header          magic version nstrings ntypes nprotos nprotowords
+ *                   nclasswords
+ *   string_offsets  nstrings + 1 offsets into the string data
+ *   types           a string id per type
+ *   protos          (rtype nargs arg*) per proto, as type ids
+ *   classes         (aflags self super ifcount iface* fcount
+ *                    (aflags name type)* mcount (aflags name proto)*)
+ *                   per class entry, in entry order
+ *   string data     NUL-terminated strings
+ *
+ * Reading one back skips inflating and parsing the class files entirely.
+ * Snapshots are named after a hash of the jar's central directory, which
+ * carries the CRC32 and size of every entry, so a changed jar never picks up
+ * a stale snapshot.
+ */
+
+static const uint32_t kSnapshotMagic = 0x434a5852; // "RXJC"
+static const uint32_t kSnapshotVersion = 2;
+static const uint32_t kSnapshotHeaderWords = 7;
+static const uint32_t kNone = 0xffffffff;
+
+static std::string snapshot_path(const std::string& snapshot_dir,
+                                 const uint8_t* mapping,
+                                 ssize_t size,
+                                 const pk_cdir_end& pce) {
+  // 64-bit FNV-1a.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&hash](const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+      hash ^= data[i];
+      hash *= 0x100000001b3ULL;
+    }
+  };
+  uint64_t jar_size = size;
+  mix(reinterpret_cast<const uint8_t*>(&jar_size), sizeof(jar_size));
+  mix(mapping + pce.cd_disk_offset, pce.cd_size);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.jarsnap", (unsigned long long)hash);
+  return snapshot_dir + "/" + name;
+}
+
+static bool is_type_desc(const char* str) {
+  size_t len = type_desc_length(str);
+  return len != 0 && str[len] == '\0';
+}
+
+namespace {
+
+class snapshot_writer {
+ public:
+  void add(const class_info& info) {
+    m_class_words.push_back(info.aflags);
+    m_class_words.push_back(type_id(info.name));
+    m_class_words.push_back(info.super_name.empty() ? kNone
+                                                    : type_id(info.super_name));
+    m_class_words.push_back(info.interfaces.size());
+    for (const auto& iface : info.interfaces) {
+      m_class_words.push_back(type_id(iface));
+    }
+    m_class_words.push_back(info.fields.size());
+    for (const auto& field : info.fields) {
+      m_class_words.push_back(field.aflags);
+      m_class_words.push_back(string_id(field.name));
+      m_class_words.push_back(type_id(field.desc));
+    }
+    m_class_words.push_back(info.methods.size());
+    for (const auto& method : info.methods) {
+      m_class_words.push_back(method.aflags);
+      m_class_words.push_back(string_id(method.name));
+      m_class_words.push_back(proto_id(method.desc));
+    }
   }
 
-  auto mapping = reinterpret_cast<const uint8_t*>(file.const_data());
-  if (!process_jar(mapping, file.size(), classes, attr_hook)) {
-    fprintf(stderr, "error: cannot process jar: %s\n", location);
-    return false;
+  /*
+   * Write to a temporary file first and rename it into place, so that
+   * concurrent builds never observe a partially written snapshot. Nothing is
+   * written if any descriptor could not be represented.
+   */
+  bool write(const std::string& path) const {
+    if (!m_valid) {
+      return false;
+    }
+    auto tmp_path = boost::filesystem::unique_path(path + ".%%%%%%%%").string();
+    {
+      std::ofstream os(tmp_path, std::ofstream::binary);
+      if (!os) {
+        return false;
+      }
+      write_u32(os, kSnapshotMagic);
+      write_u32(os, kSnapshotVersion);
+      write_u32(os, m_strings.size());
+      write_u32(os, m_types.size());
+      write_u32(os, m_num_protos);
+      write_u32(os, m_proto_words.size());
+      write_u32(os, m_class_words.size());
+      uint32_t offset = 0;
+      write_u32(os, offset);
+      for (const auto* str : m_strings) {
+        offset += str->size() + 1;
+        write_u32(os, offset);
+      }
+      write_u32s(os, m_types);
+      write_u32s(os, m_proto_words);
+      write_u32s(os, m_class_words);
+      for (const auto* str : m_strings) {
+        os.write(str->c_str(), str->size() + 1);
+      }
+      if (!os) {
+        os.close();
+        boost::filesystem::remove(tmp_path);
+        return false;
+      }
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp_path, path, ec);
+    return !ec;
   }
-  return true;
+
+ private:
+  uint32_t string_id(const std::string& str) {
+    auto it = m_string_ids.emplace(str, m_strings.size());
+    if (it.second) {
+      m_strings.push_back(&it.first->first);
+      m_string_bytes += str.size() + 1;
+      // Strings are stored NUL-terminated, and offsets are 32-bit.
+      if (strlen(str.c_str()) != str.size() || m_string_bytes > kNone) {
+        m_valid = false;
+      }
+    }
+    return it.first->second;
+  }
+
+  uint32_t type_id(const std::string& desc) {
+    auto it = m_type_ids.emplace(desc, m_types.size());
+    if (it.second) {
+      if (!is_type_desc(desc.c_str())) {
+        m_valid = false;
+      }
+      m_types.push_back(string_id(desc));
+    }
+    return it.first->second;
+  }
+
+  uint32_t proto_id(const std::string& desc) {
+    auto it = m_proto_ids.find(desc);
+    if (it != m_proto_ids.end()) {
+      return it->second;
+    }
+    std::vector<uint32_t> args;
+    uint32_t rtype = 0;
+    const char* ptr = desc.c_str();
+    if (*ptr++ != '(') {
+      m_valid = false;
+    } else {
+      while (*ptr != ')') {
+        size_t len = type_desc_length(ptr);
+        if (len == 0) {
+          m_valid = false;
+          break;
+        }
+        args.push_back(type_id(std::string(ptr, len)));
+        ptr += len;
+      }
+      if (*ptr == ')') {
+        rtype = type_id(++ptr);
+      }
+    }
+    uint32_t id = m_num_protos++;
+    m_proto_ids.emplace(desc, id);
+    m_proto_words.push_back(rtype);
+    m_proto_words.push_back(args.size());
+    m_proto_words.insert(m_proto_words.end(), args.begin(), args.end());
+    return id;
+  }
+
+  static void write_u32(std::ostream& os, uint32_t value) {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  static void write_u32s(std::ostream& os,
+                         const std::vector<uint32_t>& values) {
+    os.write(reinterpret_cast<const char*>(values.data()),
+             values.size() * sizeof(uint32_t));
+  }
+
+  bool m_valid{true};
+  std::unordered_map<std::string, uint32_t> m_string_ids;
+  std::vector<const std::string*> m_strings;
+  uint64_t m_string_bytes{0};
+  std::unordered_map<std::string, uint32_t> m_type_ids;
+  std::vector<uint32_t> m_types;
+  std::unordered_map<std::string, uint32_t> m_proto_ids;
+  uint32_t m_num_protos{0};
+  std::vector<uint32_t> m_proto_words;
+  std::vector<uint32_t> m_class_words;
+};
+
+/*
+ * A snapshot mapped into memory. open() validates every count, offset and id
+ * in the file against its size before anything is interned, so that
+ * define_classes() can then intern straight from the mapping. A snapshot
+ * that fails validation is ignored, and the jar is simply parsed again.
+ */
+class jar_snapshot {
+ public:
+  static std::unique_ptr<jar_snapshot> open(const std::string& path) {
+    if (!boost::filesystem::exists(path)) {
+      return nullptr;
+    }
+    std::unique_ptr<jar_snapshot> snapshot(new jar_snapshot());
+    try {
+      snapshot->m_file.open(path);
+    } catch (const std::exception&) {
+      return nullptr;
+    }
+    if (!snapshot->m_file.is_open() || !snapshot->validate()) {
+      fprintf(stderr, "warning: ignoring invalid jar snapshot %s\n",
+              path.c_str());
+      return nullptr;
+    }
+    return snapshot;
+  }
+
+  bool define_classes(Scope* classes) const {
+    std::vector<DexString*> strings(m_num_strings);
+    for (uint32_t i = 0; i < m_num_strings; ++i) {
+      strings[i] = DexString::make_string(string(i));
+    }
+    std::vector<DexType*> types(m_num_types);
+    for (uint32_t i = 0; i < m_num_types; ++i) {
+      types[i] = DexType::make_type(strings[m_types[i]]);
+    }
+    std::vector<DexProto*> protos(m_num_protos);
+    for (uint32_t i = 0; i < m_num_protos; ++i) {
+      const uint32_t* words = m_proto_words + m_proto_offsets[i];
+      std::deque<DexType*> args;
+      for (uint32_t j = 0; j < words[1]; ++j) {
+        args.push_back(types[words[2 + j]]);
+      }
+      protos[i] = DexProto::make_proto(
+          types[words[0]], DexTypeList::make_type_list(std::move(args)));
+    }
+
+    const uint32_t* words = m_class_words;
+    const uint32_t* end = m_class_words + m_num_class_words;
+    while (words != end) {
+      uint32_t aflags = *words++;
+      DexType* self = types[*words++];
+      uint32_t super = *words++;
+      if (type_class(self)) {
+        // The first definition wins; skip over this one.
+        words += *words + 1;
+        words += *words * 3 + 1;
+        words += *words * 3 + 1;
+        continue;
+      }
+      ClassCreator cc(self);
+      cc.set_external();
+      if (super != kNone) {
+        cc.set_super(types[super]);
+      }
+      cc.set_access((DexAccessFlags)aflags);
+      for (uint32_t count = *words++; count > 0; --count) {
+        cc.add_interface(types[*words++]);
+      }
+      for (uint32_t count = *words++; count > 0; --count, words += 3) {
+        cc.add_field(make_external_field(
+            self, strings[words[1]], types[words[2]], words[0]));
+      }
+      for (uint32_t count = *words++; count > 0; --count, words += 3) {
+        DexMethod* method = make_external_method(
+            self, strings[words[1]], protos[words[2]], words[0]);
+        if (method == nullptr) {
+          return false;
+        }
+        cc.add_method(method);
+      }
+      DexClass* dc = cc.create();
+      if (classes != nullptr) {
+        classes->emplace_back(dc);
+      }
+    }
+    return true;
+  }
+
+ private:
+  jar_snapshot() = default;
+
+  const char* string(uint32_t id) const {
+    return m_string_data + m_string_offsets[id];
+  }
+
+  const char* type_name(uint32_t id) const {
+    return string(m_types[id]);
+  }
+
+  bool validate() {
+    auto data = reinterpret_cast<const uint8_t*>(m_file.data());
+    uint64_t size = m_file.size();
+    uint32_t header[kSnapshotHeaderWords];
+    if (size < sizeof(header)) {
+      return false;
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[0] != kSnapshotMagic || header[1] != kSnapshotVersion) {
+      return false;
+    }
+    m_num_strings = header[2];
+    m_num_types = header[3];
+    m_num_protos = header[4];
+    m_num_proto_words = header[5];
+    m_num_class_words = header[6];
+    // Each count is below 2^32, so the sum can't overflow 64 bits.
+    uint64_t num_words = uint64_t(kSnapshotHeaderWords) + m_num_strings + 1 +
+                         m_num_types + m_num_proto_words + m_num_class_words;
+    if (num_words * sizeof(uint32_t) > size) {
+      return false;
+    }
+    auto words = reinterpret_cast<const uint32_t*>(data) +
+                 kSnapshotHeaderWords;
+    m_string_offsets = words;
+    m_types = m_string_offsets + m_num_strings + 1;
+    m_proto_words = m_types + m_num_types;
+    m_class_words = m_proto_words + m_num_proto_words;
+    m_string_data = reinterpret_cast<const char*>(m_class_words +
+                                                  m_num_class_words);
+    return validate_strings(size - num_words * sizeof(uint32_t)) &&
+           validate_types() && validate_protos() && validate_classes();
+  }
+
+  // Every string must be non-empty and NUL-terminated within the data.
+  bool validate_strings(uint64_t data_size) const {
+    if (m_string_offsets[0] != 0 ||
+        m_string_offsets[m_num_strings] != data_size) {
+      return false;
+    }
+    for (uint32_t i = 0; i < m_num_strings; ++i) {
+      uint32_t next = m_string_offsets[i + 1];
+      if (next <= m_string_offsets[i] || next > data_size ||
+          m_string_data[next - 1] != '\0') {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool validate_types() const {
+    for (uint32_t i = 0; i < m_num_types; ++i) {
+      if (m_types[i] >= m_num_strings || !is_type_desc(type_name(i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool validate_protos() {
+    m_proto_offsets.clear();
+    uint32_t pos = 0;
+    while (pos < m_num_proto_words) {
+      if (m_num_proto_words - pos < 2) {
+        return false;
+      }
+      m_proto_offsets.push_back(pos);
+      uint32_t rtype = m_proto_words[pos++];
+      uint32_t nargs = m_proto_words[pos++];
+      if (rtype >= m_num_types || nargs > m_num_proto_words - pos) {
+        return false;
+      }
+      for (; nargs > 0; --nargs) {
+        uint32_t arg = m_proto_words[pos++];
+        if (arg >= m_num_types || strcmp(type_name(arg), "V") == 0) {
+          return false;
+        }
+      }
+    }
+    return m_proto_offsets.size() == m_num_protos;
+  }
+
+  bool validate_classes() const {
+    uint32_t pos = 0;
+    auto remaining = [&]() -> uint64_t { return m_num_class_words - pos; };
+    auto valid_members = [&](uint32_t limit) {
+      if (remaining() < 1) {
+        return false;
+      }
+      uint32_t count = m_class_words[pos++];
+      if (remaining() < uint64_t(count) * 3) {
+        return false;
+      }
+      for (; count > 0; --count, pos += 3) {
+        if (m_class_words[pos] > 0xffff ||
+            m_class_words[pos + 1] >= m_num_strings ||
+            m_class_words[pos + 2] >= limit) {
+          return false;
+        }
+      }
+      return true;
+    };
+    while (pos < m_num_class_words) {
+      if (remaining() < 4) {
+        return false;
+      }
+      uint32_t aflags = m_class_words[pos++];
+      uint32_t self = m_class_words[pos++];
+      uint32_t super = m_class_words[pos++];
+      uint32_t ifcount = m_class_words[pos++];
+      if (aflags > 0xffff || self >= m_num_types ||
+          type_name(self)[0] != 'L' ||
+          (super != kNone && super >= m_num_types) || remaining() < ifcount) {
+        return false;
+      }
+      for (; ifcount > 0; --ifcount) {
+        if (m_class_words[pos++] >= m_num_types) {
+          return false;
+        }
+      }
+      if (!valid_members(m_num_types) || !valid_members(m_num_protos)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  boost::iostreams::mapped_file_source m_file;
+  uint32_t m_num_strings{0};
+  uint32_t m_num_types{0};
+  uint32_t m_num_protos{0};
+  uint32_t m_num_proto_words{0};
+  uint32_t m_num_class_words{0};
+  const uint32_t* m_string_offsets{nullptr};
+  const uint32_t* m_types{nullptr};
+  const uint32_t* m_proto_words{nullptr};
+  const uint32_t* m_class_words{nullptr};
+  const char* m_string_data{nullptr};
+  // Where each proto starts in m_proto_words.
+  std::vector<uint32_t> m_proto_offsets;
+};
+}
+
+static void write_snapshot(const std::string& path,
+                           const std::vector<class_info>& classes) {
+  snapshot_writer writer;
+  for (const auto& info : classes) {
+    writer.add(info);
+  }
+  if (!writer.write(path)) {
+    fprintf(stderr, "warning: cannot write jar snapshot %s\n", path.c_str());
+  }
+}
+
+bool load_jar_files(const std::vector<std::string>& locations,
+                    Scope* classes,
+                    attribute_hook_t attr_hook,
+                    const std::string& snapshot_dir,
+                    std::string* failed_location) {
+  // Snapshots don't keep attributes, so they can't serve an attribute hook.
+  bool use_snapshots = !snapshot_dir.empty() && attr_hook == nullptr;
+  std::vector<mapped_jar> jars(locations.size());
+  std::vector<class_entry> entries;
+  for (size_t i = 0; i < locations.size(); ++i) {
+    auto& jar = jars[i];
+    jar.location = locations[i];
+    jar.file.open(jar.location, boost::iostreams::mapped_file::readonly);
+    if (!jar.file.is_open()) {
+      fprintf(stderr, "error: cannot open jar file: %s\n",
+              jar.location.c_str());
+      if (failed_location != nullptr) {
+        *failed_location = jar.location;
+      }
+      return false;
+    }
+    auto mapping = reinterpret_cast<const uint8_t*>(jar.file.const_data());
+    pk_cdir_end pce;
+    if (!read_jar_entries(mapping, jar.file.size(), pce, jar.files)) {
+      fprintf(stderr, "error: cannot process jar: %s\n",
+              jar.location.c_str());
+      if (failed_location != nullptr) {
+        *failed_location = jar.location;
+      }
+      return false;
+    }
+    if (use_snapshots) {
+      jar.snapshot_path =
+          snapshot_path(snapshot_dir, mapping, jar.file.size(), pce);
+      jar.snapshot = jar_snapshot::open(jar.snapshot_path);
+      if (jar.snapshot) {
+        continue;
+      }
+    }
+    collect_class_entries(i, mapping, jar.files, entries);
+  }
+
+  init_basic_types();
+  // Define the classes of all jars before `end`, in jar order. Jars read
+  // from a snapshot are defined here; parsed jars have been defined entry by
+  // entry and only need their snapshot written.
+  size_t next_jar = 0;
+  size_t failed_jar = jars.size();
+  auto finish_jars_before = [&](size_t end) {
+    for (; next_jar < end; ++next_jar) {
+      auto& jar = jars[next_jar];
+      if (jar.snapshot) {
+        if (!jar.snapshot->define_classes(classes)) {
+          failed_jar = next_jar;
+          return false;
+        }
+        jar.snapshot.reset();
+      } else if (use_snapshots) {
+        write_snapshot(jar.snapshot_path, jar.decoded);
+        std::vector<class_info>().swap(jar.decoded);
+      }
+    }
+    return true;
+  };
+
+  size_t failed_entry_jar;
+  bool ok = process_class_entries(
+      entries,
+      [&](size_t jar, class_info& info) {
+        if (!finish_jars_before(jar)) {
+          return false;
+        }
+        if (!define_class(info, classes, attr_hook)) {
+          return false;
+        }
+        if (use_snapshots) {
+          info.cpool.clear();
+          jars[jar].decoded.push_back(std::move(info));
+        }
+        return true;
+      },
+      &failed_entry_jar);
+  if (ok) {
+    ok = finish_jars_before(jars.size());
+  } else if (failed_jar == jars.size()) {
+    failed_jar = failed_entry_jar;
+  }
+  if (!ok) {
+    fprintf(stderr, "error: cannot process jar: %s\n",
+            jars[failed_jar].location.c_str());
+    if (failed_location != nullptr) {
+      *failed_location = jars[failed_jar].location;
+    }
+  }
+  return ok;
+}
+
+bool load_jar_file(const char* location,
+                   Scope* classes,
+                   attribute_hook_t attr_hook) {
+  return load_jar_files({location}, classes, attr_hook);
 }
 
 //#define LOCAL_MAIN
@@ -15,6 +15,8 @@ class DexMethod;
 #include "boost/variant.hpp"
 
 #include <functional>
+#include <string>
+#include <vector>
 
 namespace JarLoaderUtil {
 uint32_t read32(uint8_t*& buffer);
@@ -30,4 +32,24 @@ bool load_jar_file(const char* location,
                    Scope* classes = nullptr,
                    attribute_hook_t = nullptr);
 
+/**
+ * Load several jars at once. The class entries of all the jars are inflated
+ * in parallel, but classes are defined in the order of `locations` and of the
+ * entries within each jar, exactly as if each jar had been passed to
+ * load_jar_file in turn.
+ *
+ * If snapshot_dir is set, the decoded classes of each jar are saved there,
+ * keyed by the jar's contents, and later loads of the same jar read the
+ * snapshot instead of inflating and parsing class files. Snapshots are not
+ * used when an attribute hook is given.
+ *
+ * On failure, failed_location (if given) is set to the jar that could not be
+ * loaded.
+ */
+bool load_jar_files(const std::vector<std::string>& locations,
+                    Scope* classes = nullptr,
+                    attribute_hook_t = nullptr,
+                    const std::string& snapshot_dir = "",
+                    std::string* failed_location = nullptr);
+
 bool load_class_file(const std::string& filename, Scope* classes = nullptr);
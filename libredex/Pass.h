@@ -17,6 +17,7 @@
 
 #include "DexStore.h"
 #include "ConfigFiles.h"
+#include "HierarchyService.h"
 #include "PassRegistry.h"
 
 class PassManager;
@@ -164,6 +165,15 @@ class Pass {
   virtual void eval_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {};
   virtual void run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) = 0;
 
+  /**
+   * The hierarchy analyses (see HierarchyService.h) this pass reads, which the
+   * PassManager builds before running it, and the ones it may leave stale,
+   * which are dropped once it has run. A pass that doesn't say otherwise is
+   * assumed to invalidate all of them.
+   */
+  virtual uint32_t hierarchy_reads() const { return HA_NONE; }
+  virtual uint32_t hierarchy_writes() const { return HA_ALL; }
+
  private:
   std::string m_name;
 };
@@ -105,6 +105,8 @@ void PassManager::run_type_checker(const Scope& scope,
   Timer t("IRTypeChecker");
   walk::parallel::methods(scope, [=](DexMethod* dex_method) {
     IRTypeChecker checker(dex_method);
+    // All we need is a verdict, don't keep the types at every instruction.
+    checker.enable_streaming();
     if (polymorphic_constants) {
       checker.enable_polymorphic_constants();
     }
@@ -243,6 +245,11 @@ void PassManager::run_passes(DexStoresVector& stores,
   for (size_t i = 0; i < m_activated_passes.size(); ++i) {
     Pass* pass = m_activated_passes[i];
     TRACE(PM, 1, "Running %s...\n", pass->name().c_str());
+    if (pass->hierarchy_reads() != HA_NONE) {
+      Timer hierarchy_timer(pass->name() + " (hierarchy)");
+      scope = build_class_scope(it);
+      m_hierarchy_service.prepare(scope, pass->hierarchy_reads());
+    }
     Timer t(pass->name() + " (run)");
     m_current_pass_info = &m_pass_info[i];
     bool run_profiler{m_profiler_info && m_profiler_info->pass == pass};
@@ -252,6 +259,7 @@ void PassManager::run_passes(DexStoresVector& stores,
       profiler = spawn_profiler(m_profiler_info->command);
     }
     pass->run_pass(stores, cfg, *this);
+    m_hierarchy_service.invalidate(pass->hierarchy_writes());
     if (run_profiler) {
       fprintf(stderr, "Waiting for profiler to finish...\n");
       kill_and_wait(profiler, SIGINT);
@@ -263,6 +271,11 @@ void PassManager::run_passes(DexStoresVector& stores,
     m_current_pass_info = nullptr;
   }
 
+  {
+    Timer t("Editing XML resources");
+    m_apk_mgr.commit_xml_edits();
+  }
+
   // Always run the type checker before generating the optimized dex code.
   scope = build_class_scope(it);
   run_type_checker(scope, polymorphic_constants, verify_moves);
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "ApkManager.h"
+#include "HierarchyService.h"
 #include "Pass.h"
 #include "ProguardConfiguration.h"
 
@@ -69,6 +70,10 @@ class PassManager {
 
   ApkManager& apk_manager() { return m_apk_mgr; }
 
+  // The class hierarchy and virtual scopes (ClassScopes) of the current scope,
+  // shared by the passes that don't change them.
+  HierarchyService& hierarchy_service() { return m_hierarchy_service; }
+
   void record_running_regalloc() {
     m_regalloc_has_run = true;
   }
@@ -88,6 +93,7 @@ class PassManager {
 
   Json::Value m_config;
   ApkManager m_apk_mgr;
+  HierarchyService m_hierarchy_service;
   std::vector<Pass*> m_registered_passes;
   std::vector<Pass*> m_activated_passes;
 
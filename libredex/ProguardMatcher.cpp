@@ -36,11 +36,67 @@ std::unique_ptr<boost::regex> make_rx(const std::string& s,
   return std::make_unique<boost::regex>(rx);
 }
 
-bool match_annotation_rx(const DexClass* cls, const boost::regex& annorx) {
+/*
+ * The longest prefix of a wildcard type descriptor that form_type_regex()
+ * passes through as literal characters. Any string matched by the resulting
+ * regex must start with it. A '|' anywhere would make the prefix optional, so
+ * we give up on those.
+ */
+std::string literal_prefix(const std::string& wildcard_type) {
+  if (wildcard_type.find('|') != std::string::npos) {
+    return "";
+  }
+  size_t len = 0;
+  for (char ch : wildcard_type) {
+    if (!isalnum(ch) && ch != '_' && ch != '$' && ch != '/' && ch != ';') {
+      break;
+    }
+    ++len;
+  }
+  return wildcard_type.substr(0, len);
+}
+
+/*
+ * A type pattern from a keep rule. Patterns without wildcards are resolved to
+ * their DexType once, so matching them is a pointer comparison instead of a
+ * regex evaluation.
+ */
+class TypePattern {
+ public:
+  explicit TypePattern(const std::string& pattern)
+      : m_literal(literal_prefix(pattern).size() == pattern.size()) {
+    if (m_literal) {
+      m_type = DexType::get_type(pattern.c_str());
+    } else {
+      m_rx = make_rx(pattern, false);
+    }
+  }
+
+  bool match(const DexType* type) const {
+    if (m_literal) {
+      return type == m_type;
+    }
+    return boost::regex_match(type->c_str(), *m_rx);
+  }
+
+ private:
+  bool m_literal;
+  // Null if the pattern is literal and no such type exists.
+  const DexType* m_type{nullptr};
+  std::unique_ptr<boost::regex> m_rx;
+};
+
+std::unique_ptr<TypePattern> make_type_pattern(const std::string& s) {
+  if (s.empty()) return nullptr;
+  return std::make_unique<TypePattern>(s);
+}
+
+bool has_matching_annotation(const DexClass* cls,
+                             const TypePattern& anno_pattern) {
   const auto* annos = cls->get_anno_set();
   if (!annos) return false;
   for (const auto& anno : annos->get_annotations()) {
-    if (boost::regex_match(anno->type()->c_str(), annorx)) {
+    if (anno_pattern.match(anno->type())) {
       return true;
     }
   }
@@ -57,21 +113,33 @@ struct ClassMatcher {
         unsetFlags_(ks.class_spec.unsetAccessFlags),
         m_class_name(ks.class_spec.className),
         m_cls(make_rx(ks.class_spec.className)),
-        m_anno(make_rx(ks.class_spec.annotationType, false)),
+        m_anno(make_type_pattern(ks.class_spec.annotationType)),
         m_extends(make_rx(ks.class_spec.extendsClassName)),
-        m_extends_anno(make_rx(ks.class_spec.extendsAnnotationType, false)) {}
+        m_extends_anno(
+            make_type_pattern(ks.class_spec.extendsAnnotationType)) {
+    if (!m_class_name.empty()) {
+      m_name_prefix = literal_prefix(
+          proguard_parser::convert_wildcard_type(m_class_name));
+    }
+  }
+
+  /*
+   * Every class matched by this rule has a deobfuscated name starting with
+   * this prefix, so callers can restrict the classes they try.
+   */
+  const std::string& name_prefix() const { return m_name_prefix; }
 
   bool match(const DexClass* cls) {
+    // Check for access match first; it is by far the cheapest test.
+    if (!match_access(cls)) {
+      return false;
+    }
     // Check for class name match
     // `match_name` is really slow; let's short-circuit it for wildcard-only
     // matches
     if (m_class_name != "*" && m_class_name != "**" && !match_name(cls)) {
       return false;
     }
-    // Check for access match
-    if (!match_access(cls)) {
-      return false;
-    }
     // Check to see if an annotation guard needs to be matched.
     if (!match_annotation(cls)) {
       return false;
@@ -92,7 +160,7 @@ struct ClassMatcher {
 
   bool match_annotation(const DexClass* cls) const {
     if (!m_anno) return true;
-    return match_annotation_rx(cls, *m_anno);
+    return has_matching_annotation(cls, *m_anno);
   }
 
   bool match_extends(const DexClass* cls) {
@@ -105,7 +173,7 @@ struct ClassMatcher {
     if (cls->get_type() == get_object_type()) return false;
     // First check to see if an annotation type needs to be matched.
     if (m_extends_anno) {
-      if (!match_annotation_rx(cls, *m_extends_anno)) {
+      if (!has_matching_annotation(cls, *m_extends_anno)) {
         return false;
       }
     }
@@ -160,10 +228,11 @@ struct ClassMatcher {
   DexAccessFlags setFlags_;
   DexAccessFlags unsetFlags_;
   std::string m_class_name;
+  std::string m_name_prefix;
   std::unique_ptr<boost::regex> m_cls;
-  std::unique_ptr<boost::regex> m_anno;
+  std::unique_ptr<TypePattern> m_anno;
   std::unique_ptr<boost::regex> m_extends;
-  std::unique_ptr<boost::regex> m_extends_anno;
+  std::unique_ptr<TypePattern> m_extends_anno;
 
   std::unordered_map<const DexClass*, bool> m_extends_result_cache;
 };
@@ -261,24 +330,55 @@ std::string extract_method_name_and_type(std::string qualified_fieldname) {
   return qualified_fieldname.substr(p + 2);
 }
 
+/*
+ * A cheap necessary condition for a member specification to match. When the
+ * ProGuard member name has no wildcards, the dequalified member ("name:type")
+ * must start with exactly that name followed by ':', which is much cheaper to
+ * check than running the full regex.
+ */
+class MemberNameFilter {
+ public:
+  explicit MemberNameFilter(const std::string& name) {
+    bool literal = !name.empty() &&
+                   std::all_of(name.begin(), name.end(), [](char ch) {
+                     return isalnum(ch) || ch == '_' || ch == '<' || ch == '>';
+                   });
+    if (literal) {
+      m_prefix = name + ":";
+    }
+  }
+
+  bool may_match(const std::string& dequalified_name) const {
+    return m_prefix.empty() ||
+           dequalified_name.compare(0, m_prefix.size(), m_prefix) == 0;
+  }
+
+ private:
+  std::string m_prefix;
+};
+
 bool field_level_match(RegexMap& regex_map,
                        const redex::MemberSpecification& fieldSpecification,
                        const DexField* field,
+                       const MemberNameFilter& name_filter,
                        const boost::regex& fieldname_regex) {
-  // Check for annotation guards.
-  if (!(fieldSpecification.annotationType.empty())) {
-    if (!has_annotation(regex_map, field, fieldSpecification.annotationType)) {
-      return false;
-    }
-  }
   // Check for access match.
   if (!access_matches(fieldSpecification.requiredSetAccessFlags,
                       fieldSpecification.requiredUnsetAccessFlags,
                       field->get_access())) {
     return false;
   }
-  // Match field name against regex.
   auto dequalified_name = extract_field_name(field->get_deobfuscated_name());
+  if (!name_filter.may_match(dequalified_name)) {
+    return false;
+  }
+  // Check for annotation guards.
+  if (!(fieldSpecification.annotationType.empty())) {
+    if (!has_annotation(regex_map, field, fieldSpecification.annotationType)) {
+      return false;
+    }
+  }
+  // Match field name against regex.
   return boost::regex_match(dequalified_name, fieldname_regex);
 }
 
@@ -289,10 +389,14 @@ void keep_fields(RegexMap& regex_map,
                  const Container& fields,
                  const redex::MemberSpecification& fieldSpecification,
                  const std::function<void(DexField*)>& keeper,
+                 const MemberNameFilter& name_filter,
                  const boost::regex& fieldname_regex) {
   for (DexField* field : fields) {
-    if (!field_level_match(
-            regex_map, fieldSpecification, field, fieldname_regex)) {
+    if (!field_level_match(regex_map,
+                           fieldSpecification,
+                           field,
+                           name_filter,
+                           fieldname_regex)) {
       continue;
     }
     if (apply_modifiers) {
@@ -326,12 +430,14 @@ void apply_field_keeps(RegexMap& regex_map,
   for (const auto& field_spec : keep_rule.class_spec.fieldSpecifications) {
     auto fieldname_regex = field_regex(field_spec);
     const boost::regex& matcher = register_matcher(regex_map, fieldname_regex);
+    MemberNameFilter name_filter(field_spec.name);
     keep_fields(regex_map,
                 keep_rule,
                 apply_modifiers,
                 cls->get_ifields(),
                 field_spec,
                 keeper,
+                name_filter,
                 matcher);
     keep_fields(regex_map,
                 keep_rule,
@@ -339,6 +445,7 @@ void apply_field_keeps(RegexMap& regex_map,
                 cls->get_sfields(),
                 field_spec,
                 keeper,
+                name_filter,
                 matcher);
   }
 }
@@ -346,14 +453,8 @@ void apply_field_keeps(RegexMap& regex_map,
 bool method_level_match(RegexMap& regex_map,
                         const redex::MemberSpecification& methodSpecification,
                         const DexMethod* method,
+                        const MemberNameFilter& name_filter,
                         const boost::regex& method_regex) {
-  // Check to see if the method match is guarded by an annotation match.
-  if (!(methodSpecification.annotationType.empty())) {
-    if (!has_annotation(
-            regex_map, method, methodSpecification.annotationType)) {
-      return false;
-    }
-  }
   if (!access_matches(methodSpecification.requiredSetAccessFlags,
                       methodSpecification.requiredUnsetAccessFlags,
                       method->get_access())) {
@@ -361,6 +462,16 @@ bool method_level_match(RegexMap& regex_map,
   }
   auto dequalified_name =
       extract_method_name_and_type(method->get_deobfuscated_name());
+  if (!name_filter.may_match(dequalified_name)) {
+    return false;
+  }
+  // Check to see if the method match is guarded by an annotation match.
+  if (!(methodSpecification.annotationType.empty())) {
+    if (!has_annotation(
+            regex_map, method, methodSpecification.annotationType)) {
+      return false;
+    }
+  }
   return boost::regex_match(dequalified_name.c_str(), method_regex);
 }
 
@@ -386,11 +497,15 @@ void keep_methods(RegexMap& regex_map,
                   bool apply_modifiers,
                   const redex::MemberSpecification& methodSpecification,
                   const Container& methods,
+                  const MemberNameFilter& name_filter,
                   const boost::regex& method_regex,
                   const std::function<void(DexMethod*)>& keeper) {
   for (DexMethod* method : methods) {
-    if (method_level_match(
-            regex_map, methodSpecification, method, method_regex)) {
+    if (method_level_match(regex_map,
+                           methodSpecification,
+                           method,
+                           name_filter,
+                           method_regex)) {
       if (apply_modifiers) {
         apply_keep_modifiers(keep_rule, method);
       }
@@ -426,11 +541,13 @@ void apply_method_keeps(RegexMap& regex_map,
     auto qualified_method_regex = method_regex(method_spec);
     const boost::regex& method_regex =
         register_matcher(regex_map, qualified_method_regex);
+    MemberNameFilter name_filter(method_spec.name);
     keep_methods(regex_map,
                  keep_rule,
                  apply_modifiers,
                  method_spec,
                  cls->get_vmethods(),
+                 name_filter,
                  method_regex,
                  keeper);
     keep_methods(regex_map,
@@ -438,6 +555,7 @@ void apply_method_keeps(RegexMap& regex_map,
                  apply_modifiers,
                  method_spec,
                  cls->get_dmethods(),
+                 name_filter,
                  method_regex,
                  keeper);
   }
@@ -471,13 +589,16 @@ std::vector<DexMethod*> all_method_matches(
     const MemberSpecification& method_keep,
     const boost::regex& method_regex) {
   std::vector<DexMethod*> matches;
+  MemberNameFilter name_filter(method_keep.name);
   for (const auto& method : cls->get_vmethods()) {
-    if (method_level_match(regex_map, method_keep, method, method_regex)) {
+    if (method_level_match(
+            regex_map, method_keep, method, name_filter, method_regex)) {
       matches.push_back(method);
     }
   }
   for (const auto& method : cls->get_dmethods()) {
-    if (method_level_match(regex_map, method_keep, method, method_regex)) {
+    if (method_level_match(
+            regex_map, method_keep, method, name_filter, method_regex)) {
       matches.push_back(method);
     }
   }
@@ -523,13 +644,14 @@ std::vector<DexField*> all_field_matches(
   auto sfields = cls->get_sfields();
   std::vector<DexField*> matches;
   const boost::regex& matcher = register_matcher(regex_map, fieldtype_regex);
+  MemberNameFilter name_filter(field_keep.name);
   for (const auto& field : ifields) {
-    if (field_level_match(regex_map, field_keep, field, matcher)) {
+    if (field_level_match(regex_map, field_keep, field, name_filter, matcher)) {
       matches.push_back(field);
     }
   }
   for (const auto& field : sfields) {
-    if (field_level_match(regex_map, field_keep, field, matcher)) {
+    if (field_level_match(regex_map, field_keep, field, name_filter, matcher)) {
       matches.push_back(field);
     }
   }
@@ -724,10 +846,53 @@ void build_extends_or_implements_hierarchy(const Scope& scope,
   }
 }
 
+/*
+ * The classes of the scope sorted by deobfuscated name. Classes sharing a
+ * package prefix are contiguous, so a keep rule whose class pattern starts
+ * with a literal prefix only has to be tried on one range of classes rather
+ * than on the whole scope.
+ */
+class ClassNameIndex {
+ public:
+  using const_iterator = std::vector<DexClass*>::const_iterator;
+
+  explicit ClassNameIndex(const Scope& classes) : m_classes(classes) {
+    std::sort(m_classes.begin(),
+              m_classes.end(),
+              [](const DexClass* a, const DexClass* b) {
+                return a->get_deobfuscated_name() < b->get_deobfuscated_name();
+              });
+  }
+
+  // The classes whose deobfuscated name starts with the given prefix.
+  std::pair<const_iterator, const_iterator> with_prefix(
+      const std::string& prefix) const {
+    auto begin = std::lower_bound(
+        m_classes.begin(),
+        m_classes.end(),
+        prefix,
+        [](const DexClass* cls, const std::string& prefix) {
+          return cls->get_deobfuscated_name() < prefix;
+        });
+    auto end = std::upper_bound(
+        begin,
+        m_classes.end(),
+        prefix,
+        [](const std::string& prefix, const DexClass* cls) {
+          return cls->get_deobfuscated_name().compare(
+                     0, prefix.size(), prefix) > 0;
+        });
+    return std::make_pair(begin, end);
+  }
+
+ private:
+  std::vector<DexClass*> m_classes;
+};
+
 void process_keep(
     const ProguardMap& pg_map,
     std::vector<KeepSpec>& keep_rules,
-    const Scope& classes,
+    const ClassNameIndex& class_index,
     const Scope& external_classes,
     const ClassHierarchy& hierarchy,
     std::function<void(RegexMap&, KeepSpec&, DexClass*)> keep_processor,
@@ -747,14 +912,16 @@ void process_keep(
     }
   };
 
-  // We only parallelize if keep_rule needs to be applied to all classes.
+  // We only parallelize if keep_rule needs to be applied to all classes
+  // sharing its literal name prefix.
   auto wq = workqueue_foreach<KeepSpec*>(
-      [&process_single_keep, &classes](KeepSpec* keep_rule) {
+      [&process_single_keep, &class_index](KeepSpec* keep_rule) {
         RegexMap regex_map;
         ClassMatcher class_match(*keep_rule);
 
-        for (const auto& cls : classes) {
-          process_single_keep(class_match, *keep_rule, cls, regex_map);
+        auto candidates = class_index.with_prefix(class_match.name_prefix());
+        for (auto it = candidates.first; it != candidates.second; ++it) {
+          process_single_keep(class_match, *keep_rule, *it, regex_map);
         }
       });
 
@@ -853,9 +1020,11 @@ void process_proguard_rules(const ProguardMap& pg_map,
   // given external class.
   build_extends_or_implements_hierarchy(external_classes, &hierarchy);
 
+  ClassNameIndex class_index(classes);
+
   process_keep(pg_map,
                pg_config->whyareyoukeeping_rules,
-               classes,
+               class_index,
                external_classes,
                hierarchy,
                process_whyareyoukeeping,
@@ -863,7 +1032,7 @@ void process_proguard_rules(const ProguardMap& pg_map,
 
   process_keep(pg_map,
                pg_config->keep_rules,
-               classes,
+               class_index,
                external_classes,
                hierarchy,
                mark_class_and_members_for_keep,
@@ -871,7 +1040,7 @@ void process_proguard_rules(const ProguardMap& pg_map,
 
   process_keep(pg_map,
                pg_config->assumenosideeffects_rules,
-               classes,
+               class_index,
                external_classes,
                hierarchy,
                process_assumenosideeffects,
@@ -9,10 +9,15 @@
 
 #include "ReachableObjects.h"
 
+#include <atomic>
+
+#include "ConcurrentContainers.h"
 #include "DexUtil.h"
 #include "Pass.h"
 #include "ReachableClasses.h"
 #include "Resolver.h"
+#include "Walkers.h"
+#include "WorkQueue.h"
 
 using namespace reachable_objects;
 
@@ -28,14 +33,27 @@ using namespace reachable_objects;
  * "conditional" marking: these members are kept only if their containing class
  * is determined to be kept. The conditional marking logic is also used to
  * retain (or not) implementations of interface methods. These elements are
- * placed in the cond_marked_* sets; care must be taken to promote
+ * parked on their class in m_cond_marked; care must be taken to promote
  * conditionally marked elements to fully marked.
+ *
+ * The marking itself runs on a work-stealing WorkQueue: every newly marked
+ * object becomes a task, and the marked_* sets are concurrent so that the
+ * test-and-mark in push() is atomic. The resulting sets are the least fixpoint
+ * of the reachability rules and hence do not depend on scheduling. With
+ * record_reachability, each worker records in its own graph every edge from
+ * the object it visits to the objects it pushes, whether or not they were
+ * already marked, and the graphs are merged once the walk is done. Every
+ * retainer of a reachable object is thus recorded, and the merged graph does
+ * not depend on scheduling either.
  */
 
 namespace {
 
 static ReachableObject SEED_SINGLETON{};
 
+// The retainers graph the current thread records into.
+thread_local ReachableObjectGraph* t_retainers_of = nullptr;
+
 bool is_canary(const DexClass* cls) {
   return strstr(cls->get_name()->c_str(), "Canary");
 }
@@ -144,6 +162,17 @@ bool implements_library_method(InheritanceGraph& graph,
   return false;
 }
 
+/*
+ * Members that were conditionally marked before their class got visited.
+ * Once the class is visited, later conditionally marked members are pushed
+ * right away.
+ */
+struct CondMarked {
+  bool visited{false};
+  std::vector<const DexField*> fields;
+  std::vector<const DexMethod*> methods;
+};
+
 class Reachable {
   DexStoresVector& m_stores;
   const std::unordered_set<const DexType*>& m_ignore_string_literals;
@@ -151,16 +180,16 @@ class Reachable {
   std::unordered_set<const DexType*> m_ignore_system_annos;
   bool m_record_reachability;
   InheritanceGraph m_inheritance_graph;
-  int m_num_ignore_check_strings = 0;
-  std::unordered_set<const DexClass*> m_marked_classes;
-  std::unordered_set<const DexFieldRef*> m_marked_fields;
-  std::unordered_set<const DexMethodRef*> m_marked_methods;
-  std::unordered_set<const DexField*> m_cond_marked_fields;
-  std::unordered_set<const DexMethod*> m_cond_marked_methods;
-  std::vector<const DexClass*> m_class_stack;
-  std::vector<const DexFieldRef*> m_field_stack;
-  std::vector<const DexMethodRef*> m_method_stack;
+  std::atomic<int> m_num_ignore_check_strings{0};
+  ConcurrentSet<const DexClass*> m_marked_classes;
+  ConcurrentSet<const DexFieldRef*> m_marked_fields;
+  ConcurrentSet<const DexMethodRef*> m_marked_methods;
+  ConcurrentMap<const DexClass*, CondMarked> m_cond_marked;
   ReachableObjectGraph m_retainers_of;
+  // one per worker, merged into m_retainers_of after the walk
+  std::vector<ReachableObjectGraph> m_worker_retainers_of;
+  WorkQueue<ReachableObject, ReachableObjectGraph*, std::nullptr_t>
+      m_work_queue;
 
  public:
   Reachable(
@@ -168,13 +197,26 @@ class Reachable {
       const std::unordered_set<const DexType*>& ignore_string_literals,
       const std::unordered_set<const DexType*>& ignore_string_literal_annos,
       const std::unordered_set<const DexType*>& ignore_system_annos,
-      bool record_reachability)
+      bool record_reachability,
+      size_t num_threads)
       : m_stores(stores),
         m_ignore_string_literals(ignore_string_literals),
         m_ignore_string_literal_annos(ignore_string_literal_annos),
         m_ignore_system_annos(ignore_system_annos),
         m_record_reachability(record_reachability),
-        m_inheritance_graph(stores) {
+        m_inheritance_graph(stores),
+        m_worker_retainers_of(num_threads),
+        m_work_queue(
+            [this](ReachableObjectGraph*& retainers_of, ReachableObject obj) {
+              t_retainers_of = retainers_of;
+              visit(obj);
+              return nullptr;
+            },
+            [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+            [this](unsigned int worker) {
+              return &m_worker_retainers_of[worker];
+            },
+            m_worker_retainers_of.size()) {
     // To keep the backward compatability of this code, ensure that the
     // "MemberClasses" annotation is always in m_ignore_system_annos.
     m_ignore_system_annos.emplace(
@@ -182,19 +224,16 @@ class Reachable {
   }
 
  private:
-  void mark(const DexClass* cls) {
-    if (!cls) return;
-    m_marked_classes.emplace(cls);
-  }
+  /*
+   * Atomically mark the object, returning whether we were the ones to do so.
+   * Whoever marks an object is responsible for scheduling its visit.
+   */
+  bool mark(const DexClass* cls) { return m_marked_classes.insert(cls); }
 
-  void mark(const DexFieldRef* field) {
-    if (!field) return;
-    m_marked_fields.emplace(field);
-  }
+  bool mark(const DexFieldRef* field) { return m_marked_fields.insert(field); }
 
-  void mark(const DexMethodRef* method) {
-    if (!method) return;
-    m_marked_methods.emplace(method);
+  bool mark(const DexMethodRef* method) {
+    return m_marked_methods.insert(method);
   }
 
   bool marked(const DexClass* cls) { return m_marked_classes.count(cls); }
@@ -217,75 +256,88 @@ class Reachable {
   }
 
   void push_seed(const DexClass* cls) {
-    if (!cls || marked(cls)) return;
+    if (!cls || !mark(cls)) return;
     record_is_seed(cls);
-    mark(cls);
-    m_class_stack.emplace_back(cls);
+    m_work_queue.add_item(ReachableObject(cls));
   }
 
   template <class Parent>
   void push(const Parent* parent, const DexClass* cls) {
-    // FIXME: Bug! Even if cls is already marked, we need to record its
-    // reachability from parent to cls.
-    if (!cls || marked(cls)) return;
+    if (!cls) return;
     record_reachability(parent, cls);
-    mark(cls);
-    m_class_stack.emplace_back(cls);
+    if (!mark(cls)) return;
+    m_work_queue.add_item(ReachableObject(cls));
   }
 
   void push_seed(const DexField* field) {
-    if (!field || marked(field)) return;
+    if (!field || !mark(field)) return;
     record_is_seed(field);
-    mark(field);
-    m_field_stack.emplace_back(field);
+    m_work_queue.add_item(ReachableObject(field));
   }
 
+  /*
+   * Whether the class has been visited is checked and the member parked
+   * under the same lock that visit(cls) takes, so a member cannot slip in
+   * after the class has picked up its parked members. Members that are
+   * already marked are parked too, so that the edge from their class is
+   * recorded whichever path marked them first.
+   */
   void push_cond(const DexField* field) {
-    if (!field || marked(field)) return;
+    if (!field) return;
     TRACE(REACH, 4, "Conditionally marking field: %s\n", SHOW(field));
     auto clazz = type_class(field->get_class());
-
-    if (marked(clazz)) {
+    bool visited = false;
+    m_cond_marked.update(
+        clazz, [&](const DexClass*, CondMarked& cond, bool /* exists */) {
+          visited = cond.visited;
+          if (!visited) {
+            cond.fields.emplace_back(field);
+          }
+        });
+    if (visited) {
       push(clazz, field);
-    } else {
-      m_cond_marked_fields.emplace(field);
     }
   }
 
   template <class Parent>
   void push(const Parent* parent, const DexFieldRef* field) {
-    if (!field || marked(field)) return;
+    if (!field) return;
+    record_reachability(parent, field);
+    if (!mark(field)) return;
     if (field->is_def()) {
       gather_and_push(static_cast<const DexField*>(field));
     }
-    record_reachability(parent, field);
-    mark(field);
-    m_field_stack.emplace_back(field);
+    m_work_queue.add_item(ReachableObject(field));
   }
 
   void push_seed(const DexMethod* method) {
-    if (!method || marked(method)) return;
+    if (!method || !mark(method)) return;
     record_is_seed(method);
-    mark(method);
-    m_method_stack.emplace_back(method);
+    m_work_queue.add_item(ReachableObject(method));
   }
 
   template <class Parent>
   void push(const Parent* parent, const DexMethodRef* method) {
-    if (!method || marked(method)) return;
+    if (!method) return;
     record_reachability(parent, method);
-    mark(method);
-    m_method_stack.emplace_back(method);
+    if (!mark(method)) return;
+    m_work_queue.add_item(ReachableObject(method));
   }
 
   void push_cond(const DexMethod* method) {
-    if (!method || marked(method)) return;
+    if (!method) return;
     TRACE(REACH, 4, "Conditionally marking method: %s\n", SHOW(method));
     auto clazz = type_class(method->get_class());
-    if (marked(clazz)) {
+    bool visited = false;
+    m_cond_marked.update(
+        clazz, [&](const DexClass*, CondMarked& cond, bool /* exists */) {
+          visited = cond.visited;
+          if (!visited) {
+            cond.methods.emplace_back(method);
+          }
+        });
+    if (visited) {
       push(clazz, method);
-    } else {
-      m_cond_marked_methods.emplace(method);
     }
   }
 
@@ -340,6 +392,23 @@ class Reachable {
     }
   }
 
+  void visit(const ReachableObject& obj) {
+    switch (obj.type) {
+    case ReachableObjectType::CLASS:
+      visit(obj.cls);
+      break;
+    case ReachableObjectType::FIELD:
+      visit(const_cast<DexFieldRef*>(obj.field));
+      break;
+    case ReachableObjectType::METHOD:
+      visit(const_cast<DexMethodRef*>(obj.method));
+      break;
+    case ReachableObjectType::ANNO:
+    case ReachableObjectType::SEED:
+      not_reached();
+    }
+  }
+
   void visit(const DexClass* cls) {
     TRACE(REACH, 4, "Visiting class: %s\n", SHOW(cls));
     for (auto& m : cls->get_dmethods()) {
@@ -372,25 +441,18 @@ class Reachable {
         gather_and_push(anno);
       }
     }
-    for (auto const& m : cls->get_ifields()) {
-      if (m_cond_marked_fields.count(m)) {
-        push(cls, m);
-      }
-    }
-    for (auto const& m : cls->get_sfields()) {
-      if (m_cond_marked_fields.count(m)) {
-        push(cls, m);
-      }
-    }
-    for (auto const& m : cls->get_dmethods()) {
-      if (m_cond_marked_methods.count(m)) {
-        push(cls, m);
-      }
+    CondMarked cond_marked;
+    m_cond_marked.update(
+        cls, [&](const DexClass*, CondMarked& cond, bool /* exists */) {
+          cond.visited = true;
+          cond_marked.fields.swap(cond.fields);
+          cond_marked.methods.swap(cond.methods);
+        });
+    for (auto const& m : cond_marked.fields) {
+      push(cls, m);
     }
-    for (auto const& m : cls->get_vmethods()) {
-      if (m_cond_marked_methods.count(m)) {
-        push(cls, m);
-      }
+    for (auto const& m : cond_marked.methods) {
+      push(cls, m);
     }
   }
 
@@ -459,7 +521,7 @@ class Reachable {
   void record_is_seed(Seed* seed) {
     if (m_record_reachability) {
       assert(seed != nullptr);
-      m_retainers_of[ReachableObject(seed)].emplace(SEED_SINGLETON);
+      (*t_retainers_of)[ReachableObject(seed)].emplace(SEED_SINGLETON);
     }
   }
 
@@ -477,12 +539,14 @@ class Reachable {
   void record_reachability(Parent* parent, Object* object) {
     if (m_record_reachability) {
       RecordImpl<Parent, Object>::record_reachability(
-          parent, object, m_retainers_of);
+          parent, object, *t_retainers_of);
     }
   }
 
  public:
   ReachableObjects mark(int* num_ignore_check_strings) {
+    // the seeds are pushed from this thread
+    t_retainers_of = &m_retainers_of;
     for (auto const& dex : DexStoreClassesIterator(m_stores)) {
       for (auto const& cls : dex) {
         if (root(cls) || is_canary(cls)) {
@@ -516,26 +580,14 @@ class Reachable {
         }
       }
     }
-    while (true) {
-      if (!m_class_stack.empty()) {
-        auto cls = m_class_stack.back();
-        m_class_stack.pop_back();
-        visit(cls);
-        continue;
+    m_work_queue.run_all();
+    t_retainers_of = nullptr;
+    for (auto& retainers_of : m_worker_retainers_of) {
+      for (const auto& entry : retainers_of) {
+        m_retainers_of[entry.first].insert(entry.second.begin(),
+                                           entry.second.end());
       }
-      if (!m_field_stack.empty()) {
-        auto field = m_field_stack.back();
-        m_field_stack.pop_back();
-        visit(const_cast<DexFieldRef*>(field));
-        continue;
-      }
-      if (!m_method_stack.empty()) {
-        auto method = m_method_stack.back();
-        m_method_stack.pop_back();
-        visit(const_cast<DexMethodRef*>(method));
-        continue;
-      }
-      break;
+      retainers_of.clear();
     }
 
     if (num_ignore_check_strings) {
@@ -543,9 +595,9 @@ class Reachable {
     }
 
     ReachableObjects ret;
-    ret.marked_fields = std::move(m_marked_fields);
-    ret.marked_classes = std::move(m_marked_classes);
-    ret.marked_methods = std::move(m_marked_methods);
+    ret.marked_classes.insert(m_marked_classes.begin(), m_marked_classes.end());
+    ret.marked_fields.insert(m_marked_fields.begin(), m_marked_fields.end());
+    ret.marked_methods.insert(m_marked_methods.begin(), m_marked_methods.end());
     ret.retainers_of = std::move(m_retainers_of);
     return ret;
   }
@@ -645,12 +697,14 @@ ReachableObjects compute_reachable_objects(
     const std::unordered_set<const DexType*>& ignore_string_literal_annos,
     const std::unordered_set<const DexType*>& ignore_system_annos,
     int* num_ignore_check_strings,
-    bool record_reachability) {
+    bool record_reachability,
+    size_t num_threads) {
   return Reachable(stores,
                    ignore_string_literals,
                    ignore_string_literal_annos,
                    ignore_system_annos,
-                   record_reachability)
+                   record_reachability,
+                   num_threads)
       .mark(num_ignore_check_strings);
 }
 
@@ -14,6 +14,7 @@
 
 #include "DexClass.h"
 #include "Pass.h"
+#include "Walkers.h"
 
 namespace reachable_objects {
 
@@ -163,7 +164,8 @@ ReachableObjects compute_reachable_objects(
     const std::unordered_set<const DexType*>& ignore_string_literal_annos,
     const std::unordered_set<const DexType*>& ignore_system_annos,
     int* num_ignore_check_strings,
-    bool record_reachability = false);
+    bool record_reachability = false,
+    size_t num_threads = walk::parallel::default_num_threads());
 
 // Dump reachability information to TRACE(REACH_DUMP, 5).
 void dump_reachability(DexStoresVector& stores,
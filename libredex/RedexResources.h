@@ -10,9 +10,11 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "androidfw/ResourceTypes.h"
 
@@ -103,6 +105,61 @@ int rename_classes_in_layout(
     ssize_t* out_size_delta);
 
 
+/**
+ * Batches edits to the binary XML files of an unpacked APK, so that passes
+ * touching the same files don't each read, parse and write them again. Edits
+ * are queued by the passes and apply to every file given to the session, in
+ * the order they were queued. commit() reads each file once, applies all of
+ * its edits, and writes it back once if it changed. Files are processed in
+ * parallel. Raw resources are skipped.
+ *
+ * During a Redex run, the session is owned by the ApkManager: passes queue
+ * their edits on ApkManager::xml_edits(), and the PassManager commits them
+ * once after the last pass.
+ */
+class XmlEditSession {
+ public:
+  struct FileStats {
+    size_t strings_renamed{0};
+    size_t values_remapped{0};
+    size_t values_inlined{0};
+    ssize_t size_delta{0};
+  };
+
+  explicit XmlEditSession(std::vector<std::string> files);
+
+  // Replaces ResStringPool entries, like rename_classes_in_layout.
+  void rename_strings(const std::map<std::string, std::string>& renames);
+
+  // Remaps resource references, like remap_xml_reference_attributes.
+  void remap_references(
+      const std::map<uint32_t, uint32_t>& kept_to_remapped_ids);
+
+  // Inlines resource references, like inline_xml_reference_attributes.
+  void inline_references(
+      const std::map<uint32_t, android::Res_value>& id_to_inline_value);
+
+  // Applies the queued edits and clears them. Returns the stats of each file,
+  // in the order the files were given. Throws, naming every failed file, if
+  // a file can't be read, parsed or written; no file is replaced then.
+  std::vector<FileStats> commit();
+
+ private:
+  struct ValueEdit {
+    std::map<uint32_t, uint32_t> remap;
+    std::map<uint32_t, android::Res_value> inline_values;
+  };
+
+  // Writes the edited file next to `path`, setting *staged_path, unless
+  // nothing changed.
+  FileStats edit_file(const std::string& path,
+                      std::string* staged_path) const;
+
+  std::vector<std::string> m_files;
+  std::map<std::string, std::string> m_renames;
+  std::vector<ValueEdit> m_value_edits;
+};
+
 /**
  * Follows the reference links for a resource for all configurations.
  * Returns all the nodes visited, as well as all the string values seen.
@@ -14,9 +14,15 @@
 #include "ReachableClasses.h"
 #include "Timer.h"
 #include "Trace.h"
+#include "Walkers.h"
+#include "WorkQueue.h"
 
+#include <algorithm>
+#include <boost/functional/hash.hpp>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace {
 
@@ -172,27 +178,131 @@ void create_object_class() {
   }
 }
 
-// map from a proto to the set of interface implementing that sig
-using IntfProtoMap = std::map<const DexProto*, TypeSet, dexprotos_comparator>;
+using Signature = std::pair<const DexString*, const DexProto*>;
 
-// a map from name to signatures for a set of interfaces
-using BaseIntfSigs =
-    std::map<const DexString*, IntfProtoMap, dexstrings_comparator>;
+struct SignatureHash {
+  size_t operator()(const Signature& sig) const {
+    size_t seed = 0;
+    boost::hash_combine(seed, sig.first);
+    boost::hash_combine(seed, sig.second);
+    return seed;
+  }
+};
+
+// dense id of a (name, proto) signature
+using SigId = uint32_t;
+
+/**
+ * Dense ids for all the signatures of the virtual methods in a hierarchy,
+ * including those of the interfaces it implements.
+ * Ids are handed out in SignatureMap order, by name and then by proto, so
+ * walking a list of ids sorted by value walks the SignatureMap in order.
+ * The ids are all computed upfront, lookups are read only and can be
+ * performed in parallel.
+ */
+class SignatureIds {
+ public:
+  explicit SignatureIds(std::vector<Signature> sigs) {
+    std::sort(sigs.begin(),
+              sigs.end(),
+              [](const Signature& a, const Signature& b) {
+                if (a.first != b.first) {
+                  return compare_dexstrings(a.first, b.first);
+                }
+                return compare_dexprotos(a.second, b.second);
+              });
+    sigs.erase(std::unique(sigs.begin(), sigs.end()), sigs.end());
+    m_ids.reserve(sigs.size());
+    for (SigId id = 0; id < sigs.size(); id++) {
+      m_ids.emplace(sigs[id], id);
+    }
+    m_sigs = std::move(sigs);
+  }
+
+  SigId get(const DexString* name, const DexProto* proto) const {
+    const auto& id = m_ids.find(Signature(name, proto));
+    always_assert_log(id != m_ids.end(),
+                      "Unknown signature %s:%s\n",
+                      SHOW(name),
+                      SHOW(proto));
+    return id->second;
+  }
+
+  SigId get(const DexMethod* meth) const {
+    return get(meth->get_name(), meth->get_proto());
+  }
+
+  const Signature& get(SigId id) const { return m_sigs[id]; }
 
-// map to track signatures as (name, sig)
-using BaseSigs = std::map<const DexString*,
-                          std::set<const DexProto*, dexprotos_comparator>,
-                          dexstrings_comparator>;
+ private:
+  std::vector<Signature> m_sigs;
+  std::unordered_map<Signature, SigId, SignatureHash> m_ids;
+};
+
+/**
+ * The flat version of a SignatureMap for a single type, used while building
+ * the VirtualScopes: the scopes of each signature id, sorted by id.
+ */
+using FlatSigMap = std::vector<std::pair<SigId, VirtualScopes>>;
+
+// the interfaces declaring each signature in a type, sorted by id
+using BaseIntfSigs = std::vector<std::pair<SigId, TypeSet>>;
+
+// the signatures of the methods defined in a type, sorted
+using BaseSigs = std::vector<SigId>;
+
+/**
+ * Find the entry for a given signature in a list sorted by id.
+ */
+template <typename Entries>
+auto find_sig(Entries& entries, SigId id) -> decltype(entries.begin()) {
+  auto it = std::lower_bound(
+      entries.begin(),
+      entries.end(),
+      id,
+      [](const typename Entries::value_type& entry, SigId id) {
+        return entry.first < id;
+      });
+  return it != entries.end() && it->first == id ? it : entries.end();
+}
+
+/**
+ * Load the signatures of the virtual methods in type and of the methods of
+ * every interface it implements that was not visited yet, the latter
+ * possibly turning into miranda methods.
+ */
+void load_signatures(const DexType* type,
+                     std::unordered_set<const DexType*>& visited_intfs,
+                     std::vector<Signature>& sigs) {
+  for (const auto& vmeth : get_vmethods(type)) {
+    sigs.emplace_back(vmeth->get_name(), vmeth->get_proto());
+  }
+  if (type == get_object_type()) return;
+  std::vector<const DexClass*> intfs{type_class(type)};
+  while (!intfs.empty()) {
+    auto cls = intfs.back();
+    intfs.pop_back();
+    for (const auto& intf : cls->get_interfaces()->get_type_list()) {
+      auto intf_cls = type_class(intf);
+      if (intf_cls == nullptr || !visited_intfs.insert(intf).second) {
+        continue;
+      }
+      for (const auto& vmeth : intf_cls->get_vmethods()) {
+        sigs.emplace_back(vmeth->get_name(), vmeth->get_proto());
+      }
+      intfs.push_back(intf_cls);
+    }
+  }
+}
 
 /**
  * Create a BaseSig which is the set of method definitions in a type.
  */
-BaseSigs load_base_sigs(SignatureMap& sig_map) {
+BaseSigs load_base_sigs(const FlatSigMap& sig_map) {
   BaseSigs base_sigs;
-  for (const auto& proto_it : sig_map) {
-    for (const auto& scope : proto_it.second) {
-      base_sigs[proto_it.first].insert(scope.first);
-    }
+  base_sigs.reserve(sig_map.size());
+  for (const auto& scopes_it : sig_map) {
+    base_sigs.push_back(scopes_it.first);
   }
   return base_sigs;
 }
@@ -233,11 +343,9 @@ void escape_all(VirtualScopes& scopes) {
  * if an interface at the class level is marked ESCAPED
  * everything defined in base and children escapes as well.
  */
-void escape_all(SignatureMap& sig_map) {
-  for (auto& protos_it : sig_map) {
-    for (auto& scopes_it : protos_it.second) {
-      escape_all(scopes_it.second);
-    }
+void escape_all(FlatSigMap& sig_map) {
+  for (auto& scopes_it : sig_map) {
+    escape_all(scopes_it.second);
   }
 }
 
@@ -246,41 +354,40 @@ void escape_all(SignatureMap& sig_map) {
  * Walk through all the method definitions in base.
  */
 void mark_methods(const DexType* type,
-                  SignatureMap& sig_map,
+                  FlatSigMap& sig_map,
                   const BaseSigs& base_sigs,
                   bool escape) {
-  for (const auto& protos_it : base_sigs) {
-    const auto name = protos_it.first;
-    for (const auto& proto : protos_it.second) {
-      auto& scopes = sig_map[name][proto];
-      always_assert(scopes.size() > 0);
-      always_assert(scopes[0].type == type);
-      // mark final and override accordingly
-      auto& first_scope = scopes[0];
-      if (first_scope.methods.size() == 1) {
-        TRACE(VIRT, 6, "FINAL %s\n", SHOW(first_scope.methods[0].first));
-        first_scope.methods[0].second |= FINAL;
-      } else {
-        for (auto meth = first_scope.methods.begin() + 1;
-             meth != first_scope.methods.end();
-             meth++) {
-          TRACE(VIRT, 6, "OVERRIDE %s\n", SHOW((*meth).first));
-          (*meth).second |= OVERRIDE;
-        }
-      }
-      // all others must be interfaces but we have a definition
-      // in base so they must all be override
-      if (scopes.size() > 1) {
-        for (auto scope = scopes.begin() + 1; scope != scopes.end(); scope++) {
-          always_assert((*scope).methods.size() > 0);
-          TRACE(VIRT, 6, "OVERRIDE %s\n", SHOW((*scope).methods[0].first));
-          (*scope).methods[0].second |= OVERRIDE;
-        }
+  for (const auto& sig : base_sigs) {
+    auto scopes_it = find_sig(sig_map, sig);
+    always_assert(scopes_it != sig_map.end());
+    auto& scopes = scopes_it->second;
+    always_assert(scopes.size() > 0);
+    always_assert(scopes[0].type == type);
+    // mark final and override accordingly
+    auto& first_scope = scopes[0];
+    if (first_scope.methods.size() == 1) {
+      TRACE(VIRT, 6, "FINAL %s\n", SHOW(first_scope.methods[0].first));
+      first_scope.methods[0].second |= FINAL;
+    } else {
+      for (auto meth = first_scope.methods.begin() + 1;
+           meth != first_scope.methods.end();
+           meth++) {
+        TRACE(VIRT, 6, "OVERRIDE %s\n", SHOW((*meth).first));
+        (*meth).second |= OVERRIDE;
       }
-      if (escape) {
-        escape_all(scopes);
+    }
+    // all others must be interfaces but we have a definition
+    // in base so they must all be override
+    if (scopes.size() > 1) {
+      for (auto scope = scopes.begin() + 1; scope != scopes.end(); scope++) {
+        always_assert((*scope).methods.size() > 0);
+        TRACE(VIRT, 6, "OVERRIDE %s\n", SHOW((*scope).methods[0].first));
+        (*scope).methods[0].second |= OVERRIDE;
       }
     }
+    if (escape) {
+      escape_all(scopes);
+    }
   }
 }
 
@@ -293,165 +400,134 @@ void mark_methods(const DexType* type,
  * in the VirtualScope for A.m().
  */
 void build_interface_scope(const DexType* type,
-                           SignatureMap& sig_map,
+                           FlatSigMap& sig_map,
                            const BaseIntfSigs& intf_sig_map) {
-  for (const auto& proto_it : intf_sig_map) {
-    for (const auto& intfs_it : proto_it.second) {
-      auto& scopes = sig_map[proto_it.first][intfs_it.first];
-      // first virtual scope must be that in type, it's the first we built
-      always_assert(scopes[0].type == type);
-      // mark impl all the class virtual scope
-      for (auto& meth : scopes[0].methods) {
-        TRACE(VIRT, 6, "IMPL %s\n", SHOW(meth.first));
-        meth.second |= IMPL;
-      }
-      // remaining scopes must be for interfaces so they are
-      // marked IMPL already.
-      // Scope for interfaces in base are not there yet so
-      // make a copy of the class virtual scope for every
-      // interface scope
-      const auto& intfs = intfs_it.second;
-      for (const auto& intf : intfs) {
-        VirtualScope vg;
-        vg.type = intf;
-        vg.methods = scopes[0].methods;
-        scopes.push_back(vg);
-      }
+  for (const auto& intfs_it : intf_sig_map) {
+    auto scopes_it = find_sig(sig_map, intfs_it.first);
+    always_assert(scopes_it != sig_map.end());
+    auto& scopes = scopes_it->second;
+    // first virtual scope must be that in type, it's the first we built
+    always_assert(scopes[0].type == type);
+    // mark impl all the class virtual scope
+    for (auto& meth : scopes[0].methods) {
+      TRACE(VIRT, 6, "IMPL %s\n", SHOW(meth.first));
+      meth.second |= IMPL;
+    }
+    // remaining scopes must be for interfaces so they are
+    // marked IMPL already.
+    // Scope for interfaces in base are not there yet so
+    // make a copy of the class virtual scope for every
+    // interface scope
+    const auto& intfs = intfs_it.second;
+    for (const auto& intf : intfs) {
+      VirtualScope vg;
+      vg.type = intf;
+      vg.methods = scopes[0].methods;
+      scopes.push_back(vg);
     }
   }
 }
 
 /**
- * Merge 2 signatures map. The map from derived_sig_map is copied in
- * base_sig_map.
+ * Merge the signature maps of all the children of a type in the signature
+ * map of the type.
+ * The scopes of the children are moved over, in the order of the children,
+ * so the result is the same as merging each child in turn.
  * Interface methods in base don't have an entry yet, that will be build later
  * because it's a straight copy of the class virtual scope.
  */
-void merge(const BaseSigs& base_sigs,
+void merge(const SignatureIds& sig_ids,
            const BaseIntfSigs& base_intf_sig_map,
-           SignatureMap& base_sig_map,
-           const SignatureMap& derived_sig_map) {
-
-  // Helpers
+           FlatSigMap& base_sig_map,
+           std::vector<FlatSigMap>& derived_sig_maps) {
+  // all derived scopes by signature, in the order of the children
+  std::vector<std::pair<SigId, VirtualScopes*>> derived;
+  for (auto& derived_sig_map : derived_sig_maps) {
+    for (auto& scopes_it : derived_sig_map) {
+      derived.emplace_back(scopes_it.first, &scopes_it.second);
+    }
+  }
+  std::stable_sort(derived.begin(),
+                   derived.end(),
+                   [](const std::pair<SigId, VirtualScopes*>& a,
+                      const std::pair<SigId, VirtualScopes*>& b) {
+                     return a.first < b.first;
+                   });
 
-  // is_base_sig(name, proto) - is the (name, proto) a definition in base
-  const auto is_base_sig = [&](const DexString* name, const DexProto* proto) {
-    TRACE(VIRT, 5, "/check base sigs for %s:%s\n", SHOW(name), SHOW(proto));
-    const auto sigs = base_sigs.find(name);
-    if (sigs == base_sigs.end()) return false;
-    return sigs->second.count(proto) > 0;
+  // is_base_intf_sig(sig, intf) - is the signature an interface in base
+  const auto is_base_intf_sig = [&](SigId sig, const DexType* intf) {
+    const auto& intfs_it = find_sig(base_intf_sig_map, sig);
+    if (intfs_it == base_intf_sig_map.end()) return false;
+    return intfs_it->second.count(intf) > 0;
   };
 
-  // is_base_intf_sig(name, proto) - is the (name, proto) an interface in base
-  const auto is_base_intf_sig =
-      [&](const DexString* name, const DexProto* proto, const DexType* intf) {
-        TRACE(VIRT,
-              5,
-              "/check base intf (%s) sigs for %s:%s\n",
-              SHOW(intf),
-              SHOW(name),
-              SHOW(proto));
-        const auto& sigs = base_intf_sig_map.find(name);
-        if (sigs == base_intf_sig_map.end()) return false;
-        const auto& intfs_it = sigs->second.find(proto);
-        if (intfs_it == sigs->second.end()) return false;
-        return intfs_it->second.count(intf) > 0;
-      };
-
-  // walk all derived signatures
-  for (const auto& derived_sig_entry : derived_sig_map) {
-    const auto name = derived_sig_entry.first;
-    auto& derived_protos_map = derived_sig_entry.second;
-    for (const auto& derived_scopes_it : derived_protos_map) {
-      const auto proto = derived_scopes_it.first;
-      // the signature in derived does not exists in base
-      if (!is_base_sig(name, proto)) {
-        TRACE(VIRT,
-              4,
-              "- no scope (%s:%s) in base, copy over\n",
-              SHOW(name),
-              SHOW(proto));
-        // not a known signature in original base, copy over
-        for (const auto& scope : derived_scopes_it.second) {
-          TRACE(VIRT,
-                4,
-                "- copy %s (%s:%s): (%ld) %s\n",
-                SHOW(scope.type),
-                SHOW(name),
-                SHOW(proto),
-                scope.methods.size(),
-                SHOW(scope.methods[0].first));
-          base_sig_map[name][proto].push_back(scope);
-        }
-        continue;
-      }
+  FlatSigMap merged;
+  merged.reserve(base_sig_map.size() + derived.size());
+  auto base_it = base_sig_map.begin();
+  for (auto derived_it = derived.begin(); derived_it != derived.end();) {
+    const auto sig = derived_it->first;
+    while (base_it != base_sig_map.end() && base_it->first < sig) {
+      merged.push_back(std::move(*base_it++));
+    }
 
-      // it's a sig (name, proto) in original base, the derived entry
-      // needs to merge
-      // first scope in base_sig_map must be that of the type under
-      // analysis because we built it first and added to the empty vector
-      always_assert(base_sig_map[name][proto].size() > 0);
+    // the signature in derived does not exists in base
+    if (base_it == base_sig_map.end() || base_it->first != sig) {
       TRACE(VIRT,
             4,
-            "- found existing scopes for %s:%s (%ld) - first: %s, %ld, %ld\n",
-            SHOW(name),
-            SHOW(proto),
-            base_sig_map[name][proto].size(),
-            SHOW(base_sig_map[name][proto][0].type),
-            base_sig_map[name][proto][0].methods.size(),
-            base_sig_map[name][proto][0].interfaces.size());
-      always_assert(
-          base_sig_map[name][proto][0].type == get_object_type() ||
-          !is_interface(type_class(base_sig_map[name][proto][0].type)));
+            "- no scope (%s:%s) in base, copy over\n",
+            SHOW(sig_ids.get(sig).first),
+            SHOW(sig_ids.get(sig).second));
+      // not a known signature in original base, move over
+      merged.emplace_back(sig, VirtualScopes());
+      auto& scopes = merged.back().second;
+      for (; derived_it != derived.end() && derived_it->first == sig;
+           derived_it++) {
+        for (auto& scope : *derived_it->second) {
+          scopes.push_back(std::move(scope));
+        }
+      }
+      continue;
+    }
+
+    // it's a sig (name, proto) in original base, the derived entries
+    // need to merge
+    // first scope in base_sig_map must be that of the type under
+    // analysis because we built it first and added to the empty vector
+    auto& scopes = base_it->second;
+    always_assert(scopes.size() > 0);
+    always_assert(scopes[0].type == get_object_type() ||
+                  !is_interface(type_class(scopes[0].type)));
+    for (; derived_it != derived.end() && derived_it->first == sig;
+         derived_it++) {
       // walk every scope in derived that we have to merge
-      TRACE(VIRT, 4, "-- walking scopes\n");
-      for (const auto& scope : derived_scopes_it.second) {
+      for (auto& scope : *derived_it->second) {
         // if the scope was for a class (!interface) we merge
         // with that of base which is now the top definition
-        TRACE(VIRT,
-              4,
-              "-- checking scope type %s(%ld)\n",
-              SHOW(scope.type),
-              scope.methods.size());
-        TRACE(VIRT,
-              4,
-              "-- is interface 0x%X %d\n",
-              scope.type,
-              scope.type != get_object_type() &&
-                  is_interface(type_class(scope.type)));
         if (scope.type == get_object_type() ||
             !is_interface(type_class(scope.type))) {
-          TRACE(VIRT,
-                4,
-                "-- merging with base scopes %s(%ld) : %s\n",
-                SHOW(base_sig_map[name][proto][0].type),
-                base_sig_map[name][proto][0].methods.size(),
-                SHOW(base_sig_map[name][proto][0].methods[0].first));
-          merge(base_sig_map[name][proto][0], scope);
+          merge(scopes[0], scope);
           continue;
         }
         // interface case. If derived was for an interface in base
         // do nothing because we will create those entries later
-        if (!is_base_intf_sig(name, proto, scope.type)) {
+        if (!is_base_intf_sig(sig, scope.type)) {
           TRACE(VIRT,
                 4,
                 "-- unimplemented interface %s:%s - %s, %s\n",
-                SHOW(name),
-                SHOW(proto),
+                SHOW(sig_ids.get(sig).first),
+                SHOW(sig_ids.get(sig).second),
                 SHOW(scope.type),
                 SHOW(scope.methods[0].first));
-          base_sig_map[name][proto].push_back(scope);
-          continue;
+          scopes.push_back(std::move(scope));
         }
-        TRACE(VIRT,
-              4,
-              "-- implemented interface %s:%s - %s\n",
-              SHOW(name),
-              SHOW(proto),
-              SHOW(scope.type));
       }
     }
+    merged.push_back(std::move(*base_it++));
+  }
+  while (base_it != base_sig_map.end()) {
+    merged.push_back(std::move(*base_it++));
   }
+  base_sig_map = std::move(merged);
 }
 
 //
@@ -476,24 +552,28 @@ DexMethod* make_miranda(const DexType* type,
   return static_cast<DexMethod*>(miranda);
 }
 
-bool load_interfaces_methods(const std::deque<DexType*>&, BaseIntfSigs&);
+using IntfMethods = std::vector<std::pair<SigId, const DexType*>>;
+
+bool load_interfaces_methods(const SignatureIds&,
+                             const std::deque<DexType*>&,
+                             IntfMethods&);
 
 /**
  * Load methods for a given interface and its super interfaces.
  * Return true if any interface escapes (no DexClass*).
  */
-bool load_interface_methods(const DexClass* intf_cls,
-                            BaseIntfSigs& intf_methods) {
+bool load_interface_methods(const SignatureIds& sig_ids,
+                            const DexClass* intf_cls,
+                            IntfMethods& intf_methods) {
   bool escaped = false;
   const auto& interfaces = intf_cls->get_interfaces()->get_type_list();
   if (interfaces.size() > 0) {
-    if (load_interfaces_methods(interfaces, intf_methods)) {
+    if (load_interfaces_methods(sig_ids, interfaces, intf_methods)) {
       escaped = true;
     }
   }
   for (const auto& meth : intf_cls->get_vmethods()) {
-    intf_methods[meth->get_name()][meth->get_proto()].insert(
-        intf_cls->get_type());
+    intf_methods.emplace_back(sig_ids.get(meth), intf_cls->get_type());
   }
   return escaped;
 }
@@ -502,8 +582,9 @@ bool load_interface_methods(const DexClass* intf_cls,
  * Load methods for a list of interfaces.
  * If any interface escapes (no DexClass*) return true.
  */
-bool load_interfaces_methods(const std::deque<DexType*>& interfaces,
-                             BaseIntfSigs& intf_methods) {
+bool load_interfaces_methods(const SignatureIds& sig_ids,
+                             const std::deque<DexType*>& interfaces,
+                             IntfMethods& intf_methods) {
   bool escaped = false;
   for (const auto& intf : interfaces) {
     auto intf_cls = type_class(intf);
@@ -512,7 +593,7 @@ bool load_interfaces_methods(const std::deque<DexType*>& interfaces,
       escaped = true;
       continue;
     }
-    if (load_interface_methods(intf_cls, intf_methods)) {
+    if (load_interface_methods(sig_ids, intf_cls, intf_methods)) {
       escaped = true;
     }
   }
@@ -522,8 +603,10 @@ bool load_interfaces_methods(const std::deque<DexType*>& interfaces,
 /**
  * Get all interface methods for a given type.
  */
-bool get_interface_methods(const DexType* type, BaseIntfSigs& intf_methods) {
-  always_assert_log(intf_methods.size() == 0, "intf_methods is an out param");
+bool get_interface_methods(const SignatureIds& sig_ids,
+                           const DexType* type,
+                           BaseIntfSigs& intf_sig_map) {
+  always_assert_log(intf_sig_map.size() == 0, "intf_sig_map is an out param");
   // REVIEW: should we always have a DexClass for java.lang.Object?
   if (type == get_object_type()) return false;
   auto cls = type_class(type);
@@ -532,14 +615,25 @@ bool get_interface_methods(const DexType* type, BaseIntfSigs& intf_methods) {
   bool escaped = false;
   const auto& interfaces = cls->get_interfaces()->get_type_list();
   if (interfaces.size() > 0) {
-    if (load_interfaces_methods(interfaces, intf_methods)) escaped = true;
+    IntfMethods intf_methods;
+    if (load_interfaces_methods(sig_ids, interfaces, intf_methods)) {
+      escaped = true;
+    }
+    std::sort(intf_methods.begin(), intf_methods.end());
+    for (const auto& intf_meth : intf_methods) {
+      if (intf_sig_map.empty() ||
+          intf_sig_map.back().first != intf_meth.first) {
+        intf_sig_map.emplace_back(intf_meth.first, TypeSet());
+      }
+      intf_sig_map.back().second.insert(intf_meth.second);
+    }
   }
   return escaped;
 }
 
 /**
- * Make sure all the intereface methods are added to the SignatureMap.
- * SignatureMap in input contains only scopes for virtual in the class.
+ * Make sure all the intereface methods are added to the FlatSigMap.
+ * FlatSigMap in input contains only scopes for virtual in the class.
  * After this step a type is fully specified with all its virtual methods
  * and all interface methods that did not have an implementation created
  * (as "pure miranda" methods).
@@ -548,42 +642,57 @@ bool get_interface_methods(const DexType* type, BaseIntfSigs& intf_methods) {
  * in this case we create an entry for A.m() and mark it miranda
  * even though the method did not exist. It will not be a def (!is_def()).
  */
-bool load_interfaces(const DexType* type,
-                     SignatureMap& sig_map,
+bool load_interfaces(const SignatureIds& sig_ids,
+                     const DexType* type,
+                     FlatSigMap& sig_map,
                      BaseIntfSigs& intf_sig_map) {
-  bool escaped = get_interface_methods(type, intf_sig_map);
+  bool escaped = get_interface_methods(sig_ids, type, intf_sig_map);
   const auto intf_flags = MIRANDA | IMPL;
   // sig_map contains only the virtual methods in the class and
   // intf_sig_map only the methods in the interface.
   // For any missing methods in the class we create a new (miranda) method.
   // If the method is there already we mark it miranda.
-  for (const auto& sig_it : intf_sig_map) {
-    for (const auto& proto_it : sig_it.second) {
-      const auto& name = sig_it.first;
-      const auto& proto = proto_it.first;
-      always_assert(sig_map[name][proto].size() <= 1);
-      if (sig_map[name][proto].size() == 0) {
-        // the method interface is not implemented in current
-        // type. The class is abstract or a definition up the
-        // hierarchy is present.
-        // Make a pure miranda entry
-        auto mir_meth = make_miranda(type, name, proto);
-        VirtualScope scope;
-        scope.type = type;
-        scope.methods.emplace_back(mir_meth, intf_flags);
-        sig_map[name][proto].push_back(scope);
-      } else {
-        // the method interface is implemented in the current
-        // type, mark it miranda
-        auto& scope = sig_map[name][proto][0];
-        always_assert(scope.methods.size() == 1);
-        scope.methods[0].second |= intf_flags;
-      }
+  FlatSigMap mirandas;
+  for (const auto& intfs_it : intf_sig_map) {
+    const auto sig = intfs_it.first;
+    auto scopes_it = find_sig(sig_map, sig);
+    if (scopes_it == sig_map.end()) {
+      // the method interface is not implemented in current
+      // type. The class is abstract or a definition up the
+      // hierarchy is present.
+      // Make a pure miranda entry
+      const auto& name_proto = sig_ids.get(sig);
+      auto mir_meth = make_miranda(type, name_proto.first, name_proto.second);
+      VirtualScope scope;
+      scope.type = type;
+      scope.methods.emplace_back(mir_meth, intf_flags);
       // add the implemented interfaces to the class
       // virtual scope
-      sig_map[name][proto][0].interfaces.insert(proto_it.second.begin(),
-                                                proto_it.second.end());
+      scope.interfaces = intfs_it.second;
+      mirandas.emplace_back(sig, VirtualScopes{std::move(scope)});
+    } else {
+      // the method interface is implemented in the current
+      // type, mark it miranda
+      always_assert(scopes_it->second.size() == 1);
+      auto& scope = scopes_it->second[0];
+      always_assert(scope.methods.size() == 1);
+      scope.methods[0].second |= intf_flags;
+      scope.interfaces.insert(intfs_it.second.begin(), intfs_it.second.end());
+    }
+  }
+  if (!mirandas.empty()) {
+    auto defs = sig_map.size();
+    for (auto& miranda : mirandas) {
+      sig_map.push_back(std::move(miranda));
     }
+    std::inplace_merge(
+        sig_map.begin(),
+        sig_map.begin() + defs,
+        sig_map.end(),
+        [](const std::pair<SigId, VirtualScopes>& a,
+           const std::pair<SigId, VirtualScopes>& b) {
+          return a.first < b.first;
+        });
   }
   return escaped;
 }
@@ -591,23 +700,39 @@ bool load_interfaces(const DexType* type,
 /**
  * Load all virtual methods in the given type and build an entry
  * in the signature map.
- * Those should be the only entries in the SignatureMap in input.
+ * Those should be the only entries in the FlatSigMap in input.
  * They are all TOP_DEF until a parent proves otherwise.
  */
-void load_methods(const DexType* type, SignatureMap& sig_map) {
+void load_methods(const SignatureIds& sig_ids,
+                  const DexType* type,
+                  FlatSigMap& sig_map) {
   auto const& vmethods = get_vmethods(type);
-  // add each virtual method to the SignatureMap
+  // add each virtual method to the FlatSigMap
   for (auto& vmeth : vmethods) {
-    auto& proto_map = sig_map[vmeth->get_name()];
-    auto& scopes = proto_map[vmeth->get_proto()];
-    always_assert(scopes.empty());
     VirtualScope scope;
     scope.type = type;
     scope.methods.emplace_back(vmeth, TOP_DEF);
-    scopes.emplace_back(scope);
+    sig_map.emplace_back(sig_ids.get(vmeth), VirtualScopes{std::move(scope)});
+  }
+  std::sort(sig_map.begin(),
+            sig_map.end(),
+            [](const std::pair<SigId, VirtualScopes>& a,
+               const std::pair<SigId, VirtualScopes>& b) {
+              return a.first < b.first;
+            });
+  for (size_t i = 1; i < sig_map.size(); i++) {
+    always_assert(sig_map[i - 1].first != sig_map[i].first);
   }
 }
 
+/**
+ * The signature map of a type and whether any method in it escapes.
+ */
+struct TypeSigMap {
+  FlatSigMap sig_map;
+  bool escape{false};
+};
+
 /**
  * Compute VirtualScopes and virtual method flags.
  * Starting from java.lang.Object recursively walk the type hierarchy down
@@ -645,36 +770,38 @@ void load_methods(const DexType* type, SignatureMap& sig_map) {
  * in this case, not knowing interface I, we mark all methods in A, B and C
  * ESCAPED but methods in D are not, so in this case they are just FINAL and
  * effectively D.k() would be non virtual as opposed to C.k() which is ESCAPED.
+ *
+ * The children sig maps, already computed, are moved out of :sig_maps and
+ * the one for type is stored in their place.
  */
-bool build_signature_map(const ClassHierarchy& hierarchy,
-                         const DexType* type,
-                         SignatureMap& sig_map) {
-  always_assert_log(sig_map.size() == 0,
-                    "intf_methods and children_methods are out params");
+void build_signature_map(
+    const ClassHierarchy& hierarchy,
+    const SignatureIds& sig_ids,
+    const DexType* type,
+    std::unordered_map<const DexType*, TypeSigMap>& sig_maps) {
   const TypeSet& children = hierarchy.at(type);
   TRACE(VIRT, 3, "* Visit %s\n", SHOW(type));
 
-  load_methods(type, sig_map);
+  FlatSigMap sig_map;
+  load_methods(sig_ids, type, sig_map);
   // will hold all the signature introduced by interfaces in type
   BaseIntfSigs intf_sig_map;
-  bool escape_down = load_interfaces(type, sig_map, intf_sig_map);
+  bool escape_down = load_interfaces(sig_ids, type, sig_map, intf_sig_map);
   BaseSigs base_sigs = load_base_sigs(sig_map);
   TRACE(VIRT, 3, "* Sig map computed for %s\n", SHOW(type));
 
-  // recurse through every child to collect all methods
-  // and interface methods under type
+  // collect all methods and interface methods under type
   bool escape_up = false;
+  std::vector<FlatSigMap> children_sig_maps;
+  children_sig_maps.reserve(children.size());
   for (const auto& child : children) {
-    SignatureMap child_sig_map;
-    escape_up =
-        build_signature_map(hierarchy, child, child_sig_map) || escape_up;
-    TRACE(VIRT,
-          3,
-          "* Merging sig map of %s with child %s\n",
-          SHOW(type),
-          SHOW(child));
-    merge(base_sigs, intf_sig_map, sig_map, child_sig_map);
+    auto& child_sig_map = sig_maps.at(child);
+    escape_up = child_sig_map.escape || escape_up;
+    children_sig_maps.push_back(std::move(child_sig_map.sig_map));
   }
+  TRACE(VIRT, 3, "* Merging sig map of %s with children\n", SHOW(type));
+  merge(sig_ids, intf_sig_map, sig_map, children_sig_maps);
+  children_sig_maps.clear();
 
   TRACE(VIRT, 3, "* Marking methods at %s\n", SHOW(type));
   mark_methods(type, sig_map, base_sigs, escape_up);
@@ -684,7 +811,9 @@ bool build_signature_map(const ClassHierarchy& hierarchy,
   }
 
   TRACE(VIRT, 3, "* Visited %s(%d, %d)\n", SHOW(type), escape_up, escape_down);
-  return escape_up | escape_down;
+  auto& type_sig_map = sig_maps.at(type);
+  type_sig_map.sig_map = std::move(sig_map);
+  type_sig_map.escape = escape_up | escape_down;
 }
 
 /**
@@ -788,8 +917,59 @@ void get_root_scopes(const SignatureMap& sig_map,
 } // namespace
 
 SignatureMap build_signature_map(const ClassHierarchy& class_hierarchy) {
+  // group the types by depth in the hierarchy, every level only depends
+  // on the one below it
+  const auto object = get_object_type();
+  std::vector<std::vector<const DexType*>> levels{{object}};
+  while (true) {
+    std::vector<const DexType*> next;
+    for (const auto& type : levels.back()) {
+      const auto& children = class_hierarchy.at(type);
+      next.insert(next.end(), children.begin(), children.end());
+    }
+    if (next.empty()) break;
+    levels.push_back(std::move(next));
+  }
+
+  // number all signatures upfront, this may create the Object class so
+  // it has to happen before going parallel
+  std::vector<Signature> sigs;
+  std::unordered_set<const DexType*> visited_intfs;
+  std::unordered_map<const DexType*, TypeSigMap> sig_maps;
+  for (const auto& level : levels) {
+    for (const auto& type : level) {
+      load_signatures(type, visited_intfs, sigs);
+      sig_maps[type];
+    }
+  }
+  const SignatureIds sig_ids(std::move(sigs));
+
+  // build the sig maps bottom up, the types in a level are independent
+  // of each other
+  for (auto level = levels.rbegin(); level != levels.rend(); level++) {
+    if (level->size() == 1) {
+      build_signature_map(class_hierarchy, sig_ids, level->front(), sig_maps);
+      continue;
+    }
+    auto wq = workqueue_foreach<const DexType*>(
+        [&](const DexType* type) {
+          build_signature_map(class_hierarchy, sig_ids, type, sig_maps);
+        },
+        walk::parallel::default_num_threads());
+    for (const auto& type : *level) {
+      wq.add_item(type);
+    }
+    wq.run_all();
+  }
+
+  // ids are in SignatureMap order, so entries are appended at the end
   SignatureMap signature_map;
-  build_signature_map(class_hierarchy, get_object_type(), signature_map);
+  for (auto& scopes_it : sig_maps.at(object).sig_map) {
+    const auto& sig = sig_ids.get(scopes_it.first);
+    auto& proto_map = signature_map[sig.first];
+    proto_map.emplace_hint(
+        proto_map.end(), sig.second, std::move(scopes_it.second));
+  }
   return signature_map;
 }
 
@@ -12,9 +12,11 @@
 #include <boost/filesystem.hpp>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <boost/regex.hpp>
 #include <sstream>
 #include <string>
@@ -34,6 +36,12 @@
 #include "CompatWindows.h"
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "androidfw/ResourceTypes.h"
 #include "utils/ByteOrder.h"
 #include "utils/Errors.h"
@@ -43,7 +51,9 @@
 #include "utils/Serialize.h"
 #include "utils/TypeHelpers.h"
 
+#include "RedexResources.h"
 #include "StringUtil.h"
+#include "WorkQueue.h"
 
 constexpr size_t MIN_CLASSNAME_LENGTH = 10;
 constexpr size_t MAX_CLASSNAME_LENGTH = 500;
@@ -111,72 +121,211 @@ std::string dotname_to_dexname(const std::string& classname) {
   return dexname;
 }
 
-void extract_by_pattern(
-    const std::string& string_to_search,
-    boost::regex regex,
-    std::unordered_set<std::string>& result) {
-  boost::smatch m;
-  std::string s = string_to_search;
-  while (boost::regex_search (s, m, regex)) {
-    if (m.size() > 1) {
-        result.insert(m[1].str());
+namespace {
+
+/*
+ * Read-only view of a file's contents through a private mapping, so that
+ * scanning a file doesn't first copy it into a string. An unreadable or empty
+ * file yields an empty view.
+ */
+class MappedFileView {
+ public:
+  explicit MappedFileView(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* p =
+          mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        m_data = p;
+        m_size = (size_t)st.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  MappedFileView(const MappedFileView&) = delete;
+  MappedFileView& operator=(const MappedFileView&) = delete;
+
+  ~MappedFileView() {
+    if (m_data != nullptr) {
+      munmap(m_data, m_size);
     }
-    s = m.suffix().str();
   }
+
+  const char* begin() const { return static_cast<const char*>(m_data); }
+  const char* end() const { return begin() + m_size; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+ private:
+  void* m_data{nullptr};
+  size_t m_size{0};
+};
+
+/*
+ * Maps each of `files` and runs `fn` on its contents across worker threads.
+ * Every file gets its own result slot, so callers can merge the results in
+ * the order the files were listed, independently of scheduling.
+ */
+template <typename Result>
+std::vector<Result> scan_files_in_parallel(
+    const std::vector<std::string>& files,
+    const std::function<void(
+        const std::string&, const MappedFileView&, Result&)>& fn) {
+  std::vector<Result> results(files.size());
+  if (files.empty()) {
+    return results;
+  }
+  auto num_threads = std::min<size_t>(
+      files.size(), std::max(1u, boost::thread::hardware_concurrency()));
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        MappedFileView contents(files[i]);
+        fn(files[i], contents, results[i]);
+      },
+      num_threads);
+  for (size_t i = 0; i < files.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  return results;
 }
 
-void extract_js_sounds(
-    const std::string& file_contents,
-    std::unordered_set<std::string>& result) {
-  static boost::regex sound_regex("\"([^\\\"]+)\\.(m4a|ogg)\"");
-  extract_by_pattern(file_contents, sound_regex, result);
+} // namespace
+
+namespace {
+
+bool is_js_word_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
 }
 
-void extract_js_uris(
-    const std::string& file_contents,
-    std::unordered_set<std::string>& result) {
-  static boost::regex uri_regex("\\buri:\\s*\"([^\\\"]+)\"");
-  extract_by_pattern(file_contents, uri_regex, result);
+bool is_js_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+bool has_literal(const char* p, const char* end, const char* literal) {
+  size_t len = strlen(literal);
+  return (size_t)(end - p) >= len && memcmp(p, literal, len) == 0;
 }
 
-void extract_js_asset_registrations(
-    const std::string& file_contents,
+const char* find_char(const char* p, const char* end, char c) {
+  if (p >= end) {
+    return end;
+  }
+  auto found = static_cast<const char*>(memchr(p, c, end - p));
+  return found == nullptr ? end : found;
+}
+
+void extract_js_asset_registration(
+    const std::string& registration,
     std::unordered_set<std::string>& result) {
-  static boost::regex register_regex("registerAsset\\((.+?)\\)");
   static boost::regex name_regex("name:\\\"(.+?)\\\"");
   static boost::regex location_regex("httpServerLocation:\\\"/assets/(.+?)\\\"");
   static boost::regex special_char_regex("[^a-z0-9_]");
-  std::unordered_set<std::string> registrations;
-  extract_by_pattern(file_contents, register_regex, registrations);
-  for (std::string registration : registrations) {
-    boost::smatch m;
-    if (!boost::regex_search (registration, m, location_regex) || m.size() == 0) {
-      continue;
-    }
-    std::ostringstream asset_path;
-    asset_path << m[1].str() << '/'; // location
-    if (!boost::regex_search (registration, m, name_regex) || m.size() == 0) {
-      continue;
-    }
-    asset_path << m[1].str(); // name
-    std::string full_path = asset_path.str();
-    boost::replace_all(full_path, "/", "_");;
-    boost::algorithm::to_lower(full_path);
+  boost::smatch m;
+  if (!boost::regex_search (registration, m, location_regex) || m.size() == 0) {
+    return;
+  }
+  std::ostringstream asset_path;
+  asset_path << m[1].str() << '/'; // location
+  if (!boost::regex_search (registration, m, name_regex) || m.size() == 0) {
+    return;
+  }
+  asset_path << m[1].str(); // name
+  std::string full_path = asset_path.str();
+  boost::replace_all(full_path, "/", "_");;
+  boost::algorithm::to_lower(full_path);
 
-    std::ostringstream stripped_asset_path;
-    std::ostream_iterator<char, char> oi(stripped_asset_path);
-    boost::regex_replace(oi, full_path.begin(), full_path.end(),
-      special_char_regex, "", boost::match_default | boost::format_all);
+  std::ostringstream stripped_asset_path;
+  std::ostream_iterator<char, char> oi(stripped_asset_path);
+  boost::regex_replace(oi, full_path.begin(), full_path.end(),
+    special_char_regex, "", boost::match_default | boost::format_all);
 
-    result.emplace(stripped_asset_path.str());
-  }
+  result.emplace(stripped_asset_path.str());
 }
 
-std::unordered_set<std::string> extract_js_resources(const std::string& file_contents) {
+} // namespace
+
+/*
+ * Extracts the resource names referenced from a JS bundle, in a single pass
+ * over its contents. There are three kinds of references, each recognized
+ * exactly as the regex noted next to it would find them:
+ *
+ *   "path/to/sound.m4a" (or .ogg)    "([^"]+)\.(m4a|ogg)"
+ *   uri: "name"                      \buri:\s*"([^"]+)"
+ *   registerAsset({...})             registerAsset\((.+?)\)
+ *
+ * Only the three trigger characters '"', 'u' and 'r' are looked at more
+ * closely. Like successive regex matches, a match of one kind can't overlap
+ * an earlier match of the same kind. Registrations, which are short, are then
+ * parsed for their location and name.
+ */
+std::unordered_set<std::string> extract_js_resources(
+    const char* begin,
+    const char* end) {
   std::unordered_set<std::string> result;
-  extract_js_sounds(file_contents, result);
-  extract_js_uris(file_contents, result);
-  extract_js_asset_registrations(file_contents, result);
+  std::unordered_set<std::string> registrations;
+  // The quote that would open a sound path. A quote that closes one can't
+  // open the next.
+  const char* open_quote = nullptr;
+  const char* uri_resume = begin;
+  const char* registration_resume = begin;
+  for (const char* p = begin; p < end; ++p) {
+    switch (*p) {
+    case '"': {
+      size_t len = open_quote == nullptr ? 0 : p - open_quote - 1;
+      if (len > 4 && (memcmp(p - 4, ".m4a", 4) == 0 ||
+                      memcmp(p - 4, ".ogg", 4) == 0)) {
+        result.emplace(open_quote + 1, len - 4);
+        open_quote = nullptr;
+      } else {
+        open_quote = p;
+      }
+      break;
+    }
+    case 'u': {
+      if (p < uri_resume || (p > begin && is_js_word_char(p[-1])) ||
+          !has_literal(p, end, "uri:")) {
+        break;
+      }
+      const char* q = p + 4;
+      while (q < end && is_js_space(*q)) {
+        ++q;
+      }
+      if (q == end || *q != '"') {
+        break;
+      }
+      const char* close = find_char(q + 1, end, '"');
+      if (close != end && close > q + 1) {
+        result.emplace(q + 1, close - q - 1);
+        uri_resume = close + 1;
+      }
+      break;
+    }
+    case 'r': {
+      if (p < registration_resume ||
+          !has_literal(p, end, "registerAsset(")) {
+        break;
+      }
+      const char* args = p + strlen("registerAsset(");
+      // At least one character, up to the first ')'.
+      const char* close = find_char(args + 1, end, ')');
+      if (close != end) {
+        registrations.emplace(args, close - args);
+        registration_resume = close + 1;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  for (const auto& registration : registrations) {
+    extract_js_asset_registration(registration, result);
+  }
   return result;
 }
 
@@ -352,13 +501,14 @@ std::string read_attribute_name_at_idx(
 }
 
 void extract_classes_from_layout(
-    const std::string& layout_contents,
+    const char* data,
+    size_t size,
     const std::unordered_set<std::string>& attributes_to_read,
     std::unordered_set<std::string>& out_classes,
     std::unordered_multimap<std::string, std::string>& out_attributes) {
 
   android::ResXMLTree parser;
-  parser.setTo(layout_contents.data(), layout_contents.size());
+  parser.setTo(data, size);
 
   android::String16 name("name");
   android::String16 klazz("class");
@@ -419,66 +569,353 @@ void extract_classes_from_layout(
            type != android::ResXMLParser::END_DOCUMENT);
 }
 
+namespace {
+
 /*
- * Returns all strings that look like java class names from a native library.
- *
- * Return values will be formatted the way that the dex spec formats class names:
- *
- *   "Ljava/lang/String;"
- *
+ * Identifier characters of a class name in a native library, [a-zA-Z0-9/_$],
+ * and the characters a class name can start with, [a-zL]. All classnames
+ * start with a package, which starts with a lowercase letter. Some of them
+ * are preceded by an 'L' and followed by a ';' in native libraries while
+ * others are not.
  */
-std::unordered_set<std::string> extract_classes_from_native_lib(const std::string& lib_contents) {
-  std::unordered_set<std::string> classes;
-  char buffer[MAX_CLASSNAME_LENGTH + 2]; // +2 for the trailing ";\0"
-  const char* inptr = lib_contents.data();
-  char* outptr = buffer;
-  const char* end = inptr + lib_contents.size();
-
-  size_t length = 0;
-
-  while (inptr < end) {
-    outptr = buffer;
-    length = 0;
-    // All classnames start with a package, which starts with a lowercase
-    // letter. Some of them are preceded by an 'L' and followed by a ';' in
-    // native libraries while others are not.
-    if ((*inptr >= 'a' && *inptr <= 'z') || *inptr == 'L') {
-
-      if (*inptr != 'L') {
-        *outptr++ = 'L';
-        length++;
+struct CharClassTable {
+  bool is_ident[256];
+  bool is_start[256];
+  CharClassTable() {
+    for (int c = 0; c < 256; ++c) {
+      is_ident[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                    (c >= '0' && c <= '9') || c == '/' || c == '_' ||
+                    c == '$';
+      is_start[c] = (c >= 'a' && c <= 'z') || c == 'L';
+    }
+  }
+  bool ident(char c) const { return is_ident[(uint8_t)c]; }
+  bool start(char c) const { return is_start[(uint8_t)c]; }
+};
+
+const CharClassTable s_char_classes;
+
+// A start character only yields a class name if it begins a run of at least
+// this many identifier characters.
+constexpr size_t kMinNameRun = MIN_CLASSNAME_LENGTH - 1;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+/*
+ * Classifies 64 bytes at once into bitmasks with bit i set iff p[i] is an
+ * identifier character, respectively a start character. Letters are matched
+ * case-insensitively by OR-ing in 0x20; '/' sits right before '0', so [/-9]
+ * covers digits and '/'. Unsigned range checks are signed compares after
+ * biasing `lo` to -128.
+ */
+#if defined(__AVX2__)
+constexpr size_t kVectorSize = 32;
+
+inline __m256i bytes_in_range(__m256i v, char lo, char hi) {
+  __m256i biased = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - lo)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + (hi - lo) + 1)),
+                           biased);
+}
+
+inline void classify_vector(const char* p, uint32_t& ident, uint32_t& start) {
+  __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  __m256i lower = bytes_in_range(v, 'a', 'z');
+  __m256i m = _mm256_or_si256(
+      bytes_in_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'),
+      bytes_in_range(v, '/', '9'));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+  ident = (uint32_t)_mm256_movemask_epi8(m);
+  start = (uint32_t)_mm256_movemask_epi8(
+      _mm256_or_si256(lower, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('L'))));
+}
+#else
+constexpr size_t kVectorSize = 16;
+
+inline __m128i bytes_in_range(__m128i v, char lo, char hi) {
+  __m128i biased = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - lo)));
+  return _mm_cmplt_epi8(biased,
+                        _mm_set1_epi8((char)(0x80 + (hi - lo) + 1)));
+}
+
+inline void classify_vector(const char* p, uint32_t& ident, uint32_t& start) {
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i lower = bytes_in_range(v, 'a', 'z');
+  __m128i m = _mm_or_si128(
+      bytes_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'),
+      bytes_in_range(v, '/', '9'));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+  ident = (uint32_t)_mm_movemask_epi8(m);
+  start = (uint32_t)_mm_movemask_epi8(
+      _mm_or_si128(lower, _mm_cmpeq_epi8(v, _mm_set1_epi8('L'))));
+}
+#endif
+
+inline void classify_block(const char* p, uint64_t& ident, uint64_t& start) {
+  ident = 0;
+  start = 0;
+  for (size_t i = 0; i < 64; i += kVectorSize) {
+    uint32_t vector_ident;
+    uint32_t vector_start;
+    classify_vector(p + i, vector_ident, vector_start);
+    ident |= (uint64_t)vector_ident << i;
+    start |= (uint64_t)vector_start << i;
+  }
+}
+
+#endif // __AVX2__ || __SSE2__
+
+/*
+ * Returns the first position in [p, end) holding a start character that is
+ * followed by at least kMinNameRun - 1 more identifier characters, or `end`.
+ * Any earlier start character in the same run would itself qualify, so this
+ * is always the first start character of its run (counting from p).
+ */
+const char* find_name_start(const char* p, const char* end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  // Each block also looks at the bits of the one after it, for runs that
+  // cross into it.
+  if ((size_t)(end - p) >= 128) {
+    uint64_t ident, start, next_ident, next_start;
+    classify_block(p, ident, start);
+    while ((size_t)(end - p) >= 128) {
+      classify_block(p + 64, next_ident, next_start);
+      uint64_t long_run = ident;
+      for (size_t k = 1; k < kMinNameRun; ++k) {
+        long_run &= (ident >> k) | (next_ident << (64 - k));
       }
+      uint64_t candidates = start & long_run;
+      if (candidates != 0) {
+        return p + __builtin_ctzll(candidates);
+      }
+      p += 64;
+      ident = next_ident;
+      start = next_start;
+    }
+  }
+#endif
+  for (; (size_t)(end - p) >= kMinNameRun; ++p) {
+    if (!s_char_classes.start(*p)) {
+      continue;
+    }
+    size_t k = 1;
+    while (k < kMinNameRun && s_char_classes.ident(p[k])) {
+      ++k;
+    }
+    if (k == kMinNameRun) {
+      return p;
+    }
+  }
+  return end;
+}
+
+/*
+ * Returns the first position in [p, end) that doesn't hold an identifier
+ * character, or `end`.
+ */
+const char* find_run_end(const char* p, const char* end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  while ((size_t)(end - p) >= kVectorSize) {
+    uint32_t ident, start;
+    classify_vector(p, ident, start);
+    uint32_t non_ident = ~ident & (uint32_t)((1ull << kVectorSize) - 1);
+    if (non_ident != 0) {
+      return p + __builtin_ctz(non_ident);
+    }
+    p += kVectorSize;
+  }
+#endif
+  while (p < end && s_char_classes.ident(*p)) {
+    ++p;
+  }
+  return p;
+}
 
-      while (( // This loop is safe since lib_contents.data() ends with a \0
-                 (*inptr >= 'a' && *inptr <= 'z') ||
-                 (*inptr >= 'A' && *inptr <= 'Z') ||
-                 (*inptr >= '0' && *inptr <= '9') ||
-                 *inptr == '/' || *inptr == '_' || *inptr == '$')
-             && length < MAX_CLASSNAME_LENGTH) {
+/*
+ * A class name candidate as a view into the library's bytes, without the
+ * leading 'L': "com/foo/Bar" and "Lcom/foo/Bar" name the same class, and
+ * compare equal here. Lets us dedupe before allocating any strings. The hash
+ * is computed once, when the span is found, and reused when merging chunks.
+ */
+struct NameSpan {
+  const char* data{nullptr};
+  size_t size{0};
+  size_t hash{0};
+
+  NameSpan() = default;
+  NameSpan(const char* data, size_t size)
+      : data(data), size(size), hash(hash_bytes(data, size)) {}
+
+  bool operator==(const NameSpan& that) const {
+    return hash == that.hash && size == that.size &&
+           memcmp(data, that.data, size) == 0;
+  }
 
-        *outptr++ = *inptr++;
-        length++;
+  // Eight bytes at a time, multiply-xorshift mixed.
+  static size_t hash_bytes(const char* p, size_t size) {
+    const uint64_t kMul = 0x9ddfea08eb382d69ull;
+    uint64_t hash = size * kMul;
+    uint64_t word;
+    for (; size >= 8; p += 8, size -= 8) {
+      memcpy(&word, p, 8);
+      hash = (hash ^ word) * kMul;
+      hash ^= hash >> 47;
+    }
+    word = 0;
+    memcpy(&word, p, size);
+    hash = (hash ^ word) * kMul;
+    hash ^= hash >> 47;
+    return (size_t)(hash * kMul);
+  }
+};
+
+/*
+ * Open-addressing set of NameSpans. Candidates repeat a lot (every JNI
+ * signature mentioning a class names it again), so almost all inserts are
+ * lookups that hit; keeping the slots in one array makes those a single
+ * cache miss rather than a walk over bucket nodes.
+ */
+class NameSpanSet {
+ public:
+  NameSpanSet() : m_slots(kInitialCapacity) {}
+
+  void insert(const NameSpan& span) {
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = span.hash & mask;; i = (i + 1) & mask) {
+      auto& slot = m_slots[i];
+      if (slot.data == nullptr) {
+        slot = span;
+        if (++m_size * 2 > m_slots.size()) {
+          grow();
+        }
+        return;
       }
-      if (length >= MIN_CLASSNAME_LENGTH) {
-        *outptr++ = ';';
-        *outptr = '\0';
-        classes.insert(std::string(buffer));
+      if (slot == span) {
+        return;
       }
     }
-    inptr++;
   }
+
+  void insert(const NameSpanSet& that) {
+    that.for_each([this](const NameSpan& span) { insert(span); });
+  }
+
+  size_t size() const { return m_size; }
+
+  template <typename Fn>
+  void for_each(const Fn& fn) const {
+    for (const auto& slot : m_slots) {
+      if (slot.data != nullptr) {
+        fn(slot);
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t kInitialCapacity = 1024;
+
+  void grow() {
+    std::vector<NameSpan> old_slots(m_slots.size() * 2);
+    old_slots.swap(m_slots);
+    m_size = 0;
+    for (const auto& slot : old_slots) {
+      if (slot.data != nullptr) {
+        insert(slot);
+      }
+    }
+  }
+
+  std::vector<NameSpan> m_slots;
+  size_t m_size{0};
+};
+
+/*
+ * Collects the class name candidates in [begin, end). The scanner state resets
+ * at every non-identifier byte, so any range that ends on one (or at the end
+ * of the file) can be scanned independently of its neighbours.
+ */
+void scan_native_class_names(const char* begin,
+                             const char* end,
+                             NameSpanSet& out) {
+  const char* p = begin;
+  while (p < end) {
+    const char* q = find_name_start(p, end);
+    if (q == end) {
+      break;
+    }
+    const char* run_end = find_run_end(q + kMinNameRun, end);
+    // A lowercase start gets an 'L' prepended, which counts towards the
+    // length limit.
+    size_t prefix = *q == 'L' ? 0 : 1;
+    size_t len =
+        std::min((size_t)(run_end - q), MAX_CLASSNAME_LENGTH - prefix);
+    if (len + prefix >= MIN_CLASSNAME_LENGTH) {
+      out.insert(NameSpan(q + 1 - prefix, len - 1 + prefix));
+    }
+    // A name cut off at the length limit resumes after skipping one more
+    // character.
+    p = q + len == run_end ? run_end : q + len + 1;
+  }
+}
+
+std::unordered_set<std::string> to_class_names(const NameSpanSet& spans) {
+  std::unordered_set<std::string> classes;
+  classes.reserve(spans.size());
+  spans.for_each([&classes](const NameSpan& span) {
+    std::string name;
+    name.reserve(span.size + 2);
+    name += 'L';
+    name.append(span.data, span.size);
+    name += ';';
+    classes.emplace(std::move(name));
+  });
   return classes;
 }
 
+// Large libraries are split into chunks of about this size, cut at
+// non-identifier bytes, and scanned in parallel.
+constexpr size_t kNativeLibChunkSize = 1 << 20;
+
+} // namespace
+
+/*
+ * Returns all strings that look like java class names from a native library.
+ *
+ * Return values will be formatted the way that the dex spec formats class names:
+ *
+ *   "Ljava/lang/String;"
+ *
+ */
+std::unordered_set<std::string> extract_classes_from_native_lib(
+    const char* begin,
+    const char* end) {
+  NameSpanSet spans;
+  scan_native_class_names(begin, end, spans);
+  return to_class_names(spans);
+}
+
+std::unordered_set<std::string> extract_classes_from_native_lib(
+    const std::string& lib_contents) {
+  return extract_classes_from_native_lib(
+      lib_contents.data(), lib_contents.data() + lib_contents.size());
+}
+
 /*
  * Reads an entire file into a std::string. Returns an empty string if
  * anything went wrong (e.g. file not found).
  */
 std::string read_entire_file(const std::string& filename) {
-  std::ifstream in(filename, std::ios::in | std::ios::binary);
-  std::ostringstream sstr;
-  sstr << in.rdbuf();
-  return sstr.str();
+  std::ifstream in(filename, std::ios::in | std::ios::binary | std::ios::ate);
+  std::string contents;
+  auto size = in ? (std::streamoff)in.tellg() : 0;
+  if (size > 0) {
+    contents.resize((size_t)size);
+    in.seekg(0);
+    in.read(&contents[0], size);
+    contents.resize((size_t)in.gcount());
+  }
+  return contents;
 }
 
 void write_entire_file(
@@ -506,22 +943,15 @@ std::unordered_set<std::string> get_files_by_suffix(
   path_t dir(directory);
 
   if (exists(dir) && is_directory(dir)) {
-    for (auto it = dir_iterator(dir); it != dir_iterator(); ++it) {
-      auto const& entry = *it;
-      path_t entry_path = entry.path();
-
+    // A single walk of the whole tree; like the old per-directory recursion,
+    // this descends into symlinked directories.
+    auto options = boost::filesystem::symlink_option::recurse;
+    for (auto it = rdir_iterator(dir, options); it != rdir_iterator(); ++it) {
+      path_t entry_path = it->path();
       if (is_regular_file(entry_path) &&
           ends_with(entry_path.string().c_str(), suffix.c_str())) {
         files.emplace(entry_path.string());
       }
-
-      if (is_directory(entry_path)) {
-        std::unordered_set<std::string> sub_files = get_files_by_suffix(
-          entry_path.string(),
-          suffix);
-
-        files.insert(sub_files.begin(), sub_files.end());
-      }
     }
   }
   return files;
@@ -535,19 +965,6 @@ std::unordered_set<std::string> get_js_files(const std::string& directory) {
   return get_files_by_suffix(directory, ".js");
 }
 
-std::unordered_set<std::string> get_candidate_js_resources(
-    const std::string& filename) {
-  std::string file_contents = read_entire_file(filename);
-  std::unordered_set<std::string> js_candidate_resources;
-  if (file_contents.size()) {
-    js_candidate_resources = extract_js_resources(file_contents);
-  } else {
-    fprintf(stderr, "Unable to read file: %s\n", filename.data());
-  }
-  return js_candidate_resources;
-}
-
-
 // Parses the content of all .js files and extracts all resources referenced.
 std::unordered_set<uint32_t> get_js_resources_by_parsing(
     const std::string& directory,
@@ -555,8 +972,21 @@ std::unordered_set<uint32_t> get_js_resources_by_parsing(
   std::unordered_set<std::string> js_candidate_resources;
   std::unordered_set<uint32_t> js_resources;
 
-  for (auto& f : get_js_files(directory)) {
-    auto c = get_candidate_js_resources(f);
+  auto js_files = get_js_files(directory);
+  std::vector<std::string> files(js_files.begin(), js_files.end());
+  std::sort(files.begin(), files.end());
+  auto per_file = scan_files_in_parallel<std::unordered_set<std::string>>(
+      files,
+      [](const std::string& filename,
+         const MappedFileView& contents,
+         std::unordered_set<std::string>& out) {
+        if (contents.empty()) {
+          fprintf(stderr, "Unable to read file: %s\n", filename.data());
+          return;
+        }
+        out = extract_js_resources(contents.begin(), contents.end());
+      });
+  for (auto& c : per_file) {
     js_candidate_resources.insert(c.begin(), c.end());
   }
 
@@ -647,53 +1077,110 @@ bool is_drawable_attribute(
   return false;
 }
 
-int inline_xml_reference_attributes(
-    const std::string& filename,
+namespace {
+
+// Inlines the value of attribute `i` if it references one of the given ids.
+bool inline_attribute(
+    android::ResXMLTree& parser,
+    size_t i,
     const std::map<uint32_t, android::Res_value>& id_to_inline_value) {
-  int num_values_inlined = 0;
-  std::string file_contents = read_entire_file(filename);
-  ensure_file_contents(file_contents, filename);
-  bool made_change = false;
+  // Older versions of Android (below V5) do not allow inlining into
+  // android:drawable attributes.
+  if (is_drawable_attribute(parser, i)) {
+    return false;
+  }
+  if (parser.getAttributeDataType(i) == android::Res_value::TYPE_REFERENCE) {
+    android::Res_value outValue;
+    parser.getAttributeValue(i, &outValue);
+    if (outValue.data <= PACKAGE_RESID_START) {
+      return false;
+    }
+    auto p = id_to_inline_value.find(outValue.data);
+    if (p != id_to_inline_value.end()) {
+      android::Res_value new_value = p->second;
+      parser.setAttribute(i, new_value);
+      return true;
+    }
+  }
+  return false;
+}
 
-  android::ResXMLTree parser;
-  parser.setTo(file_contents.data(), file_contents.size());
-  if (parser.getError() != android::NO_ERROR) {
-    throw std::runtime_error("Unable to read file: " + filename);
+// Remaps attribute `i` if it is a reference to one of the given ids.
+bool remap_attribute(
+    android::ResXMLTree& parser,
+    size_t i,
+    const std::map<uint32_t, uint32_t>& kept_to_remapped_ids) {
+  if (parser.getAttributeDataType(i) == android::Res_value::TYPE_REFERENCE ||
+      parser.getAttributeDataType(i) == android::Res_value::TYPE_ATTRIBUTE) {
+    android::Res_value outValue;
+    parser.getAttributeValue(i, &outValue);
+    if (outValue.data > PACKAGE_RESID_START &&
+        kept_to_remapped_ids.count(outValue.data)) {
+      uint32_t new_value = kept_to_remapped_ids.at(outValue.data);
+      if (new_value != outValue.data) {
+        parser.setAttributeData(i, new_value);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Updates the embedded resource ID array.
+size_t remap_resource_ids(
+    android::ResXMLTree& parser,
+    const std::map<uint32_t, uint32_t>& kept_to_remapped_ids) {
+  size_t num_remapped = 0;
+  size_t resIdCount = 0;
+  uint32_t* resourceIds = parser.getResourceIds(&resIdCount);
+  for (size_t i = 0; i < resIdCount; ++i) {
+    auto id_search = kept_to_remapped_ids.find(resourceIds[i]);
+    if (id_search != kept_to_remapped_ids.end()) {
+      resourceIds[i] = id_search->second;
+      ++num_remapped;
+    }
   }
+  return num_remapped;
+}
 
+// Calls `fn(parser, i)` on every attribute of every tag.
+template <typename Fn>
+void for_each_attribute(android::ResXMLTree& parser, const Fn& fn) {
   android::ResXMLParser::event_code_t type;
   do {
     type = parser.next();
     if (type == android::ResXMLParser::START_TAG) {
       const size_t attr_count = parser.getAttributeCount();
       for (size_t i = 0; i < attr_count; ++i) {
-        // Older versions of Android (below V5) do not allow inlining into
-        // android:drawable attributes.
-        if (is_drawable_attribute(parser, i)) {
-          continue;
-        }
-
-        if (parser.getAttributeDataType(i) == android::Res_value::TYPE_REFERENCE) {
-          android::Res_value outValue;
-          parser.getAttributeValue(i, &outValue);
-          if (outValue.data <= PACKAGE_RESID_START) {
-            continue;
-          }
-
-          auto p = id_to_inline_value.find(outValue.data);
-          if (p != id_to_inline_value.end()) {
-            android::Res_value new_value = p->second;
-            parser.setAttribute(i, new_value);
-            ++num_values_inlined;
-            made_change = true;
-          }
-        }
+        fn(parser, i);
       }
     }
   } while (type != android::ResXMLParser::BAD_DOCUMENT &&
            type != android::ResXMLParser::END_DOCUMENT);
+}
 
-  if (made_change) {
+} // namespace
+
+int inline_xml_reference_attributes(
+    const std::string& filename,
+    const std::map<uint32_t, android::Res_value>& id_to_inline_value) {
+  int num_values_inlined = 0;
+  std::string file_contents = read_entire_file(filename);
+  ensure_file_contents(file_contents, filename);
+
+  android::ResXMLTree parser;
+  parser.setTo(file_contents.data(), file_contents.size());
+  if (parser.getError() != android::NO_ERROR) {
+    throw std::runtime_error("Unable to read file: " + filename);
+  }
+
+  for_each_attribute(parser, [&](android::ResXMLTree& parser, size_t i) {
+    if (inline_attribute(parser, i, id_to_inline_value)) {
+      ++num_values_inlined;
+    }
+  });
+
+  if (num_values_inlined > 0) {
     write_entire_file(filename, file_contents);
   }
 
@@ -708,7 +1195,6 @@ void remap_xml_reference_attributes(
   }
   std::string file_contents = read_entire_file(filename);
   ensure_file_contents(file_contents, filename);
-  bool made_change = false;
 
   android::ResXMLTree parser;
   parser.setTo(file_contents.data(), file_contents.size());
@@ -716,40 +1202,10 @@ void remap_xml_reference_attributes(
     throw std::runtime_error("Unable to read file: " + filename);
   }
 
-  // Update embedded resource ID array
-  size_t resIdCount = 0;
-  uint32_t* resourceIds = parser.getResourceIds(&resIdCount);
-  for (size_t i = 0; i < resIdCount; ++i) {
-    auto id_search = kept_to_remapped_ids.find(resourceIds[i]);
-    if (id_search != kept_to_remapped_ids.end()) {
-      resourceIds[i] = id_search->second;
-      made_change = true;
-    }
-  }
-
-  android::ResXMLParser::event_code_t type;
-  do {
-    type = parser.next();
-    if (type == android::ResXMLParser::START_TAG) {
-      const size_t attr_count = parser.getAttributeCount();
-      for (size_t i = 0; i < attr_count; ++i) {
-        if (parser.getAttributeDataType(i) == android::Res_value::TYPE_REFERENCE ||
-            parser.getAttributeDataType(i) == android::Res_value::TYPE_ATTRIBUTE) {
-          android::Res_value outValue;
-          parser.getAttributeValue(i, &outValue);
-          if (outValue.data > PACKAGE_RESID_START &&
-              kept_to_remapped_ids.count(outValue.data)) {
-            uint32_t new_value = kept_to_remapped_ids.at(outValue.data);
-            if (new_value != outValue.data) {
-              parser.setAttributeData(i, new_value);
-              made_change = true;
-            }
-          }
-        }
-      }
-    }
-  } while (type != android::ResXMLParser::BAD_DOCUMENT &&
-           type != android::ResXMLParser::END_DOCUMENT);
+  bool made_change = remap_resource_ids(parser, kept_to_remapped_ids) > 0;
+  for_each_attribute(parser, [&](android::ResXMLTree& parser, size_t i) {
+    made_change |= remap_attribute(parser, i, kept_to_remapped_ids);
+  });
 
   if (made_change) {
     write_entire_file(filename, file_contents);
@@ -788,26 +1244,44 @@ void collect_layout_classes_and_attributes_for_file(
     const std::unordered_set<std::string>& attributes_to_read,
     std::unordered_set<std::string>& out_classes,
     std::unordered_multimap<std::string, std::string>& out_attributes) {
-  std::string contents = read_entire_file(file_path);
+  MappedFileView contents(file_path);
   extract_classes_from_layout(
-    contents,
+    contents.begin(),
+    contents.size(),
     attributes_to_read,
     out_classes,
     out_attributes);
 }
 
+namespace {
+
+struct LayoutScanResult {
+  std::unordered_set<std::string> classes;
+  std::unordered_multimap<std::string, std::string> attributes;
+};
+
+} // namespace
+
 void collect_layout_classes_and_attributes(
     const std::string& apk_directory,
     const std::unordered_set<std::string>& attributes_to_read,
     std::unordered_set<std::string>& out_classes,
     std::unordered_multimap<std::string, std::string>& out_attributes) {
   std::vector<std::string> files = find_layout_files(apk_directory);
-  for (auto layout_file : files) {
-    collect_layout_classes_and_attributes_for_file(
-      layout_file,
-      attributes_to_read,
-      out_classes,
-      out_attributes);
+  auto per_file = scan_files_in_parallel<LayoutScanResult>(
+      files,
+      [&attributes_to_read](const std::string&,
+                            const MappedFileView& contents,
+                            LayoutScanResult& out) {
+        extract_classes_from_layout(contents.begin(),
+                                    contents.size(),
+                                    attributes_to_read,
+                                    out.classes,
+                                    out.attributes);
+      });
+  for (auto& result : per_file) {
+    out_classes.insert(result.classes.begin(), result.classes.end());
+    out_attributes.insert(result.attributes.begin(), result.attributes.end());
   }
 }
 
@@ -864,13 +1338,42 @@ std::vector<std::string> find_native_library_files(const std::string& apk_direct
  */
 std::unordered_set<std::string> get_native_classes(const std::string& apk_directory) {
   std::vector<std::string> native_libs = find_native_library_files(apk_directory);
-  std::unordered_set<std::string> all_classes;
-  for (auto native_lib : native_libs) {
-    std::string contents = read_entire_file(native_lib);
-    std::unordered_set<std::string> classes_from_layout = extract_classes_from_native_lib(contents);
-    all_classes.insert(classes_from_layout.begin(), classes_from_layout.end());
+  std::vector<std::unique_ptr<MappedFileView>> views;
+  std::vector<std::pair<const char*, const char*>> chunks;
+  for (const auto& native_lib : native_libs) {
+    views.emplace_back(std::make_unique<MappedFileView>(native_lib));
+    const char* end = views.back()->end();
+    const char* p = views.back()->begin();
+    while (p < end) {
+      const char* chunk_end = find_run_end(
+          p + std::min(kNativeLibChunkSize, (size_t)(end - p)), end);
+      chunks.emplace_back(p, chunk_end);
+      p = chunk_end;
+    }
+  }
+  if (chunks.empty()) {
+    return std::unordered_set<std::string>();
   }
-  return all_classes;
+
+  std::vector<NameSpanSet> per_chunk(chunks.size());
+  auto num_threads = std::min<size_t>(
+      chunks.size(), std::max(1u, boost::thread::hardware_concurrency()));
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        scan_native_class_names(
+            chunks[i].first, chunks[i].second, per_chunk[i]);
+      },
+      num_threads);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  NameSpanSet all_spans;
+  for (const auto& spans : per_chunk) {
+    all_spans.insert(spans);
+  }
+  return to_class_names(all_spans);
 }
 
 void* map_file(
@@ -921,11 +1424,19 @@ size_t write_serialized_data(
   return vec_size > 0 ? vec_size : length;
 }
 
-int replace_in_xml_string_pool(
+namespace {
+
+/*
+ * Builds the ResStringPool of the given binary XML with the entries in
+ * `shortened_names` replaced. Everything after the pool, starting at
+ * `*out_nodes_offset`, can be copied over unchanged.
+ */
+int build_replaced_string_pool(
   const void* data,
   const size_t len,
   const std::map<std::string, std::string>& shortened_names,
-  android::Vector<char>* out_data,
+  android::Vector<char>* out_pool,
+  size_t* out_nodes_offset,
   size_t* out_num_renamed) {
   const auto chunk_size = sizeof(android::ResChunk_header);
   const auto pool_header_size =
@@ -948,17 +1459,9 @@ int replace_in_xml_string_pool(
 
   size_t num_replaced = 0;
   android::ResStringPool pool(pool_ptr, dtohl(pool_ptr->header.size));
-
-  // Straight copy of everything after the string pool.
-  android::Vector<char> serialized_nodes;
-  auto start = chunk_size + pool_ptr->header.size;
-  auto remaining = len - start;
-  serialized_nodes.resize(remaining);
-  void* start_ptr = ((char*) data) + start;
-  memcpy((void*) &serialized_nodes[0], start_ptr, remaining);
+  *out_nodes_offset = chunk_size + pool_ptr->header.size;
 
   // Rewrite the strings
-  android::Vector<char> serialized_pool;
   auto num_strings = pool_ptr->stringCount;
 
   // Make an empty pool.
@@ -1006,9 +1509,41 @@ int replace_in_xml_string_pool(
     }
   }
 
-  new_pool.serialize(serialized_pool);
+  new_pool.serialize(*out_pool);
+
+  *out_num_renamed = num_replaced;
+  return android::OK;
+}
+
+} // namespace
+
+int replace_in_xml_string_pool(
+  const void* data,
+  const size_t len,
+  const std::map<std::string, std::string>& shortened_names,
+  android::Vector<char>* out_data,
+  size_t* out_num_renamed) {
+  android::Vector<char> serialized_pool;
+  size_t nodes_offset;
+  auto status = build_replaced_string_pool(data,
+                                           len,
+                                           shortened_names,
+                                           &serialized_pool,
+                                           &nodes_offset,
+                                           out_num_renamed);
+  if (status != android::OK) {
+    return status;
+  }
+
+  // Straight copy of everything after the string pool.
+  android::Vector<char> serialized_nodes;
+  auto remaining = len - nodes_offset;
+  serialized_nodes.resize(remaining);
+  void* start_ptr = ((char*) data) + nodes_offset;
+  memcpy((void*) &serialized_nodes[0], start_ptr, remaining);
 
   // Assemble
+  const auto chunk_size = sizeof(android::ResChunk_header);
   push_short(*out_data, android::RES_XML_TYPE);
   push_short(*out_data, chunk_size);
   auto total_size =
@@ -1018,7 +1553,6 @@ int replace_in_xml_string_pool(
   out_data->appendVector(serialized_pool);
   out_data->appendVector(serialized_nodes);
 
-  *out_num_renamed = num_replaced;
   return android::OK;
 }
 
@@ -1049,3 +1583,175 @@ int rename_classes_in_layout(
   *out_size_delta = serialized.size() - len;
   return android::OK;
 }
+
+XmlEditSession::XmlEditSession(std::vector<std::string> files)
+    : m_files(std::move(files)) {}
+
+void XmlEditSession::rename_strings(
+    const std::map<std::string, std::string>& renames) {
+  // Fold into the renames queued so far: a string renamed earlier is looked
+  // up again under its new name.
+  for (auto& pair : m_renames) {
+    auto it = renames.find(pair.second);
+    if (it != renames.end()) {
+      pair.second = it->second;
+    }
+  }
+  for (const auto& pair : renames) {
+    m_renames.emplace(pair.first, pair.second);
+  }
+}
+
+void XmlEditSession::remap_references(
+    const std::map<uint32_t, uint32_t>& kept_to_remapped_ids) {
+  m_value_edits.emplace_back();
+  m_value_edits.back().remap = kept_to_remapped_ids;
+}
+
+void XmlEditSession::inline_references(
+    const std::map<uint32_t, android::Res_value>& id_to_inline_value) {
+  m_value_edits.emplace_back();
+  m_value_edits.back().inline_values = id_to_inline_value;
+}
+
+XmlEditSession::FileStats XmlEditSession::edit_file(
+    const std::string& path, std::string* staged_path) const {
+  FileStats stats;
+  std::string contents = read_entire_file(path);
+  bool changed = false;
+
+  // Reference edits rewrite attribute data in place, in one walk over the
+  // tree. Each attribute goes through the edits in the order they were
+  // queued, so later edits see the results of earlier ones.
+  if (!m_value_edits.empty()) {
+    ensure_file_contents(contents, path);
+    android::ResXMLTree parser;
+    parser.setTo(contents.data(), contents.size());
+    if (parser.getError() != android::NO_ERROR) {
+      throw std::runtime_error("Unable to read file: " + path);
+    }
+    for (const auto& edit : m_value_edits) {
+      if (!edit.remap.empty()) {
+        auto num_remapped = remap_resource_ids(parser, edit.remap);
+        changed |= num_remapped > 0;
+      }
+    }
+    for_each_attribute(parser, [&](android::ResXMLTree& parser, size_t i) {
+      for (const auto& edit : m_value_edits) {
+        if (!edit.remap.empty() && remap_attribute(parser, i, edit.remap)) {
+          ++stats.values_remapped;
+        }
+        if (!edit.inline_values.empty() &&
+            inline_attribute(parser, i, edit.inline_values)) {
+          ++stats.values_inlined;
+        }
+      }
+    });
+    changed |= stats.values_remapped > 0 || stats.values_inlined > 0;
+  }
+
+  // Renames rebuild the string pool; the nodes after it, including any
+  // edits above, are written out straight from the buffer.
+  android::Vector<char> pool;
+  size_t nodes_offset = contents.size();
+  if (!m_renames.empty() && !contents.empty()) {
+    size_t num_renamed = 0;
+    auto status = build_replaced_string_pool(contents.data(),
+                                             contents.size(),
+                                             m_renames,
+                                             &pool,
+                                             &nodes_offset,
+                                             &num_renamed);
+    if (status == android::OK && num_renamed > 0) {
+      stats.strings_renamed = num_renamed;
+      changed = true;
+    } else {
+      pool.clear();
+      nodes_offset = contents.size();
+    }
+  }
+
+  if (!changed) {
+    return stats;
+  }
+  *staged_path =
+      boost::filesystem::unique_path(path + ".%%%%%%%%.tmp").string();
+  std::ofstream out(*staged_path,
+                    std::ofstream::binary | std::ofstream::trunc);
+  if (stats.strings_renamed > 0) {
+    android::Vector<char> header;
+    const auto chunk_size = sizeof(android::ResChunk_header);
+    push_short(header, android::RES_XML_TYPE);
+    push_short(header, chunk_size);
+    push_long(header, chunk_size + pool.size() +
+                          (contents.size() - nodes_offset));
+    out.write(header.array(), header.size());
+    out.write(pool.array(), pool.size());
+    out.write(contents.data() + nodes_offset, contents.size() - nodes_offset);
+    stats.size_delta = (ssize_t)(chunk_size + pool.size()) - nodes_offset;
+  } else {
+    out.write(contents.data(), contents.size());
+  }
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Unable to write file: " + path);
+  }
+  return stats;
+}
+
+std::vector<XmlEditSession::FileStats> XmlEditSession::commit() {
+  std::vector<FileStats> stats(m_files.size());
+  if (m_files.empty() || (m_renames.empty() && m_value_edits.empty())) {
+    return stats;
+  }
+  // Edited files are staged next to the originals, and only moved over them
+  // once every file has been edited and written successfully.
+  std::vector<std::string> staged(m_files.size());
+  std::vector<std::string> errors(m_files.size());
+  auto num_threads = std::min<size_t>(
+      m_files.size(), std::max(1u, boost::thread::hardware_concurrency()));
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        if (is_raw_resource(m_files[i])) {
+          return;
+        }
+        try {
+          stats[i] = edit_file(m_files[i], &staged[i]);
+        } catch (const std::exception& e) {
+          errors[i] = e.what();
+        }
+      },
+      num_threads);
+  for (size_t i = 0; i < m_files.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  m_renames.clear();
+  m_value_edits.clear();
+
+  std::string error;
+  for (size_t i = 0; i < m_files.size(); ++i) {
+    if (!errors[i].empty()) {
+      error += (error.empty() ? "" : "\n") + errors[i];
+    }
+  }
+  for (size_t i = 0; i < m_files.size(); ++i) {
+    if (staged[i].empty()) {
+      continue;
+    }
+    boost::system::error_code ec;
+    if (error.empty()) {
+      boost::filesystem::rename(staged[i], m_files[i], ec);
+      if (ec) {
+        error = "Unable to replace file: " + m_files[i];
+      }
+    }
+    if (!error.empty()) {
+      boost::filesystem::remove(staged[i], ec);
+    }
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+  return stats;
+}
@@ -136,15 +136,15 @@ void AccessMarkingPass::run_pass(DexStoresVector& stores,
                                  ConfigFiles& cfg,
                                  PassManager& pm) {
   auto scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
-  SignatureMap sm = build_signature_map(ch);
+  auto ch = pm.hierarchy_service().class_hierarchy(scope);
+  SignatureMap sm = build_signature_map(*ch);
   if (m_finalize_classes) {
-    auto n_classes_final = mark_classes_final(scope, ch);
+    auto n_classes_final = mark_classes_final(scope, *ch);
     pm.incr_metric("finalized_classes", n_classes_final);
     TRACE(ACCESS, 1, "Finalized %lu classes\n", n_classes_final);
   }
   if (m_finalize_methods) {
-    auto n_methods_final = mark_methods_final(scope, ch);
+    auto n_methods_final = mark_methods_final(scope, *ch);
     pm.incr_metric("finalized_methods", n_methods_final);
     TRACE(ACCESS, 1, "Finalized %lu methods\n", n_methods_final);
   }
@@ -23,6 +23,15 @@ class AccessMarkingPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  // Finalizing and privatizing methods changes the virtual scopes, but not
+  // the class hierarchy.
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
+  virtual uint32_t hierarchy_writes() const override {
+    return HA_CLASS_SCOPES;
+  }
+
  private:
   bool m_finalize_classes;
   bool m_finalize_methods;
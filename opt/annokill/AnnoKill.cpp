@@ -32,6 +32,7 @@ constexpr const char* METRIC_FIELD_ASETS_TOTAL = "num_field_total";
 constexpr const char* METRIC_SIGNATURES_KILLED = "num_signatures_killed";
 
 AnnoKill::AnnoKill(Scope& scope,
+                   const ClassHierarchy& ch,
                    bool kill_bad_signatures,
                    bool only_force_kill,
                    const AnnoNames& keep,
@@ -79,7 +80,6 @@ AnnoKill::AnnoKill(Scope& scope,
   }
 
   // Populate class hierarchy keep map
-  auto ch = build_type_hierarchy(m_scope);
   for (auto it : class_hierarchy_keep_annos) {
     auto* type = DexType::get_type(it.first.c_str());
     auto* type_cls = type ? type_class(type) : nullptr;
@@ -646,6 +646,7 @@ void AnnoKillPass::run_pass(DexStoresVector& stores,
   auto scope = build_class_scope(stores);
 
   AnnoKill ak(scope,
+              *mgr.hierarchy_service().class_hierarchy(scope),
               m_kill_bad_signatures,
               only_force_kill(),
               m_keep_annos,
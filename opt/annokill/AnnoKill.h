@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include "ClassHierarchy.h"
 #include "Pass.h"
 
 #include <map>
@@ -41,6 +42,7 @@ class AnnoKill {
   };
 
   AnnoKill(Scope& scope,
+           const ClassHierarchy& ch,
            bool only_force_kill,
            bool kill_bad_signatures,
            const AnnoNames& keep,
@@ -103,6 +105,10 @@ class AnnoKillPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
+
   virtual bool only_force_kill() const { return false; }
 
  private:
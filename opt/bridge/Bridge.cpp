@@ -157,7 +157,7 @@ class BridgeRemover {
   };
 
   const std::vector<DexClass*>* m_scope;
-  ClassHierarchy m_ch;
+  std::shared_ptr<const ClassHierarchy> m_ch;
   PassManager& m_mgr;
   std::unordered_map<DexMethod*, DexMethod*> m_bridges_to_bridgees;
   std::unordered_multimap<MethodRef, DexMethod*, MethodRefHash>
@@ -231,7 +231,7 @@ class BridgeRemover {
      *   Easy.  Any subclass can refer to the bridgee.
      */
     TypeSet subclasses;
-    get_all_children(m_ch, clstype, subclasses);
+    get_all_children(*m_ch, clstype, subclasses);
     for (auto subclass : subclasses) {
       m_potential_bridgee_refs.emplace(MethodRef(subclass, name, proto),
                                        bridge);
@@ -362,7 +362,7 @@ class BridgeRemover {
  public:
   BridgeRemover(const std::vector<DexClass*>& scope, PassManager& mgr)
       : m_scope(&scope), m_mgr(mgr) {
-    m_ch = build_type_hierarchy(scope);
+    m_ch = mgr.hierarchy_service().class_hierarchy(scope);
   }
 
   void run() {
@@ -16,4 +16,12 @@ class BridgePass : public Pass {
   BridgePass() : Pass("BridgePass") {}
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  // Removes bridge methods and their bridgees, but no classes.
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
+  virtual uint32_t hierarchy_writes() const override {
+    return HA_CLASS_SCOPES;
+  }
 };
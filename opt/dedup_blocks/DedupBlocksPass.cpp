@@ -9,14 +9,20 @@
 
 #include "DedupBlocksPass.h"
 
+#include <algorithm>
 #include <atomic>
 #include <boost/optional.hpp>
+#include <iomanip>
 #include <iterator>
 #include <mutex>
+#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "ConcurrentContainers.h"
 #include "ControlFlow.h"
+#include "Creators.h"
+#include "DexAccess.h"
 #include "DexClass.h"
 #include "DexOutput.h"
 #include "DexUtil.h"
@@ -63,6 +69,16 @@
  * Deleting the line info would also make things complicated if `cleanup()` is
  * inlined into `getBar()`. We would be unable to reconstruct the inlined stack
  * frame if we deleted the callsite's line number.
+ *
+ * With `cross_method_outline`, the pass also shares blocks across methods.
+ * Blocks that end in a return or a throw and only read registers they define
+ * themselves need nothing from the method they are in, so they can be moved
+ * into a static method with no arguments. The parallel walk indexes these
+ * blocks by fingerprint; the ones that recur often enough to pay for an
+ * outlined method are moved into `Lcom/facebook/redex/OutlinedBlocks;` and
+ * replaced by a call to it at every occurrence. Stack traces through the shared
+ * code show the outlined method, without a line number, above the line of the
+ * first instruction of the block in the caller.
  */
 
 namespace {
@@ -106,16 +122,157 @@ struct BlockEquals {
   }
 };
 
+/*
+ * A 64-bit fingerprint of the code of a block that is stable across runs:
+ * references are folded in by name rather than by address. Blocks with the
+ * same code (as per BlockEquals::same_code) have the same fingerprint.
+ */
+class BlockFingerprint {
+ public:
+  static uint64_t of_code(cfg::Block* b) {
+    BlockFingerprint fp;
+    for (auto& mie : InstructionIterable(b)) {
+      fp.add(mie.insn);
+    }
+    return fp.m_value;
+  }
+
+  // The code of a block that is outlined into a method returning :rtype.
+  // Blocks from different methods with the same code but different return
+  // types can't share an outlined method.
+  static uint64_t of_outlinable(cfg::Block* b, const DexType* rtype) {
+    BlockFingerprint fp;
+    fp.m_value = of_code(b);
+    fp.add(rtype);
+    return fp.m_value;
+  }
+
+ private:
+  uint64_t m_value{0xcbf29ce484222325};
+
+  void mix(uint64_t v) {
+    m_value ^= v + 0x9e3779b97f4a7c15 + (m_value << 6) + (m_value >> 2);
+  }
+
+  void add(const DexString* str) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325;
+    for (const char* c = str->c_str(); *c != '\0'; ++c) {
+      h = (h ^ static_cast<unsigned char>(*c)) * 0x100000001b3;
+    }
+    mix(h);
+  }
+
+  void add(const DexType* type) {
+    if (type == nullptr) {
+      mix(0);
+    } else {
+      add(type->get_name());
+    }
+  }
+
+  void add(const DexProto* proto) {
+    add(proto->get_rtype());
+    for (auto arg : proto->get_args()->get_type_list()) {
+      add(arg);
+    }
+  }
+
+  void add(IRInstruction* insn) {
+    mix(insn->opcode());
+    for (size_t i = 0; i < insn->srcs_size(); i++) {
+      mix(insn->src(i));
+    }
+    if (insn->dests_size() > 0) {
+      mix(insn->dest());
+    }
+    if (insn->has_literal()) {
+      mix(static_cast<uint64_t>(insn->get_literal()));
+    }
+    if (insn->has_data()) {
+      auto data = insn->get_data();
+      for (size_t i = 0; i < data->data_size(); i++) {
+        mix(data->data()[i]);
+      }
+    }
+    if (insn->has_string()) {
+      add(insn->get_string());
+    } else if (insn->has_type()) {
+      add(insn->get_type());
+    } else if (insn->has_field()) {
+      auto field = insn->get_field();
+      add(field->get_class());
+      add(field->get_name());
+      add(field->get_type());
+    } else if (insn->has_method()) {
+      auto method = insn->get_method();
+      add(method->get_class());
+      add(method->get_name());
+      add(method->get_proto());
+    }
+  }
+};
+
 struct BlockHasher {
   hash_t operator()(cfg::Block* b) const {
-    hash_t result = 0;
-    for (auto& mie : InstructionIterable(b)) {
-      result ^= mie.insn->hash();
+    return BlockFingerprint::of_code(b);
+  }
+};
+
+/*
+ * A block that ends in a return or a throw and that reads no register before
+ * writing it. The instructions stay owned by the method.
+ */
+struct SelfContainedBlock {
+  DexMethod* method;
+  // rank of the block among the self-contained blocks of its method
+  size_t rank;
+  // return type of the outlined method
+  DexType* rtype;
+  std::vector<IRInstruction*> insns;
+
+  size_t code_units() const {
+    size_t result = 0;
+    for (auto insn : insns) {
+      result += insn->size();
     }
     return result;
   }
+
+  // What is left of the block in the caller: an invoke-static, a move-result
+  // of the value returned or thrown, and the return or throw itself.
+  size_t call_code_units() const {
+    auto terminator = insns.back();
+    return 3 + (terminator->srcs_size() > 0 ? 1 : 0) + terminator->size();
+  }
+
+  bool same_code(const SelfContainedBlock& other) const {
+    return rtype == other.rtype && insns.size() == other.insns.size() &&
+           std::equal(insns.begin(),
+                      insns.end(),
+                      other.insns.begin(),
+                      [](const IRInstruction* a, const IRInstruction* b) {
+                        return *a == *b;
+                      });
+  }
 };
 
+// A method id, an encoded method and a code item header
+constexpr int64_t OUTLINED_METHOD_OVERHEAD_BYTES = 8 + 4 + 16;
+
+// Bytes saved by outlining the :occurrences of a block
+int64_t estimated_savings(const SelfContainedBlock& block,
+                          size_t occurrences) {
+  auto code_units = static_cast<int64_t>(block.code_units());
+  auto call_code_units = static_cast<int64_t>(block.call_code_units());
+  return 2 * (code_units - call_code_units) *
+             static_cast<int64_t>(occurrences) -
+         2 * code_units - OUTLINED_METHOD_OVERHEAD_BYTES;
+}
+
+constexpr const char* OUTLINED_CLASS_NAME =
+    "Lcom/facebook/redex/OutlinedBlocks;";
+
 struct BlockCompare {
   bool operator()(const cfg::Block* a, const cfg::Block* b) const {
     return *a < *b;
@@ -143,12 +300,104 @@ class DedupBlocksImpl {
         record_stats(dups);
         deduplicate(dups, cfg);
       }
+      if (m_outline_scope.count(type_class(method->get_class())) != 0) {
+        index_self_contained_blocks(method, cfg);
+      }
 
       code.clear_cfg();
     });
     report_stats();
   }
 
+  // Index the self-contained blocks of the methods of :scope during run().
+  void set_outline_scope(const Scope& scope) {
+    m_outline_scope.insert(scope.begin(), scope.end());
+  }
+
+  // Move the indexed blocks that recur across methods into static methods
+  // of the outlined class, adding that class to :dex if it doesn't exist.
+  void outline(DexClasses& dex) {
+    std::vector<uint64_t> fingerprints;
+    for (const auto& entry : m_index) {
+      if (entry.second.size() > 1) {
+        fingerprints.push_back(entry.first);
+      }
+    }
+    std::sort(fingerprints.begin(), fingerprints.end());
+
+    auto outlined_type = DexType::make_type(OUTLINED_CLASS_NAME);
+    std::vector<DexMethod*> outlined_methods;
+    std::unordered_map<DexMethod*,
+                       std::vector<std::pair<const SelfContainedBlock*,
+                                             DexMethod*>>>
+        call_sites;
+    int64_t total_savings = 0;
+    size_t outlined_blocks = 0;
+    for (auto fingerprint : fingerprints) {
+      for (auto& group : group_by_code(m_index.find(fingerprint)->second)) {
+        if (group.size() < 2) {
+          continue;
+        }
+        auto savings = estimated_savings(*group.front(), group.size());
+        TRACE(DEDUP_BLOCKS,
+              3,
+              "fingerprint %016lx: %lu blocks of %lu code units, %ld bytes "
+              "saved by outlining (e.g. in %s)\n",
+              fingerprint,
+              group.size(),
+              group.front()->code_units(),
+              savings,
+              SHOW(group.front()->method));
+        if (savings <= 0) {
+          continue;
+        }
+        auto outlined =
+            make_outlined_method(outlined_type, fingerprint, *group.front());
+        outlined_methods.push_back(outlined);
+        for (auto block : group) {
+          call_sites[block->method].emplace_back(block, outlined);
+        }
+        total_savings += savings;
+        outlined_blocks += group.size();
+      }
+    }
+    if (outlined_methods.empty()) {
+      return;
+    }
+
+    for (auto& entry : call_sites) {
+      auto code = entry.first->get_code();
+      for (const auto& call_site : entry.second) {
+        replace_with_call(code, *call_site.first, call_site.second);
+      }
+    }
+
+    auto outlined_cls = type_class(outlined_type);
+    if (outlined_cls != nullptr) {
+      for (auto method : outlined_methods) {
+        outlined_cls->add_method(method);
+      }
+    } else {
+      ClassCreator creator(outlined_type);
+      creator.set_access(ACC_PUBLIC | ACC_FINAL);
+      creator.set_super(get_object_type());
+      for (auto method : outlined_methods) {
+        creator.add_method(method);
+      }
+      dex.push_back(creator.create());
+    }
+
+    m_mgr.incr_metric(METRIC_OUTLINED_METHODS, outlined_methods.size());
+    m_mgr.incr_metric(METRIC_OUTLINED_BLOCKS, outlined_blocks);
+    m_mgr.incr_metric(METRIC_OUTLINED_BYTES_SAVED, total_savings);
+    TRACE(DEDUP_BLOCKS,
+          1,
+          "%lu blocks outlined into %lu methods, ~%ld bytes saved\n",
+          outlined_blocks,
+          outlined_methods.size(),
+          total_savings);
+  }
+
  private:
   using Duplicates = std::unordered_map<cfg::Block*,
                                         std::set<cfg::Block*, BlockCompare>,
@@ -156,6 +405,9 @@ class DedupBlocksImpl {
                                         BlockEquals>;
   const char* METRIC_BLOCKS_REMOVED = "blocks_removed";
   const char* METRIC_ELIGIBLE_BLOCKS = "eligible_blocks";
+  const char* METRIC_OUTLINED_METHODS = "outlined_methods";
+  const char* METRIC_OUTLINED_BLOCKS = "outlined_blocks";
+  const char* METRIC_OUTLINED_BYTES_SAVED = "outlined_bytes_saved";
   const std::vector<DexClass*>& m_scope;
   PassManager& m_mgr;
   const DedupBlocksPass::Config& m_config;
@@ -167,6 +419,150 @@ class DedupBlocksImpl {
   std::unordered_map<size_t, size_t> m_dup_sizes;
   std::mutex lock;
 
+  std::unordered_set<const DexClass*> m_outline_scope;
+  // self-contained blocks of the outline scope, by fingerprint
+  ConcurrentMap<uint64_t, std::vector<SelfContainedBlock>, 127> m_index;
+
+  void index_self_contained_blocks(DexMethod* method,
+                                   const cfg::ControlFlowGraph& cfg) {
+    size_t rank = 0;
+    for (cfg::Block* block : cfg.blocks()) {
+      auto rtype = outlined_return_type(method, block);
+      if (rtype == nullptr || !is_self_contained(block)) {
+        continue;
+      }
+      SelfContainedBlock self_contained{method, rank++, rtype, {}};
+      for (auto& mie : InstructionIterable(block)) {
+        self_contained.insns.push_back(mie.insn);
+      }
+      if (self_contained.code_units() <= self_contained.call_code_units()) {
+        continue;
+      }
+      m_index.update(BlockFingerprint::of_outlinable(block, rtype),
+                     [&](uint64_t,
+                         std::vector<SelfContainedBlock>& blocks,
+                         bool /* exists */) {
+                       blocks.push_back(std::move(self_contained));
+                     });
+    }
+  }
+
+  // The blocks of a fingerprint with the same code, each group in method
+  // order.
+  static std::vector<std::vector<const SelfContainedBlock*>> group_by_code(
+      const std::vector<SelfContainedBlock>& blocks) {
+    std::vector<std::vector<const SelfContainedBlock*>> groups;
+    for (const auto& block : blocks) {
+      auto it = std::find_if(
+          groups.begin(),
+          groups.end(),
+          [&](const std::vector<const SelfContainedBlock*>& group) {
+            return group.front()->same_code(block);
+          });
+      if (it == groups.end()) {
+        groups.push_back({&block});
+      } else {
+        it->push_back(&block);
+      }
+    }
+    for (auto& group : groups) {
+      std::sort(group.begin(),
+                group.end(),
+                [](const SelfContainedBlock* a, const SelfContainedBlock* b) {
+                  return a->method != b->method
+                             ? compare_dexmethods(a->method, b->method)
+                             : a->rank < b->rank;
+                });
+    }
+    // The groups were formed in the order the walk indexed the blocks.
+    std::sort(groups.begin(),
+              groups.end(),
+              [](const std::vector<const SelfContainedBlock*>& a,
+                 const std::vector<const SelfContainedBlock*>& b) {
+                auto first_a = a.front();
+                auto first_b = b.front();
+                return first_a->method != first_b->method
+                           ? compare_dexmethods(first_a->method,
+                                                first_b->method)
+                           : first_a->rank < first_b->rank;
+              });
+    return groups;
+  }
+
+  // A static method of :type, named after the fingerprint, holding a copy of
+  // :block.
+  static DexMethod* make_outlined_method(DexType* type,
+                                         uint64_t fingerprint,
+                                         const SelfContainedBlock& block) {
+    auto proto =
+        DexProto::make_proto(block.rtype, DexTypeList::make_type_list({}));
+    std::ostringstream base_name;
+    base_name << "block$" << std::hex << std::setw(16) << std::setfill('0')
+              << fingerprint;
+    // Different code with the same fingerprint, or a block outlined by an
+    // earlier run of the pass.
+    auto name = DexString::make_string(base_name.str());
+    for (size_t i = 1; DexMethod::get_method(type, name, proto) != nullptr;
+         ++i) {
+      name = DexString::make_string(base_name.str() + "$" + std::to_string(i));
+    }
+
+    auto code = std::make_unique<IRCode>();
+    uint16_t registers_size = 0;
+    for (auto insn : block.insns) {
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        registers_size = std::max<uint16_t>(
+            registers_size, insn->src(i) + (insn->src_is_wide(i) ? 2 : 1));
+      }
+      if (insn->dests_size() > 0) {
+        registers_size = std::max<uint16_t>(
+            registers_size, insn->dest() + (insn->dest_is_wide() ? 2 : 1));
+      }
+      code->push_back(new IRInstruction(*insn));
+    }
+    code->set_registers_size(registers_size);
+
+    auto method =
+        static_cast<DexMethod*>(DexMethod::make_method(type, name, proto));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, std::move(code), false);
+    return method;
+  }
+
+  // Replace all but the return or throw of :block with a call to :outlined
+  // that produces the value returned or thrown. The call takes the place of
+  // the first instruction, so it keeps its line number.
+  static void replace_with_call(IRCode* code,
+                                const SelfContainedBlock& block,
+                                DexMethod* outlined) {
+    auto first = block.insns.front();
+    auto terminator = block.insns.back();
+    auto it = std::find_if(
+        code->begin(), code->end(), [&](const MethodItemEntry& mie) {
+          return mie.type == MFLOW_OPCODE && mie.insn == first;
+        });
+    always_assert(it != code->end());
+
+    auto invoke = new IRInstruction(OPCODE_INVOKE_STATIC);
+    invoke->set_method(outlined)->set_arg_word_count(0);
+    code->insert_before(it, invoke);
+    if (terminator->srcs_size() > 0) {
+      auto op = terminator->opcode() == OPCODE_RETURN
+                    ? OPCODE_MOVE_RESULT
+                    : terminator->opcode() == OPCODE_RETURN_WIDE
+                          ? OPCODE_MOVE_RESULT_WIDE
+                          : OPCODE_MOVE_RESULT_OBJECT;
+      auto move_result = new IRInstruction(op);
+      move_result->set_dest(terminator->src(0));
+      code->insert_before(it, move_result);
+    }
+
+    for (; it->type != MFLOW_OPCODE || it->insn != terminator; ++it) {
+      if (it->type == MFLOW_OPCODE) {
+        code->remove_opcode(it);
+      }
+    }
+  }
+
   // Find blocks with the same exact code
   Duplicates collect_duplicates(const cfg::ControlFlowGraph& cfg) {
     const auto& blocks = cfg.blocks();
@@ -332,6 +728,96 @@ class DedupBlocksImpl {
     return true;
   }
 
+  // The return type of the outlined method if :block can be outlined, nullptr
+  // otherwise. Thrown exceptions are returned to the caller as Throwables.
+  static DexType* outlined_return_type(DexMethod* method, cfg::Block* block) {
+    if (!has_opcodes(block) || block->is_catch() ||
+        begins_with_move_result(block)) {
+      return nullptr;
+    }
+    auto op = block->get_last_insn()->insn->opcode();
+    DexType* rtype = nullptr;
+    if (is_return(op)) {
+      rtype = method->get_proto()->get_rtype();
+    } else if (is_throw(op)) {
+      rtype = DexType::make_type("Ljava/lang/Throwable;");
+    } else {
+      return nullptr;
+    }
+    if (!is_accessible_anywhere(rtype)) {
+      return nullptr;
+    }
+    for (const auto& mie : InstructionIterable(block)) {
+      if (!can_be_outlined(mie.insn)) {
+        return nullptr;
+      }
+    }
+    return rtype;
+  }
+
+  // The outlined method has no arguments, so the block must not read any
+  // register it hasn't written itself.
+  static bool is_self_contained(cfg::Block* block) {
+    std::unordered_set<uint16_t> written;
+    for (const auto& mie : InstructionIterable(block)) {
+      auto insn = mie.insn;
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        auto reg = insn->src(i);
+        if (written.count(reg) == 0 ||
+            (insn->src_is_wide(i) && written.count(reg + 1) == 0)) {
+          return false;
+        }
+      }
+      if (insn->dests_size() > 0) {
+        written.insert(insn->dest());
+        if (insn->dest_is_wide()) {
+          written.insert(insn->dest() + 1);
+        }
+      }
+    }
+    return true;
+  }
+
+  // The outlined method lives in another class and package than the caller,
+  // so it can only use public members of public classes.
+  static bool can_be_outlined(const IRInstruction* insn) {
+    auto op = insn->opcode();
+    if ((opcode::is_internal(op) && !opcode::is_move_result_pseudo(op)) ||
+        is_monitor(op) || is_invoke_super(op) || op == OPCODE_MOVE_EXCEPTION) {
+      return false;
+    }
+    if (insn->has_type()) {
+      return is_accessible_anywhere(insn->get_type());
+    }
+    if (insn->has_field()) {
+      auto field =
+          resolve_field(insn->get_field(),
+                        is_sfield_op(op) ? FieldSearch::Static
+                                         : FieldSearch::Instance);
+      return field != nullptr && is_public(field) &&
+             is_accessible_anywhere(field->get_class()) &&
+             !((is_iput(op) || is_sput(op)) && is_final(field));
+    }
+    if (insn->has_method()) {
+      auto ref = insn->get_method();
+      auto method = resolve_method(ref, opcode_to_search(insn));
+      return method != nullptr && is_public(method) &&
+             (!is_invoke_direct(op) || is_init(method)) &&
+             is_accessible_anywhere(ref->get_class()) &&
+             is_accessible_anywhere(method->get_class());
+    }
+    return true;
+  }
+
+  static bool is_accessible_anywhere(const DexType* type) {
+    type = get_array_type_or_self(type);
+    if (is_primitive(type)) {
+      return true;
+    }
+    auto cls = type_class(type);
+    return cls != nullptr && is_public(cls);
+  }
+
   static bool begins_with_move_result(cfg::Block* block) {
     const auto& first_mie = *block->get_first_insn();
     auto first_op = first_mie.insn->opcode();
@@ -437,7 +923,18 @@ void DedupBlocksPass::run_pass(DexStoresVector& stores,
                                PassManager& mgr) {
   const auto& scope = build_class_scope(stores);
   DedupBlocksImpl impl(scope, mgr, m_config);
+  auto& root_dexen = stores[0].get_dexen();
+  if (m_config.cross_method_outline) {
+    // Like the Outliner, leave the primary dex alone: the outlined class goes
+    // to a secondary dex, which isn't loaded yet when the primary dex runs.
+    for (size_t i = 1; i < root_dexen.size(); ++i) {
+      impl.set_outline_scope(root_dexen[i]);
+    }
+  }
   impl.run();
+  if (m_config.cross_method_outline) {
+    impl.outline(root_dexen.back());
+  }
 }
 
 static DedupBlocksPass s_pass;
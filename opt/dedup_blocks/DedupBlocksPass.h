@@ -25,9 +25,14 @@ class DedupBlocksPass : public Pass {
       if (meth == nullptr || !meth->is_def()) continue;
       m_config.method_black_list.emplace(static_cast<DexMethod*>(meth));
     }
+    pc.get("cross_method_outline", false, m_config.cross_method_outline);
   }
 
   struct Config {
     std::unordered_set<DexMethod*> method_black_list;
+    // Also share the blocks that recur across methods through outlined
+    // methods. The outlined class is added to the last dex of the root store,
+    // so this should run before InterDex.
+    bool cross_method_outline{false};
   } m_config;
 };
@@ -9,9 +9,11 @@
 
 #include "InterDex.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <unordered_set>
 
@@ -31,9 +33,6 @@
 
 namespace {
 
-typedef std::unordered_set<DexMethodRef*> mrefs_t;
-typedef std::unordered_set<DexFieldRef*> frefs_t;
-
 size_t global_dmeth_cnt;
 size_t global_smeth_cnt;
 size_t global_vmeth_cnt;
@@ -48,48 +47,275 @@ bool emit_canaries = false;
 int64_t linear_alloc_limit;
 std::unordered_set<DexClass*> mixed_mode_classes;
 
-void gather_refs(InterDexPass* pass,
-                 const DexClass* cls,
-                 mrefs_t* mrefs,
-                 frefs_t* frefs) {
+constexpr int kMaxMethodRefs = ((64 * 1024) - 1);
+constexpr int kMaxFieldRefs = 64 * 1024 - 1;
+constexpr char kCanaryPrefix[] = "Lsecondary/dex";
+constexpr char kCanaryClassFormat[] = "Lsecondary/dex%02d/Canary;";
+constexpr size_t kCanaryClassBufsize = sizeof(kCanaryClassFormat);
+constexpr int kMaxDexNum = 99;
+
+/*
+ * Dense numbering of the method or field refs of the classes being emitted,
+ * so that sets of refs can be kept as sorted id arrays and bitsets.
+ */
+template <typename Ref>
+class ref_ids {
+ public:
+  uint32_t intern(Ref* ref) {
+    auto it = m_ids.emplace(ref, m_refs.size());
+    if (it.second) {
+      m_refs.push_back(ref);
+    }
+    return it.first->second;
+  }
+
+  bool find(Ref* ref, uint32_t* id) const {
+    auto it = m_ids.find(ref);
+    if (it == m_ids.end()) {
+      return false;
+    }
+    *id = it->second;
+    return true;
+  }
+
+  Ref* get(uint32_t id) const { return m_refs[id]; }
+
+  void clear() {
+    m_ids.clear();
+    m_refs.clear();
+  }
+
+ private:
+  std::unordered_map<Ref*, uint32_t> m_ids;
+  std::vector<Ref*> m_refs;
+};
+
+/*
+ * The refs of the dex being filled, as a bitset over ref ids. The number of
+ * set bits is maintained as ids are inserted.
+ */
+class ref_set {
+ public:
+  size_t size() const { return m_count; }
+
+  bool contains(uint32_t id) const {
+    auto word = id / 64;
+    return word < m_words.size() && (m_words[word] >> (id % 64)) & 1;
+  }
+
+  // The number of :ids that aren't in the set yet.
+  size_t count_missing(const std::vector<uint32_t>& ids) const {
+    size_t missing = 0;
+    for (auto id : ids) {
+      missing += !contains(id);
+    }
+    return missing;
+  }
+
+  // :ids is sorted, so its last element bounds the bitset.
+  void insert(const std::vector<uint32_t>& ids) {
+    if (ids.empty()) {
+      return;
+    }
+    auto words = ids.back() / 64 + 1;
+    if (m_words.size() < words) {
+      m_words.resize(words);
+    }
+    for (auto id : ids) {
+      auto& word = m_words[id / 64];
+      auto bit = uint64_t(1) << (id % 64);
+      m_count += !(word & bit);
+      word |= bit;
+    }
+  }
+
+  void clear() {
+    std::fill(m_words.begin(), m_words.end(), 0);
+    m_count = 0;
+  }
+
+ private:
+  std::vector<uint64_t> m_words;
+  size_t m_count{0};
+};
+
+/*
+ * The method and field refs that defining a class in a dex adds to it, as
+ * sorted ref ids. The refs themselves are only kept for the plugins.
+ */
+struct class_refs {
+  std::vector<uint32_t> mrefs;
+  std::vector<uint32_t> frefs;
   std::vector<DexMethodRef*> method_refs;
   std::vector<DexFieldRef*> field_refs;
-  cls->gather_methods(method_refs);
-  cls->gather_fields(field_refs);
-  for (const auto& plugin : pass->m_plugins) {
-    plugin->gather_mrefs(cls, method_refs, field_refs);
+};
+
+bool compare_refs(const DexMethodRef* a, const DexMethodRef* b) {
+  return compare_dexmethods(a, b);
+}
+
+bool compare_refs(const DexFieldRef* a, const DexFieldRef* b) {
+  return compare_dexfields(a, b);
+}
+
+/*
+ * Sorts :refs by name and dedups them. Interning refs in this order hands
+ * out ids that don't depend on pointer values.
+ */
+template <typename Ref>
+void sort_refs(std::vector<Ref*>& refs) {
+  sort_unique(refs, [](const Ref* a, const Ref* b) {
+    return compare_refs(a, b);
+  });
+}
+
+template <typename Ref>
+std::vector<uint32_t> intern_refs(ref_ids<Ref>& ids,
+                                  const std::vector<Ref*>& refs) {
+  std::vector<uint32_t> result;
+  result.reserve(refs.size());
+  for (auto ref : refs) {
+    result.push_back(ids.intern(ref));
   }
-  mrefs->insert(method_refs.begin(), method_refs.end());
-  frefs->insert(field_refs.begin(), field_refs.end());
+  sort_unique(result);
+  return result;
 }
 
+} // End namespace
+
 /*
- * Removes the elements of b from a. Runs in O(size(a)), so it works best if
- * size(a) << size(b).
+ * The refs of the code of the classes InterDex emits, as dense ids, for one
+ * run of the pass. The plugins' extra refs aren't part of these: plugins are
+ * asked for them when the class is emitted.
  */
-template <typename T>
-std::unordered_set<T> set_difference(const std::unordered_set<T>& a,
-                                     const std::unordered_set<T>& b) {
-  std::unordered_set<T> result;
-  for (auto& v : a) {
-    if (!b.count(v)) {
-      result.emplace(v);
+struct InterDexRefSummaries {
+  ref_ids<DexMethodRef> mref_ids;
+  ref_ids<DexFieldRef> fref_ids;
+  std::unordered_map<const DexClass*, class_refs> classes;
+
+  // Records the sorted :method_refs and :field_refs of :cls. The refs are
+  // kept too if the plugins will need them.
+  const class_refs& add(InterDexPass* pass,
+                        const DexClass* cls,
+                        std::vector<DexMethodRef*>& method_refs,
+                        std::vector<DexFieldRef*>& field_refs) {
+    auto& refs = classes[cls];
+    refs.mrefs = intern_refs(mref_ids, method_refs);
+    refs.frefs = intern_refs(fref_ids, field_refs);
+    if (!pass->m_plugins.empty()) {
+      refs.method_refs = std::move(method_refs);
+      refs.field_refs = std::move(field_refs);
     }
+    return refs;
+  }
+};
+
+namespace {
+
+/*
+ * Gathers the refs of the code of every class in :scope up front, in
+ * parallel, so that emitting a class doesn't have to walk its code again.
+ * Ids are assigned serially, in scope order and then by name, and are thus
+ * deterministic.
+ */
+void summarize_class_refs(InterDexPass* pass, const Scope& scope) {
+  pass->m_ref_summaries = std::make_unique<InterDexRefSummaries>();
+  auto& summaries = *pass->m_ref_summaries;
+
+  std::vector<std::vector<DexMethodRef*>> method_refs(scope.size());
+  std::vector<std::vector<DexFieldRef*>> field_refs(scope.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        scope[i]->gather_methods(method_refs[i]);
+        scope[i]->gather_fields(field_refs[i]);
+        sort_refs(method_refs[i]);
+        sort_refs(field_refs[i]);
+      },
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < scope.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  summaries.classes.reserve(scope.size());
+  for (size_t i = 0; i < scope.size(); ++i) {
+    summaries.add(pass, scope[i], method_refs[i], field_refs[i]);
   }
-  return result;
 }
 
-constexpr int kMaxMethodRefs = ((64 * 1024) - 1);
-constexpr int kMaxFieldRefs = 64 * 1024 - 1;
-constexpr char kCanaryPrefix[] = "Lsecondary/dex";
-constexpr char kCanaryClassFormat[] = "Lsecondary/dex%02d/Canary;";
-constexpr size_t kCanaryClassBufsize = sizeof(kCanaryClassFormat);
-constexpr int kMaxDexNum = 99;
+/*
+ * Returns the refs of the code of :cls. Classes outside the summarized scope,
+ * such as plugin-generated ones, are summarized on first use.
+ */
+const class_refs& get_code_refs(InterDexPass* pass, const DexClass* cls) {
+  auto& summaries = *pass->m_ref_summaries;
+  auto it = summaries.classes.find(cls);
+  if (it != summaries.classes.end()) {
+    return it->second;
+  }
+  std::vector<DexMethodRef*> method_refs;
+  std::vector<DexFieldRef*> field_refs;
+  cls->gather_methods(method_refs);
+  cls->gather_fields(field_refs);
+  sort_refs(method_refs);
+  sort_refs(field_refs);
+  return summaries.add(pass, cls, method_refs, field_refs);
+}
+
+// Adds the ids of :refs[begin:] to the sorted :ids.
+template <typename Ref>
+void add_ref_ids(ref_ids<Ref>& interned,
+                 const std::vector<Ref*>& refs,
+                 size_t begin,
+                 std::vector<uint32_t>& ids) {
+  if (begin == refs.size()) {
+    return;
+  }
+  std::vector<Ref*> extra_refs(refs.begin() + begin, refs.end());
+  sort_refs(extra_refs);
+  auto extra_ids = intern_refs(interned, extra_refs);
+  std::vector<uint32_t> merged;
+  merged.reserve(ids.size() + extra_ids.size());
+  std::set_union(ids.begin(),
+                 ids.end(),
+                 extra_ids.begin(),
+                 extra_ids.end(),
+                 std::back_inserter(merged));
+  ids = std::move(merged);
+}
+
+/*
+ * Returns :code_refs plus the refs the plugins add for :cls, as of this point
+ * of the emission.
+ */
+class_refs add_plugin_refs(InterDexPass* pass,
+                           const DexClass* cls,
+                           const class_refs& code_refs) {
+  // Plugins append their refs to the refs of the code.
+  auto method_refs = code_refs.method_refs;
+  auto field_refs = code_refs.field_refs;
+  for (const auto& plugin : pass->m_plugins) {
+    plugin->gather_mrefs(cls, method_refs, field_refs);
+  }
+  auto& summaries = *pass->m_ref_summaries;
+  class_refs refs;
+  refs.mrefs = code_refs.mrefs;
+  refs.frefs = code_refs.frefs;
+  add_ref_ids(summaries.mref_ids,
+              method_refs,
+              code_refs.method_refs.size(),
+              refs.mrefs);
+  add_ref_ids(summaries.fref_ids,
+              field_refs,
+              code_refs.field_refs.size(),
+              refs.frefs);
+  return refs;
+}
 
 struct dex_emit_tracker {
   unsigned la_size{0};
-  mrefs_t mrefs;
-  frefs_t frefs;
+  ref_set mrefs;
+  ref_set frefs;
   std::vector<DexClass*> outs;
   std::unordered_set<DexClass*> emitted;
   std::unordered_map<std::string, DexClass*> clookup;
@@ -121,10 +347,12 @@ void update_class_stats(DexClass* clazz) {
 }
 
 /*
- * Sanity check: did gather_refs return all the refs that ultimately ended up
+ * Sanity check: did emit_class count all the refs that ultimately ended up
  * in the dex?
  */
-void check_refs_count(const dex_emit_tracker& det, const DexClasses& dc) {
+void check_refs_count(const InterDexRefSummaries& summaries,
+                      const dex_emit_tracker& det,
+                      const DexClasses& dc) {
   std::vector<DexMethodRef*> mrefs;
   for (DexClass* cls : dc) {
     cls->gather_methods(mrefs);
@@ -132,7 +360,8 @@ void check_refs_count(const dex_emit_tracker& det, const DexClasses& dc) {
   std::unordered_set<DexMethodRef*> mrefs_set(mrefs.begin(), mrefs.end());
   if (mrefs_set.size() > det.mrefs.size()) {
     for (DexMethodRef* mr : mrefs_set) {
-      if (!det.mrefs.count(mr)) {
+      uint32_t id;
+      if (!summaries.mref_ids.find(mr, &id) || !det.mrefs.contains(id)) {
         TRACE(IDEX, 1,
               "WARNING: Could not find %s in predicted mrefs set\n",
               SHOW(mr));
@@ -147,7 +376,8 @@ void check_refs_count(const dex_emit_tracker& det, const DexClasses& dc) {
   std::unordered_set<DexFieldRef*> frefs_set(frefs.begin(), frefs.end());
   if (frefs_set.size() > det.frefs.size()) {
     for (auto* fr : frefs_set) {
-      if (!det.frefs.count(fr)) {
+      uint32_t id;
+      if (!summaries.fref_ids.find(fr, &id) || !det.frefs.contains(id)) {
         TRACE(IDEX, 1,
               "WARNING: Could not find %s in predicted frefs set\n",
               SHOW(fr));
@@ -187,7 +417,7 @@ void flush_out_dex(InterDexPass* pass,
     }
     dc.insert(dc.end(), add_classes.begin(), add_classes.end());
   }
-  check_refs_count(det, dc);
+  check_refs_count(*pass->m_ref_summaries, det, dc);
 
   outdex.emplace_back(std::move(dc));
 
@@ -358,32 +588,36 @@ void emit_class(InterDexPass* pass,
 
   // Calculate the extra method and field refs that we would need to add to
   // the current dex if we defined :clazz in it.
-  mrefs_t clazz_mrefs;
-  frefs_t clazz_frefs;
-  gather_refs(pass, clazz, &clazz_mrefs, &clazz_frefs);
-  auto extra_mrefs = set_difference(clazz_mrefs, det.mrefs);
-  auto extra_frefs = set_difference(clazz_frefs, det.frefs);
+  const auto& code_refs = get_code_refs(pass, clazz);
+  class_refs with_plugin_refs;
+  if (!pass->m_plugins.empty()) {
+    with_plugin_refs = add_plugin_refs(pass, clazz, code_refs);
+  }
+  const auto& clazz_refs =
+      pass->m_plugins.empty() ? code_refs : with_plugin_refs;
+  auto extra_mrefs = det.mrefs.count_missing(clazz_refs.mrefs);
+  auto extra_frefs = det.frefs.count_missing(clazz_refs.frefs);
 
   // If those extra refs would cause use to overflow, start a new dex.
   if ((det.la_size + laclazz) > linear_alloc_limit ||
       // XXX(jezng): shouldn't this >= be > instead?
-      det.mrefs.size() + extra_mrefs.size() >= kMaxMethodRefs ||
-      det.frefs.size() + extra_frefs.size() >= kMaxFieldRefs) {
+      det.mrefs.size() + extra_mrefs >= kMaxMethodRefs ||
+      det.frefs.size() + extra_frefs >= kMaxFieldRefs) {
     // Emit out list
     always_assert_log(!is_primary,
                       "would have to do an early flush on the primary dex\n"
                       "la %d:%d , mrefs %lu:%d frefs %lu:%d\n",
                       det.la_size + laclazz,
                       linear_alloc_limit,
-                      det.mrefs.size() + extra_mrefs.size(),
+                      det.mrefs.size() + extra_mrefs,
                       kMaxMethodRefs,
-                      det.frefs.size() + extra_frefs.size(),
+                      det.frefs.size() + extra_frefs,
                       kMaxFieldRefs);
     flush_out_secondary(pass, det, outdex);
   }
 
-  det.mrefs.insert(clazz_mrefs.begin(), clazz_mrefs.end());
-  det.frefs.insert(clazz_frefs.begin(), clazz_frefs.end());
+  det.mrefs.insert(clazz_refs.mrefs);
+  det.frefs.insert(clazz_refs.frefs);
   det.la_size += laclazz;
   det.outs.push_back(clazz);
   det.emitted.insert(clazz);
@@ -397,88 +631,187 @@ void emit_class(InterDexPass* pass,
   emit_class(pass, det, outdex, clazz, false);
 }
 
+/*
+ * Finds the cold-start classes that no other cold-start class refers to. A
+ * cold-start class is kept if
+ *  - it can't be renamed, since it may be used from native code, or
+ *  - the code of another kept cold-start class refers to it, or
+ *  - it is among the types of a class kept by one of the two rules above.
+ * Dropping a class can leave others unreferenced, so this is a fixpoint. The
+ * references among cold-start classes are gathered once, in parallel; classes
+ * are then dropped off a worklist as their reference counts reach zero.
+ */
 std::unordered_set<const DexClass*> find_unrefenced_coldstart_classes(
     const Scope& scope,
     dex_emit_tracker& det,
     const std::vector<std::string>& interdexorder,
     bool static_prune_classes) {
-  int old_no_ref = -1;
-  int new_no_ref = 0;
-  std::unordered_set<DexClass*> coldstart_classes;
-  std::unordered_set<const DexClass*> cold_cold_references;
   std::unordered_set<const DexClass*> unreferenced_classes;
-  Scope input_scope = scope;
 
   // don't do analysis if we're not going doing pruning
   if (!static_prune_classes) {
     return unreferenced_classes;
   }
 
+  std::vector<DexClass*> coldstart_classes;
+  std::unordered_map<const DexClass*, uint32_t> coldstart_ids;
   for (auto const& class_string : interdexorder) {
-    if (det.clookup.count(class_string)) {
-      coldstart_classes.insert(det.clookup[class_string]);
+    auto it = det.clookup.find(class_string);
+    if (it != det.clookup.end() &&
+        coldstart_ids.emplace(it->second, coldstart_classes.size()).second) {
+      coldstart_classes.push_back(it->second);
     }
   }
-
-  while (old_no_ref != new_no_ref) {
-    old_no_ref = new_no_ref;
-    new_no_ref = 0;
-    cold_cold_references.clear();
-    walk::code(
-      input_scope,
-      [&](DexMethod* meth) {
-        return coldstart_classes.count(type_class(meth->get_class())) > 0;
+  // For each cold-start class, the other cold-start classes its code refers
+  // to, and the cold-start classes among its types.
+  size_t n = coldstart_classes.size();
+  std::vector<std::vector<uint32_t>> code_refs(n);
+  std::vector<std::vector<uint32_t>> type_refs(n);
+  auto gather_type_refs = [&](const DexClass* cls, std::vector<uint32_t>& ids) {
+    std::vector<DexType*> types;
+    cls->gather_types(types);
+    for (const auto& type : types) {
+      auto it = coldstart_ids.find(type_class(type));
+      if (it != coldstart_ids.end()) {
+        ids.push_back(it->second);
+      }
+    }
+    sort_unique(ids);
+  };
+  auto gather_wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        auto base_cls = coldstart_classes[i];
+        walk::code(
+          std::vector<DexClass*>{base_cls},
+          [&](DexMethod* meth, const IRCode& code) {
+            for (auto& mie : InstructionIterable(meth->get_code())) {
+              auto inst = mie.insn;
+              DexClass* called_cls = nullptr;
+              if (inst->has_method()) {
+                called_cls = type_class(inst->get_method()->get_class());
+              } else if (inst->has_field()) {
+                called_cls = type_class(inst->get_field()->get_class());
+              } else if (inst->has_type()) {
+                called_cls = type_class(inst->get_type());
+              }
+              if (called_cls != nullptr && base_cls != called_cls) {
+                auto it = coldstart_ids.find(called_cls);
+                if (it != coldstart_ids.end()) {
+                  code_refs[i].push_back(it->second);
+                }
+              }
+            }
+          });
+        sort_unique(code_refs[i]);
+        gather_type_refs(base_cls, type_refs[i]);
       },
-      [&](DexMethod* meth, const IRCode& code) {
-        auto base_cls = type_class(meth->get_class());
-        for (auto& mie : InstructionIterable(meth->get_code())) {
-          auto inst = mie.insn;
-          DexClass* called_cls = nullptr;
-          if (inst->has_method()) {
-            called_cls = type_class(inst->get_method()->get_class());
-          } else if (inst->has_field()) {
-            called_cls = type_class(inst->get_field()->get_class());
-          } else if (inst->has_type()) {
-            called_cls = type_class(inst->get_type());
-          }
-          if (called_cls != nullptr && base_cls != called_cls &&
-              coldstart_classes.count(called_cls) > 0) {
-            cold_cold_references.insert(called_cls);
-          }
-        }
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < n; ++i) {
+    gather_wq.add_item(i);
+  }
+  gather_wq.run_all();
+
+  // make sure we don't drop classes which might be called from native code,
+  // nor the cold-start classes among their types
+  std::vector<char> pinned(n, 0);
+  std::vector<uint32_t> type_count(n, 0);
+  for (const auto& cls : scope) {
+    if (can_rename(cls)) {
+      continue;
+    }
+    auto it = coldstart_ids.find(cls);
+    if (it != coldstart_ids.end()) {
+      pinned[it->second] = 1;
+    } else {
+      std::vector<uint32_t> ids;
+      gather_type_refs(cls, ids);
+      for (auto id : ids) {
+        ++type_count[id];
       }
-    );
-    for (const auto& cls: scope) {
-      // make sure we don't drop classes which might be called from native code
-      if (!can_rename(cls)) {
-        cold_cold_references.insert(cls);
+    }
+  }
+
+  // The first round judges all cold-start classes, and also counts the types
+  // of non-renamable classes outside the cold-start set. Later rounds only
+  // look at the cold-start classes still kept. If the first round drops
+  // nothing, there are no later rounds.
+  std::vector<uint32_t> code_count(n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    for (auto id : code_refs[i]) {
+      ++code_count[id];
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (pinned[i] || code_count[i] > 0) {
+      for (auto id : type_refs[i]) {
+        ++type_count[id];
       }
     }
-    // get all classes in the reference set, even if they are not referenced by
-    // opcodes directly
-    for (const auto& cls: input_scope) {
-      if (cold_cold_references.count(cls)) {
-        std::vector<DexType*> types;
-        cls->gather_types(types);
-        for (const auto& type: types) {
-          auto ref_cls = type_class(type);
-          cold_cold_references.insert(ref_cls);
-        }
+  }
+  std::vector<char> kept(n);
+  bool dropped_any = false;
+  for (size_t i = 0; i < n; ++i) {
+    kept[i] = pinned[i] || code_count[i] > 0 || type_count[i] > 0;
+    dropped_any |= !kept[i];
+  }
+  if (!dropped_any) {
+    TRACE(IDEX, 1, "found 0 classes in coldstart with no references\n");
+    return unreferenced_classes;
+  }
+
+  // Recount with only the kept classes. A class supplies its types while it
+  // is kept by one of the first two rules.
+  std::fill(code_count.begin(), code_count.end(), 0);
+  std::fill(type_count.begin(), type_count.end(), 0);
+  for (size_t i = 0; i < n; ++i) {
+    if (kept[i]) {
+      for (auto id : code_refs[i]) {
+        ++code_count[id];
       }
     }
-    Scope output_scope;
-    for (auto& cls : coldstart_classes) {
-      if (can_rename(cls) && cold_cold_references.count(cls) == 0) {
-        new_no_ref++;
-        unreferenced_classes.insert(cls);
-      } else {
-        output_scope.push_back(cls);
+  }
+  std::vector<char> supplies_types(n);
+  for (size_t i = 0; i < n; ++i) {
+    supplies_types[i] = kept[i] && (pinned[i] || code_count[i] > 0);
+    if (supplies_types[i]) {
+      for (auto id : type_refs[i]) {
+        ++type_count[id];
+      }
+    }
+  }
+
+  std::vector<uint32_t> worklist;
+  auto drop_if_unreferenced = [&](uint32_t id) {
+    if (kept[id] && !pinned[id] && code_count[id] == 0 &&
+        type_count[id] == 0) {
+      kept[id] = 0;
+      worklist.push_back(id);
+    }
+  };
+  for (size_t i = 0; i < n; ++i) {
+    drop_if_unreferenced(i);
+  }
+  while (!worklist.empty()) {
+    auto dropped = worklist.back();
+    worklist.pop_back();
+    for (auto id : code_refs[dropped]) {
+      if (--code_count[id] == 0 && supplies_types[id] && !pinned[id]) {
+        supplies_types[id] = 0;
+        for (auto type_id : type_refs[id]) {
+          --type_count[type_id];
+          drop_if_unreferenced(type_id);
+        }
       }
+      drop_if_unreferenced(id);
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (!kept[i]) {
+      unreferenced_classes.insert(coldstart_classes[i]);
     }
-    TRACE(IDEX, 1, "found %d classes in coldstart with no references\n",
-          new_no_ref);
-    input_scope = output_scope;
   }
+  TRACE(IDEX, 1, "found %zu classes in coldstart with no references\n",
+        unreferenced_classes.size());
   return unreferenced_classes;
 }
 
@@ -618,6 +951,7 @@ DexClassesVector run_interdex(InterDexPass* pass,
   }
 
   auto scope = build_class_scope(dexen);
+  summarize_class_refs(pass, scope);
 
   auto unreferenced_classes = find_unrefenced_coldstart_classes(
       scope,
@@ -839,12 +1173,22 @@ DexClassesVector run_interdex(InterDexPass* pass,
 %d in secondary dexes due to static analysis\n",
     cls_skipped_in_primary,
     cls_skipped_in_secondary);
+
+  pass->m_ref_summaries.reset();
   return outdex;
 }
 
 } // End namespace
 
 
+InterDexPass::InterDexPass() : Pass(INTERDEX_PASS_NAME) {
+  std::unique_ptr<InterDexRegistry> plugin =
+      std::make_unique<InterDexRegistry>();
+  PluginRegistry::get().register_pass(INTERDEX_PASS_NAME, std::move(plugin));
+}
+
+InterDexPass::~InterDexPass() {}
+
 void InterDexPass::run_pass(DexClassesVector& dexen,
                             Scope& original_scope,
                             ConfigFiles& cfg,
@@ -54,12 +54,12 @@ class InterDexPassPlugin {
 
 typedef PluginEntry<InterDexPassPlugin> InterDexRegistry;
 
+struct InterDexRefSummaries;
+
 class InterDexPass : public Pass {
  public:
-  InterDexPass() : Pass(INTERDEX_PASS_NAME) {
-    std::unique_ptr<InterDexRegistry> plugin = std::make_unique<InterDexRegistry>();
-    PluginRegistry::get().register_pass(INTERDEX_PASS_NAME, std::move(plugin));
-  }
+  InterDexPass();
+  ~InterDexPass();
 
   virtual void configure_pass(const PassConfig& pc) override {
     pc.get("static_prune", false, m_static_prune);
@@ -82,6 +82,8 @@ class InterDexPass : public Pass {
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
   std::vector<std::unique_ptr<InterDexPassPlugin>> m_plugins;
+  // The refs of every class being emitted, while the pass runs.
+  std::unique_ptr<InterDexRefSummaries> m_ref_summaries;
 
  private:
   bool m_static_prune;
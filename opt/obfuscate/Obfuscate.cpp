@@ -21,6 +21,7 @@
 #include "Trace.h"
 #include "VirtualRenamer.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -136,16 +137,83 @@ void get_totals(Scope& scope, RenameStats& stats) {
   }
 }
 
-} // end namespace
-
-void obfuscate(Scope& scope, RenameStats& stats) {
-  get_totals(scope, stats);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+/**
+ * Split the scope in groups of classes that can pick the new names of their
+ * members independently of the other groups. The names picked for a class
+ * depend on the names of the members of its super classes and subclasses,
+ * so a group holds whole hierarchies, up to (not including) the first
+ * external super class. Interfaces are grouped with their implementors.
+ * Classes are kept in scope order in a group, and the groups are ordered by
+ * their first class.
+ */
+std::vector<Scope> group_related_classes(const Scope& scope) {
+  std::unordered_map<const DexType*, size_t> index;
+  for (size_t i = 0; i < scope.size(); i++) {
+    if (scope[i]->is_external()) continue;
+    index.emplace(scope[i]->get_type(), i);
+  }
+  // union-find over the classes in scope
+  std::vector<size_t> parent(scope.size());
+  for (size_t i = 0; i < parent.size(); i++) {
+    parent[i] = i;
+  }
+  const auto find = [&](size_t i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  };
+  const auto unite = [&](size_t i, const DexType* type) {
+    const auto& it = index.find(type);
+    if (it == index.end()) return;
+    auto a = find(i);
+    auto b = find(it->second);
+    // keep the earlier class as the representative
+    if (a < b) {
+      parent[b] = a;
+    } else {
+      parent[a] = b;
+    }
+  };
+  for (size_t i = 0; i < scope.size(); i++) {
+    for (const auto& intf : scope[i]->get_interfaces()->get_type_list()) {
+      unite(i, intf);
+    }
+    // classes whose super classes are external still walk up to the
+    // internal ones above them
+    auto super = scope[i]->get_super_class();
+    while (super != nullptr) {
+      unite(i, super);
+      auto super_cls = type_class(super);
+      if (super_cls == nullptr) break;
+      super = super_cls->get_super_class();
+    }
+  }
 
-  DexFieldManager field_name_manager(new_dex_field_manager());
-  DexMethodManager method_name_manager = new_dex_method_manager();
+  std::vector<Scope> groups;
+  std::unordered_map<size_t, size_t> group_of_root;
+  for (size_t i = 0; i < scope.size(); i++) {
+    auto root = find(i);
+    auto group = group_of_root.emplace(root, groups.size());
+    if (group.second) {
+      groups.emplace_back();
+    }
+    groups[group.first->second].push_back(scope[i]);
+  }
+  return groups;
+}
 
-  for (DexClass* cls : scope) {
+/**
+ * Pick the new names of the fields and direct methods in classes.
+ * The managers are used for the given classes only, so that separate
+ * groups of classes can be worked on in parallel.
+ */
+void obfuscate_members(const Scope& classes,
+                       const ClassHierarchy& ch,
+                       DexFieldManager& field_name_manager,
+                       DexMethodManager& method_name_manager) {
+  for (DexClass* cls : classes) {
     always_assert_log(!cls->is_external(),
         "Shouldn't rename members of external classes. %s", SHOW(cls));
     // Checks to short-circuit expensive name-gathering logic (code is still
@@ -239,6 +307,46 @@ void obfuscate(Scope& scope, RenameStats& stats) {
           method_name_manager);
     }
   }
+}
+
+} // end namespace
+
+void obfuscate(Scope& scope, RenameStats& stats) {
+  obfuscate(scope, ClassScopes(scope), stats);
+}
+
+void obfuscate(Scope& scope,
+               const ClassScopes& class_scopes,
+               RenameStats& stats) {
+  const auto& ch = class_scopes.get_class_hierarchy();
+  get_totals(scope, stats);
+
+  // Pick the new names of each group of related classes on its own, then
+  // gather all of them in a single manager, in the order of the groups
+  const auto groups = group_related_classes(scope);
+  std::vector<DexFieldManager> field_name_managers;
+  std::vector<DexMethodManager> method_name_managers;
+  for (size_t i = 0; i < groups.size(); i++) {
+    field_name_managers.emplace_back(new_dex_field_manager());
+    method_name_managers.emplace_back(new_dex_method_manager());
+  }
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        obfuscate_members(
+            groups[i], ch, field_name_managers[i], method_name_managers[i]);
+      },
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < groups.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  DexFieldManager field_name_manager(new_dex_field_manager());
+  DexMethodManager method_name_manager = new_dex_method_manager();
+  for (size_t i = 0; i < groups.size(); i++) {
+    field_name_manager.merge(std::move(field_name_managers[i]));
+    method_name_manager.merge(std::move(method_name_managers[i]));
+  }
   field_name_manager.print_elements();
   method_name_manager.print_elements();
 
@@ -256,7 +364,7 @@ void obfuscate(Scope& scope, RenameStats& stats) {
   stats.fields_renamed = field_name_manager.commit_renamings_to_dex();
   stats.dmethods_renamed = method_name_manager.commit_renamings_to_dex();
 
-  stats.vmethods_renamed = rename_virtuals(scope);
+  stats.vmethods_renamed = rename_virtuals(scope, class_scopes);
 
   debug_logging(scope);
 
@@ -281,7 +389,7 @@ void ObfuscatePass::run_pass(DexStoresVector& stores,
   }
   auto scope = build_class_scope(stores);
   RenameStats stats;
-  obfuscate(scope, stats);
+  obfuscate(scope, *mgr.hierarchy_service().class_scopes(scope), stats);
   mgr.incr_metric(
       METRIC_FIELD_TOTAL, static_cast<int>(stats.fields_total));
   mgr.incr_metric(
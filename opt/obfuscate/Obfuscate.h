@@ -9,13 +9,23 @@
 
 #pragma once
 
+#include "ClassHierarchy.h"
 #include "PassManager.h"
+#include "VirtualScope.h"
 
 class ObfuscatePass : public Pass {
  public:
   ObfuscatePass() : Pass("ObfuscatePass") {}
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  // Renames fields and methods only, which leaves the class hierarchy intact.
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_SCOPES;
+  }
+  virtual uint32_t hierarchy_writes() const override {
+    return HA_CLASS_SCOPES;
+  }
 };
 
 struct RenameStats {
@@ -28,3 +38,6 @@ struct RenameStats {
 };
 
 void obfuscate(Scope& classes, RenameStats& stats);
+void obfuscate(Scope& classes,
+               const ClassScopes& class_scopes,
+               RenameStats& stats);
@@ -511,6 +511,26 @@ public:
         [sig_getter_fn(elem)][elem->get_name()].get() : emplace(elem);
   }
 
+  // Moves all the wrappers of another manager in this one. The managers must
+  // have been used on separate classes, only the wrappers of members of
+  // classes they share (external ones, never renamed) are kept from this one
+  void merge(DexElemManager&& other) {
+    for (auto& class_itr : other.elements) {
+      auto& sigs = elements[class_itr.first];
+      for (auto& type_itr : class_itr.second) {
+        auto& names = sigs[type_itr.first];
+        for (auto& name_wrap : type_itr.second) {
+          if (names.count(name_wrap.first) > 0) {
+            always_assert(!name_wrap.second->is_modified());
+            continue;
+          }
+          names.emplace(name_wrap.first, std::move(name_wrap.second));
+        }
+      }
+    }
+    other.elements.clear();
+  }
+
   // Commits all the renamings in elements to the dex by modifying the
   // underlying DexFields. Does in-place modification. Returns the number
   // of elements renamed
@@ -15,7 +15,9 @@
 #include "Resolver.h"
 #include "Trace.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 
@@ -196,6 +198,7 @@ struct VirtualRenamer {
       class_scopes(class_scopes),
       def_refs(def_refs) {}
 
+  int rename_type_scopes(const DexType* type, int& seed) const;
   int rename_virtual_scopes(const DexType* type, int& seed) const;
   int rename_interface_scopes(int& seed) const;
 
@@ -343,37 +346,47 @@ int VirtualRenamer::rename_interface_scopes(int& seed) const {
 }
 
 /**
- * Rename only scopes that are not interface and can_rename.
+ * Rename only scopes rooted at type that are not interface and can_rename.
  */
-int VirtualRenamer::rename_virtual_scopes(
+int VirtualRenamer::rename_type_scopes(
     const DexType* type, int& seed) const {
   int renamed = 0;
   const auto cls = type_class(type);
   TRACE(OBFUSCATE, 5, "Attempting to rename %s\n", SHOW(type));
-  // object or external classes are not renamable, move
-  // to the children
-  if (cls != nullptr && !cls->is_external()) {
-    const auto& scopes = class_scopes.get(type);
-    // rename all scopes at this level that are not interface
-    // and can be renamed
-    TRACE(OBFUSCATE, 5, "Found %ld scopes in %s\n", scopes.size(), SHOW(type));
-    for (auto& scope : scopes) {
-      if (!can_rename_scope(scope)) {
-        TRACE(OBFUSCATE, 5,
-            "Cannot rename %s\n", SHOW(scope->methods[0].first));
-        continue;
-      }
-      if (is_impl_scope(scope)) {
-        TRACE(OBFUSCATE, 5,
-            "Impl scope %s\n", SHOW(scope->methods[0].first));
-        continue;
-      }
-      auto name =  get_unescaped_name(scope, seed);
-      TRACE(OBFUSCATE, 5, "New name %s for %s\n",
-          SHOW(name), SHOW(scope->methods[0].first));
-      renamed += rename_scope(scope, def_refs, name);
+  // object or external classes are not renamable
+  if (cls == nullptr || cls->is_external()) return renamed;
+  const auto& scopes = class_scopes.get(type);
+  // rename all scopes at this level that are not interface
+  // and can be renamed
+  TRACE(OBFUSCATE, 5, "Found %ld scopes in %s\n", scopes.size(), SHOW(type));
+  for (auto& scope : scopes) {
+    if (!can_rename_scope(scope)) {
+      TRACE(OBFUSCATE, 5,
+          "Cannot rename %s\n", SHOW(scope->methods[0].first));
+      continue;
     }
+    if (is_impl_scope(scope)) {
+      TRACE(OBFUSCATE, 5,
+          "Impl scope %s\n", SHOW(scope->methods[0].first));
+      continue;
+    }
+    auto name =  get_unescaped_name(scope, seed);
+    TRACE(OBFUSCATE, 5, "New name %s for %s\n",
+        SHOW(name), SHOW(scope->methods[0].first));
+    renamed += rename_scope(scope, def_refs, name);
   }
+  return renamed;
+}
+
+/**
+ * Rename only scopes that are not interface and can_rename, in the
+ * hierarchy rooted at type.
+ */
+int VirtualRenamer::rename_virtual_scopes(
+    const DexType* type, int& seed) const {
+  // object or external classes are not renamable, move
+  // to the children
+  int renamed = rename_type_scopes(type, seed);
 
   // will be used for interface renaming, effectively this
   // gets the last name (seed) for all virtual scopes and
@@ -432,17 +445,41 @@ void collect_refs(Scope& scope, RefsMap& def_refs) {
  * Rename virtual methods.
  */
 size_t rename_virtuals(Scope& classes) {
-  // build a ClassScope a RefsMap and a VirtualRenamer
-  ClassScopes class_scopes(classes);
+  return rename_virtuals(classes, ClassScopes(classes));
+}
+
+size_t rename_virtuals(Scope& classes, const ClassScopes& class_scopes) {
+  // build a RefsMap and a VirtualRenamer
   scope_info(class_scopes);
   RefsMap def_refs;
   collect_refs(classes, def_refs);
   VirtualRenamer vr(class_scopes, def_refs);
 
-  // rename virtual only first
+  // rename virtual only first.
+  // Virtual scopes never span two hierarchies under Object, and each of
+  // them picks names starting from the seed left by Object, so they can be
+  // renamed in parallel with the same result as walking them in order
   const auto obj_t = get_object_type();
   int seed = 0;
-  size_t renamed = vr.rename_virtual_scopes(obj_t, seed);
+  size_t renamed = vr.rename_type_scopes(obj_t, seed);
+  const auto& children =
+      get_children(class_scopes.get_class_hierarchy(), obj_t);
+  std::vector<const DexType*> roots(children.begin(), children.end());
+  std::vector<int> root_seeds(roots.size(), seed);
+  std::vector<size_t> root_renamed(roots.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        root_renamed[i] = vr.rename_virtual_scopes(roots[i], root_seeds[i]);
+      },
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < roots.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  for (size_t i = 0; i < roots.size(); i++) {
+    renamed += root_renamed[i];
+    seed = std::max(seed, root_seeds[i]);
+  }
   TRACE(OBFUSCATE, 2, "Virtual renamed: %ld\n", renamed);
 
   // rename interfaces
@@ -12,3 +12,8 @@
 #include "Obfuscate.h"
 
 size_t rename_virtuals(Scope& scope);
+
+/**
+ * Same as above, with the virtual scopes of :scope already built.
+ */
+size_t rename_virtuals(Scope& scope, const ClassScopes& class_scopes);
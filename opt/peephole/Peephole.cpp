@@ -10,6 +10,8 @@
 #include "Peephole.h"
 
 #include <algorithm>
+#include <array>
+#include <bitset>
 #include <numeric>
 #include <unordered_map>
 #include <unordered_set>
@@ -98,6 +100,7 @@ enum class Register : uint16_t {
   pair_C = 6,
   pair_D = 8,
 };
+constexpr size_t kNumRegisters = static_cast<size_t>(Register::E) + 1;
 
 enum class Literal {
   // For an arbitrary literal argument
@@ -107,6 +110,8 @@ enum class Literal {
   // Directive: Write the length of string A as a 16-bit integer.
   Length_String_A,
 };
+constexpr size_t kNumLiterals =
+    static_cast<size_t>(Literal::Length_String_A) + 1;
 
 enum class String {
   // For arbitrary string arguments
@@ -129,16 +134,20 @@ enum class String {
   concat_string_A_long_int_A,
   Type_A_get_simple_name,
 };
+constexpr size_t kNumStrings =
+    static_cast<size_t>(String::Type_A_get_simple_name) + 1;
 
 enum class Type {
   A,
   B,
 };
+constexpr size_t kNumTypes = static_cast<size_t>(Type::B) + 1;
 
 enum class Field {
   A,
   B,
 };
+constexpr size_t kNumFields = static_cast<size_t>(Field::B) + 1;
 
 // Just a minimal refactor for long string constants.
 static const char* LjavaString = "Ljava/lang/String;";
@@ -238,6 +247,44 @@ struct DexPattern {
       : kind(Kind::copy), copy_index(index) {}
 };
 
+// Values bound to the placeholders of a pattern while matching it.
+// Placeholders are small enums, so the bindings are kept in a fixed-size array
+// indexed by the placeholder and resetting them only clears a bitmask.
+template <typename Key, typename Value, size_t N>
+class Bindings {
+ public:
+  void clear() { m_bound.reset(); }
+
+  bool contains(Key key) const { return m_bound.test(index(key)); }
+
+  const Value& at(Key key) const {
+    always_assert(contains(key));
+    return m_values[index(key)];
+  }
+
+  // Bind `key` to `value` unless it is bound already. Returns whether `key` is
+  // now bound to `value`.
+  bool bind(Key key, Value value) {
+    auto i = index(key);
+    if (m_bound.test(i)) {
+      return m_values[i] == value;
+    }
+    m_bound.set(i);
+    m_values[i] = value;
+    return true;
+  }
+
+ private:
+  static size_t index(Key key) {
+    auto i = static_cast<size_t>(key);
+    assert(i < N);
+    return i;
+  }
+
+  std::bitset<N> m_bound;
+  std::array<Value, N> m_values;
+};
+
 struct Matcher;
 
 struct Pattern {
@@ -262,19 +309,11 @@ struct Matcher {
   size_t match_index;
   std::vector<IRInstruction*> matched_instructions;
 
-  // Another reason why we need C++14...
-  struct EnumClassHash {
-    template <typename T>
-    size_t operator()(T t) const {
-      return static_cast<size_t>(t);
-    }
-  };
-
-  std::unordered_map<Register, uint16_t, EnumClassHash> matched_regs;
-  std::unordered_map<String, DexString*, EnumClassHash> matched_strings;
-  std::unordered_map<Literal, int64_t, EnumClassHash> matched_literals;
-  std::unordered_map<Type, DexType*, EnumClassHash> matched_types;
-  std::unordered_map<Field, DexFieldRef*, EnumClassHash> matched_fields;
+  Bindings<Register, uint16_t, kNumRegisters> matched_regs;
+  Bindings<String, DexString*, kNumStrings> matched_strings;
+  Bindings<Literal, int64_t, kNumLiterals> matched_literals;
+  Bindings<Type, DexType*, kNumTypes> matched_types;
+  Bindings<Field, DexFieldRef*, kNumFields> matched_fields;
 
   explicit Matcher(const Pattern& pattern) : pattern(pattern), match_index(0) {}
 
@@ -291,48 +330,29 @@ struct Matcher {
   // It updates the matching state for the given instruction. Returns true if
   // insn matches to the last 'match' pattern.
   bool try_match(IRInstruction* insn) {
+    // A placeholder observed already must match the same value again;
+    // a newly observed one is remembered.
     auto match_reg = [&](Register pattern_reg, uint16_t insn_reg) {
-      // This register has been observed already. Check whether they are same.
-      if (matched_regs.find(pattern_reg) != end(matched_regs)) {
-        return matched_regs.at(pattern_reg) == insn_reg;
-      }
-
-      // Newly observed. Remember it.
-      matched_regs.emplace(pattern_reg, insn_reg);
-      return true;
+      return matched_regs.bind(pattern_reg, insn_reg);
     };
 
     auto match_literal = [&](Literal lit_pattern, int64_t insn_literal_val) {
-      if (matched_literals.find(lit_pattern) != end(matched_literals)) {
-        return matched_literals.at(lit_pattern) == insn_literal_val;
-      }
-      matched_literals.emplace(lit_pattern, insn_literal_val);
-      return true;
+      return matched_literals.bind(lit_pattern, insn_literal_val);
     };
 
     auto match_string = [&](String str_pattern, DexString* insn_str) {
       if (str_pattern == String::empty) {
         return (insn_str->is_simple() && insn_str->size() == 0);
       }
-      if (matched_strings.find(str_pattern) != end(matched_strings)) {
-        return matched_strings.at(str_pattern) == insn_str;
-      }
-      matched_strings.emplace(str_pattern, insn_str);
-      return true;
+      return matched_strings.bind(str_pattern, insn_str);
     };
 
     auto match_type = [&](Type type_pattern, DexType* insn_type) {
-      if (matched_types.find(type_pattern) != end(matched_types)) {
-        return matched_types.at(type_pattern) == insn_type;
-      }
-      matched_types.emplace(type_pattern, insn_type);
-      return true;
+      return matched_types.bind(type_pattern, insn_type);
     };
 
     auto match_field = [&](Field field_pattern, DexFieldRef* insn_field) {
-      auto result = matched_fields.emplace(field_pattern, insn_field);
-      bool newly_inserted = result.second;
-      return newly_inserted ? true : result.first->second == insn_field;
+      return matched_fields.bind(field_pattern, insn_field);
     };
 
     // Does 'insn' match to the given DexPattern?
@@ -517,13 +537,13 @@ struct Matcher {
       if (replace_info.dests.size() > 0) {
         assert(replace_info.dests.size() == 1);
         const Register dest = replace_info.dests[0];
-        always_assert(matched_regs.find(dest) != end(matched_regs));
+        always_assert(matched_regs.contains(dest));
         replace->set_dest(matched_regs.at(dest));
       }
 
       for (size_t i = 0; i < replace_info.srcs.size(); ++i) {
         const Register reg = replace_info.srcs[i];
-        always_assert(matched_regs.find(reg) != end(matched_regs));
+        always_assert(matched_regs.contains(reg));
         replace->set_src(i, matched_regs.at(reg));
       }
 
@@ -1420,10 +1440,69 @@ bool contains(const std::vector<T>& vec, const T& value) {
   return std::find(vec.begin(), vec.end(), value) != vec.end();
 }
 
+constexpr size_t kNumOpcodes = IOPCODE_MOVE_RESULT_PSEUDO_WIDE + 1;
+
+// The opcodes and invoked methods present in a piece of code.
+struct CodeFeatures {
+  std::bitset<kNumOpcodes> opcodes;
+  std::unordered_set<DexMethodRef*> methods;
+
+  void gather(IRCode* code) {
+    opcodes.reset();
+    methods.clear();
+    for (const auto& mie : InstructionIterable(code)) {
+      auto insn = mie.insn;
+      opcodes.set(insn->opcode());
+      if (insn->has_method()) {
+        methods.insert(insn->get_method());
+      }
+    }
+  }
+};
+
+// What code must contain for a pattern to possibly match it: one of the
+// opcodes of every instruction of the pattern, and every method the pattern
+// invokes. Most patterns are about a handful of library methods, so this
+// rules out the vast majority of (pattern, method) pairs without scanning the
+// method once per pattern.
+struct PatternRequirements {
+  std::vector<std::bitset<kNumOpcodes>> opcodes;
+  std::vector<DexMethodRef*> methods;
+
+  explicit PatternRequirements(const Pattern& pattern) {
+    for (const auto& dex_pattern : pattern.match) {
+      std::bitset<kNumOpcodes> any_of;
+      for (auto op : dex_pattern.opcodes) {
+        any_of.set(op);
+      }
+      opcodes.push_back(any_of);
+      if (dex_pattern.kind == DexPattern::Kind::method) {
+        methods.push_back(dex_pattern.method);
+      }
+    }
+  }
+
+  bool may_match(const CodeFeatures& features) const {
+    for (const auto& any_of : opcodes) {
+      if ((any_of & features.opcodes).none()) {
+        return false;
+      }
+    }
+    for (auto method : methods) {
+      if (features.methods.count(method) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
 class PeepholeOptimizer {
  private:
   std::vector<Matcher> m_matchers;
+  std::vector<PatternRequirements> m_requirements;
   std::vector<size_t> m_stats;
+  CodeFeatures m_features;
   PassManager& m_mgr;
   int m_stats_removed = 0;
   int m_stats_inserted = 0;
@@ -1436,6 +1515,7 @@ class PeepholeOptimizer {
       for (const Pattern& pattern : pattern_list) {
         if (!contains(disabled_peepholes, pattern.name)) {
           m_matchers.emplace_back(pattern);
+          m_requirements.emplace_back(pattern);
         } else {
           TRACE(PEEPHOLE,
                 2,
@@ -1452,11 +1532,19 @@ class PeepholeOptimizer {
 
   void peephole(DexMethod* method) {
     auto code = method->get_code();
-    code->build_cfg();
+    m_features.gather(code);
+    bool cfg_built = false;
 
     // do optimizations one at a time
     // so they can match on the same pattern without interfering
     for (size_t i = 0; i < m_matchers.size(); ++i) {
+      if (!m_requirements[i].may_match(m_features)) {
+        continue;
+      }
+      if (!cfg_built) {
+        code->build_cfg();
+        cfg_built = true;
+      }
       auto& matcher = m_matchers[i];
       std::vector<IRInstruction*> deletes;
       std::vector<std::pair<IRInstruction*, std::vector<IRInstruction*>>>
@@ -1501,6 +1589,10 @@ class PeepholeOptimizer {
       for (auto& insn : deletes) {
         code->remove_opcode(insn);
       }
+      // the replacements may enable patterns we ruled out
+      if (!inserts.empty()) {
+        m_features.gather(code);
+      }
     }
   }
 
@@ -367,6 +367,7 @@ void RemoveBuildersPass::run_pass(DexStoresVector& stores,
         if (was_not_removed) {
           kept_builders.emplace(builder_cls);
           method->set_code(method_copy->release_code());
+          b_transform.invalidate(method);
         } else {
           b_counter.methods_cleared++;
           removed_builders.emplace(builder_cls);
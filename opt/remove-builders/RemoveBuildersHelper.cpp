@@ -1152,6 +1152,9 @@ bool BuilderTransform::inline_methods(
     return false;
   }
 
+  // The method may have been rewritten since it was last inlined into.
+  m_inliner->invalidate_summary(method);
+
   std::vector<DexMethod*> previous_to_inline;
   std::vector<DexMethod*> to_inline = get_methods_to_inline(code, type);
 
@@ -1184,10 +1187,12 @@ bool BuilderTransform::inline_methods(
   return true;
 }
 
-bool remove_builder_from(DexMethod* method,
-                         DexClass* builder,
-                         BuilderTransform& b_transform,
-                         DexType* super_class_holder) {
+namespace {
+
+bool rewrite_builder_uses(DexMethod* method,
+                          DexClass* builder,
+                          BuilderTransform& b_transform,
+                          DexType* super_class_holder) {
   DexType* buildee = get_buildee(builder->get_type());
   always_assert(buildee != nullptr);
 
@@ -1233,3 +1238,17 @@ bool remove_builder_from(DexMethod* method,
   }
   return true;
 }
+
+} // namespace
+
+bool remove_builder_from(DexMethod* method,
+                         DexClass* builder,
+                         BuilderTransform& b_transform,
+                         DexType* super_class_holder) {
+  bool removed =
+      rewrite_builder_uses(method, builder, b_transform, super_class_holder);
+  // the method was rewritten outside of the inliner, even if we gave up
+  // half way
+  b_transform.invalidate(method);
+  return removed;
+}
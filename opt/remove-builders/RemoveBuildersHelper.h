@@ -111,6 +111,12 @@ class BuilderTransform {
                       std::function<std::vector<DexMethod*>(IRCode*, DexType*)>
                           get_methods_to_inline);
 
+  /**
+   * Drop what the inliner knows about a method whose code was changed
+   * outside of it.
+   */
+  void invalidate(DexMethod* method) { m_inliner->invalidate_summary(method); }
+
  private:
   std::unique_ptr<MultiMethodInliner> m_inliner;
   MultiMethodInliner::Config m_inliner_config;
@@ -711,8 +711,8 @@ void RenameClassesPassV2::eval_pass(DexStoresVector& stores,
   PassConfig pc(config);
   pc.get("apk_dir", "", m_apk_dir);
   auto scope = build_class_scope(stores);
-  ClassHierarchy class_hierarchy = build_type_hierarchy(scope);
-  eval_classes(scope, class_hierarchy, cfg, m_rename_annotations, mgr);
+  auto class_hierarchy = mgr.hierarchy_service().class_hierarchy(scope);
+  eval_classes(scope, *class_hierarchy, cfg, m_rename_annotations, mgr);
 }
 
 void RenameClassesPassV2::rename_classes(
@@ -909,33 +909,10 @@ void RenameClassesPassV2::rename_classes_in_layouts(
       JavaNameUtil::internal_to_external(apair.first->str()),
       JavaNameUtil::internal_to_external(apair.second->str()));
   }
-  ssize_t layout_bytes_delta = 0;
-  size_t num_layout_renamed = 0;
-  auto xml_files = get_xml_files(m_apk_dir + "/res");
-  for (const auto& path : xml_files) {
-    if (is_raw_resource(path)) {
-      continue;
-    }
-    size_t num_renamed = 0;
-    ssize_t out_delta = 0;
-    TRACE(RENAME, 5, "Begin rename Views in layout %s\n", path.c_str());
-    rename_classes_in_layout(path, aliases_for_layouts, &num_renamed, &out_delta);
-    TRACE(
-      RENAME,
-      3,
-      "Renamed %zu ResStringPool entries in layout %s\n",
-      num_renamed,
-      path.c_str());
-    layout_bytes_delta += out_delta;
-    num_layout_renamed += num_renamed;
-  }
-  mgr.incr_metric("layout_bytes_delta", layout_bytes_delta);
-  TRACE(
-    RENAME,
-    2,
-    "Renamed %zu ResStringPool entries, delta %zi bytes\n",
-    num_layout_renamed,
-    layout_bytes_delta);
+  // The layouts are rewritten once all passes have queued their edits.
+  mgr.apk_manager().xml_edits().rename_strings(aliases_for_layouts);
+  TRACE(RENAME, 2, "Queued %zu class renames for layouts\n",
+        aliases_for_layouts.size());
 }
 
 void RenameClassesPassV2::run_pass(DexStoresVector& stores,
@@ -948,8 +925,8 @@ void RenameClassesPassV2::run_pass(DexStoresVector& stores,
     return;
   }
   auto scope = build_class_scope(stores);
-  ClassHierarchy class_hierarchy = build_type_hierarchy(scope);
-  eval_classes_post(scope, class_hierarchy, mgr);
+  auto class_hierarchy = mgr.hierarchy_service().class_hierarchy(scope);
+  eval_classes_post(scope, *class_hierarchy, mgr);
   int total_classes = scope.size();
 
   s_base_strings_size = 0;
@@ -58,6 +58,9 @@ class RenameClassesPassV2 : public Pass {
       ConfigFiles& cfg, PassManager& mgr) override;
   virtual void run_pass(DexStoresVector& stores,
       ConfigFiles& cfg, PassManager& mgr) override;
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
 
  private:
   std::unordered_map<const DexType*, std::string>
@@ -101,28 +101,36 @@ void SimpleInlinePass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassM
   size_t inlined_count = inlined.size();
   size_t deleted = delete_methods(scope, inlined, resolver);
 
-  TRACE(SINL, 3, "recursive %ld\n", inliner.get_info().recursive);
-  TRACE(SINL, 3, "blacklisted meths %ld\n", inliner.get_info().blacklisted);
-  TRACE(SINL, 3, "virtualizing methods %ld\n", inliner.get_info().need_vmethod);
-  TRACE(SINL, 3, "invoke super %ld\n", inliner.get_info().invoke_super);
-  TRACE(SINL, 3, "override inputs %ld\n", inliner.get_info().write_over_ins);
-  TRACE(SINL, 3, "escaped virtual %ld\n", inliner.get_info().escaped_virtual);
+  TRACE(SINL, 3, "recursive %ld\n", inliner.get_info().recursive.load());
+  TRACE(SINL, 3, "blacklisted meths %ld\n",
+      inliner.get_info().blacklisted.load());
+  TRACE(SINL, 3, "virtualizing methods %ld\n",
+      inliner.get_info().need_vmethod.load());
+  TRACE(SINL, 3, "invoke super %ld\n", inliner.get_info().invoke_super.load());
+  TRACE(SINL, 3, "override inputs %ld\n",
+      inliner.get_info().write_over_ins.load());
+  TRACE(SINL, 3, "escaped virtual %ld\n",
+      inliner.get_info().escaped_virtual.load());
   TRACE(SINL, 3, "known non public virtual %ld\n",
-      inliner.get_info().non_pub_virtual);
-  TRACE(SINL, 3, "non public ctor %ld\n", inliner.get_info().non_pub_ctor);
-  TRACE(SINL, 3, "unknown field %ld\n", inliner.get_info().escaped_field);
-  TRACE(SINL, 3, "non public field %ld\n", inliner.get_info().non_pub_field);
-  TRACE(SINL, 3, "throws %ld\n", inliner.get_info().throws);
-  TRACE(SINL, 3, "multiple returns %ld\n", inliner.get_info().multi_ret);
+      inliner.get_info().non_pub_virtual.load());
+  TRACE(SINL, 3, "non public ctor %ld\n",
+      inliner.get_info().non_pub_ctor.load());
+  TRACE(SINL, 3, "unknown field %ld\n",
+      inliner.get_info().escaped_field.load());
+  TRACE(SINL, 3, "non public field %ld\n",
+      inliner.get_info().non_pub_field.load());
+  TRACE(SINL, 3, "throws %ld\n", inliner.get_info().throws.load());
+  TRACE(SINL, 3, "multiple returns %ld\n", inliner.get_info().multi_ret.load());
   TRACE(SINL, 3, "references cross stores %ld\n",
-      inliner.get_info().cross_store);
-  TRACE(SINL, 3, "not found %ld\n", inliner.get_info().not_found);
-  TRACE(SINL, 3, "caller too large %ld\n", inliner.get_info().caller_too_large);
+      inliner.get_info().cross_store.load());
+  TRACE(SINL, 3, "not found %ld\n", inliner.get_info().not_found.load());
+  TRACE(SINL, 3, "caller too large %ld\n",
+      inliner.get_info().caller_too_large.load());
   TRACE(SINL, 1,
       "%ld inlined calls over %ld methods and %ld methods removed\n",
-      inliner.get_info().calls_inlined, inlined_count, deleted);
+      inliner.get_info().calls_inlined.load(), inlined_count, deleted);
 
-  mgr.incr_metric("calls_inlined", inliner.get_info().calls_inlined);
+  mgr.incr_metric("calls_inlined", inliner.get_info().calls_inlined.load());
   mgr.incr_metric("methods_removed", deleted);
 }
 
@@ -31,6 +31,7 @@ class SimpleInlinePass : public Pass {
     pc.get("no_inline_annos", {}, m_no_inline_annos);
     pc.get("force_inline_annos", {}, m_force_inline_annos);
     pc.get("multiple_callers", false, m_multiple_callers);
+    pc.get("parallel", true, m_inliner_config.parallel);
 
     std::vector<std::string> black_list;
     pc.get("black_list", {}, black_list);
@@ -101,7 +101,7 @@ const int MAX_PASSES = 8;
 
 void SingleImplPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {
   auto scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+  auto ch = mgr.hierarchy_service().class_hierarchy(scope);
   int max_steps = 0;
   size_t previous_invoke_intf_count = s_invoke_intf_count;
   removed_count = 0;
@@ -117,7 +117,7 @@ void SingleImplPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassMan
         SingleImplAnalysis::analyze(
             scope, stores, single_impl, intfs, m_pass_config);
     auto optimized = optimize(
-        std::move(single_impls), ch, scope, m_pass_config);
+        std::move(single_impls), *ch, scope, m_pass_config);
     if (optimized == 0 || ++max_steps >= MAX_PASSES) break;
     removed_count += optimized;
     assert(scope_size > scope.size());
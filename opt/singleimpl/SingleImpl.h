@@ -39,6 +39,10 @@ class SingleImplPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
+
   // count of removed interfaces
   size_t removed_count{0};
 
@@ -378,7 +378,8 @@ void StaticSinkPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassMan
     TRACE(SINK, 1, "StaticSinkPass not run because no ProGuard configuration was provided.");
     return;
   }
-  ClassHierarchy ch = build_type_hierarchy(build_class_scope(stores));
+  auto ch =
+      mgr.hierarchy_service().class_hierarchy(build_class_scope(stores));
   DexClassesVector& root_store = stores[0].get_dexen();
   auto method_list = cfg.get_coldstart_methods();
   auto methods = strings_to_dexmethods(method_list);
@@ -391,7 +392,7 @@ void StaticSinkPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassMan
   TRACE(SINK, 1, "statics after removing primary dex: %lu\n", statics.size());
   auto sink_map = get_sink_map(stores, coldstart_classes, statics);
   TRACE(SINK, 1, "statics with sinkable callsite: %lu\n", sink_map.size());
-  auto holder = move_statics_out(ch, statics, sink_map);
+  auto holder = move_statics_out(*ch, statics, sink_map);
   TRACE(SINK, 1, "methods in static holder: %lu\n",
           holder->get_dmethods().size());
   DexClasses dc(1);
@@ -908,12 +908,12 @@ void SynthPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager&
     return;
   }
   Scope scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+  auto ch = mgr.hierarchy_service().class_hierarchy(scope);
   SynthMetrics metrics;
   int passes = 0;
   do {
     TRACE(SYNT, 1, "Synth removal, pass %d\n", passes);
-    bool more_opt_needed = optimize(ch, scope, m_pass_config, metrics);
+    bool more_opt_needed = optimize(*ch, scope, m_pass_config, metrics);
     if (!more_opt_needed) break;
   } while (++passes < m_pass_config.max_passes);
 
@@ -25,6 +25,10 @@ class SynthPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
+
  private:
   SynthConfig m_pass_config;
 };
@@ -25,6 +25,7 @@
 #include "Walkers.h"
 #include "UnterfaceOpt.h"
 #include "ClassHierarchy.h"
+#include "PassManager.h"
 
 namespace {
 
@@ -183,7 +184,7 @@ using ImplsFilter = std::function<bool (std::unordered_set<DexClass*>&)>;
  */
 class InterfaceImplementations {
 public:
-  InterfaceImplementations(Scope& scope);
+  InterfaceImplementations(Scope& scope, const ClassHierarchy& ch);
   TypeRelationship match(IntfFilter intf_filter, ImplsFilter impls_filter);
 
   Trait get_intf_traits(DexClass* intf) {
@@ -203,7 +204,7 @@ public:
 
 private:
   Scope& scope;
-  ClassHierarchy ch;
+  const ClassHierarchy& ch;
   ClassSet ifset;
   ClassTraits intf_traits;
   TypeRelationship intf_to_impls;
@@ -235,9 +236,9 @@ TypeRelationship InterfaceImplementations::match(
   return intf_impls;
 }
 
-InterfaceImplementations::InterfaceImplementations(Scope& scope)
-    : scope(scope) {
-  ch = build_type_hierarchy(scope);
+InterfaceImplementations::InterfaceImplementations(Scope& scope,
+                                                   const ClassHierarchy& ch)
+    : scope(scope), ch(ch) {
   load_interfaces();
   for (auto intf : ifset) {
     intf_traits[intf] = NO_TRAIT;
@@ -438,7 +439,8 @@ TypeRelationship exclude(InterfaceImplementations& interfaces,
 void UnterfacePass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {
   Scope scope = build_class_scope(stores);
 
-  InterfaceImplementations interfaces(scope);
+  auto ch = mgr.hierarchy_service().class_hierarchy(scope);
+  InterfaceImplementations interfaces(scope, *ch);
   assert(interfaces.print_all());
 
   auto one_level = exclude(interfaces,
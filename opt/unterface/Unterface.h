@@ -16,4 +16,8 @@ class UnterfacePass : public Pass {
   UnterfacePass() : Pass("UnterfacePass") {}
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual uint32_t hierarchy_reads() const override {
+    return HA_CLASS_HIERARCHY;
+  }
 };
@@ -57,7 +57,7 @@ void FixpointIterator::analyze_node(DexMethod* const& method,
 }
 
 Domain FixpointIterator::analyze_edge(
-    const std::shared_ptr<call_graph::Edge>& edge,
+    const call_graph::EdgeId& edge,
     const Domain& exit_state_at_source) const {
   Domain entry_state_at_dest;
   auto it = edge->invoke_iterator();
@@ -76,7 +76,7 @@ class FixpointIterator
   void analyze_node(DexMethod* const& method,
                     Domain* current_state) const override;
 
-  Domain analyze_edge(const std::shared_ptr<call_graph::Edge>& edge,
+  Domain analyze_edge(const call_graph::EdgeId& edge,
                       const Domain& exit_state_at_source) const override;
 
   std::unique_ptr<intraprocedural::FixpointIterator>
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+
+#include "RedexTest.h"
+
+inline std::string read_file(const std::string& path) {
+  std::ifstream is(path, std::ifstream::binary);
+  std::stringstream ss;
+  ss << is.rdbuf();
+  return ss.str();
+}
+
+inline void write_file(const std::string& path, const std::string& content) {
+  std::ofstream os(path, std::ofstream::binary | std::ofstream::trunc);
+  os << content;
+}
+
+// Out of range for any offset, count or id of the files the tests write.
+constexpr uint32_t OUT_OF_RANGE_WORD = 0xfffffff0;
+
+// :file with the word at byte :offset set to :value.
+inline std::string with_word(std::string file, size_t offset, uint32_t value) {
+  memcpy(&file[offset], &value, sizeof(value));
+  return file;
+}
+
+// Calls check() with each prefix of :file whose size is a multiple of :step.
+template <class Check>
+void for_each_truncation(const std::string& file,
+                         size_t step,
+                         const Check& check) {
+  for (size_t size = 0; size < file.size(); size += step) {
+    check(file.substr(0, size));
+  }
+}
+
+// Calls check() with :file with each of the words [begin, end) in turn set
+// out of range.
+template <class Check>
+void for_each_corrupt_word(const std::string& file,
+                           size_t begin,
+                           size_t end,
+                           const Check& check) {
+  for (size_t word = begin; word < end; ++word) {
+    check(with_word(file, word * 4, OUT_OF_RANGE_WORD));
+  }
+}
+
+/*
+ * A RedexTest with a fresh temporary directory, for the tests that write
+ * files and read them back, corrupt ones included.
+ */
+struct TempDirTest : public RedexTest {
+  TempDirTest()
+      : m_dir(boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path()) {
+    boost::filesystem::create_directories(m_dir);
+  }
+
+  ~TempDirTest() { boost::filesystem::remove_all(m_dir); }
+
+  std::string path(const std::string& name) const {
+    return (m_dir / name).string();
+  }
+
+  // A check that writes the corrupt file it is given and expects open() to
+  // fail on it.
+  template <class Open>
+  std::function<void(const std::string&)> expect_rejected_by(Open open) {
+    return [this, open](const std::string& corrupt) {
+      auto corrupt_path = path("corrupt");
+      write_file(corrupt_path, corrupt);
+      EXPECT_FALSE(open(corrupt_path));
+    };
+  }
+
+  boost::filesystem::path m_dir;
+};
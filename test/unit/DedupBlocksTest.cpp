@@ -17,6 +17,7 @@
 #include "DexUtil.h"
 #include "IRAssembler.h"
 #include "IRCode.h"
+#include "IRTypeChecker.h"
 
 struct Branch {
   MethodItemEntry* source;
@@ -405,3 +406,107 @@ TEST_F(DedupBlocksTest, diamond) {
       << cfg_str(expected_code.get()) << SHOW(expected_code) << "actual:\n"
       << cfg_str(code) << SHOW(method->get_code());
 }
+
+// The block that logs and returns 42 is the same in `a`, `b` and `c`, and
+// reads no register it doesn't write. It is outlined and every occurrence is
+// replaced by a call. The block of `d` logs other strings and stays.
+TEST_F(DedupBlocksTest, outlineAcrossMethods) {
+  ClassCreator creator(DexType::make_type("Lcom/example/Foo;"));
+  creator.set_access(ACC_PUBLIC);
+  creator.set_super(get_object_type());
+  auto log = static_cast<DexMethod*>(
+      DexMethod::make_method("Lcom/example/Foo;.log:(Ljava/lang/String;)V"));
+  log->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  creator.add_method(log);
+
+  auto make_block = [](const std::string& str) {
+    std::string block;
+    for (int i = 0; i < 4; ++i) {
+      block += R"(
+        (const-string ")" + str + std::to_string(i) + R"(")
+        (move-result-pseudo-object v0)
+        (invoke-static (v0) "Lcom/example/Foo;.log:(Ljava/lang/String;)V")
+      )";
+    }
+    return block + R"(
+      (const v1 42)
+      (return v1)
+    )";
+  };
+  auto make_code = [&](const std::string& str) {
+    return R"(
+      (
+        (load-param v2)
+        (if-eqz v2 :shared)
+        (return v2)
+        (:shared)
+      )" + make_block(str) + ")";
+  };
+  std::vector<DexMethod*> methods;
+  for (auto name : {"a", "b", "c", "d"}) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        std::string("Lcom/example/Foo;.") + name + ":(I)I"));
+    method->make_concrete(
+        ACC_PUBLIC | ACC_STATIC,
+        assembler::ircode_from_string(make_code(*name == 'd' ? "x" : "a")),
+        false);
+    creator.add_method(method);
+    methods.push_back(method);
+  }
+  auto foo = creator.create();
+
+  std::vector<DexStore> stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes({});
+  store.add_classes({foo});
+  stores.emplace_back(std::move(store));
+  auto pass = new DedupBlocksPass();
+  pass->m_config.cross_method_outline = true;
+  PassManager manager({pass});
+  manager.set_testing_mode();
+  Scope external_classes;
+  Json::Value conf_obj = Json::nullValue;
+  ConfigFiles dummy_config(conf_obj);
+  manager.run_passes(stores, external_classes, dummy_config);
+
+  auto outlined_cls =
+      type_class(DexType::get_type("Lcom/facebook/redex/OutlinedBlocks;"));
+  ASSERT_NE(outlined_cls, nullptr);
+  EXPECT_EQ(outlined_cls, stores[0].get_dexen().back().back());
+  ASSERT_EQ(1, outlined_cls->get_dmethods().size());
+  auto outlined = outlined_cls->get_dmethods().front();
+  EXPECT_TRUE(is_public(outlined) && is_static(outlined));
+  auto expected_outlined = "(" + make_block("a") + ")";
+  EXPECT_EQ(assembler::to_s_expr(
+                assembler::ircode_from_string(expected_outlined).get()),
+            assembler::to_s_expr(outlined->get_code()));
+
+  auto expected_call = assembler::ircode_from_string(R"(
+    (
+      (load-param v2)
+      (if-eqz v2 :shared)
+      (return v2)
+      (:shared)
+      (invoke-static () ")" + show(outlined) + R"(")
+      (move-result v1)
+      (return v1)
+    )
+  )");
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(assembler::to_s_expr(expected_call.get()),
+              assembler::to_s_expr(methods[i]->get_code()))
+        << SHOW(methods[i]);
+  }
+  EXPECT_EQ(
+      assembler::to_s_expr(assembler::ircode_from_string(make_code("x")).get()),
+      assembler::to_s_expr(methods[3]->get_code()));
+
+  methods.push_back(outlined);
+  for (auto method : methods) {
+    IRTypeChecker checker(method);
+    checker.run();
+    EXPECT_TRUE(checker.good()) << checker.what();
+  }
+}
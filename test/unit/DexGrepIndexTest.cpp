@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <json/json.h>
+#include <sys/mman.h>
+
+#include "ConfigFiles.h"
+#include "Creators.h"
+#include "DexClass.h"
+#include "DexCommon.h"
+#include "DexGrepIndex.h"
+#include "DexOutput.h"
+#include "DexPosition.h"
+#include "TempDirTest.h"
+
+namespace {
+
+DexClass* make_class(const char* name) {
+  ClassCreator creator(DexType::make_type(name));
+  creator.set_access(ACC_PUBLIC | ACC_ABSTRACT);
+  creator.set_super(get_object_type());
+  return creator.create();
+}
+
+void write_dex(const std::string& path, DexClasses classes) {
+  Json::Value json(Json::objectValue);
+  ConfigFiles cfg(json);
+  std::unique_ptr<PositionMapper> pos_mapper(PositionMapper::make("", ""));
+  write_classes_to_dex(
+      path, &classes, nullptr, 0, cfg, json, pos_mapper.get());
+}
+
+/*
+ * The classes of :dexfiles that contain :needle, found the way dexgrep does
+ * without an index.
+ */
+std::vector<std::string> scan(const std::vector<std::string>& dexfiles,
+                              const char* needle) {
+  std::vector<std::string> ret;
+  for (const auto& dexfile : dexfiles) {
+    ddump_data rd;
+    EXPECT_TRUE(try_open_dex_file(dexfile.c_str(), &rd));
+    for (uint32_t i = 0; i < rd.dexh->class_defs_size; i++) {
+      auto name = dex_string_by_type_idx(&rd, rd.dex_class_defs[i].typeidx);
+      if (strstr(name, needle) != nullptr) {
+        ret.push_back(dexfile + ": " + name);
+      }
+    }
+    munmap(rd.dexmmap, rd.dex_size);
+  }
+  return ret;
+}
+
+std::vector<std::string> describe(const DexGrepIndex& index,
+                                  const std::vector<uint32_t>& ids,
+                                  uint16_t kinds) {
+  std::vector<std::string> ret;
+  for (const auto& hit : index.hits(ids, kinds)) {
+    std::string line = index.dex_name(hit.dex);
+    if (kinds != SK_CLASS) {
+      line += std::string(": ") + symbol_kind_name(hit.kind);
+    }
+    ret.push_back(line + ": " + index.symbol(hit.symbol));
+  }
+  return ret;
+}
+
+} // namespace
+
+class DexGrepIndexTest : public TempDirTest {
+ protected:
+  void SetUp() override {
+    m_index = path("index");
+
+    // Classes are defined out of name order, so that the order of the
+    // matches tells whether they come in definition order.
+    auto zoo = make_class("Lcom/example/Zoo;");
+    auto count = static_cast<DexField*>(DexField::make_field(
+        zoo->get_type(), DexString::make_string("count"), get_int_type()));
+    count->make_concrete(ACC_PUBLIC);
+    zoo->add_field(count);
+    auto run = static_cast<DexMethod*>(DexMethod::make_method(
+        "Lcom/example/Zoo;", "run", "V", {}));
+    run->make_concrete(ACC_PUBLIC | ACC_ABSTRACT, true);
+    zoo->add_method(run);
+    auto apple = make_class("Lcom/example/Apple;");
+    auto mango = make_class("Lcom/example/Mango;");
+
+    m_dexfiles = {path("classes.dex"), path("classes2.dex")};
+    write_dex(m_dexfiles[0], {zoo, apple});
+    write_dex(m_dexfiles[1], {mango});
+  }
+
+  std::string m_index;
+  std::vector<std::string> m_dexfiles;
+};
+
+TEST_F(DexGrepIndexTest, matchesScan) {
+  ASSERT_TRUE(build_index(m_dexfiles, m_index.c_str()));
+  auto index = DexGrepIndex::open(m_index.c_str());
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(2, index->dex_count());
+
+  // Short needles scan the symbols, longer ones go through the trigrams.
+  for (auto needle : {"L", "com/example", "Zoo", "Mango;", "nothing"}) {
+    EXPECT_EQ(scan(m_dexfiles, needle),
+              describe(*index, index->find(needle), SK_CLASS))
+        << needle;
+  }
+  auto dex0 = m_dexfiles[0] + ": ";
+  EXPECT_EQ(std::vector<std::string>({dex0 + "Lcom/example/Zoo;",
+                                      dex0 + "Lcom/example/Apple;"}),
+            scan({m_dexfiles[0]}, "L"));
+
+  EXPECT_EQ(
+      std::vector<std::string>({dex0 + "class: Lcom/example/Zoo;",
+                                dex0 + "type: Lcom/example/Zoo;",
+                                dex0 + "method: Lcom/example/Zoo;.run:()V",
+                                dex0 + "field: Lcom/example/Zoo;.count:I"}),
+      describe(*index,
+               index->find("Zoo;"),
+               SK_CLASS | SK_TYPE | SK_METHOD | SK_FIELD));
+}
+
+TEST_F(DexGrepIndexTest, unreadableDexFailsTheBuild) {
+  auto not_a_dex = path("not_a.dex");
+  write_file(not_a_dex, std::string(256, 'x'));
+  EXPECT_FALSE(build_index({m_dexfiles[0], not_a_dex}, m_index.c_str()));
+  EXPECT_FALSE(build_index({path("missing.dex")}, m_index.c_str()));
+}
+
+TEST_F(DexGrepIndexTest, corruptIndexIsRejected) {
+  ASSERT_TRUE(build_index(m_dexfiles, m_index.c_str()));
+  const auto good = read_file(m_index);
+  auto expect_rejected = expect_rejected_by([](const std::string& path) {
+    return DexGrepIndex::open(path.c_str());
+  });
+
+  for_each_truncation(good, 4, expect_rejected);
+  auto unterminated = good;
+  unterminated.back() = 'x';
+  expect_rejected(unterminated);
+
+  // Header: magic, version, dex_count, class_count, symbol_count, ref_count,
+  // gram_count, posting_count and strings_size. Every word of the header and
+  // of the tables that hold offsets, counts or ids is set out of range. The
+  // grams themselves can hold any value.
+  uint32_t header[9];
+  memcpy(header, good.data(), sizeof(header));
+  auto dex_count = header[2];
+  auto class_count = header[3];
+  auto symbol_count = header[4];
+  auto ref_count = header[5];
+  auto gram_count = header[6];
+  auto posting_count = header[7];
+  size_t grams_begin = 9 + 2 * (dex_count + 1) + class_count +
+                       2 * (symbol_count + 1) + ref_count;
+  size_t grams_end = grams_begin + gram_count;
+  size_t tables_end = grams_end + gram_count + 1 + posting_count;
+  for_each_corrupt_word(good, 0, grams_begin, expect_rejected);
+  for_each_corrupt_word(good, grams_end, tables_end, expect_rejected);
+}
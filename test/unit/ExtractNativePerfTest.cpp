@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "RedexResources.h"
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//==========
+// Benchmark for class name extraction from native libraries
+//==========
+
+std::unordered_set<std::string> extract_classes_from_native_lib(
+    const std::string& lib_contents);
+
+constexpr size_t MIN_CLASSNAME_LENGTH = 10;
+constexpr size_t MAX_CLASSNAME_LENGTH = 500;
+
+// The byte-at-a-time scanner this replaced, kept as the baseline.
+std::unordered_set<std::string> reference_extract(
+    const std::string& lib_contents) {
+  std::unordered_set<std::string> classes;
+  char buffer[MAX_CLASSNAME_LENGTH + 2];
+  const char* inptr = lib_contents.data();
+  char* outptr = buffer;
+  const char* end = inptr + lib_contents.size();
+  size_t length = 0;
+  while (inptr < end) {
+    outptr = buffer;
+    length = 0;
+    if ((*inptr >= 'a' && *inptr <= 'z') || *inptr == 'L') {
+      if (*inptr != 'L') {
+        *outptr++ = 'L';
+        length++;
+      }
+      while (((*inptr >= 'a' && *inptr <= 'z') ||
+              (*inptr >= 'A' && *inptr <= 'Z') ||
+              (*inptr >= '0' && *inptr <= '9') || *inptr == '/' ||
+              *inptr == '_' || *inptr == '$') &&
+             length < MAX_CLASSNAME_LENGTH) {
+        *outptr++ = *inptr++;
+        length++;
+      }
+      if (length >= MIN_CLASSNAME_LENGTH) {
+        *outptr++ = ';';
+        *outptr = '\0';
+        classes.insert(std::string(buffer));
+      }
+    }
+    inptr++;
+  }
+  return classes;
+}
+
+// Mostly binary noise, with NUL-terminated symbol-like strings drawn from a
+// fixed pool (as in .rodata and JNI signatures) and the occasional run longer
+// than MAX_CLASSNAME_LENGTH.
+std::string make_library(size_t size, unsigned seed) {
+  static const char* const kWords[] = {
+      "com", "facebook", "android", "Lcom", "java", "lang", "String",
+      "Foo$Bar", "jni_onload", "_ZN3art", "internal", "x", "a1"};
+  const size_t kNumWords = sizeof(kWords) / sizeof(kWords[0]);
+  std::mt19937 rng(seed);
+  std::vector<std::string> pool;
+  for (size_t i = 0; i < 20000; ++i) {
+    std::string name;
+    auto words = 1 + rng() % 6;
+    for (size_t w = 0; w < words; ++w) {
+      if (w > 0) {
+        name += '/';
+      }
+      name += kWords[rng() % kNumWords];
+    }
+    pool.push_back(name);
+  }
+  std::string lib;
+  lib.reserve(size + MAX_CLASSNAME_LENGTH * 2);
+  while (lib.size() < size) {
+    auto roll = rng() % 1000;
+    if (roll < 980) {
+      lib += (char)(rng() % 256);
+    } else if (roll < 999) {
+      lib += pool[rng() % pool.size()];
+      lib += '\0';
+    } else {
+      lib.append(MAX_CLASSNAME_LENGTH + rng() % MAX_CLASSNAME_LENGTH,
+                 'a' + rng() % 26);
+    }
+  }
+  lib += '\0';
+  return lib;
+}
+
+template <typename Fn>
+double time_ms(const Fn& fn) {
+  auto start = std::chrono::high_resolution_clock::now();
+  fn();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+  size_t megabytes = argc > 1 ? std::atoi(argv[1]) : 64;
+  auto lib = make_library(megabytes << 20, 1);
+  printf("library size: %zu MB\n", megabytes);
+
+  std::unordered_set<std::string> expected;
+  std::unordered_set<std::string> actual;
+  double reference_ms = time_ms([&] { expected = reference_extract(lib); });
+  double scan_ms =
+      time_ms([&] { actual = extract_classes_from_native_lib(lib); });
+  printf("reference: %.1f ms, vectorized: %.1f ms, speedup: %f\n",
+         reference_ms, scan_ms, reference_ms / scan_ms);
+  if (actual != expected) {
+    printf("MISMATCH: %zu vs %zu classes\n", actual.size(), expected.size());
+    return 1;
+  }
+
+  // The same contents spread over several libraries, scanned in chunks
+  // across all threads.
+  auto apk_dir = boost::filesystem::temp_directory_path() /
+                 boost::filesystem::unique_path();
+  auto lib_dir = apk_dir / "lib" / "x86";
+  boost::filesystem::create_directories(lib_dir);
+  const size_t kNumLibs = 4;
+  size_t piece = lib.size() / kNumLibs;
+  std::unordered_set<std::string> expected_all;
+  for (size_t i = 0; i < kNumLibs; ++i) {
+    auto contents = lib.substr(i * piece, piece);
+    auto classes = reference_extract(contents);
+    expected_all.insert(classes.begin(), classes.end());
+    std::ofstream out((lib_dir / ("lib" + std::to_string(i) + ".so")).string(),
+                      std::ios::binary);
+    out << contents;
+  }
+  double parallel_ms = time_ms(
+      [&] { actual = get_native_classes(apk_dir.string()); });
+  boost::filesystem::remove_all(apk_dir);
+  printf("get_native_classes over %zu libraries: %.1f ms, speedup: %f\n",
+         kNumLibs, parallel_ms, reference_ms / parallel_ms);
+  if (actual != expected_all) {
+    printf("MISMATCH: %zu vs %zu classes\n", actual.size(),
+           expected_all.size());
+    return 1;
+  }
+  return 0;
+}
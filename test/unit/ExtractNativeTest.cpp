@@ -20,3 +20,34 @@ TEST(ExtractNativeTest, empty) {
   auto overset = extract_classes_from_native_lib(over);
   EXPECT_EQ(overset.size(), 2);
 }
+
+TEST(ExtractNativeTest, prefixedAndUnprefixedNamesMatch) {
+  std::string lib("\x01" "com/facebook/Foo\0Lcom/facebook/Foo;\0", 37);
+  auto classes = extract_classes_from_native_lib(lib);
+  EXPECT_EQ(classes.size(), 1);
+  EXPECT_EQ(classes.count("Lcom/facebook/Foo;"), 1);
+}
+
+TEST(ExtractNativeTest, nameStartsAtFirstLowercaseOfRun) {
+  auto classes = extract_classes_from_native_lib("XY9com/facebook/Foo$Bar");
+  EXPECT_EQ(classes.size(), 1);
+  EXPECT_EQ(classes.count("Lcom/facebook/Foo$Bar;"), 1);
+}
+
+TEST(ExtractNativeTest, shortNamesAreIgnored) {
+  EXPECT_TRUE(extract_classes_from_native_lib("com/Foo com/Bar").empty());
+  auto classes = extract_classes_from_native_lib("com/FooBar");
+  EXPECT_EQ(classes.count("Lcom/FooBar;"), 1);
+}
+
+TEST(ExtractNativeTest, namesAcrossVectorBoundaries) {
+  std::string lib;
+  std::unordered_set<std::string> expected;
+  for (size_t i = 0; i < 300; ++i) {
+    std::string name = "com/facebook/C" + std::to_string(i);
+    lib += std::string(i % 37, '\xff') + name;
+    lib += '\0';
+    expected.emplace("L" + name + ";");
+  }
+  EXPECT_EQ(extract_classes_from_native_lib(lib), expected);
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexClass.h"
+#include "HierarchyService.h"
+#include "ScopeHelper.h"
+#include "Show.h"
+#include "VirtualScope.h"
+
+/**
+ * class java.lang.Object { // Object methods ... }
+ * class A { }
+ *  class B extends A {}
+ *  class C extends A {}
+ */
+TEST(HierarchyService, cacheAndInvalidate) {
+  g_redex = new RedexContext();
+
+  Scope scope = create_empty_scope();
+  auto obj_t = get_object_type();
+  auto a_t = DexType::make_type("LA;");
+  scope.push_back(create_internal_class(a_t, obj_t, {}));
+  auto b_t = DexType::make_type("LB;");
+  scope.push_back(create_internal_class(b_t, a_t, {}));
+
+  HierarchyService service;
+  auto ch = service.class_hierarchy(scope);
+  EXPECT_EQ(ch, service.class_hierarchy(scope));
+  EXPECT_EQ(1, get_children(*ch, a_t).count(b_t));
+
+  // The hierarchy survives changes to the virtual scopes only.
+  service.invalidate(HA_CLASS_SCOPES);
+  EXPECT_EQ(ch, service.class_hierarchy(scope));
+
+  service.invalidate(HA_CLASS_HIERARCHY);
+  auto rebuilt = service.class_hierarchy(scope);
+  EXPECT_NE(ch, rebuilt);
+  EXPECT_EQ(*ch, *rebuilt);
+
+  // A scope with other classes in it isn't served from the cache.
+  auto c_t = DexType::make_type("LC;");
+  scope.push_back(create_internal_class(c_t, a_t, {}));
+  auto with_c = service.class_hierarchy(scope);
+  EXPECT_NE(rebuilt, with_c);
+  EXPECT_EQ(1, get_children(*with_c, a_t).count(c_t));
+  EXPECT_EQ(0, get_children(*rebuilt, a_t).count(c_t));
+
+  // The hierarchy comes out of the class scopes when they are built first,
+  // and outlives them when only the virtual scopes are invalidated.
+  service.invalidate();
+  auto class_scopes = service.class_scopes(scope);
+  auto shared = service.class_hierarchy(scope);
+  EXPECT_EQ(&class_scopes->get_class_hierarchy(), shared.get());
+  service.invalidate(HA_CLASS_SCOPES);
+  auto copied = service.class_hierarchy(scope);
+  EXPECT_NE(shared, copied);
+  EXPECT_EQ(*shared, *copied);
+  EXPECT_EQ(copied, service.class_hierarchy(scope));
+  EXPECT_NE(class_scopes, service.class_scopes(scope));
+
+  delete g_redex;
+}
+
+/**
+ * A scope large enough to be split across threads gives the same hierarchy
+ * as building it one class at a time.
+ */
+TEST(HierarchyService, parallelBuild) {
+  g_redex = new RedexContext();
+
+  Scope scope = create_empty_scope();
+  auto obj_t = get_object_type();
+  std::vector<DexType*> types{obj_t};
+  for (size_t i = 0; i < 5000; ++i) {
+    auto type = DexType::make_type(
+        DexString::make_string("LC" + std::to_string(i) + ";"));
+    scope.push_back(create_internal_class(type, types[i / 3], {}));
+    types.push_back(type);
+  }
+
+  ClassHierarchy expected;
+  for (const auto* cls : scope) {
+    expected[cls->get_type()];
+    if (cls->get_super_class() != nullptr) {
+      expected[cls->get_super_class()].insert(cls->get_type());
+    }
+  }
+  auto ch = build_type_hierarchy(scope);
+  for (const auto& entry : expected) {
+    EXPECT_EQ(entry.second, ch.at(entry.first)) << show(entry.first);
+  }
+  EXPECT_EQ(3, get_children(ch, types[7]).size());
+
+  delete g_redex;
+}
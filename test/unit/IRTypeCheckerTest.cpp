@@ -253,6 +253,33 @@ TEST_F(IRTypeCheckerTest, referenceFromInteger) {
       checker.what());
 }
 
+TEST_F(IRTypeCheckerTest, streaming) {
+  using namespace dex_asm;
+  std::vector<IRInstruction*> insns = {
+      dasm(OPCODE_CHECK_CAST, DexType::make_type("[I"), {14_v}),
+      dasm(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT, {0_v}),
+      dasm(OPCODE_AGET, {0_v, 5_v}),
+      dasm(IOPCODE_MOVE_RESULT_PSEUDO, {0_v}),
+      dasm(OPCODE_INT_TO_FLOAT, {0_v, 0_v}),
+      dasm(OPCODE_ADD_INT, {1_v, 0_v, 5_v}),
+      dasm(OPCODE_RETURN, {9_v}),
+  };
+  add_code(insns);
+  IRTypeChecker checker(m_method);
+  checker.enable_streaming();
+  checker.run();
+  EXPECT_TRUE(checker.fail());
+  EXPECT_EQ(
+      "Type error in method testMethod at instruction 'ADD_INT v1, v0, v5' "
+      "for register v0: expected type INT, but found FLOAT instead",
+      checker.what());
+  // The types are recomputed on demand from the entry of the block.
+  EXPECT_EQ(REFERENCE, checker.get_type(insns[2], 0));
+  EXPECT_EQ(SCALAR, checker.get_type(insns[4], 0));
+  EXPECT_EQ(FLOAT, checker.get_type(insns[5], 0));
+  EXPECT_EQ(BOTTOM, checker.get_type(dasm(OPCODE_NOP), 0));
+}
+
 TEST_F(IRTypeCheckerTest, misalignedLong) {
   using namespace dex_asm;
   std::vector<IRInstruction*> insns = {
@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <zlib.h>
+
+#include "DexClass.h"
+#include "JarLoader.h"
+#include "Show.h"
+#include "TempDirTest.h"
+
+namespace {
+
+struct Bytes : std::string {
+  void u8(uint8_t v) { push_back(v); }
+  void be16(uint16_t v) {
+    u8(v >> 8);
+    u8(v);
+  }
+  void be32(uint32_t v) {
+    be16(v >> 16);
+    be16(v);
+  }
+  void le16(uint16_t v) {
+    u8(v);
+    u8(v >> 8);
+  }
+  void le32(uint32_t v) {
+    le16(v);
+    le16(v >> 16);
+  }
+  void be16s(std::initializer_list<uint16_t> vs) {
+    for (auto v : vs) {
+      be16(v);
+    }
+  }
+  void le16s(std::initializer_list<uint16_t> vs) {
+    for (auto v : vs) {
+      le16(v);
+    }
+  }
+  void utf8(const char* str) {
+    u8(1);
+    be16(strlen(str));
+    append(str);
+  }
+};
+
+// A class file for
+//   public class Foo implements Runnable {
+//     private int count;
+//     public Foo();
+//     public Object bar(int, String, long[]);
+//   }
+std::string make_class_file() {
+  Bytes b;
+  b.be32(0xcafebabe);
+  b.be16(0);
+  b.be16(50);
+  b.be16(13);
+  b.utf8("com/example/Foo"); // 1
+  b.u8(7); // 2
+  b.be16(1);
+  b.utf8("java/lang/Object"); // 3
+  b.u8(7); // 4
+  b.be16(3);
+  b.utf8("count"); // 5
+  b.utf8("I"); // 6
+  b.utf8("bar"); // 7
+  b.utf8("(ILjava/lang/String;[J)Ljava/lang/Object;"); // 8
+  b.utf8("<init>"); // 9
+  b.utf8("()V"); // 10
+  b.utf8("java/lang/Runnable"); // 11
+  b.u8(7); // 12
+  b.be16(11);
+  b.be16(ACC_PUBLIC);
+  b.be16(2);
+  b.be16(4);
+  b.be16(1);
+  b.be16(12);
+  b.be16(1);
+  b.be16s({ACC_PRIVATE, 5, 6, 0});
+  b.be16(2);
+  b.be16s({ACC_PUBLIC, 9, 10, 0, ACC_PUBLIC, 7, 8, 0});
+  b.be16(0);
+  return std::move(b);
+}
+
+std::string deflate_raw(const std::string& data) {
+  z_stream zs{};
+  deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&zs, data.size()), '\0');
+  zs.next_in = (Bytef*)data.data();
+  zs.avail_in = data.size();
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+// A jar holding the single deflated entry `name`.
+std::string make_jar(const std::string& name, const std::string& content) {
+  auto compressed = deflate_raw(content);
+  uint32_t crc = crc32(0, (const Bytef*)content.data(), content.size());
+  Bytes b;
+  b.le32(0x04034b50);
+  b.le16s({20, 0, 8, 0, 0});
+  b.le32(crc);
+  b.le32(compressed.size());
+  b.le32(content.size());
+  b.le16(name.size());
+  b.le16(0);
+  b.append(name);
+  b.append(compressed);
+  uint32_t cd_offset = b.size();
+  b.le32(0x02014b50);
+  b.le16s({20, 20, 0, 8, 0, 0});
+  b.le32(crc);
+  b.le32(compressed.size());
+  b.le32(content.size());
+  b.le16s({(uint16_t)name.size(), 0, 0, 0, 0});
+  b.le32(0);
+  b.le32(0);
+  b.append(name);
+  uint32_t cd_size = b.size() - cd_offset;
+  b.le32(0x06054b50);
+  b.le16s({0, 0, 1, 1});
+  b.le32(cd_size);
+  b.le32(cd_offset);
+  b.le16(0);
+  return std::move(b);
+}
+
+std::string describe(const Scope& classes) {
+  std::ostringstream ss;
+  for (const DexClass* cls : classes) {
+    ss << show(cls) << " " << cls->get_access() << " "
+       << show(cls->get_super_class()) << "\n";
+    for (auto* iface : cls->get_interfaces()->get_type_list()) {
+      ss << " implements " << show(iface) << "\n";
+    }
+    for (auto* field : cls->get_ifields()) {
+      ss << " " << show(field) << " " << field->get_access() << "\n";
+    }
+    for (auto* method : cls->get_dmethods()) {
+      ss << " " << show(method) << " " << method->get_access() << " "
+         << method->is_virtual() << "\n";
+    }
+    for (auto* method : cls->get_vmethods()) {
+      ss << " " << show(method) << " " << method->get_access() << " "
+         << method->is_virtual() << "\n";
+    }
+  }
+  return ss.str();
+}
+
+} // namespace
+
+class JarLoaderTest : public TempDirTest {
+ protected:
+  void SetUp() override {
+    m_snapshot_dir = path("snapshots");
+    boost::filesystem::create_directories(m_snapshot_dir);
+    m_jar = path("foo.jar");
+    write_file(m_jar, make_jar("com/example/Foo.class", make_class_file()));
+  }
+
+  bool load(Scope* classes, const std::string& snapshot_dir) {
+    delete g_redex;
+    g_redex = new RedexContext();
+    return load_jar_files({m_jar}, classes, nullptr, snapshot_dir);
+  }
+
+  std::string snapshot_file() {
+    std::vector<std::string> files;
+    for (const auto& entry :
+         boost::filesystem::directory_iterator(m_snapshot_dir)) {
+      files.push_back(entry.path().string());
+    }
+    EXPECT_EQ(files.size(), 1);
+    return files.empty() ? "" : files[0];
+  }
+
+  std::string m_snapshot_dir;
+  std::string m_jar;
+};
+
+TEST_F(JarLoaderTest, snapshotRoundTrip) {
+  Scope parsed;
+  ASSERT_TRUE(load(&parsed, m_snapshot_dir));
+  auto expected = describe(parsed);
+  EXPECT_EQ(expected,
+            "Lcom/example/Foo; 1 Ljava/lang/Object;\n"
+            " implements Ljava/lang/Runnable;\n"
+            " Lcom/example/Foo;.count:I 2\n"
+            " Lcom/example/Foo;.<init>:()V 65537 0\n"
+            " Lcom/example/Foo;.bar:(ILjava/lang/String;[J)Ljava/lang/Object; "
+            "1 1\n");
+  auto snapshot = snapshot_file();
+
+  // Clobber the compressed class data without touching the central
+  // directory, so only a load from the snapshot can still succeed.
+  auto jar = read_file(m_jar);
+  auto pos = jar.find("Foo.class") + strlen("Foo.class");
+  std::fill(jar.begin() + pos, jar.begin() + pos + 8, '\xff');
+  write_file(m_jar, jar);
+
+  Scope from_snapshot;
+  ASSERT_TRUE(load(&from_snapshot, m_snapshot_dir));
+  EXPECT_EQ(describe(from_snapshot), expected);
+  EXPECT_EQ(snapshot_file(), snapshot);
+
+  Scope reparsed;
+  EXPECT_FALSE(load(&reparsed, ""));
+}
+
+TEST_F(JarLoaderTest, corruptSnapshotIsIgnored) {
+  Scope parsed;
+  ASSERT_TRUE(load(&parsed, m_snapshot_dir));
+  auto expected = describe(parsed);
+  auto snapshot_path = snapshot_file();
+  const auto snapshot = read_file(snapshot_path);
+
+  auto expect_ignored = [&](const std::string& corrupt) {
+    write_file(snapshot_path, corrupt);
+    Scope classes;
+    ASSERT_TRUE(load(&classes, m_snapshot_dir));
+    EXPECT_EQ(describe(classes), expected);
+    // The jar was parsed again and its snapshot rewritten.
+    EXPECT_EQ(read_file(snapshot_path), snapshot);
+  };
+
+  for_each_truncation(snapshot, 4, expect_ignored);
+  expect_ignored(snapshot.substr(0, snapshot.size() - 1));
+  // Every header count, every string offset and every table entry up to the
+  // string data, set out of range.
+  uint32_t header[7];
+  memcpy(header, snapshot.data(), sizeof(header));
+  size_t table_end =
+      7 + header[2] + 1 + header[3] + header[5] + header[6];
+  for_each_corrupt_word(snapshot, 0, table_end, expect_ignored);
+  // A string that is not NUL-terminated.
+  auto unterminated = snapshot;
+  unterminated.back() = 'x';
+  expect_ignored(unterminated);
+}
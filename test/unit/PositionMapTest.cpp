@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "DexClass.h"
+#include "DexPosition.h"
+#include "PositionMap.h"
+#include "TempDirTest.h"
+
+namespace {
+
+std::string describe(const std::vector<Position>& stack) {
+  std::ostringstream ss;
+  for (const auto& pos : stack) {
+    ss << pos.cls << "." << pos.method << "(" << pos.filename << ":"
+       << pos.line << ")\n";
+  }
+  return ss.str();
+}
+
+DexMethod* make_method(const char* name) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(name));
+  method->set_deobfuscated_name(name);
+  return method;
+}
+
+} // namespace
+
+class PositionMapTest : public TempDirTest {
+ protected:
+  void SetUp() override {
+    m_map_v2 = path("map_v2");
+    m_map_v3 = path("map_v3");
+  }
+
+  std::string m_map_v2;
+  std::string m_map_v3;
+};
+
+/*
+ * A map written in v3 reads back the same positions as the v2 map of the
+ * same mapper.
+ */
+TEST_F(PositionMapTest, v3RoundTrip) {
+  auto foo_bar = make_method("Lcom/example/Foo;.bar:()V");
+  auto baz_qux = make_method("Lcom/example/Baz;.qux:(I)I");
+  auto foo_java = DexString::make_string("Foo.java");
+  auto baz_java = DexString::make_string("Baz.java");
+
+  DexPosition callsite(10);
+  callsite.bind(foo_bar, foo_java);
+  DexPosition inlined(20);
+  inlined.bind(baz_qux, baz_java);
+  inlined.parent = &callsite;
+  DexPosition unemitted(30);
+  unemitted.bind(baz_qux, baz_java);
+
+  RealPositionMapper mapper("", m_map_v2, m_map_v3);
+  mapper.register_position(&unemitted);
+  auto callsite_line = mapper.position_to_line(&callsite);
+  auto inlined_line = mapper.position_to_line(&inlined);
+  mapper.write_map();
+
+  auto v2 = read_map(m_map_v2.c_str());
+  auto v3 = read_map(m_map_v3.c_str());
+  ASSERT_NE(v2, nullptr);
+  ASSERT_NE(v3, nullptr);
+  ASSERT_EQ(3, v3->positions_size);
+  ASSERT_EQ(v2->positions_size, v3->positions_size);
+  EXPECT_EQ("com.example.Baz.qux(Baz.java:20)\n"
+            "com.example.Foo.bar(Foo.java:10)\n",
+            describe(get_stack(*v3, inlined_line - 1)));
+  EXPECT_EQ("com.example.Foo.bar(Foo.java:10)\n",
+            describe(get_stack(*v3, callsite_line - 1)));
+  for (size_t i = 0; i < v3->positions_size; ++i) {
+    EXPECT_EQ(describe(get_stack(*v2, i)), describe(get_stack(*v3, i)));
+  }
+
+  std::string trace = "java.lang.Exception\n\tat X.y(:" +
+                      std::to_string(inlined_line) + ")\n\tat Z.w(Z.java:5)\n";
+  std::string out_v2;
+  std::string out_v3;
+  symbolicate(*v2, trace.data(), trace.data() + trace.size(), out_v2);
+  symbolicate(*v3, trace.data(), trace.data() + trace.size(), out_v3);
+  EXPECT_EQ(out_v2, out_v3);
+  EXPECT_EQ("java.lang.Exception\n"
+            "\tat X.y(Baz.java:20)\n"
+            "\tat X.y(Foo.java:10)\n"
+            "\tat Z.w(Z.java:5)\n",
+            out_v3);
+}
+
+/*
+ * Frames the map knows nothing about are copied unchanged, and no line break
+ * is added after the last line if the trace didn't end with one.
+ */
+TEST_F(PositionMapTest, symbolicateKeepsUnmappedLines) {
+  auto foo_bar = make_method("Lcom/example/Foo;.bar:()V");
+  DexPosition pos(10);
+  pos.bind(foo_bar, DexString::make_string("Foo.java"));
+  RealPositionMapper mapper("", "", m_map_v3);
+  auto line = mapper.position_to_line(&pos);
+  mapper.write_map();
+  auto map = read_map(m_map_v3.c_str());
+  ASSERT_NE(map, nullptr);
+
+  auto run = [&](const std::string& trace) {
+    std::string out;
+    symbolicate(*map, trace.data(), trace.data() + trace.size(), out);
+    return out;
+  };
+  auto frame = "\tat X.y(:" + std::to_string(line) + ")";
+  EXPECT_EQ("\tat X.y(Foo.java:10)", run(frame));
+  EXPECT_EQ("\tat X.y(Foo.java:10)\n", run(frame + "\n"));
+  EXPECT_EQ("\tat X.y(:0)\n\tat X.y(:2)", run("\tat X.y(:0)\n\tat X.y(:2)"));
+  EXPECT_EQ("a\n\nb", run("a\n\nb"));
+  EXPECT_EQ("", run(""));
+}
+
+/*
+ * Truncated maps, maps whose header or tables point outside of the file and
+ * maps whose parent chains loop are rejected rather than read out of bounds
+ * or walked forever.
+ */
+TEST_F(PositionMapTest, corruptMapsAreRejected) {
+  auto foo_bar = make_method("Lcom/example/Foo;.bar:()V");
+  DexPosition pos(10);
+  pos.bind(foo_bar, DexString::make_string("Foo.java"));
+  RealPositionMapper mapper("", m_map_v2, m_map_v3);
+  mapper.position_to_line(&pos);
+  mapper.write_map();
+
+  auto expect_rejected = expect_rejected_by([](const std::string& path) {
+    return read_map(path.c_str());
+  });
+
+  for (const auto& map_path : {m_map_v2, m_map_v3}) {
+    ASSERT_NE(read_map(map_path.c_str()), nullptr);
+    for_each_truncation(read_file(map_path), 1, expect_rejected);
+  }
+
+  // v3 header: magic, version, string_count, pos_count, then the offsets of
+  // the string offsets, the string data and the positions, 8 bytes each.
+  const auto v3 = read_file(m_map_v3);
+  for_each_corrupt_word(v3, 2, 10, expect_rejected);
+  uint64_t string_offsets_start;
+  uint64_t positions_start;
+  memcpy(&string_offsets_start, &v3[16], sizeof(string_offsets_start));
+  memcpy(&positions_start, &v3[32], sizeof(positions_start));
+  // A string ending past the string data, then a string with a negative
+  // size.
+  uint32_t string_count;
+  memcpy(&string_count, &v3[8], sizeof(string_count));
+  expect_rejected(with_word(
+      v3, string_offsets_start + 4 * string_count, OUT_OF_RANGE_WORD));
+  expect_rejected(with_word(v3, string_offsets_start + 4, OUT_OF_RANGE_WORD));
+  // Each string id of the position.
+  for (size_t field = 0; field < 3; ++field) {
+    expect_rejected(with_word(v3, positions_start + 4 * field, string_count));
+  }
+  // A position that is its own parent.
+  expect_rejected(with_word(v3, positions_start + 16, 1));
+
+  // v2: magic, version, string_count, then each string with its size.
+  const auto v2 = read_file(m_map_v2);
+  expect_rejected(with_word(v2, 8, OUT_OF_RANGE_WORD));
+  expect_rejected(with_word(v2, 12, OUT_OF_RANGE_WORD));
+  expect_rejected(with_word(v2, v2.size() - 24, OUT_OF_RANGE_WORD));
+  expect_rejected(with_word(v2, v2.size() - 20, 3));
+  expect_rejected(with_word(v2, v2.size() - 4, 1));
+}
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <set>
+
+#include "Creators.h"
+#include "DexClass.h"
+#include "DexStore.h"
+#include "IRAssembler.h"
+#include "ReachableObjects.h"
+#include "RedexContext.h"
+
+namespace {
+
+std::string class_name(size_t i) {
+  return "Lcom/example/C" + std::to_string(i) + ";";
+}
+
+/*
+ * Two groups of :count classes, each with a static field and a static method
+ * that reach into a few other classes of their group, so that most objects
+ * have several retainers. Only C0 and the methods of every tenth class of the
+ * first group are kept, so the second group is unreachable.
+ */
+DexClasses make_classes(size_t count) {
+  DexClasses classes;
+  for (size_t i = 0; i < 2 * count; ++i) {
+    auto group = i / count * count;
+    auto other = [&](size_t k) { return class_name(group + k % count); };
+    auto name = class_name(i);
+    ClassCreator creator(DexType::make_type(name.c_str()));
+    creator.set_access(ACC_PUBLIC);
+    creator.set_super(get_object_type());
+
+    auto field = static_cast<DexField*>(
+        DexField::make_field(DexType::make_type(name.c_str()),
+                             DexString::make_string("f"),
+                             DexType::make_type(other(i * 3 + 2).c_str())));
+    field->make_concrete(ACC_PUBLIC | ACC_STATIC);
+    creator.add_field(field);
+
+    auto method = assembler::method_from_string(
+        "(method (public static) \"" + name + ".m:()V\" (" +
+        "(invoke-static () \"" + other(i * 7 + 1) + ".m:()V\")" +
+        "(invoke-static () \"" + other(i * 13 + 5) + ".m:()V\")" +
+        "(sget-object \"" + other(i * 5 + 3) + ".f:" + other(i * 15 + 11) +
+        "\")" + "(move-result-pseudo-object v0)" + "(return-void)" + "))");
+    creator.add_method(method);
+    if (group == 0 && i % 10 == 0) {
+      method->rstate.set_keep();
+    }
+
+    auto cls = creator.create();
+    if (i == 0) {
+      cls->rstate.set_keep();
+    }
+    classes.push_back(cls);
+  }
+  return classes;
+}
+
+// The edges of :graph, as retainer and retained object names.
+std::set<std::pair<std::string, std::string>> edges(
+    const reachable_objects::ReachableObjectGraph& graph) {
+  std::set<std::pair<std::string, std::string>> ret;
+  for (const auto& entry : graph) {
+    for (const auto& retainer : entry.second) {
+      ret.emplace(retainer.str(), entry.first.str());
+    }
+  }
+  return ret;
+}
+
+} // namespace
+
+/*
+ * The marked objects and the retainers graph are the same whatever the number
+ * of workers and however they get scheduled.
+ */
+TEST(ReachableObjectsTest, parallelWalkMatchesSerialWalk) {
+  g_redex = new RedexContext();
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(make_classes(250));
+  DexStoresVector stores;
+  stores.emplace_back(std::move(store));
+
+  auto walk = [&](size_t num_threads) {
+    return compute_reachable_objects(stores,
+                                     {},
+                                     {},
+                                     {},
+                                     nullptr,
+                                     /* record_reachability */ true,
+                                     num_threads);
+  };
+  auto serial = walk(1);
+  auto serial_edges = edges(serial.retainers_of);
+  EXPECT_EQ(250, serial.marked_classes.size());
+  for (size_t run = 0; run < 10; ++run) {
+    auto parallel = walk(8);
+    EXPECT_EQ(serial.marked_classes, parallel.marked_classes);
+    EXPECT_EQ(serial.marked_fields, parallel.marked_fields);
+    EXPECT_EQ(serial.marked_methods, parallel.marked_methods);
+    EXPECT_EQ(serial_edges, edges(parallel.retainers_of));
+  }
+
+  delete g_redex;
+}
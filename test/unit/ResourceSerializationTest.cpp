@@ -8,6 +8,8 @@
  */
 
 #include <array>
+#include <boost/filesystem.hpp>
+#include <fstream>
 #include <gtest/gtest.h>
 
 #include "Debug.h"
@@ -193,6 +195,178 @@ TEST(ResStringPool, ReplaceStringsInXmlLayout) {
   unmap_and_close(file_descriptor, fp, length);
 }
 
+TEST(XmlEditSession, ChainedRenamesWriteFileOnce) {
+  auto dir = boost::filesystem::temp_directory_path() /
+             boost::filesystem::unique_path();
+  boost::filesystem::create_directories(dir);
+  auto layout = (dir / "layout.xml").string();
+  boost::filesystem::copy_file(std::getenv("test_layout_path"), layout);
+  auto original_size = boost::filesystem::file_size(layout);
+
+  XmlEditSession session({layout});
+  std::map<std::string, std::string> first_pass;
+  first_pass.emplace("com.example.test.CustomViewGroup", "Y.a");
+  first_pass.emplace("com.example.test.CustomTextView", "Z.b");
+  session.rename_strings(first_pass);
+  std::map<std::string, std::string> second_pass;
+  second_pass.emplace("Y.a", "Z.a");
+  second_pass.emplace("com.example.test.CustomButton", "Z.c");
+  session.rename_strings(second_pass);
+  auto stats = session.commit();
+
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].strings_renamed, 3);
+  auto contents = read_entire_file(layout);
+  EXPECT_EQ(stats[0].size_delta, (ssize_t)contents.size() - original_size);
+  boost::filesystem::remove_all(dir);
+
+  android::ResXMLTree parser;
+  parser.setTo(contents.data(), contents.size());
+  ASSERT_EQ(android::NO_ERROR, parser.getError());
+  std::vector<std::string> tags;
+  android::ResXMLParser::event_code_t type;
+  do {
+    type = parser.next();
+    if (type == android::ResXMLParser::START_TAG) {
+      size_t len;
+      android::String8 tag(parser.getElementName(&len));
+      tags.emplace_back(tag.string());
+    }
+  } while (type != android::ResXMLParser::BAD_DOCUMENT &&
+           type != android::ResXMLParser::END_DOCUMENT);
+  std::vector<std::string> expected_tags{
+      "Z.a", "TextView", "Z.b", "Z.c", "Button"};
+  EXPECT_EQ(tags, expected_tags);
+}
+
+namespace {
+
+// The data of every reference attribute in the binary XML `contents`.
+std::vector<android::Res_value> reference_attributes(
+    const std::string& contents) {
+  android::ResXMLTree parser;
+  parser.setTo(contents.data(), contents.size());
+  EXPECT_EQ(android::NO_ERROR, parser.getError());
+  std::vector<android::Res_value> values;
+  android::ResXMLParser::event_code_t type;
+  do {
+    type = parser.next();
+    if (type == android::ResXMLParser::START_TAG) {
+      for (size_t i = 0; i < parser.getAttributeCount(); ++i) {
+        if (parser.getAttributeNameResID(i) == 0x010100d0) { // android:id
+          android::Res_value value;
+          parser.getAttributeValue(i, &value);
+          values.push_back(value);
+        }
+      }
+    }
+  } while (type != android::ResXMLParser::BAD_DOCUMENT &&
+           type != android::ResXMLParser::END_DOCUMENT);
+  return values;
+}
+
+struct XmlEditSessionTest : testing::Test {
+  XmlEditSessionTest() {
+    dir = boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir);
+    layout = (dir / "layout.xml").string();
+    boost::filesystem::copy_file(std::getenv("test_layout_path"), layout);
+  }
+
+  ~XmlEditSessionTest() { boost::filesystem::remove_all(dir); }
+
+  boost::filesystem::path dir;
+  std::string layout;
+};
+
+} // namespace
+
+TEST_F(XmlEditSessionTest, RemapReferences) {
+  auto before = reference_attributes(read_entire_file(layout));
+  ASSERT_EQ(before.size(), 4);
+  EXPECT_EQ(before[2].data, 0x7f0b0060);
+  EXPECT_EQ(before[3].data, 0x7f0b0061);
+
+  XmlEditSession session({layout});
+  session.remap_references({{0x7f0b0060, 0x7f0b0010}});
+  auto stats = session.commit();
+
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].values_remapped, 1);
+  EXPECT_EQ(stats[0].size_delta, 0);
+  auto after = reference_attributes(read_entire_file(layout));
+  ASSERT_EQ(after.size(), 4);
+  EXPECT_EQ(after[1].data, 0x7f0b005f);
+  EXPECT_EQ(after[2].dataType, android::Res_value::TYPE_REFERENCE);
+  EXPECT_EQ(after[2].data, 0x7f0b0010);
+  EXPECT_EQ(after[3].data, 0x7f0b0061);
+}
+
+TEST_F(XmlEditSessionTest, InlineReferences) {
+  android::Res_value value;
+  value.size = sizeof(value);
+  value.res0 = 0;
+  value.dataType = android::Res_value::TYPE_INT_DEC;
+  value.data = 42;
+
+  XmlEditSession session({layout});
+  session.inline_references({{0x7f0b0061, value}});
+  auto stats = session.commit();
+
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].values_inlined, 1);
+  auto after = reference_attributes(read_entire_file(layout));
+  ASSERT_EQ(after.size(), 4);
+  EXPECT_EQ(after[2].dataType, android::Res_value::TYPE_REFERENCE);
+  EXPECT_EQ(after[2].data, 0x7f0b0060);
+  EXPECT_EQ(after[3].dataType, android::Res_value::TYPE_INT_DEC);
+  EXPECT_EQ(after[3].data, 42);
+}
+
+TEST_F(XmlEditSessionTest, EditsApplyInQueuedOrder) {
+  android::Res_value value;
+  value.size = sizeof(value);
+  value.res0 = 0;
+  value.dataType = android::Res_value::TYPE_INT_BOOLEAN;
+  value.data = 1;
+
+  // The inline sees the id the remap produced, not the original one.
+  XmlEditSession session({layout});
+  session.remap_references({{0x7f0b0060, 0x7f0b0010}});
+  session.inline_references({{0x7f0b0010, value}});
+  session.rename_strings({{"com.example.test.CustomButton", "Z.c"}});
+  auto stats = session.commit();
+
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].values_remapped, 1);
+  EXPECT_EQ(stats[0].values_inlined, 1);
+  EXPECT_EQ(stats[0].strings_renamed, 1);
+  auto after = reference_attributes(read_entire_file(layout));
+  ASSERT_EQ(after.size(), 4);
+  EXPECT_EQ(after[2].dataType, android::Res_value::TYPE_INT_BOOLEAN);
+  EXPECT_EQ(after[3].data, 0x7f0b0061);
+}
+
+TEST_F(XmlEditSessionTest, FailedFileLeavesAllFilesUntouched) {
+  auto broken = (dir / "broken.xml").string();
+  {
+    std::ofstream out(broken, std::ofstream::binary);
+    out << "not binary xml";
+  }
+  auto original = read_entire_file(layout);
+
+  XmlEditSession session({broken, layout});
+  session.remap_references({{0x7f0b0060, 0x7f0b0010}});
+  EXPECT_THROW(session.commit(), std::runtime_error);
+
+  EXPECT_EQ(read_entire_file(layout), original);
+  // No staged files are left behind.
+  size_t num_files = std::distance(boost::filesystem::directory_iterator(dir),
+                                   boost::filesystem::directory_iterator());
+  EXPECT_EQ(num_files, 2);
+}
+
 void assert_serialized_data(void* original, size_t length, android::Vector<char>& serialized) {
   ASSERT_EQ(length, serialized.size());
   for (size_t i = 0; i < length; i++) {
@@ -9,9 +9,11 @@
 
 #include <gtest/gtest.h>
 
+#include "Creators.h"
 #include "DexAsm.h"
 #include "DexUtil.h"
 #include "Inliner.h"
+#include "IRAssembler.h"
 #include "IRCode.h"
 #include "RedexTest.h"
 
@@ -71,3 +73,262 @@ TEST_F(SimpleInlineTest, insertMoves) {
 
   EXPECT_EQ(caller_code->get_registers_size(), 5);
 }
+
+/*
+ * Test that callers sharing a callee are inlined in the same layer, after the
+ * callee, and that the top level caller ends up with the whole call tree.
+ */
+TEST_F(SimpleInlineTest, parallelLayers) {
+  auto cls_ty = DexType::make_type("LFoo;");
+  ClassCreator creator(cls_ty);
+  creator.set_super(get_object_type());
+
+  auto top = assembler::method_from_string(R"(
+    (method (public static) "LFoo;.top:()V"
+     (
+      (invoke-static () "LFoo;.mid1:()V")
+      (invoke-static () "LFoo;.mid2:()V")
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(top);
+  auto mid1 = assembler::method_from_string(R"(
+    (method (public static) "LFoo;.mid1:()V"
+     (
+      (invoke-static () "LFoo;.leaf:()V")
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(mid1);
+  auto mid2 = assembler::method_from_string(R"(
+    (method (public static) "LFoo;.mid2:()V"
+     (
+      (invoke-static () "LFoo;.leaf:()V")
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(mid2);
+  auto leaf = assembler::method_from_string(R"(
+    (method (public static) "LFoo;.leaf:()V"
+     (
+      (const v0 1)
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(leaf);
+
+  Scope scope{creator.create()};
+  DexStore store("classes");
+  store.add_classes(scope);
+  DexStoresVector stores;
+  stores.emplace_back(std::move(store));
+
+  MultiMethodInliner::Config config;
+  config.throws_inline = false;
+  config.parallel = true;
+  auto resolver = [](DexMethodRef* method, MethodSearch search) {
+    return resolve_method(method, search);
+  };
+  {
+    MultiMethodInliner inliner(
+        scope, stores, {mid1, mid2, leaf}, resolver, config);
+    inliner.inline_methods();
+    EXPECT_EQ(inliner.get_inlined().size(), 3);
+    EXPECT_EQ(inliner.get_info().calls_inlined, 4);
+  }
+
+  size_t invokes = 0;
+  size_t consts = 0;
+  for (const auto& mie : InstructionIterable(top->get_code())) {
+    if (is_invoke(mie.insn->opcode())) invokes++;
+    if (mie.insn->opcode() == OPCODE_CONST) consts++;
+  }
+  EXPECT_EQ(invokes, 0);
+  EXPECT_EQ(consts, 2);
+}
+
+/*
+ * Test that the members a callee references are made public when the callee
+ * is inlined by concurrent callers, once their layer is done.
+ */
+TEST_F(SimpleInlineTest, parallelVisibility) {
+  auto cls_ty = DexType::make_type("LBar;");
+  ClassCreator creator(cls_ty);
+  creator.set_super(get_object_type());
+
+  auto field = static_cast<DexField*>(DexField::make_field(
+      cls_ty, DexString::make_string("f"), get_int_type()));
+  field->make_concrete(ACC_PRIVATE | ACC_STATIC);
+  creator.add_field(field);
+
+  std::vector<DexMethod*> callers;
+  for (auto name : {"mid1", "mid2", "mid3"}) {
+    auto caller = assembler::method_from_string(std::string(R"(
+      (method (public static) "LBar;.)") + name + R"(:()V"
+       (
+        (invoke-static () "LBar;.leaf:()V")
+        (return-void)
+       )
+      )
+    )");
+    creator.add_method(caller);
+    callers.push_back(caller);
+  }
+  auto leaf = assembler::method_from_string(R"(
+    (method (public static) "LBar;.leaf:()V"
+     (
+      (sget "LBar;.f:I")
+      (move-result-pseudo v0)
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(leaf);
+
+  Scope scope{creator.create()};
+  DexStore store("classes");
+  store.add_classes(scope);
+  DexStoresVector stores;
+  stores.emplace_back(std::move(store));
+
+  MultiMethodInliner::Config config;
+  config.throws_inline = false;
+  config.parallel = true;
+  auto resolver = [](DexMethodRef* method, MethodSearch search) {
+    return resolve_method(method, search);
+  };
+  {
+    MultiMethodInliner inliner(scope, stores, {leaf}, resolver, config);
+    inliner.inline_methods();
+    EXPECT_EQ(inliner.get_info().calls_inlined, 3);
+  }
+
+  EXPECT_TRUE(is_public(field));
+  for (auto caller : callers) {
+    size_t sgets = 0;
+    for (const auto& mie : InstructionIterable(caller->get_code())) {
+      if (mie.insn->opcode() == OPCODE_SGET) sgets++;
+    }
+    EXPECT_EQ(sgets, 1);
+  }
+}
+
+/*
+ * Test that the size of a method that callees get inlined into is its actual
+ * size afterwards, rather than an estimate that only grows: once `mid` is
+ * summarized, it gets `leaf` inlined, and is then inlined into `top`, which
+ * ends up right under the method size limit.
+ */
+TEST_F(SimpleInlineTest, summarizedCallerSize) {
+  auto cls_ty = DexType::make_type("LBaz;");
+  ClassCreator creator(cls_ty);
+  creator.set_super(get_object_type());
+  auto probe_ty = DexType::make_type("LProbe;");
+  ClassCreator probe_creator(probe_ty);
+  probe_creator.set_super(get_object_type());
+
+  auto top = assembler::method_from_string(R"(
+    (method (public static) "LBaz;.top:()V"
+     (
+      (invoke-static () "LBaz;.mid:()V")
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(top);
+  auto mid = assembler::method_from_string(R"(
+    (method (public static) "LBaz;.mid:()V"
+     (
+      (invoke-static () "LBaz;.leaf:()V")
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(mid);
+  auto leaf = assembler::method_from_string(R"(
+    (method (public static) "LBaz;.leaf:()V"
+     (
+      (const v0 1)
+      (return-void)
+     )
+    )
+  )");
+  creator.add_method(leaf);
+  // Callers in LProbe; are blacklisted, so probe only gets mid summarized.
+  auto probe = assembler::method_from_string(R"(
+    (method (public static) "LProbe;.probe:()V"
+     (
+      (invoke-static () "LBaz;.mid:()V")
+      (return-void)
+     )
+    )
+  )");
+  probe_creator.add_method(probe);
+
+  // Once leaf and then mid are inlined, top holds the consts of mid, the
+  // const of leaf and a return-void. The limit is 2^15 code units, minus a
+  // buffer of 2^12.
+  const size_t max_size = (1 << 15) - (1 << 12);
+  const size_t top_size = top->get_code()->sum_opcode_sizes();
+  const size_t leaf_size = leaf->get_code()->sum_opcode_sizes();
+  auto mid_code = mid->get_code();
+  auto make_const = [] {
+    auto insn = new IRInstruction(OPCODE_CONST);
+    insn->set_dest(0)->set_literal(1);
+    return insn;
+  };
+  std::unique_ptr<IRInstruction> const_insn(make_const());
+  const size_t const_size = const_insn->size();
+  size_t final_size = leaf_size;
+  while (top_size + final_size + const_size <= max_size) {
+    mid_code->push_back(make_const());
+    final_size += const_size;
+  }
+  mid_code->set_registers_size(1);
+  // move the return-void after the consts
+  auto ret = std::find_if(
+      mid_code->begin(), mid_code->end(), [](const MethodItemEntry& mie) {
+        return mie.type == MFLOW_OPCODE &&
+               mie.insn->opcode() == OPCODE_RETURN_VOID;
+      });
+  mid_code->remove_opcode(ret);
+  mid_code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+
+  Scope scope{creator.create(), probe_creator.create()};
+  DexStore store("classes");
+  store.add_classes(scope);
+  DexStoresVector stores;
+  stores.emplace_back(std::move(store));
+
+  MultiMethodInliner::Config config;
+  config.throws_inline = false;
+  config.caller_black_list.emplace(probe_ty);
+  auto resolver = [](DexMethodRef* method, MethodSearch search) {
+    return resolve_method(method, search);
+  };
+  auto invokes_of = [](DexMethod* method) {
+    std::unordered_set<IRInstruction*> invokes;
+    for (const auto& mie : InstructionIterable(method->get_code())) {
+      if (is_invoke(mie.insn->opcode())) {
+        invokes.insert(mie.insn);
+      }
+    }
+    return invokes;
+  };
+  {
+    MultiMethodInliner inliner(scope, stores, {mid, leaf}, resolver, config);
+    inliner.inline_callees(probe, invokes_of(probe));
+    EXPECT_EQ(inliner.get_info().calls_inlined, 0);
+    inliner.inline_callees(mid, invokes_of(mid));
+    EXPECT_EQ(inliner.get_info().calls_inlined, 1);
+    EXPECT_EQ(mid->get_code()->sum_opcode_sizes(), final_size);
+    inliner.inline_callees(top, invokes_of(top));
+    EXPECT_EQ(inliner.get_info().calls_inlined, 2);
+    EXPECT_EQ(inliner.get_info().caller_too_large, 0);
+  }
+  EXPECT_EQ(top->get_code()->sum_opcode_sizes(), final_size);
+}
@@ -39,17 +39,23 @@ dex_map_item* get_dex_map_item(ddump_data* rd, uint16_t type) {
   return nullptr;
 }
 
-void open_dex_file(const char* filename, ddump_data* rd) {
+bool try_open_dex_file(const char* filename, ddump_data* rd) {
   int fd = open(filename, O_RDWR);
   struct stat stat;
   rd->dex_filename = filename;
   if (fd < 0) {
-    fprintf(stderr, "Cannot open dump file %s, bailing\n", filename);
-    exit(1);
+    fprintf(stderr, "Cannot open dump file %s\n", filename);
+    return false;
   }
   if (fstat(fd, &stat)) {
-    fprintf(stderr, "Cannot fstat file %s, bailing\n", filename);
-    exit(1);
+    fprintf(stderr, "Cannot fstat file %s\n", filename);
+    close(fd);
+    return false;
+  }
+  if ((size_t)stat.st_size < sizeof(dex_header)) {
+    fprintf(stderr, "%s is too short to be a dex\n", filename);
+    close(fd);
+    return false;
   }
   rd->dex_size = stat.st_size;
   rd->dexmmap = (char*)mmap(nullptr,
@@ -59,20 +65,30 @@ void open_dex_file(const char* filename, ddump_data* rd) {
                             fd,
                             0);
   close(fd);
-  if (rd->dexmmap == nullptr) {
-    fprintf(stderr, "Address space allocation failed for mmap, bailing\n");
-    exit(1);
+  if (rd->dexmmap == MAP_FAILED) {
+    fprintf(stderr, "Address space allocation failed for mmap of %s\n",
+            filename);
+    return false;
   }
   rd->dexh = (dex_header*)rd->dexmmap;
   if (memcmp(rd->dexh->magic, dex_header_string, sizeof(rd->dexh->magic))) {
-    fprintf(stderr, "Bad dex magic, bailing\n");
-    exit(1);
+    fprintf(stderr, "Bad dex magic in %s\n", filename);
+    munmap(rd->dexmmap, rd->dex_size);
+    return false;
   }
   rd->dex_string_ids = (dex_string_id*)(rd->dexmmap + rd->dexh->string_ids_off);
   rd->dex_class_defs = (dex_class_def*)(rd->dexmmap + rd->dexh->class_defs_off);
   rd->dex_field_ids = (dex_field_id*)(rd->dexmmap + rd->dexh->field_ids_off);
   rd->dex_method_ids = (dex_method_id*)(rd->dexmmap + rd->dexh->method_ids_off);
   rd->dex_proto_ids = (dex_proto_id*)(rd->dexmmap + rd->dexh->proto_ids_off);
+  return true;
+}
+
+void open_dex_file(const char* filename, ddump_data* rd) {
+  if (!try_open_dex_file(filename, rd)) {
+    fprintf(stderr, "Bailing\n");
+    exit(1);
+  }
 }
 
 void get_type_extent(ddump_data* rd,
@@ -36,6 +36,9 @@ void get_dex_map_items(ddump_data* rd,
                        dex_map_item** _maps);
 dex_map_item* get_dex_map_item(ddump_data* rd, uint16_t type);
 void open_dex_file(const char* filename, ddump_data* rd);
+// Like open_dex_file, but reports failure to the caller instead of exiting,
+// so that it can be used from worker threads.
+bool try_open_dex_file(const char* filename, ddump_data* rd);
 void get_type_extent(ddump_data* rd,
                      uint16_t type,
                      uint32_t& start,
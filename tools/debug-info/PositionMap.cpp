@@ -8,15 +8,178 @@
  */
 
 #include <boost/scope_exit.hpp>
+#include <cctype>
+#include <cstring>
 #include <fcntl.h>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "PositionMap.h"
 
+PositionMap::~PositionMap() {
+  if (mapping != nullptr) {
+    munmap(mapping, mapping_size);
+  }
+}
+
+namespace {
+
+/*
+ * Reads fixed-size values out of a buffer, failing rather than reading past
+ * its end.
+ */
+class BoundedReader {
+ public:
+  BoundedReader(const uint8_t* begin, const uint8_t* end)
+      : m_cursor(begin), m_end(end) {}
+
+  template <typename T>
+  bool read(T* value) {
+    if (remaining() < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, m_cursor, sizeof(T));
+    m_cursor += sizeof(T);
+    return true;
+  }
+
+  bool skip(uint64_t size) {
+    if (remaining() < size) {
+      return false;
+    }
+    m_cursor += size;
+    return true;
+  }
+
+  const uint8_t* cursor() const { return m_cursor; }
+  uint64_t remaining() const { return m_end - m_cursor; }
+
+ private:
+  const uint8_t* m_cursor;
+  const uint8_t* m_end;
+};
+
+bool check_string_ids(const PositionMap& map, uint64_t string_count) {
+  for (size_t i = 0; i < map.positions_size; ++i) {
+    const auto& pi = map.positions[i];
+    if (pi.class_id >= string_count || pi.method_id >= string_count ||
+        pi.file_id >= string_count) {
+      std::cerr << "Position " << i << " refers to a missing string\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Parent chains must end, or get_stack() and symbolicate() would walk them
+ * forever. Each chain is walked once: positions on the chain being walked are
+ * marked as such until the chain is known to end.
+ */
+bool check_parents(const PositionMap& map) {
+  enum : uint8_t { UNSEEN, ON_CHAIN, ENDS };
+  std::vector<uint8_t> state(map.positions_size, UNSEEN);
+  auto in_map = [&](int64_t idx) {
+    return idx >= 0 && (size_t)idx < map.positions_size;
+  };
+  auto parent = [&](int64_t idx) {
+    return (int64_t)map.positions[idx].parent - 1;
+  };
+  for (size_t i = 0; i < map.positions_size; ++i) {
+    int64_t idx = i;
+    for (; in_map(idx) && state[idx] == UNSEEN; idx = parent(idx)) {
+      state[idx] = ON_CHAIN;
+    }
+    if (in_map(idx) && state[idx] == ON_CHAIN) {
+      std::cerr << "Position " << idx << " is its own ancestor\n";
+      return false;
+    }
+    for (idx = i; in_map(idx) && state[idx] == ON_CHAIN; idx = parent(idx)) {
+      state[idx] = ENDS;
+    }
+  }
+  return true;
+}
+
+bool read_map_v2(BoundedReader& reader, PositionMap* map) {
+  uint32_t spool_count;
+  if (!reader.read(&spool_count)) {
+    std::cerr << "Truncated map file\n";
+    return false;
+  }
+  for (uint32_t i = 0; i < spool_count; ++i) {
+    uint32_t ssize;
+    auto data = reader.cursor() + sizeof(ssize);
+    if (!reader.read(&ssize) || !reader.skip(ssize)) {
+      std::cerr << "Truncated map file\n";
+      return false;
+    }
+    map->string_pool.emplace_back((const char*)data, ssize);
+  }
+  uint32_t pos_count;
+  if (!reader.read(&pos_count) ||
+      reader.remaining() < (uint64_t)pos_count * sizeof(PositionItem)) {
+    std::cerr << "Truncated map file\n";
+    return false;
+  }
+  map->positions = (const PositionItem*)reader.cursor();
+  map->positions_size = pos_count;
+  return check_string_ids(*map, spool_count) && check_parents(*map);
+}
+
+bool read_map_v3(BoundedReader& reader, PositionMap* map) {
+  uint32_t string_count;
+  uint32_t pos_count;
+  uint64_t string_offsets_start;
+  uint64_t string_data_start;
+  uint64_t positions_start;
+  if (!reader.read(&string_count) || !reader.read(&pos_count) ||
+      !reader.read(&string_offsets_start) ||
+      !reader.read(&string_data_start) || !reader.read(&positions_start)) {
+    std::cerr << "Truncated map file\n";
+    return false;
+  }
+  // Each table has to lie within the file, and the ones read as arrays of
+  // words have to be aligned like the writer aligns them.
+  const uint64_t size = map->mapping_size;
+  auto table_fits = [size](uint64_t start, uint64_t count, uint64_t width) {
+    return start <= size && count <= (size - start) / width;
+  };
+  if (string_offsets_start % sizeof(uint32_t) != 0 ||
+      positions_start % sizeof(uint32_t) != 0 ||
+      !table_fits(string_offsets_start,
+                  (uint64_t)string_count + 1,
+                  sizeof(uint32_t)) ||
+      string_data_start > size ||
+      !table_fits(positions_start, pos_count, sizeof(PositionItem))) {
+    std::cerr << "Truncated map file\n";
+    return false;
+  }
+  const uint8_t* start = (const uint8_t*)map->mapping;
+  map->string_offsets = (const uint32_t*)(start + string_offsets_start);
+  map->string_data = (const char*)(start + string_data_start);
+  map->positions = (const PositionItem*)(start + positions_start);
+  map->positions_size = pos_count;
+  // The string offsets never decrease and the last one ends the string data.
+  for (uint32_t i = 0; i < string_count; ++i) {
+    if (map->string_offsets[i] > map->string_offsets[i + 1]) {
+      std::cerr << "String " << i << " has a negative size\n";
+      return false;
+    }
+  }
+  if (map->string_offsets[string_count] > size - string_data_start) {
+    std::cerr << "Truncated map file\n";
+    return false;
+  }
+  return check_string_ids(*map, string_count) && check_parents(*map);
+}
+
+} // namespace
+
 std::unique_ptr<PositionMap> read_map(const char* filename) {
   int fd = open(filename, O_RDONLY);
   if (fd == -1) {
@@ -24,62 +187,147 @@ std::unique_ptr<PositionMap> read_map(const char* filename) {
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
+  BOOST_SCOPE_EXIT_ALL(=) {
+    close(fd);
+  };
   struct stat buf;
   if (fstat(fd, &buf)) {
     std::cerr << "Cannot fstat file (" << filename
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
-  uint8_t* mapping = (uint8_t*)mmap(
+  if ((size_t)buf.st_size < 2 * sizeof(uint32_t)) {
+    std::cerr << "Truncated map file\n";
+    return nullptr;
+  }
+  void* mapping = mmap(
       nullptr, buf.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
-  uint32_t magic = *(uint32_t*)mapping;
-  mapping += sizeof(uint32_t);
   if (mapping == MAP_FAILED) {
     std::cerr << "mmap failed for file (" << filename
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
-  BOOST_SCOPE_EXIT_ALL(=, &buf) {
-    munmap(mapping, buf.st_size);
-  };
+  std::unique_ptr<PositionMap> map(new PositionMap());
+  map->mapping = mapping;
+  map->mapping_size = buf.st_size;
+
+  const uint8_t* begin = (const uint8_t*)mapping;
+  BoundedReader reader(begin, begin + map->mapping_size);
+  uint32_t magic;
+  uint32_t version;
+  reader.read(&magic);
+  reader.read(&version);
   if (magic != 0xfaceb000) {
     std::cerr << "Magic number mismatch\n";
     return nullptr;
   }
-  uint32_t version = *(uint32_t*)mapping;
-  mapping += sizeof(uint32_t);
-  if (version != 2) {
+  bool ok = false;
+  if (version == 2) {
+    ok = read_map_v2(reader, map.get());
+  } else if (version == 3) {
+    ok = read_map_v3(reader, map.get());
+  } else {
     std::cerr << "Version mismatch\n";
+  }
+  if (!ok) {
     return nullptr;
   }
-
-  std::unique_ptr<PositionMap> map(new PositionMap());
-  std::vector<std::string> string_pool;
-  uint32_t spool_count = *(uint32_t*)mapping;
-  mapping += sizeof(uint32_t);
-  for (uint32_t i = 0; i < spool_count; ++i) {
-    uint32_t ssize = *(uint32_t*)mapping;
-    mapping += sizeof(uint32_t);
-    map->string_pool.emplace_back((const char*)mapping, ssize);
-    mapping += ssize;
-  }
-  uint32_t pos_count = *(uint32_t*)mapping;
-  mapping += sizeof(uint32_t);
-  map->positions.reset(new PositionItem[pos_count]);
-  map->positions_size = pos_count;
-  memcpy(map->positions.get(), mapping, pos_count * sizeof(PositionItem));
   return map;
 }
 
 std::vector<Position> get_stack(const PositionMap& map, int64_t idx) {
   std::vector<Position> stack;
   while (idx >= 0 && (size_t)idx < map.positions_size) {
-    auto pi = map.positions[idx];
-    stack.push_back(Position(map.string_pool[pi.class_id],
-                             map.string_pool[pi.method_id],
-                             map.string_pool[pi.file_id],
+    const auto& pi = map.positions[idx];
+    stack.push_back(Position(map.get_string(pi.class_id),
+                             map.get_string(pi.method_id),
+                             map.get_string(pi.file_id),
                              pi.line));
     idx = (int64_t)pi.parent - 1;
   }
   return stack;
 }
+
+bool parse_frame(const char* begin,
+                 const char* end,
+                 size_t* prefix_size,
+                 int64_t* line) {
+  auto p = begin;
+  if (p == end || !isspace((unsigned char)*p)) {
+    return false;
+  }
+  while (p != end && isspace((unsigned char)*p)) {
+    ++p;
+  }
+  if (end - p < 3 || p[0] != 'a' || p[1] != 't' ||
+      !isspace((unsigned char)p[2])) {
+    return false;
+  }
+  auto paren = (const char*)memchr(p, '(', end - p);
+  if (paren == nullptr || end - paren < 2 || paren[1] != ':') {
+    return false;
+  }
+  p = paren + 2;
+  int64_t value = 0;
+  auto digits = p;
+  while (p != end && isdigit((unsigned char)*p)) {
+    if (p - digits >= 18) {
+      // Not a line number we could have emitted.
+      return false;
+    }
+    value = value * 10 + (*p - '0');
+    ++p;
+  }
+  if (p == digits || p == end || *p != ')') {
+    return false;
+  }
+  ++p;
+  if (p != end && isspace((unsigned char)*p)) {
+    ++p;
+  }
+  if (p != end) {
+    return false;
+  }
+  *prefix_size = paren - begin;
+  *line = value;
+  return true;
+}
+
+void symbolicate(const PositionMap& map,
+                 const char* begin,
+                 const char* end,
+                 std::string& out) {
+  while (begin != end) {
+    auto eol = (const char*)memchr(begin, '\n', end - begin);
+    auto line_end = eol == nullptr ? end : eol;
+    auto next = eol == nullptr ? end : eol + 1;
+    size_t prefix_size;
+    int64_t line;
+    if (!parse_frame(begin, line_end, &prefix_size, &line) || line < 1 ||
+        (size_t)(line - 1) >= map.positions_size) {
+      // Not a frame of ours, or one the map knows nothing about.
+      out.append(begin, next);
+      begin = next;
+      continue;
+    }
+    auto idx = line - 1;
+    bool first = true;
+    while (idx >= 0 && (size_t)idx < map.positions_size) {
+      const auto& pi = map.positions[idx];
+      if (!first) {
+        out.push_back('\n');
+      }
+      first = false;
+      out.append(begin, prefix_size);
+      out.push_back('(');
+      map.append_string(out, pi.file_id);
+      out.push_back(':');
+      out.append(std::to_string(pi.line));
+      out.push_back(')');
+      idx = (int64_t)pi.parent - 1;
+    }
+    // The line break of the frame, if it had one.
+    out.append(line_end, next);
+    begin = next;
+  }
+}
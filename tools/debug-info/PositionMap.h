@@ -31,11 +31,66 @@ struct Position {
       : cls(cls), method(method), filename(filename), line(line) {}
 };
 
+/*
+ * A line map read from a file, either of version 2 or 3. The file stays
+ * mapped for as long as the PositionMap is alive and the positions are read in
+ * place. The strings of a v3 map are read in place as well, those of a v2 map
+ * are copied into string_pool.
+ */
 struct PositionMap {
+  PositionMap() = default;
+  PositionMap(const PositionMap&) = delete;
+  PositionMap& operator=(const PositionMap&) = delete;
+  ~PositionMap();
+
+  std::string get_string(uint32_t id) const {
+    if (string_offsets != nullptr) {
+      return std::string(string_data + string_offsets[id],
+                         string_offsets[id + 1] - string_offsets[id]);
+    }
+    return string_pool[id];
+  }
+
+  void append_string(std::string& out, uint32_t id) const {
+    if (string_offsets != nullptr) {
+      out.append(string_data + string_offsets[id],
+                 string_offsets[id + 1] - string_offsets[id]);
+    } else {
+      out.append(string_pool[id]);
+    }
+  }
+
   std::vector<std::string> string_pool;
-  std::unique_ptr<PositionItem[]> positions;
-  size_t positions_size;
+  const uint32_t* string_offsets{nullptr};
+  const char* string_data{nullptr};
+  const PositionItem* positions{nullptr};
+  size_t positions_size{0};
+
+  void* mapping{nullptr};
+  size_t mapping_size{0};
 };
 
 std::unique_ptr<PositionMap> read_map(const char* filename);
 std::vector<Position> get_stack(const PositionMap& map, int64_t idx);
+
+/*
+ * Parses a stack frame emitted with a remapped line number, i.e. a line of
+ * the form "<spaces>at <method>(:<line>)", optionally followed by a single
+ * space character. On success, :prefix_size is set to the size of the part
+ * before the parenthesis and :line to the line number.
+ */
+bool parse_frame(const char* begin,
+                 const char* end,
+                 size_t* prefix_size,
+                 int64_t* line);
+
+/*
+ * Appends the lines of :trace to :out, replacing every frame with a remapped
+ * line number by the frames of the positions it stands for in :map. Other
+ * lines, and frames whose line number isn't in :map, are copied unchanged.
+ * The output ends with a line break only if the input does.
+ */
+void symbolicate(const PositionMap& map,
+                 const char* begin,
+                 const char* end,
+                 std::string& out);
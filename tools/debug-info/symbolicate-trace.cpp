@@ -7,31 +7,460 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
-#include <boost/regex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
+#include "Parallel.h"
 #include "PositionMap.h"
 
-boost::regex trace_regex(R"/((\s+at\s+[^(]*)\(:(\d+)\)\s?)/");
+namespace {
+
+const char* const BUILD_ID_HEADER = "build-id: ";
+const char* const OUTPUT_SUFFIX = ".symbolicated";
+// Clients sending a larger trace are dropped rather than buffered.
+const size_t MAX_TRACE_SIZE = 64 << 20;
+// Clients that stall for longer are dropped, so they can't tie up a worker.
+const time_t CLIENT_TIMEOUT_SECONDS = 30;
+
+void usage() {
+  std::cerr
+      << "Usage: cat trace | symbolicate-trace mapping_file\n"
+      << "       symbolicate-trace --map [build_id=]mapping_file... [-j N]\n"
+      << "                         (trace_file|trace_dir)...\n"
+      << "       symbolicate-trace --map [build_id=]mapping_file... [-j N]\n"
+      << "                         --server socket_path\n"
+      << "\n"
+      << "A trace whose first line is \"" << BUILD_ID_HEADER << "<id>\" is\n"
+      << "symbolicated with the map of that id, any other trace with the map\n"
+      << "given without an id.\n";
+}
+
+/*
+ * The maps we symbolicate with, keyed by the build id they were passed with.
+ */
+struct MapSet {
+  std::unordered_map<std::string, std::unique_ptr<PositionMap>> by_build_id;
+  const PositionMap* default_map{nullptr};
+
+  const PositionMap* find(const std::string& build_id) const {
+    auto it = by_build_id.find(build_id);
+    return it == by_build_id.end() ? nullptr : it->second.get();
+  }
+};
+
+/*
+ * Loads every map on its own thread. Each spec is either a path or
+ * build_id=path.
+ */
+bool load_maps(const std::vector<std::string>& specs, MapSet* maps) {
+  std::vector<std::string> ids(specs.size());
+  std::vector<std::string> paths(specs.size());
+  std::vector<std::unique_ptr<PositionMap>> loaded(specs.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < specs.size(); ++i) {
+    auto eq = specs[i].find('=');
+    if (eq != std::string::npos) {
+      ids[i] = specs[i].substr(0, eq);
+      paths[i] = specs[i].substr(eq + 1);
+    } else {
+      paths[i] = specs[i];
+    }
+    threads.emplace_back([&, i] { loaded[i] = read_map(paths[i].c_str()); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t i = 0; i < specs.size(); ++i) {
+    if (loaded[i] == nullptr) {
+      return false;
+    }
+    if (maps->by_build_id.count(ids[i])) {
+      std::cerr << "Duplicate map for build id \"" << ids[i] << "\"\n";
+      return false;
+    }
+    maps->by_build_id.emplace(ids[i], std::move(loaded[i]));
+  }
+  maps->default_map = maps->find("");
+  if (maps->default_map == nullptr && maps->by_build_id.size() == 1) {
+    maps->default_map = maps->by_build_id.begin()->second.get();
+  }
+  return true;
+}
+
+/*
+ * Symbolicates a whole trace, picking the map from its build id header if it
+ * has one. Traces we have no map for are passed through unchanged.
+ */
+void process_trace(const MapSet& maps,
+                   const char* begin,
+                   const char* end,
+                   std::string& out) {
+  out.reserve(out.size() + (end - begin) * 2);
+  auto map = maps.default_map;
+  auto header_size = strlen(BUILD_ID_HEADER);
+  if ((size_t)(end - begin) >= header_size &&
+      memcmp(begin, BUILD_ID_HEADER, header_size) == 0) {
+    auto eol = (const char*)memchr(begin, '\n', end - begin);
+    auto id_end = eol == nullptr ? end : eol;
+    auto id_begin = begin + header_size;
+    while (id_end != id_begin && isspace((unsigned char)id_end[-1])) {
+      --id_end;
+    }
+    std::string build_id(id_begin, id_end);
+    map = maps.find(build_id);
+    if (map == nullptr) {
+      std::cerr << "No map for build id \"" << build_id << "\"\n";
+    }
+    auto next = eol == nullptr ? end : eol + 1;
+    out.append(begin, next);
+    begin = next;
+  }
+  if (map == nullptr) {
+    out.append(begin, end);
+    return;
+  }
+  symbolicate(*map, begin, end, out);
+}
+
+bool write_fully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    auto written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool process_file(const MapSet& maps, const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::cerr << "Failed to open " << path << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    std::cerr << "Failed to stat " << path << ": " << strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+  const char* data = nullptr;
+  if (st.st_size > 0) {
+    auto mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      std::cerr << "Failed to map " << path << ": " << strerror(errno)
+                << "\n";
+      close(fd);
+      return false;
+    }
+    data = (const char*)mapping;
+  }
+  close(fd);
+  std::string out;
+  process_trace(maps, data, data + st.st_size, out);
+  if (data != nullptr) {
+    munmap((void*)data, st.st_size);
+  }
+  auto out_path = path + OUTPUT_SUFFIX;
+  std::ofstream ofs(out_path, std::ofstream::binary);
+  ofs.write(out.data(), out.size());
+  if (!ofs) {
+    std::cerr << "Failed to write " << out_path << "\n";
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Expands directories into the trace files they contain, skipping our own
+ * output files.
+ */
+std::vector<std::string> collect_inputs(const std::vector<std::string>& args) {
+  namespace fs = boost::filesystem;
+  std::vector<std::string> inputs;
+  auto is_output = [](const std::string& path) {
+    auto suffix_size = strlen(OUTPUT_SUFFIX);
+    return path.size() >= suffix_size &&
+           path.compare(path.size() - suffix_size, suffix_size,
+                        OUTPUT_SUFFIX) == 0;
+  };
+  for (const auto& arg : args) {
+    if (!fs::is_directory(arg)) {
+      inputs.push_back(arg);
+      continue;
+    }
+    std::vector<std::string> files;
+    for (fs::recursive_directory_iterator it(arg), end; it != end; ++it) {
+      auto path = it->path().string();
+      if (fs::is_regular_file(it->status()) && !is_output(path)) {
+        files.push_back(path);
+      }
+    }
+    std::sort(files.begin(), files.end());
+    inputs.insert(inputs.end(), files.begin(), files.end());
+  }
+  return inputs;
+}
+
+bool process_files(const MapSet& maps,
+                   const std::vector<std::string>& inputs,
+                   size_t num_threads) {
+  std::atomic<bool> ok{true};
+  parallel_for(inputs.size(),
+               [&](size_t i) {
+                 if (!process_file(maps, inputs[i])) {
+                   ok = false;
+                 }
+               },
+               num_threads);
+  return ok;
+}
+
+/*
+ * A client sends a trace, shuts down its side of the connection, and reads
+ * back the symbolicated trace until we close ours.
+ */
+void serve_client(const MapSet& maps, int fd) {
+  timeval timeout{CLIENT_TIMEOUT_SECONDS, 0};
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ==
+          -1 ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) ==
+          -1) {
+    std::cerr << "Failed to set the client timeout: " << strerror(errno)
+              << "\n";
+    close(fd);
+    return;
+  }
+  std::string trace;
+  char buf[1 << 16];
+  for (;;) {
+    auto n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      std::cerr << "Dropping a client idle for more than "
+                << CLIENT_TIMEOUT_SECONDS << " seconds\n";
+      close(fd);
+      return;
+    }
+    if (n <= 0) {
+      break;
+    }
+    if (trace.size() + n > MAX_TRACE_SIZE) {
+      std::cerr << "Dropping a client sending more than " << MAX_TRACE_SIZE
+                << " bytes\n";
+      close(fd);
+      return;
+    }
+    trace.append(buf, n);
+  }
+  std::string out;
+  process_trace(maps, trace.data(), trace.data() + trace.size(), out);
+  write_fully(fd, out.data(), out.size());
+  close(fd);
+}
+
+/*
+ * The connections accepted but not served yet. pop() blocks until there is
+ * one, and returns -1 once the queue is closed and drained.
+ */
+class ClientQueue {
+ public:
+  void push(int fd) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_fds.push_back(fd);
+    }
+    m_cv.notify_one();
+  }
+
+  int pop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_closed || !m_fds.empty(); });
+    if (m_fds.empty()) {
+      return -1;
+    }
+    int fd = m_fds.front();
+    m_fds.pop_front();
+    return fd;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+    }
+    m_cv.notify_all();
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<int> m_fds;
+  bool m_closed{false};
+};
+
+/*
+ * Removes what a previous server left at :socket_path. Anything there other
+ * than a socket is left alone and reported.
+ */
+bool remove_stale_socket(const std::string& socket_path) {
+  struct stat st;
+  if (lstat(socket_path.c_str(), &st) == -1) {
+    if (errno == ENOENT) {
+      return true;
+    }
+  } else if (!S_ISSOCK(st.st_mode)) {
+    std::cerr << socket_path << " exists and is not a socket\n";
+    return false;
+  } else if (unlink(socket_path.c_str()) == 0) {
+    return true;
+  }
+  std::cerr << "Failed to remove " << socket_path << ": " << strerror(errno)
+            << "\n";
+  return false;
+}
+
+int serve(const MapSet& maps,
+          const std::string& socket_path,
+          size_t num_threads) {
+  // Clients going away early shouldn't take the server down.
+  signal(SIGPIPE, SIG_IGN);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long: " << socket_path << "\n";
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path.c_str());
+  if (!remove_stale_socket(socket_path)) {
+    return 1;
+  }
+  int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server_fd == -1) {
+    std::cerr << "Failed to create socket: " << strerror(errno) << "\n";
+    return 1;
+  }
+  if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(server_fd, SOMAXCONN) == -1) {
+    std::cerr << "Failed to listen on " << socket_path << ": "
+              << strerror(errno) << "\n";
+    close(server_fd);
+    return 1;
+  }
+  ClientQueue clients;
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers.emplace_back([&] {
+      for (int fd = clients.pop(); fd != -1; fd = clients.pop()) {
+        serve_client(maps, fd);
+      }
+    });
+  }
+  int status = 0;
+  for (;;) {
+    int client_fd = accept(server_fd, nullptr, nullptr);
+    if (client_fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "Failed to accept: " << strerror(errno) << "\n";
+      status = 1;
+      break;
+    }
+    clients.push(client_fd);
+  }
+  close(server_fd);
+  // Serve the clients already accepted before going away.
+  clients.close();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return status;
+}
+
+}
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
-    std::cerr << "Usage: cat trace | remap mapping_file\n";
-    abort();
-  }
-  auto map = read_map(argv[1]);
-  for (std::string line; std::getline(std::cin, line);) {
-    boost::smatch matches;
-    if (boost::regex_match(line, matches, trace_regex)) {
-      auto idx = std::stoi(matches[2]) - 1;
-      auto stack = get_stack(*map, idx);
-      for (auto pos : stack) {
-        std::cout << matches[1] << "(" << pos.filename << ":" << pos.line
-                  << ")" << std::endl;
+  if (argc == 2 && argv[1][0] != '-') {
+    // Filter stdin line by line, so that we can sit at the end of a pipe.
+    auto map = read_map(argv[1]);
+    if (map == nullptr) {
+      return 1;
+    }
+    std::string out;
+    for (std::string line; std::getline(std::cin, line);) {
+      if (!std::cin.eof()) {
+        line.push_back('\n');
       }
+      out.clear();
+      symbolicate(*map, line.data(), line.data() + line.size(), out);
+      std::cout << out << std::flush;
+    }
+    return 0;
+  }
+
+  std::vector<std::string> map_specs;
+  std::vector<std::string> args;
+  std::string socket_path;
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if ((arg == "--map" || arg == "-j" || arg == "--server") && i + 1 < argc) {
+      std::string value(argv[++i]);
+      if (arg == "--map") {
+        map_specs.push_back(value);
+      } else if (arg == "-j") {
+        num_threads = std::max(1, atoi(value.c_str()));
+      } else {
+        socket_path = value;
+      }
+    } else if (arg[0] == '-') {
+      usage();
+      return 1;
     } else {
-      std::cout << line << std::endl;
+      args.push_back(arg);
     }
   }
+  if (map_specs.empty() || socket_path.empty() == args.empty()) {
+    usage();
+    return 1;
+  }
+
+  MapSet maps;
+  if (!load_maps(map_specs, &maps)) {
+    return 1;
+  }
+  if (!socket_path.empty()) {
+    return serve(maps, socket_path, num_threads);
+  }
+  return process_files(maps, collect_inputs(args), num_threads) ? 0 : 1;
 }
@@ -7,32 +7,209 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
+#include <boost/regex.hpp>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <getopt.h>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "DexCommon.h"
+#include "DexGrepIndex.h"
 
 void print_usage() {
-  fprintf(stderr, "Usage: dexgrep <classname> <dexfile 1> <dexfile 2> ...\n");
+  fprintf(stderr,
+          "Usage: dexgrep [-l] [-E] [--json] <classname> <dexfile 1> "
+          "<dexfile 2> ...\n"
+          "       dexgrep --build-index <index> <dexfile 1> <dexfile 2> ...\n"
+          "       dexgrep --index <index> [-l] [-E] [-a] [--json] <pattern>\n"
+          "\n"
+          "  -l, --files-without-match  only print the names of the files\n"
+          "  -E, --regex                the pattern is a regular expression\n"
+          "  -a, --all-symbols          match the types, methods and fields\n"
+          "                             the dexes reference too, not only\n"
+          "                             the classes they define\n"
+          "  --json                     print the matches as JSON\n");
 }
 
-int main(int argc, char* argv[]) {
+namespace {
+
+struct Options {
   bool files_only = false;
-  char c;
+  bool regex = false;
+  bool all_symbols = false;
+  bool json = false;
+};
+
+std::string json_string(const char* str) {
+  std::string ret = "\"";
+  for (auto p = str; *p != '\0'; ++p) {
+    auto c = (unsigned char)*p;
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ret += buf;
+    } else {
+      ret += c;
+    }
+  }
+  ret += '"';
+  return ret;
+}
+
+/*
+ * Prints the matches, given as (dex file, kind, symbol) in output order.
+ */
+void print_matches(
+    const std::vector<std::tuple<const char*, SymbolKind, const char*>>&
+        matches,
+    const Options& opts) {
+  if (opts.files_only) {
+    std::vector<const char*> files;
+    for (const auto& match : matches) {
+      if (files.empty() || strcmp(files.back(), std::get<0>(match)) != 0) {
+        files.push_back(std::get<0>(match));
+      }
+    }
+    if (opts.json) {
+      printf("[");
+      for (size_t i = 0; i < files.size(); i++) {
+        printf("%s%s", i == 0 ? "" : ",", json_string(files[i]).c_str());
+      }
+      printf("]\n");
+    } else {
+      for (auto file : files) {
+        printf("%s\n", file);
+      }
+    }
+    return;
+  }
+  if (opts.json) {
+    printf("[");
+    for (size_t i = 0; i < matches.size(); i++) {
+      printf("%s{\"dex\":%s,\"kind\":\"%s\",\"symbol\":%s}",
+             i == 0 ? "" : ",",
+             json_string(std::get<0>(matches[i])).c_str(),
+             symbol_kind_name(std::get<1>(matches[i])),
+             json_string(std::get<2>(matches[i])).c_str());
+    }
+    printf("]\n");
+    return;
+  }
+  for (const auto& match : matches) {
+    if (opts.all_symbols) {
+      printf("%s: %s: %s\n",
+             std::get<0>(match),
+             symbol_kind_name(std::get<1>(match)),
+             std::get<2>(match));
+    } else {
+      printf("%s: %s\n", std::get<0>(match), std::get<2>(match));
+    }
+  }
+}
+
+int grep_index(const char* index_file,
+               const char* search_str,
+               const Options& opts) {
+  auto index = DexGrepIndex::open(index_file);
+  if (index == nullptr) {
+    return 1;
+  }
+  std::vector<uint32_t> ids;
+  if (opts.regex) {
+    boost::regex re(search_str);
+    ids = index->find_if(
+        [&](const char* symbol) { return boost::regex_search(symbol, re); });
+  } else {
+    ids = index->find(search_str);
+  }
+
+  uint16_t wanted = opts.all_symbols
+                        ? (SK_CLASS | SK_TYPE | SK_METHOD | SK_FIELD)
+                        : SK_CLASS;
+  std::vector<std::tuple<const char*, SymbolKind, const char*>> matches;
+  for (const auto& hit : index->hits(ids, wanted)) {
+    matches.emplace_back(
+        index->dex_name(hit.dex), hit.kind, index->symbol(hit.symbol));
+  }
+  print_matches(matches, opts);
+  return 0;
+}
+
+int grep_dexes(const char* search_str,
+               const std::vector<const char*>& dexfiles,
+               const Options& opts) {
+  boost::regex re;
+  if (opts.regex) {
+    re = boost::regex(search_str);
+  }
+  std::vector<std::tuple<const char*, SymbolKind, const char*>> matches;
+  for (auto dexfile : dexfiles) {
+    ddump_data rd;
+    open_dex_file(dexfile, &rd);
+
+    auto size = rd.dexh->class_defs_size;
+    for (uint32_t j = 0; j < size; j++) {
+      dex_class_def* cls_def = rd.dex_class_defs + j;
+      char* name = dex_string_by_type_idx(&rd, cls_def->typeidx);
+      if (opts.regex ? boost::regex_search(name, re)
+                     : strstr(name, search_str) != nullptr) {
+        matches.emplace_back(dexfile, SK_CLASS, name);
+      }
+    }
+  }
+  print_matches(matches, opts);
+  return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  Options opts;
+  const char* build_index_file = nullptr;
+  const char* index_file = nullptr;
+  int c;
   static const struct option options[] = {
     { "files-without-match", no_argument, nullptr, 'l' },
+    { "regex", no_argument, nullptr, 'E' },
+    { "all-symbols", no_argument, nullptr, 'a' },
+    { "json", no_argument, nullptr, 'j' },
+    { "build-index", required_argument, nullptr, 'b' },
+    { "index", required_argument, nullptr, 'i' },
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 },
   };
   while ((c = getopt_long(
             argc,
             argv,
-            "hl",
+            "hlEab:i:",
             &options[0],
             nullptr)) != -1) {
     switch (c) {
       case 'l':
-        files_only = true;
+        opts.files_only = true;
+        break;
+      case 'E':
+        opts.regex = true;
+        break;
+      case 'a':
+        opts.all_symbols = true;
+        break;
+      case 'j':
+        opts.json = true;
+        break;
+      case 'b':
+        build_index_file = optarg;
+        break;
+      case 'i':
+        index_file = optarg;
         break;
       case 'h':
         print_usage();
@@ -43,30 +220,37 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (build_index_file != nullptr) {
+    if (optind == argc) {
+      fprintf(stderr, "%s: no dex files given\n", argv[0]);
+      print_usage();
+      return 1;
+    }
+    std::vector<std::string> dexfiles(argv + optind, argv + argc);
+    return build_index(dexfiles, build_index_file) ? 0 : 1;
+  }
+
+  if (index_file != nullptr) {
+    if (optind + 1 != argc) {
+      fprintf(stderr, "%s: expected exactly one pattern\n", argv[0]);
+      print_usage();
+      return 1;
+    }
+    return grep_index(index_file, argv[optind], opts);
+  }
+
   if (optind == argc) {
     fprintf(stderr, "%s: no dex files given\n", argv[0]);
     print_usage();
     return 1;
   }
+  if (opts.all_symbols) {
+    fprintf(stderr, "%s: -a needs an index\n", argv[0]);
+    print_usage();
+    return 1;
+  }
 
   const char* search_str = argv[optind];
-
-  for (int i = optind + 1; i < argc; ++i) {
-    const char* dexfile = argv[i];
-    ddump_data rd;
-    open_dex_file(dexfile, &rd);
-
-    auto size = rd.dexh->class_defs_size;
-    for (uint32_t j = 0; j < size; j++) {
-      dex_class_def* cls_def = rd.dex_class_defs + j;
-      char* name = dex_string_by_type_idx(&rd, cls_def->typeidx);
-      if (strstr(name, search_str) != nullptr) {
-        if (files_only) {
-          printf("%s\n", dexfile);
-        } else {
-          printf("%s: %s\n", dexfile, name);
-        }
-      }
-    }
-  }
+  std::vector<const char*> dexfiles(argv + optind + 1, argv + argc);
+  return grep_dexes(search_str, dexfiles, opts);
 }
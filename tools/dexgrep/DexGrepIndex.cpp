@@ -0,0 +1,580 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "DexGrepIndex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+
+#include "DexCommon.h"
+#include "Parallel.h"
+
+/*
+ * Index file layout. All the sections are arrays of uint32_t, except for the
+ * refs (pairs of uint16_t) and the strings, which come last so that
+ * everything before them stays aligned:
+ *
+ *   IndexHeader
+ *   uint32_t dex_name_offsets[dex_count + 1]     into strings
+ *   uint32_t class_index[dex_count + 1]          into classes
+ *   uint32_t classes[class_count]                symbol ids, per dex in the
+ *                                                order the dex defines them
+ *   uint32_t symbol_offsets[symbol_count + 1]    into strings
+ *   uint32_t ref_index[symbol_count + 1]         into refs
+ *   Ref      refs[ref_count]                     sorted by dex per symbol
+ *   uint32_t grams[gram_count]                   sorted trigrams
+ *   uint32_t gram_index[gram_count + 1]          into postings
+ *   uint32_t postings[posting_count]             sorted symbol ids per gram
+ *   char     strings[strings_size]               NUL-terminated
+ *
+ * Symbols are sorted, so symbol ids follow the order of the symbols. Each of
+ * the *_index tables is non-decreasing and ends with the size of the table it
+ * points into. open() checks all of this, as well as every offset and id, so
+ * that the accessors don't have to.
+ */
+
+namespace {
+
+constexpr char kIndexMagic[4] = {'D', 'X', 'G', 'I'};
+constexpr uint32_t kIndexVersion = 2;
+
+struct IndexHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t dex_count;
+  uint32_t class_count;
+  uint32_t symbol_count;
+  uint32_t ref_count;
+  uint32_t gram_count;
+  uint32_t posting_count;
+  uint32_t strings_size;
+};
+
+using Ref = DexGrepIndex::Ref;
+
+// Three consecutive bytes of a symbol.
+uint32_t make_gram(const char* p) {
+  return (uint32_t)(uint8_t)p[0] << 16 | (uint32_t)(uint8_t)p[1] << 8 |
+         (uint32_t)(uint8_t)p[2];
+}
+
+struct SymbolRef {
+  std::string symbol;
+  SymbolKind kind;
+};
+
+std::string type_list_string(ddump_data* rd, uint32_t off) {
+  std::string ret;
+  if (off == 0) {
+    return ret;
+  }
+  auto tl = (uint32_t*)(rd->dexmmap + off);
+  auto count = *tl++;
+  auto types = (uint16_t*)tl;
+  for (uint32_t i = 0; i < count; i++) {
+    ret += dex_string_by_type_idx(rd, types[i]);
+  }
+  return ret;
+}
+
+/*
+ * Reads the symbols of :dexfile, its classes first in the order it defines
+ * them. Returns false if the dex can't be read.
+ */
+bool read_symbols(const char* dexfile, std::vector<SymbolRef>* out) {
+  ddump_data rd;
+  if (!try_open_dex_file(dexfile, &rd)) {
+    return false;
+  }
+  auto dexh = rd.dexh;
+  auto& symbols = *out;
+  symbols.reserve(dexh->class_defs_size + dexh->type_ids_size +
+                  dexh->method_ids_size + dexh->field_ids_size);
+
+  for (uint32_t i = 0; i < dexh->class_defs_size; i++) {
+    symbols.push_back(
+        {dex_string_by_type_idx(&rd, rd.dex_class_defs[i].typeidx), SK_CLASS});
+  }
+  for (uint32_t i = 0; i < dexh->type_ids_size; i++) {
+    symbols.push_back({dex_string_by_type_idx(&rd, i), SK_TYPE});
+  }
+  for (uint32_t i = 0; i < dexh->method_ids_size; i++) {
+    auto method = rd.dex_method_ids + i;
+    auto proto = rd.dex_proto_ids + method->protoidx;
+    std::string symbol = dex_string_by_type_idx(&rd, method->classidx);
+    symbol += ".";
+    symbol += dex_string_by_idx(&rd, method->nameidx);
+    symbol += ":(";
+    symbol += type_list_string(&rd, proto->param_off);
+    symbol += ")";
+    symbol += dex_string_by_type_idx(&rd, proto->rtypeidx);
+    symbols.push_back({std::move(symbol), SK_METHOD});
+  }
+  for (uint32_t i = 0; i < dexh->field_ids_size; i++) {
+    auto field = rd.dex_field_ids + i;
+    std::string symbol = dex_string_by_type_idx(&rd, field->classidx);
+    symbol += ".";
+    symbol += dex_string_by_idx(&rd, field->nameidx);
+    symbol += ":";
+    symbol += dex_string_by_type_idx(&rd, field->typeidx);
+    symbols.push_back({std::move(symbol), SK_FIELD});
+  }
+  munmap(rd.dexmmap, rd.dex_size);
+  return true;
+}
+
+template <typename T>
+bool write_array(FILE* fp, const std::vector<T>& v) {
+  return fwrite(v.data(), sizeof(T), v.size(), fp) == v.size();
+}
+
+// Whether :table, of :size + 1 entries, never decreases and ends at :end.
+bool is_index_table(const uint32_t* table, uint32_t size, uint32_t end) {
+  for (uint32_t i = 0; i < size; i++) {
+    if (table[i] > table[i + 1]) {
+      return false;
+    }
+  }
+  return table[size] == end;
+}
+
+// Binary search in a sorted array of uint32_t; returns the index of :value
+// or :size if it isn't there.
+uint32_t find_sorted(const uint32_t* begin, uint32_t size, uint32_t value) {
+  auto it = std::lower_bound(begin, begin + size, value);
+  return (it != begin + size && *it == value) ? it - begin : size;
+}
+
+}
+
+const char* symbol_kind_name(SymbolKind kind) {
+  switch (kind) {
+  case SK_CLASS:
+    return "class";
+  case SK_TYPE:
+    return "type";
+  case SK_METHOD:
+    return "method";
+  case SK_FIELD:
+    return "field";
+  }
+  return "unknown";
+}
+
+bool build_index(const std::vector<std::string>& dexfiles,
+                 const char* index_file) {
+  if (dexfiles.size() > std::numeric_limits<uint16_t>::max()) {
+    fprintf(stderr, "Too many dex files to index: %zu\n", dexfiles.size());
+    return false;
+  }
+
+  std::vector<std::vector<SymbolRef>> dex_symbols(dexfiles.size());
+  std::unique_ptr<bool[]> read_ok(new bool[dexfiles.size()]);
+  parallel_for(dexfiles.size(), [&](size_t i) {
+    read_ok[i] = read_symbols(dexfiles[i].c_str(), &dex_symbols[i]);
+  });
+  if (!std::all_of(
+          read_ok.get(), read_ok.get() + dexfiles.size(), [](bool ok) {
+            return ok;
+          })) {
+    return false;
+  }
+
+  // Sorted, deduplicated symbols: a symbol's id is its position in here.
+  std::vector<const std::string*> symbols;
+  for (const auto& refs : dex_symbols) {
+    for (const auto& ref : refs) {
+      symbols.push_back(&ref.symbol);
+    }
+  }
+  auto less = [](const std::string* a, const std::string* b) {
+    return *a < *b;
+  };
+  auto equal = [](const std::string* a, const std::string* b) {
+    return *a == *b;
+  };
+  std::sort(symbols.begin(), symbols.end(), less);
+  symbols.erase(std::unique(symbols.begin(), symbols.end(), equal),
+                symbols.end());
+  auto symbol_id = [&](const std::string& symbol) {
+    return (uint32_t)(std::lower_bound(symbols.begin(),
+                                       symbols.end(),
+                                       &symbol,
+                                       less) -
+                      symbols.begin());
+  };
+
+  // Per symbol, which dexes mention it and how. Dexes are visited in order,
+  // so the refs of a symbol come out sorted by dex.
+  std::vector<std::vector<Ref>> symbol_refs(symbols.size());
+  for (size_t dex = 0; dex < dex_symbols.size(); dex++) {
+    for (const auto& ref : dex_symbols[dex]) {
+      auto& refs = symbol_refs[symbol_id(ref.symbol)];
+      if (refs.empty() || refs.back().dex != dex) {
+        refs.push_back({(uint16_t)dex, 0});
+      }
+      refs.back().kinds |= ref.kind;
+    }
+  }
+
+  // (gram, symbol id) pairs, built over slices of the symbols in parallel.
+  constexpr size_t kSliceSize = 4096;
+  size_t num_slices = (symbols.size() + kSliceSize - 1) / kSliceSize;
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> slice_grams(
+      num_slices);
+  parallel_for(num_slices, [&](size_t slice) {
+    auto& grams = slice_grams[slice];
+    auto end = std::min(symbols.size(), (slice + 1) * kSliceSize);
+    for (size_t id = slice * kSliceSize; id < end; id++) {
+      const auto& symbol = *symbols[id];
+      auto first = grams.size();
+      for (size_t i = 0; i + 3 <= symbol.size(); i++) {
+        grams.emplace_back(make_gram(symbol.data() + i), id);
+      }
+      std::sort(grams.begin() + first, grams.end());
+      grams.erase(std::unique(grams.begin() + first, grams.end()),
+                  grams.end());
+    }
+  });
+  std::vector<std::pair<uint32_t, uint32_t>> all_grams;
+  for (auto& grams : slice_grams) {
+    all_grams.insert(all_grams.end(), grams.begin(), grams.end());
+    std::vector<std::pair<uint32_t, uint32_t>>().swap(grams);
+  }
+  // The slices are in id order already, so a stable sort by gram keeps the
+  // postings of every gram sorted by id.
+  std::stable_sort(all_grams.begin(),
+                   all_grams.end(),
+                   [](const std::pair<uint32_t, uint32_t>& a,
+                      const std::pair<uint32_t, uint32_t>& b) {
+                     return a.first < b.first;
+                   });
+
+  // Lay out the sections. Every count and offset is stored as a uint32_t,
+  // so check that they fit before narrowing any of them.
+  uint64_t strings_size = 0;
+  for (const auto& dexfile : dexfiles) {
+    strings_size += dexfile.size() + 1;
+  }
+  for (auto symbol : symbols) {
+    strings_size += symbol->size() + 1;
+  }
+  uint64_t class_count = 0;
+  uint64_t ref_count = 0;
+  for (const auto& refs : dex_symbols) {
+    class_count += std::count_if(
+        refs.begin(), refs.end(), [](const SymbolRef& ref) {
+          return ref.kind == SK_CLASS;
+        });
+  }
+  for (const auto& sr : symbol_refs) {
+    ref_count += sr.size();
+  }
+  constexpr uint64_t kMaxSize = std::numeric_limits<uint32_t>::max();
+  if (strings_size > kMaxSize || symbols.size() >= kMaxSize ||
+      class_count > kMaxSize || ref_count > kMaxSize ||
+      all_grams.size() > kMaxSize) {
+    fprintf(stderr, "Too many symbols to index\n");
+    return false;
+  }
+
+  std::vector<uint32_t> dex_name_offsets;
+  std::vector<uint32_t> symbol_offsets;
+  std::string strings;
+  strings.reserve(strings_size);
+  for (const auto& dexfile : dexfiles) {
+    dex_name_offsets.push_back(strings.size());
+    strings.append(dexfile.c_str(), dexfile.size() + 1);
+  }
+  dex_name_offsets.push_back(strings.size());
+  for (auto symbol : symbols) {
+    symbol_offsets.push_back(strings.size());
+    strings.append(symbol->c_str(), symbol->size() + 1);
+  }
+  symbol_offsets.push_back(strings.size());
+
+  std::vector<uint32_t> class_index;
+  std::vector<uint32_t> classes;
+  for (const auto& refs : dex_symbols) {
+    class_index.push_back(classes.size());
+    for (const auto& ref : refs) {
+      if (ref.kind == SK_CLASS) {
+        classes.push_back(symbol_id(ref.symbol));
+      }
+    }
+  }
+  class_index.push_back(classes.size());
+
+  std::vector<uint32_t> ref_index;
+  std::vector<Ref> refs;
+  for (const auto& sr : symbol_refs) {
+    ref_index.push_back(refs.size());
+    refs.insert(refs.end(), sr.begin(), sr.end());
+  }
+  ref_index.push_back(refs.size());
+
+  std::vector<uint32_t> grams;
+  std::vector<uint32_t> gram_index;
+  std::vector<uint32_t> postings;
+  postings.reserve(all_grams.size());
+  for (const auto& gram : all_grams) {
+    if (grams.empty() || grams.back() != gram.first) {
+      grams.push_back(gram.first);
+      gram_index.push_back(postings.size());
+    }
+    postings.push_back(gram.second);
+  }
+  gram_index.push_back(postings.size());
+
+  IndexHeader header;
+  memcpy(header.magic, kIndexMagic, sizeof(header.magic));
+  header.version = kIndexVersion;
+  header.dex_count = dexfiles.size();
+  header.class_count = classes.size();
+  header.symbol_count = symbols.size();
+  header.ref_count = refs.size();
+  header.gram_count = grams.size();
+  header.posting_count = postings.size();
+  header.strings_size = strings.size();
+
+  FILE* fp = fopen(index_file, "wb");
+  if (fp == nullptr) {
+    fprintf(stderr, "Cannot open index file %s for writing\n", index_file);
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            write_array(fp, dex_name_offsets) &&
+            write_array(fp, class_index) && write_array(fp, classes) &&
+            write_array(fp, symbol_offsets) && write_array(fp, ref_index) &&
+            write_array(fp, refs) && write_array(fp, grams) &&
+            write_array(fp, gram_index) && write_array(fp, postings) &&
+            fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+  ok = fclose(fp) == 0 && ok;
+  if (!ok) {
+    fprintf(stderr, "Failed to write index file %s\n", index_file);
+  }
+  return ok;
+}
+
+std::unique_ptr<DexGrepIndex> DexGrepIndex::open(const char* index_file) {
+  int fd = ::open(index_file, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open index file %s\n", index_file);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+    fprintf(stderr, "Index file %s is too short\n", index_file);
+    close(fd);
+    return nullptr;
+  }
+  auto mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Cannot map index file %s\n", index_file);
+    return nullptr;
+  }
+  std::unique_ptr<DexGrepIndex> index(new DexGrepIndex());
+  index->m_mapping = mapping;
+  index->m_mapping_size = st.st_size;
+
+  IndexHeader header;
+  memcpy(&header, mapping, sizeof(header));
+  if (memcmp(header.magic, kIndexMagic, sizeof(header.magic)) != 0 ||
+      header.version != kIndexVersion) {
+    fprintf(stderr, "%s is not a dexgrep index\n", index_file);
+    return nullptr;
+  }
+  uint64_t expected_size =
+      sizeof(IndexHeader) +
+      sizeof(uint32_t) *
+          (2 * ((uint64_t)header.dex_count + 1) + header.class_count +
+           2 * ((uint64_t)header.symbol_count + 1) + header.gram_count +
+           (uint64_t)header.gram_count + 1 + header.posting_count) +
+      sizeof(Ref) * (uint64_t)header.ref_count + header.strings_size;
+  if (expected_size != (uint64_t)st.st_size) {
+    fprintf(stderr, "Index file %s is corrupt\n", index_file);
+    return nullptr;
+  }
+
+  auto cursor = (const uint32_t*)((const char*)mapping + sizeof(IndexHeader));
+  index->m_dex_count = header.dex_count;
+  index->m_dex_name_offsets = cursor;
+  cursor += header.dex_count + 1;
+  index->m_class_index = cursor;
+  cursor += header.dex_count + 1;
+  index->m_classes = cursor;
+  cursor += header.class_count;
+  index->m_symbol_count = header.symbol_count;
+  index->m_symbol_offsets = cursor;
+  cursor += header.symbol_count + 1;
+  index->m_ref_index = cursor;
+  cursor += header.symbol_count + 1;
+  index->m_refs = (const Ref*)cursor;
+  cursor += header.ref_count;
+  index->m_gram_count = header.gram_count;
+  index->m_grams = cursor;
+  cursor += header.gram_count;
+  index->m_gram_index = cursor;
+  cursor += header.gram_count + 1;
+  index->m_postings = cursor;
+  cursor += header.posting_count;
+  index->m_strings = (const char*)cursor;
+
+  index->m_class_count = header.class_count;
+  index->m_ref_count = header.ref_count;
+  index->m_posting_count = header.posting_count;
+  index->m_strings_size = header.strings_size;
+  if (!index->is_valid()) {
+    fprintf(stderr, "Index file %s is corrupt\n", index_file);
+    return nullptr;
+  }
+  return index;
+}
+
+bool DexGrepIndex::is_valid() const {
+  // Every string starts within the strings and the last one is terminated,
+  // so all of them are.
+  auto strings_size = m_strings_size;
+  if (strings_size > 0 && m_strings[strings_size - 1] != '\0') {
+    return false;
+  }
+  auto valid_offsets = [&](const uint32_t* offsets, uint32_t count) {
+    return is_index_table(offsets, count, offsets[count]) &&
+           offsets[count] <= strings_size &&
+           (count == 0 || offsets[count - 1] < strings_size);
+  };
+  auto all_below = [](const uint32_t* ids, uint32_t count, uint32_t limit) {
+    return std::all_of(
+        ids, ids + count, [limit](uint32_t id) { return id < limit; });
+  };
+  return valid_offsets(m_dex_name_offsets, m_dex_count) &&
+         valid_offsets(m_symbol_offsets, m_symbol_count) &&
+         is_index_table(m_class_index, m_dex_count, m_class_count) &&
+         all_below(m_classes, m_class_count, m_symbol_count) &&
+         is_index_table(m_ref_index, m_symbol_count, m_ref_count) &&
+         std::all_of(m_refs,
+                     m_refs + m_ref_count,
+                     [&](const Ref& ref) { return ref.dex < m_dex_count; }) &&
+         is_index_table(m_gram_index, m_gram_count, m_posting_count) &&
+         all_below(m_postings, m_posting_count, m_symbol_count);
+}
+
+DexGrepIndex::~DexGrepIndex() {
+  if (m_mapping != nullptr) {
+    munmap(m_mapping, m_mapping_size);
+  }
+}
+
+const char* DexGrepIndex::dex_name(uint32_t dex) const {
+  return m_strings + m_dex_name_offsets[dex];
+}
+
+const char* DexGrepIndex::symbol(uint32_t id) const {
+  return m_strings + m_symbol_offsets[id];
+}
+
+std::vector<uint32_t> DexGrepIndex::find(const std::string& needle) const {
+  auto contains = [&](const char* symbol) {
+    return strstr(symbol, needle.c_str()) != nullptr;
+  };
+  if (needle.size() < 3) {
+    return find_if(contains);
+  }
+
+  // Every symbol containing the needle has all of the needle's trigrams:
+  // intersect their postings, shortest first, and check what's left.
+  std::vector<std::pair<const uint32_t*, const uint32_t*>> lists;
+  for (size_t i = 0; i + 3 <= needle.size(); i++) {
+    auto gram = find_sorted(m_grams, m_gram_count, make_gram(&needle[i]));
+    if (gram == m_gram_count) {
+      return {};
+    }
+    lists.emplace_back(m_postings + m_gram_index[gram],
+                       m_postings + m_gram_index[gram + 1]);
+  }
+  std::sort(lists.begin(),
+            lists.end(),
+            [](const std::pair<const uint32_t*, const uint32_t*>& a,
+               const std::pair<const uint32_t*, const uint32_t*>& b) {
+              return a.second - a.first < b.second - b.first;
+            });
+  std::vector<uint32_t> candidates(lists[0].first, lists[0].second);
+  std::vector<uint32_t> narrowed;
+  for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+    narrowed.clear();
+    std::set_intersection(candidates.begin(),
+                          candidates.end(),
+                          lists[i].first,
+                          lists[i].second,
+                          std::back_inserter(narrowed));
+    candidates.swap(narrowed);
+  }
+  candidates.erase(std::remove_if(candidates.begin(),
+                                  candidates.end(),
+                                  [&](uint32_t id) {
+                                    return !contains(symbol(id));
+                                  }),
+                   candidates.end());
+  return candidates;
+}
+
+std::vector<uint32_t> DexGrepIndex::find_if(
+    const std::function<bool(const char*)>& pred) const {
+  std::vector<uint32_t> ids;
+  for (uint32_t id = 0; id < m_symbol_count; id++) {
+    if (pred(symbol(id))) {
+      ids.push_back(id);
+    }
+  }
+  return ids;
+}
+
+std::vector<DexGrepIndex::Hit> DexGrepIndex::hits(
+    const std::vector<uint32_t>& ids, uint16_t kinds) const {
+  // Sort keys: classes are ranked by their position in the dex, the other
+  // symbols by id.
+  std::vector<std::tuple<uint16_t, uint16_t, uint32_t, uint32_t>> keys;
+  if (kinds & SK_CLASS) {
+    for (uint32_t dex = 0; dex < m_dex_count; dex++) {
+      for (auto cls = classes_begin(dex); cls != classes_end(dex); ++cls) {
+        if (std::binary_search(ids.begin(), ids.end(), *cls)) {
+          keys.emplace_back(
+              dex, SK_CLASS, cls - classes_begin(dex), *cls);
+        }
+      }
+    }
+  }
+  for (auto id : ids) {
+    for (auto ref = refs_begin(id); ref != refs_end(id); ++ref) {
+      for (uint16_t kind = SK_TYPE; kind <= SK_FIELD; kind <<= 1) {
+        if (ref->kinds & kind & kinds) {
+          keys.emplace_back(ref->dex, kind, id, id);
+        }
+      }
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  std::vector<Hit> ret;
+  ret.reserve(keys.size());
+  for (const auto& key : keys) {
+    ret.push_back(
+        {std::get<0>(key), (SymbolKind)std::get<1>(key), std::get<3>(key)});
+  }
+  return ret;
+}
@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * The ways a dex can mention a symbol. A symbol may be mentioned in several
+ * ways by the same dex, e.g. a class it defines is also one of its types.
+ */
+enum SymbolKind : uint16_t {
+  SK_CLASS = 1, // a class defined by the dex
+  SK_TYPE = 2, // a type referenced by the dex
+  SK_METHOD = 4, // a method referenced by the dex, as Lcls;.name:(args)ret
+  SK_FIELD = 8, // a field referenced by the dex, as Lcls;.name:type
+};
+
+const char* symbol_kind_name(SymbolKind kind);
+
+/*
+ * Writes an index of the symbols of :dexfiles to :index_file, reading the
+ * dexes in parallel.
+ *
+ * The index holds the sorted, deduplicated symbols of all the dexes, which
+ * dexes mention each symbol and how, and a trigram index over the symbols so
+ * that substring queries only look at the symbols that can match.
+ */
+bool build_index(const std::vector<std::string>& dexfiles,
+                 const char* index_file);
+
+/*
+ * A read-only view of an index file written by build_index.
+ */
+class DexGrepIndex {
+ public:
+  struct Ref {
+    uint16_t dex;
+    uint16_t kinds; // a mask of SymbolKind
+  };
+
+  struct Hit {
+    uint16_t dex;
+    SymbolKind kind;
+    uint32_t symbol;
+  };
+
+  static std::unique_ptr<DexGrepIndex> open(const char* index_file);
+  ~DexGrepIndex();
+
+  uint32_t dex_count() const { return m_dex_count; }
+  const char* dex_name(uint32_t dex) const;
+
+  // The classes :dex defines, in the order it defines them.
+  const uint32_t* classes_begin(uint32_t dex) const {
+    return m_classes + m_class_index[dex];
+  }
+  const uint32_t* classes_end(uint32_t dex) const {
+    return m_classes + m_class_index[dex + 1];
+  }
+
+  uint32_t symbol_count() const { return m_symbol_count; }
+  const char* symbol(uint32_t id) const;
+
+  const Ref* refs_begin(uint32_t id) const { return m_refs + m_ref_index[id]; }
+  const Ref* refs_end(uint32_t id) const {
+    return m_refs + m_ref_index[id + 1];
+  }
+
+  /*
+   * The ids, in ascending order, of the symbols that contain :needle.
+   */
+  std::vector<uint32_t> find(const std::string& needle) const;
+
+  /*
+   * The ids, in ascending order, of the symbols :pred holds for.
+   */
+  std::vector<uint32_t> find_if(
+      const std::function<bool(const char*)>& pred) const;
+
+  /*
+   * The ways the dexes mention the symbols :ids, which must be sorted, as far
+   * as they are of the kinds in :kinds. The hits come dex by dex and kind by
+   * kind. Classes come in the order their dex defines them, like dexgrep
+   * prints them without an index; the other symbols in id order.
+   */
+  std::vector<Hit> hits(const std::vector<uint32_t>& ids,
+                        uint16_t kinds) const;
+
+ private:
+  DexGrepIndex() = default;
+  bool is_valid() const;
+
+  void* m_mapping{nullptr};
+  size_t m_mapping_size{0};
+
+  uint32_t m_dex_count{0};
+  const uint32_t* m_dex_name_offsets{nullptr};
+  uint32_t m_class_count{0};
+  const uint32_t* m_class_index{nullptr};
+  const uint32_t* m_classes{nullptr};
+  uint32_t m_symbol_count{0};
+  const uint32_t* m_symbol_offsets{nullptr};
+  const char* m_strings{nullptr};
+  const uint32_t* m_ref_index{nullptr};
+  uint32_t m_ref_count{0};
+  const Ref* m_refs{nullptr};
+  uint32_t m_gram_count{0};
+  const uint32_t* m_grams{nullptr};
+  const uint32_t* m_gram_index{nullptr};
+  uint32_t m_posting_count{0};
+  const uint32_t* m_postings{nullptr};
+  uint32_t m_strings_size{0};
+};
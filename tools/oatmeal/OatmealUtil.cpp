@@ -42,10 +42,13 @@ void stream_file(FileHandle& in, FileHandle& out) {
 }
 
 void write_padding(FileHandle& fh, char byte, size_t num) {
-  // This might be inefficient, but the most padding we ever do at
-  // once is 4k, so this shouldn't be too bad.
-  for (size_t i = 0; i < num; i++) {
-    CHECK(fh.fwrite(&byte, sizeof(char), 1) == sizeof(char));
+  constexpr size_t kBufSize = 0x1000;
+  char buf[kBufSize];
+  memset(buf, byte, std::min(num, kBufSize));
+  while (num > 0) {
+    auto chunk = std::min(num, kBufSize);
+    write_buf(fh, ConstBuffer{buf, chunk});
+    num -= chunk;
   }
 }
 
@@ -12,6 +12,7 @@
 
 #include "dump-oat.h"
 #include "OatmealUtil.h"
+#include "Parallel.h"
 #include "QuickData.h"
 #include "Util.h"
 #include "dex.h"
@@ -1457,23 +1458,28 @@ void OatClasses_079::write(
       table_offset);
     #endif
 
-    // write pointers to ClassInfo.
+    // Lay out the whole table in memory, so that it goes out in one write.
+    std::vector<char> table(num_classes *
+                            (sizeof(uint32_t) + sizeof(OatClasses::ClassInfo)));
+    auto cur = table.data();
+
+    // pointers to ClassInfo.
     for (size_t i = 0; i < num_classes; i++) {
-      write_word(cksum_fh, table_offset + i * sizeof(uint32_t));
+      uint32_t info_offset = table_offset + i * sizeof(uint32_t);
+      memcpy(cur, &info_offset, sizeof(uint32_t));
+      cur += sizeof(uint32_t);
 
       #ifdef DEBUG_LOG
-      printf("#ClassOffsets[%zu] -> %zu\n",
-        i,
-        table_offset + i * sizeof(uint32_t));
+      printf("#ClassOffsets[%zu] -> %u\n", i, info_offset);
       #endif
     }
-    CHECK(table_offset == cksum_fh.bytes_written());
 
-    // Write ClassInfo structs.
+    // ClassInfo structs.
     OatClasses::ClassInfo info(OatClasses::Status::kStatusVerified,
                                OatClasses::Type::kOatClassNoneCompiled);
     for (size_t i = 0; i < num_classes; i++) {
-      write_obj(cksum_fh, info);
+      memcpy(cur, &info, sizeof(OatClasses::ClassInfo));
+      cur += sizeof(OatClasses::ClassInfo);
 
       #ifdef DEBUG_LOG
       printf("#OatClass[%zu]:%u ::  type: %u\n",
@@ -1483,6 +1489,7 @@ void OatClasses_079::write(
       #endif
       table_offset += sizeof(OatClasses::ClassInfo);
     }
+    write_vec(cksum_fh, table);
     CHECK(table_offset == cksum_fh.bytes_written());
     dex_count++;
   }
@@ -1513,11 +1520,14 @@ class SamsungLookupTables {
   };
 
   struct LookupTable {
+    LookupTable() = default;
+    LookupTable(std::unique_ptr<LookupTableEntry[]> data_, uint32_t size_)
+        : data(std::move(data_)), size(size_) {}
     LookupTable(LookupTable&&) = default;
     LookupTable& operator=(LookupTable&&) = default;
 
     std::unique_ptr<LookupTableEntry[]> data;
-    uint32_t size;
+    uint32_t size{0};
 
     size_t byte_size() const { return size * sizeof(LookupTableEntry); }
   };
@@ -1539,15 +1549,20 @@ class SamsungLookupTables {
       const std::vector<DexInput>& dex_input_vec,
       const std::vector<DexFileListing_064::DexFile_064>& dex_files,
       FileHandle& cksum_fh) {
+    CHECK(dex_input_vec.size() == dex_files.size());
+    // The tables of different dexes are independent, build them all at once
+    // and only write them out in order.
+    std::vector<LookupTable> tables(dex_files.size());
+    parallel_for(dex_files.size(), [&](size_t i) {
+      tables[i] = build_lookup_table(dex_input_vec[i].filename);
+    });
     foreach_pair(
-        dex_input_vec,
+        tables,
         dex_files,
-        [&](const DexInput& dex_input,
+        [&](const LookupTable& table,
             const DexFileListing_064::DexFile_064& dex_file) {
           CHECK(dex_file.lookup_table_offset == cksum_fh.bytes_written());
 
-          auto table = build_lookup_table(dex_input.filename);
-
           auto buf =
               ConstBuffer{reinterpret_cast<const char*>(table.data.get()),
                           table.byte_size()};
@@ -1760,20 +1775,23 @@ class LookupTables {
       const std::vector<DexInput>& dex_input_vec,
       const std::vector<DexFileType>& dex_files,
       FileHandle& cksum_fh) {
+    CHECK(dex_input_vec.size() == dex_files.size());
+    // Hashing the class names of a dex only needs that dex, so build all the
+    // tables at once and only write them out in order.
+    std::vector<std::unique_ptr<LookupTableEntry[]>> tables(dex_files.size());
+    parallel_for(dex_files.size(), [&](size_t i) {
+      tables[i] = build_lookup_table(dex_input_vec[i].filename,
+                                     numEntries(dex_files[i].num_classes));
+    });
     foreach_pair(
-        dex_input_vec,
+        tables,
         dex_files,
-        [&](const DexInput& dex_input,
+        [&](const std::unique_ptr<LookupTableEntry[]>& lookup_table_buf,
             const DexFileListing_079::DexFile_079& dex_file) {
           CHECK(dex_file.lookup_table_offset == cksum_fh.bytes_written());
-          const auto num_classes = dex_file.num_classes;
-
-          const auto lookup_table_size = numEntries(num_classes);
           const auto lookup_table_byte_size =
-              lookup_table_size * sizeof(LookupTableEntry);
+              numEntries(dex_file.num_classes) * sizeof(LookupTableEntry);
 
-          auto lookup_table_buf =
-              build_lookup_table(dex_input.filename, lookup_table_size);
           auto buf =
               ConstBuffer{reinterpret_cast<const char*>(lookup_table_buf.get()),
                           lookup_table_byte_size};
@@ -2721,6 +2739,29 @@ OatHeader build_header(OatVersion oat_version,
   return header;
 }
 
+struct DexInputHeader {
+  size_t file_size;
+  DexFileHeader header;
+};
+
+// Opens every input dex, on as many threads as we have, to read its size and
+// header.
+static std::vector<DexInputHeader> read_dex_headers(
+    const std::vector<DexInput>& dex_input) {
+  std::vector<DexInputHeader> headers(dex_input.size());
+  parallel_for(dex_input.size(), [&](size_t i) {
+    auto dex_fh = FileHandle(fopen(dex_input[i].filename.c_str(), "r"));
+    CHECK(dex_fh.get() != nullptr);
+
+    headers[i].file_size = get_filesize(dex_fh);
+    CHECK(headers[i].file_size >= sizeof(DexFileHeader));
+
+    headers[i].header = {};
+    CHECK(dex_fh.fread(&headers[i].header, sizeof(DexFileHeader), 1) == 1);
+  });
+  return headers;
+}
+
 std::vector<DexFileListing_064::DexFile_064> DexFileListing_064::build(
     const std::vector<DexInput>& dex_input,
     uint32_t& next_offset,
@@ -2735,22 +2776,16 @@ std::vector<DexFileListing_064::DexFile_064> DexFileListing_064::build(
   std::vector<DexFileListing_064::DexFile_064> dex_files;
   dex_files.reserve(dex_input.size());
 
-  for (const auto& dex : dex_input) {
+  auto headers = read_dex_headers(dex_input);
+  for (size_t dex_idx = 0; dex_idx < dex_input.size(); dex_idx++) {
+    const auto& dex = dex_input[dex_idx];
     auto dex_offset = next_offset + total_dex_size;
 
-    auto dex_fh = FileHandle(fopen(dex.filename.c_str(), "r"));
-    CHECK(dex_fh.get() != nullptr);
-
-    auto file_size = get_filesize(dex_fh);
-
     // dex files are 4-byte aligned inside the oatfile.
-    auto padded_size = align<4>(file_size);
+    auto padded_size = align<4>(headers[dex_idx].file_size);
 
-    CHECK(file_size >= sizeof(DexFileHeader));
-
-    // read the header to get the count of classes.
-    DexFileHeader header = {};
-    CHECK(dex_fh.fread(&header, sizeof(DexFileHeader), 1) == 1);
+    // the header gives us the count of classes.
+    const auto& header = headers[dex_idx].header;
 
     const auto num_classes = header.class_defs_size;
     const auto num_types = header.type_ids_size;
@@ -2823,23 +2858,17 @@ std::vector<DexFileListing_079::DexFile_079> DexFileListing_079::build(
   std::vector<DexFileListing_079::DexFile_079> dex_files;
   dex_files.reserve(dex_input.size());
 
-  for (const auto dex : dex_input) {
+  auto headers = read_dex_headers(dex_input);
+  for (size_t dex_idx = 0; dex_idx < dex_input.size(); dex_idx++) {
+    const auto& dex = dex_input[dex_idx];
     auto dex_offset = next_offset + total_dex_size;
 
-    auto dex_fh = FileHandle(fopen(dex.filename.c_str(), "r"));
-    CHECK(dex_fh.get() != nullptr);
-
-    auto file_size = get_filesize(dex_fh);
-
     // dex files are 4-byte aligned inside the oatfile.
-    auto padded_size = align<4>(file_size);
+    auto padded_size = align<4>(headers[dex_idx].file_size);
     total_dex_size += padded_size;
 
-    CHECK(file_size >= sizeof(DexFileHeader));
-
-    // read the header to get the count of classes.
-    DexFileHeader header = {};
-    CHECK(dex_fh.fread(&header, sizeof(DexFileHeader), 1) == 1);
+    // the header gives us the count of classes.
+    const auto& header = headers[dex_idx].header;
 
     auto num_classes = header.class_defs_size;
     auto class_table_size =
@@ -3054,10 +3083,8 @@ static size_t fields_size(size_t num_elements) {
 static size_t compute_bss_size_079(const std::vector<DexInput>& dex_files) {
   size_t ret = 0;
 
-  for (const auto& e : dex_files) {
-    auto dex_fh = FileHandle(fopen(e.filename.c_str(), "r"));
-    DexFileHeader header = {};
-    CHECK(dex_fh.fread(&header, sizeof(DexFileHeader), 1) == 1);
+  for (const auto& e : read_dex_headers(dex_files)) {
+    const auto& header = e.header;
 
     auto meth_offset = align<pointer_size>(types_size(header.type_ids_size));
     auto strings_offset =
@@ -3383,19 +3410,20 @@ OatFile::Status build_oatfile_after_v124(
     const QuickData* quick_data) {
   // Make sure the output is a directory where we will place ODEX and VDEX files
   CHECK(oat_file_name[oat_file_name.size() - 1] == '/');
-  OatFile::Status result = OatFile::Status::BUILD_SUCCESS;
+  CHECK(oat_version == OatVersion::V_124 || oat_version == OatVersion::V_131,
+        "must not build vdex/odex pairs for non-Oreo builds");
 
-  for (const auto& dex : dex_input) {
+  // Every dex gets its own pair of files, so they can all be built at once.
+  std::vector<OatFile::Status> results(dex_input.size());
+  parallel_for(dex_input.size(), [&](size_t i) {
+    const auto& dex = dex_input[i];
     size_t found = dex.filename.find_last_of("/") + 1;
     CHECK(found >= 0);
     auto odex_file_name = dex.filename.substr(found);
     odex_file_name.erase(odex_file_name.size() - 3);
     odex_file_name = oat_file_name + odex_file_name + std::string("odex");
 
-    CHECK(oat_version == OatVersion::V_124 || oat_version == OatVersion::V_131,
-          "must not build vdex/odex pairs for non-Oreo builds");
-
-    auto partial_result = build_vdex_odex_pairs<DexFileListinType>(
+    results[i] = build_vdex_odex_pairs<DexFileListinType>(
           odex_file_name,
           oat_version,
           dex,
@@ -3404,16 +3432,21 @@ OatFile::Status build_oatfile_after_v124(
           art_image_location,
           samsung_mode,
           quick_data);
+  });
 
-    if (partial_result != OatFile::Status::BUILD_SUCCESS) {
-      fprintf(stderr,
-              "Building V124/V131 ODEX/VDEX pair failed for DEX input: %s, "
-              "Result: %d\n",
-              dex.filename.c_str(),
-              static_cast<int>(partial_result));
-      result = partial_result;
-    }
-  }
+  OatFile::Status result = OatFile::Status::BUILD_SUCCESS;
+  foreach_pair(dex_input,
+               results,
+               [&](const DexInput& dex, OatFile::Status partial_result) {
+                 if (partial_result != OatFile::Status::BUILD_SUCCESS) {
+                   fprintf(stderr,
+                           "Building V124/V131 ODEX/VDEX pair failed for DEX "
+                           "input: %s, Result: %d\n",
+                           dex.filename.c_str(),
+                           static_cast<int>(partial_result));
+                   result = partial_result;
+                 }
+               });
   return result;
 }
 
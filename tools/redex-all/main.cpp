@@ -590,19 +590,32 @@ int main(int argc, char* argv[]) {
     Scope external_classes;
     if (!library_jars.empty()) {
       Timer t("Load library jars");
+      std::vector<std::string> library_jar_paths;
       for (const auto& library_jar : library_jars) {
         TRACE(MAIN, 1, "LIBRARY JAR: %s\n", library_jar.c_str());
-        if (!load_jar_file(library_jar.c_str(), &external_classes)) {
+        if (boost::filesystem::exists(library_jar)) {
+          library_jar_paths.emplace_back(library_jar);
+        } else {
           // Try again with the basedir
-          std::string basedir_path =
-              pg_config.basedirectory + "/" + library_jar.c_str();
-          if (!load_jar_file(basedir_path.c_str())) {
-            std::cerr << "error: library jar could not be loaded: "
-                      << library_jar << std::endl;
-            exit(EXIT_FAILURE);
-          }
+          library_jar_paths.emplace_back(pg_config.basedirectory + "/" +
+                                         library_jar);
         }
       }
+      auto snapshot_dir =
+          args.config.get("library_jar_snapshot_dir", "").asString();
+      if (!snapshot_dir.empty()) {
+        boost::filesystem::create_directories(snapshot_dir);
+      }
+      std::string failed_jar;
+      if (!load_jar_files(library_jar_paths,
+                          &external_classes,
+                          /* attr_hook */ nullptr,
+                          snapshot_dir,
+                          &failed_jar)) {
+        std::cerr << "error: library jar could not be loaded: " << failed_jar
+                  << std::endl;
+        exit(EXIT_FAILURE);
+      }
     }
 
     ConfigFiles cfg(args.config);
@@ -641,8 +654,10 @@ int main(int argc, char* argv[]) {
         cfg.metafile(args.config.get("line_number_map", "").asString());
     auto pos_output_v2 =
         cfg.metafile(args.config.get("line_number_map_v2", "").asString());
+    auto pos_output_v3 =
+        cfg.metafile(args.config.get("line_number_map_v3", "").asString());
     std::unique_ptr<PositionMapper> pos_mapper(
-        PositionMapper::make(pos_output, pos_output_v2));
+        PositionMapper::make(pos_output, pos_output_v2, pos_output_v3));
     for (auto& store : stores) {
       Timer t("Writing optimized dexes");
       for (size_t i = 0; i < store.get_dexen().size(); i++) {
@@ -21,9 +21,22 @@ $ sqlite3 dex.db "SELECT COUNT(*) FROM dex;"   # verify sane-looking value
 $ ./native/redex/tools/redex-tool/DexSqlQuery.py dex.db
 <..enter queries..>
 
+Loading a large app through INSERT statements is slow. Passing --format csv
+instead writes one CSV file per table and a load.sql script that creates the
+tables and bulk-imports the files, from the directory dex-sql-dump ran in:
+
+$ buck run  //native/redex:redex-tool -- dex-sql-dump  \
+      --apkdir <APKDIR> --dexendir <DEXEN_DIR> \
+      --jars <ANDROID_JAR> --proguard-map <RENAME_MAP> \
+      --format csv --output dex_csv
+$ sqlite3 dex.db < dex_csv/load.sql
+
 */
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/filesystem.hpp>
+#include <initializer_list>
+#include <memory>
 #include <queue>
 #include <vector>
 #include <unordered_map>
@@ -36,6 +49,7 @@ $ ./native/redex/tools/redex-tool/DexSqlQuery.py dex.db
 #include "Show.h"
 #include "Tool.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -44,154 +58,20 @@ static std::unordered_map<DexMethod*, int> method_ids;
 static std::unordered_map<DexField*, int> field_ids;
 static std::unordered_map<DexString*, int> string_ids;
 
-void dump_field_refs(FILE* fdout, const char* prefix, DexField* field, int field_id) {
-  static int next_string_ref = 0;
-  auto* static_value = field->get_static_value();
-  if (!static_value || (static_value->evtype() != DEVT_STRING)) return;
-  auto* static_string_value = static_cast<DexEncodedValueString*>(static_value);
-  auto string_id = string_ids[static_string_value->string()];
-  fprintf(
-    fdout,
-    "INSERT INTO %sfield_string_refs VALUES (%d, %d, %d);\n",
-    prefix,
-    next_string_ref++,
-    field_id,
-    string_id);
-}
-
-void dump_method_refs(FILE* fdout, const char* prefix, DexMethod* method, int method_id) {
-  auto code = method->get_code();
-  if (!code) return;
-
-  static int next_string_ref = 0;
-  static int next_class_ref = 0;
-  static int next_field_ref = 0;
-  static int next_method_ref = 0;
-
-  for (auto& mie : InstructionIterable(code)) {
-    auto insn = mie.insn;
-    if (insn->has_string()) {
-      if (string_ids.count(insn->get_string())) {
-        auto string_id = string_ids[insn->get_string()];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_string_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_string_ref++,
-          method_id,
-          string_id,
-          insn->opcode());
-      }
-    }
-    if (insn->has_type()) {
-      auto cls = type_class(insn->get_type());
-      if (cls && class_ids.count(cls)) {
-        auto class_id = class_ids[cls];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_class_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_class_ref++,
-          method_id,
-          class_id,
-          insn->opcode());
-      }
-    }
-    if (insn->has_field()) {
-      auto field = resolve_field(insn->get_field());
-      if (field != nullptr && field_ids.count(field)) {
-        auto field_id = field_ids[field];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_field_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_field_ref++,
-          method_id,
-          field_id,
-          insn->opcode());
-      }
-    }
-    if (insn->has_method()) {
-      auto meth = resolve_method(insn->get_method(), opcode_to_search(insn));
-      if (meth != nullptr && method_ids.count(meth)) {
-        auto method_ref_id = method_ids[meth];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_method_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_method_ref++,
-          method_id,
-          method_ref_id,
-          insn->opcode());
-      }
-    }
-  }
-}
-
-void dump_class(FILE* fdout, const char* prefix, const char* dex_id, DexClass* cls, int class_id) {
-  // TODO: annotations?
-  // TODO: inheritance?
-  // TODO: string usage
-  // TODO: size estimate
-  auto deobfuscated_name = cls->get_deobfuscated_name();
-  fprintf(
-    fdout,
-    "INSERT INTO %sclasses VALUES (%d,'%s','%s','%s',%u);\n",
-    prefix,
-    class_id,
-    dex_id,
-    deobfuscated_name.c_str(),
-    cls->get_name()->c_str(),
-    cls->get_access()
-  );
-}
-
-void dump_field(FILE* fdout, const char* prefix, int class_id, DexField* field, int field_id) {
-  // TODO: more fixup here on this crapped up name/signature
-  // TODO: break down signature
-  // TODO: annotations?
-  // TODO: string usage (encoded_value for static fields)
-  auto deobfuscated_name = field->get_deobfuscated_name();
-  auto field_name = strchr(deobfuscated_name.c_str(), ';');
-  fprintf(
-    fdout,
-    "INSERT INTO %sfields VALUES(%d, %d, '%s', '%s', %u);\n",
-    prefix,
-    field_id,
-    class_id,
-    field_name,
-    field->get_name()->c_str(),
-    field->get_access()
-  );
-}
-
-void dump_method(FILE* fdout, const char* prefix, int class_id, DexMethod* method, int method_id) {
-  // TODO: more fixup here on this crapped up name/signature
-  // TODO: break down signature
-  // TODO: throws?
-  // TODO: annotations?
-  // TODO: string usage
-  // TODO: size estimate
-  auto deobfuscated_name = method->get_deobfuscated_name();
-  auto method_name = strchr(deobfuscated_name.c_str(), ';');
-  fprintf(
-    fdout,
-    "INSERT INTO %smethods VALUES (%d,%d,'%s','%s',%d,%lu);\n",
-    prefix,
-    method_id,
-    class_id,
-    method_name,
-    method->get_name()->c_str(),
-    method->get_access(),
-    method->get_code() ? method->get_code()->sum_opcode_sizes() : 0
-  );
-}
+const char* const TABLES[] = {
+    "classes",
+    "methods",
+    "is_a",
+    "strings",
+    "fields",
+    "field_string_refs",
+    "method_class_refs",
+    "method_method_refs",
+    "method_field_refs",
+    "method_string_refs",
+};
 
-void dump_sql(
-  FILE* fdout,
-  DexStoresVector& stores,
-  ProguardMap& pg_map,
-  const char* prefix) {
+void print_schema(FILE* fdout, const char* prefix) {
   fprintf(
     fdout,
 R"___(
@@ -268,111 +148,484 @@ CREATE TABLE %1$smethod_string_refs (
 )___",
     prefix
   );
+}
+
+/*
+ * A column value of a row of the dump.
+ */
+struct SqlValue {
+  SqlValue(int64_t i) : text(nullptr), integer(i) {}
+  SqlValue(const char* s) : text(s ? s : ""), integer(0) {}
+
+  const char* text;
+  int64_t integer;
+};
+
+/*
+ * Where the rows of the dump go.
+ */
+class DumpWriter {
+ public:
+  virtual ~DumpWriter() {}
+
+  virtual void begin_transaction() {}
+  virtual void end_transaction() {}
+  virtual void insert(const char* table,
+                      std::initializer_list<SqlValue> values) = 0;
+};
+
+/*
+ * A SQL script of INSERT statements, for sqlite3 to replay.
+ */
+class SqlScriptWriter : public DumpWriter {
+ public:
+  SqlScriptWriter(FILE* fdout, const char* prefix)
+      : m_fdout(fdout), m_prefix(prefix) {
+    print_schema(m_fdout, m_prefix);
+  }
+
+  void begin_transaction() override {
+    fprintf(m_fdout, "BEGIN TRANSACTION;\n");
+  }
+
+  void end_transaction() override {
+    fprintf(m_fdout, "END TRANSACTION;\n");
+  }
+
+  void insert(const char* table,
+              std::initializer_list<SqlValue> values) override {
+    m_row.clear();
+    for (const auto& value : values) {
+      if (!m_row.empty()) {
+        m_row += ", ";
+      }
+      if (value.text != nullptr) {
+        // Escape strings before inserting. ' -> ''
+        std::string esc(value.text);
+        boost::replace_all(esc, "'", "''");
+        m_row += '\'';
+        m_row += esc;
+        m_row += '\'';
+      } else {
+        m_row += std::to_string(value.integer);
+      }
+    }
+    fprintf(
+        m_fdout, "INSERT INTO %s%s VALUES (%s);\n", m_prefix, table,
+        m_row.c_str());
+  }
+
+ private:
+  FILE* m_fdout;
+  const char* m_prefix;
+  std::string m_row;
+};
+
+/*
+ * Quotes :str as an argument of a sqlite3 shell dot-command, which takes
+ * double-quoted arguments with C-style escapes.
+ */
+std::string quote_dot_command_arg(const std::string& str) {
+  std::string ret = "\"";
+  for (auto c : str) {
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+    }
+    ret += c;
+  }
+  ret += '"';
+  return ret;
+}
+
+/*
+ * One CSV file per table, plus a load.sql script that creates the tables and
+ * imports the files with sqlite3's .import. Nothing is known to have been
+ * written until finish() succeeds.
+ */
+class CsvWriter : public DumpWriter {
+ public:
+  CsvWriter(const std::string& dir, const char* prefix) {
+    boost::filesystem::create_directories(dir);
+    auto load_path = dir + "/load.sql";
+    FILE* load = fopen(load_path.c_str(), "w");
+    always_assert_log(load, "Could not open %s for writing", load_path.c_str());
+    print_schema(load, prefix);
+    fprintf(load, ".mode csv\n");
+    for (auto table : TABLES) {
+      auto path = dir + "/" + table + ".csv";
+      FILE* fp = fopen(path.c_str(), "w");
+      always_assert_log(fp, "Could not open %s for writing", path.c_str());
+      // Rows are small: buffer a lot of them per write.
+      setvbuf(fp, nullptr, _IOFBF, 1 << 20);
+      m_files.emplace(table, File{fp, path, true});
+      fprintf(load,
+              ".import %s %s%s\n",
+              quote_dot_command_arg(path).c_str(),
+              prefix,
+              table);
+    }
+    m_ok = close_file(load, load_path);
+  }
+
+  ~CsvWriter() override {
+    for (const auto& file : m_files) {
+      if (file.second.fp != nullptr) {
+        fclose(file.second.fp);
+      }
+    }
+  }
+
+  void insert(const char* table,
+              std::initializer_list<SqlValue> values) override {
+    m_row.clear();
+    for (const auto& value : values) {
+      if (!m_row.empty()) {
+        m_row += ',';
+      }
+      if (value.text != nullptr) {
+        std::string esc(value.text);
+        boost::replace_all(esc, "\"", "\"\"");
+        m_row += '"';
+        m_row += esc;
+        m_row += '"';
+      } else {
+        m_row += std::to_string(value.integer);
+      }
+    }
+    m_row += '\n';
+    auto& file = m_files.at(table);
+    if (fwrite(m_row.data(), 1, m_row.size(), file.fp) != m_row.size()) {
+      file.ok = false;
+    }
+  }
+
+  /*
+   * Flushes and closes every file. Returns false, after reporting each file
+   * that couldn't be written in full, if any of them failed.
+   */
+  bool finish() {
+    for (auto& file : m_files) {
+      auto& f = file.second;
+      if (!f.ok) {
+        fprintf(stderr, "Failed to write %s\n", f.path.c_str());
+        fclose(f.fp);
+        m_ok = false;
+      } else if (!close_file(f.fp, f.path)) {
+        m_ok = false;
+      }
+      f.fp = nullptr;
+    }
+    return m_ok;
+  }
+
+ private:
+  struct File {
+    FILE* fp;
+    std::string path;
+    bool ok;
+  };
+
+  static bool close_file(FILE* fp, const std::string& path) {
+    bool ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+      fprintf(stderr, "Failed to write %s\n", path.c_str());
+    }
+    return ok;
+  }
+
+  std::unordered_map<std::string, File> m_files;
+  std::string m_row;
+  bool m_ok;
+};
+
+/*
+ * A reference from a method (or field) to another item, as
+ * (referencing id, referenced id, opcode).
+ */
+struct Ref {
+  int from;
+  int to;
+  int opcode;
+};
+
+/*
+ * The references made by the code and static values of the classes of one
+ * dex, in class order.
+ */
+struct DexRefs {
+  std::vector<Ref> field_string_refs;
+  std::vector<Ref> method_string_refs;
+  std::vector<Ref> method_class_refs;
+  std::vector<Ref> method_field_refs;
+  std::vector<Ref> method_method_refs;
+};
+
+template <typename Map, typename Key>
+int find_id(const Map& ids, Key key) {
+  auto it = ids.find(key);
+  return it == ids.end() ? -1 : it->second;
+}
+
+void collect_field_refs(DexField* field, int field_id, DexRefs& refs) {
+  auto* static_value = field->get_static_value();
+  if (!static_value || (static_value->evtype() != DEVT_STRING)) return;
+  auto* static_string_value = static_cast<DexEncodedValueString*>(static_value);
+  auto string_id = find_id(string_ids, static_string_value->string());
+  if (string_id != -1) {
+    refs.field_string_refs.push_back({field_id, string_id, 0});
+  }
+}
+
+void collect_method_refs(DexMethod* method, int method_id, DexRefs& refs) {
+  auto code = method->get_code();
+  if (!code) return;
+
+  for (auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    int opcode = insn->opcode();
+    if (insn->has_string()) {
+      auto string_id = find_id(string_ids, insn->get_string());
+      if (string_id != -1) {
+        refs.method_string_refs.push_back({method_id, string_id, opcode});
+      }
+    }
+    if (insn->has_type()) {
+      auto cls = type_class(insn->get_type());
+      auto class_id = cls ? find_id(class_ids, cls) : -1;
+      if (class_id != -1) {
+        refs.method_class_refs.push_back({method_id, class_id, opcode});
+      }
+    }
+    if (insn->has_field()) {
+      auto field = resolve_field(insn->get_field());
+      auto field_id = field ? find_id(field_ids, field) : -1;
+      if (field_id != -1) {
+        refs.method_field_refs.push_back({method_id, field_id, opcode});
+      }
+    }
+    if (insn->has_method()) {
+      auto meth = resolve_method(insn->get_method(), opcode_to_search(insn));
+      auto method_ref_id = meth ? find_id(method_ids, meth) : -1;
+      if (method_ref_id != -1) {
+        refs.method_method_refs.push_back({method_id, method_ref_id, opcode});
+      }
+    }
+  }
+}
+
+DexRefs collect_refs(const DexClasses& dex) {
+  DexRefs refs;
+  for (const auto& cls : dex) {
+    for (const auto& meth : cls->get_dmethods()) {
+      collect_method_refs(meth, method_ids.at(meth), refs);
+    }
+    for (auto& meth : cls->get_vmethods()) {
+      collect_method_refs(meth, method_ids.at(meth), refs);
+    }
+    for (const auto& field : cls->get_sfields()) {
+      collect_field_refs(field, field_ids.at(field), refs);
+    }
+    for (const auto& field : cls->get_ifields()) {
+      collect_field_refs(field, field_ids.at(field), refs);
+    }
+  }
+  return refs;
+}
+
+void dump_class(DumpWriter& out, const char* dex_id, DexClass* cls, int class_id) {
+  // TODO: annotations?
+  // TODO: inheritance?
+  // TODO: string usage
+  // TODO: size estimate
+  auto deobfuscated_name = cls->get_deobfuscated_name();
+  out.insert("classes",
+             {class_id,
+              dex_id,
+              deobfuscated_name.c_str(),
+              cls->get_name()->c_str(),
+              cls->get_access()});
+}
+
+void dump_field(DumpWriter& out, int class_id, DexField* field, int field_id) {
+  // TODO: more fixup here on this crapped up name/signature
+  // TODO: break down signature
+  // TODO: annotations?
+  // TODO: string usage (encoded_value for static fields)
+  auto deobfuscated_name = field->get_deobfuscated_name();
+  auto field_name = strchr(deobfuscated_name.c_str(), ';');
+  out.insert("fields",
+             {field_id,
+              class_id,
+              field_name,
+              field->get_name()->c_str(),
+              field->get_access()});
+}
+
+void dump_method(DumpWriter& out, int class_id, DexMethod* method, int method_id) {
+  // TODO: more fixup here on this crapped up name/signature
+  // TODO: break down signature
+  // TODO: throws?
+  // TODO: annotations?
+  // TODO: string usage
+  // TODO: size estimate
+  auto deobfuscated_name = method->get_deobfuscated_name();
+  auto method_name = strchr(deobfuscated_name.c_str(), ';');
+  out.insert("methods",
+             {method_id,
+              class_id,
+              method_name,
+              method->get_name()->c_str(),
+              method->get_access(),
+              (int64_t)(method->get_code()
+                            ? method->get_code()->sum_opcode_sizes()
+                            : 0)});
+}
+
+void dump_refs(DumpWriter& out,
+               const char* table,
+               const std::vector<Ref>& refs,
+               int& next_ref_id,
+               bool with_opcode = true) {
+  for (const auto& ref : refs) {
+    if (with_opcode) {
+      out.insert(table, {next_ref_id++, ref.from, ref.to, ref.opcode});
+    } else {
+      out.insert(table, {next_ref_id++, ref.from, ref.to});
+    }
+  }
+}
+
+void dump_sql(
+  DumpWriter& out,
+  DexStoresVector& stores,
+  ProguardMap& pg_map) {
   int next_class_id = 0;
   int next_method_id = 0;
   int next_field_id = 0;
   int next_string_id = 0;
 
   // Dump all dex items
-  fprintf(fdout, "BEGIN TRANSACTION;\n");
+  std::vector<const DexClasses*> all_dexen;
+  out.begin_transaction();
   for (auto& store : stores) {
     auto store_name = store.get_name();
     auto& dexen = store.get_dexen();
     apply_deobfuscated_names(dexen, pg_map);
     for (size_t dex_idx = 0 ; dex_idx < dexen.size() ; ++dex_idx) {
       auto& dex = dexen[dex_idx];
+      all_dexen.push_back(&dex);
       GatheredTypes gtypes(&dex);
       auto strings = gtypes.get_cls_order_dexstring_emitlist();
       for (auto dexstr : strings) {
         int id = next_string_id++;
         string_ids[dexstr] = id;
-        // Escape string before inserting. ' -> ''
-        std::string esc(dexstr->c_str());
-        boost::replace_all(esc, "'", "''");
-        fprintf(fdout, "INSERT INTO %sstrings VALUES(%d, '%s');\n", prefix, id, esc.c_str());
+        out.insert("strings", {id, dexstr->c_str()});
       }
       std::string dex_id_str(store_name + "/" + std::to_string(dex_idx));
       const char* dex_id = dex_id_str.c_str();
       for (const auto& cls : dex) {
         int class_id = next_class_id++;
-        dump_class(fdout, prefix, dex_id, cls, class_id);
+        dump_class(out, dex_id, cls, class_id);
         class_ids[cls] = class_id;
         for (auto field : cls->get_ifields()) {
           int field_id = next_field_id++;
           field_ids[field] = field_id;
-          dump_field(fdout, prefix, class_id, field, field_id);
+          dump_field(out, class_id, field, field_id);
         }
         for (auto field : cls->get_sfields()) {
           int field_id = next_field_id++;
           field_ids[field] = field_id;
-          dump_field(fdout, prefix, class_id, field, field_id);
+          dump_field(out, class_id, field, field_id);
         }
         for (const auto& meth : cls->get_dmethods()) {
           int meth_id = next_method_id++;
           method_ids[meth] = meth_id;
-          dump_method(fdout, prefix, class_id, meth, meth_id);
+          dump_method(out, class_id, meth, meth_id);
         }
         for (auto& meth : cls->get_vmethods()) {
           int meth_id = next_method_id++;
           method_ids[meth] = meth_id;
-          dump_method(fdout, prefix, class_id, meth, meth_id);
+          dump_method(out, class_id, meth, meth_id);
         }
       }
     }
   }
-  fprintf(fdout, "END TRANSACTION;\n");
+  out.end_transaction();
+
+  // Walking the code of a dex for references only reads the id maps, so the
+  // dexes are walked in parallel and their references dumped in dex order.
+  std::vector<DexRefs> dex_refs(all_dexen.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { dex_refs[i] = collect_refs(*all_dexen[i]); },
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < all_dexen.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
 
   // Dump references
-  fprintf(fdout, "BEGIN TRANSACTION;\n");
-  for (auto& store : stores) {
-    auto& dexen = store.get_dexen();
-    for (size_t dex_idx = 0 ; dex_idx < dexen.size() ; ++dex_idx) {
-      auto& dex = dexen[dex_idx];
-      for (const auto& cls : dex) {
-        for (const auto& meth : cls->get_dmethods()) {
-          int meth_id = method_ids[meth];
-          dump_method_refs(fdout, prefix, meth, meth_id);
-        }
-        for (auto& meth : cls->get_vmethods()) {
-          int meth_id = method_ids[meth];
-          dump_method_refs(fdout, prefix, meth, meth_id);
-        }
-        for (const auto& field : cls->get_sfields()) {
-          int field_id = field_ids[field];
-          dump_field_refs(fdout, prefix, field, field_id);
-        }
-        for (const auto& field : cls->get_ifields()) {
-          int field_id = field_ids[field];
-          dump_field_refs(fdout, prefix, field, field_id);
-        }
-      }
-    }
+  int next_field_string_ref = 0;
+  int next_method_string_ref = 0;
+  int next_method_class_ref = 0;
+  int next_method_field_ref = 0;
+  int next_method_method_ref = 0;
+  out.begin_transaction();
+  for (const auto& refs : dex_refs) {
+    dump_refs(out,
+              "field_string_refs",
+              refs.field_string_refs,
+              next_field_string_ref,
+              false);
+    dump_refs(out,
+              "method_string_refs",
+              refs.method_string_refs,
+              next_method_string_ref);
+    dump_refs(out,
+              "method_class_refs",
+              refs.method_class_refs,
+              next_method_class_ref);
+    dump_refs(out,
+              "method_field_refs",
+              refs.method_field_refs,
+              next_method_field_ref);
+    dump_refs(out,
+              "method_method_refs",
+              refs.method_method_refs,
+              next_method_method_ref);
   }
-  fprintf(fdout, "END TRANSACTION;\n");
+  out.end_transaction();
 
   // Dump hierarchy
   auto scope = build_class_scope(stores);
   ClassHierarchy ch = build_type_hierarchy(scope);
+  std::vector<std::vector<int>> is_a(scope.size());
+  auto is_a_wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        TypeSet results;
+        get_all_children_or_implementors(ch, scope, scope[i], results);
+        for (auto type : results) {
+          auto type_cls = type_class(type);
+          if (type_cls) {
+            is_a[i].push_back(class_ids.at(type_cls));
+          }
+        }
+      },
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < scope.size(); ++i) {
+    is_a_wq.add_item(i);
+  }
+  is_a_wq.run_all();
+
   int next_is_a_id = 0;
-  fprintf(fdout, "BEGIN TRANSACTION;\n");
-  for (auto& cls : scope) {
-    TypeSet results;
-    get_all_children_or_implementors(ch, scope, cls, results);
-    for(auto type : results) {
-      auto type_cls = type_class(type);
-      if (type_cls) {
-        fprintf(
-          fdout,
-          "INSERT INTO %sis_a VALUES(%d, %d, %d);\n",
-          prefix,
-          next_is_a_id++,
-          class_ids[type_cls],
-          class_ids[cls]
-        );
-      }
+  out.begin_transaction();
+  for (size_t i = 0; i < scope.size(); ++i) {
+    auto class_id = class_ids.at(scope[i]);
+    for (auto child_id : is_a[i]) {
+      out.insert("is_a", {next_is_a_id++, child_id, class_id});
     }
   }
-  fprintf(fdout, "END TRANSACTION;\n");
+  out.end_transaction();
 }
 
 class DexSqlDump : public Tool {
@@ -387,34 +640,66 @@ class DexSqlDump : public Tool {
        "path to a rename map")
       ("output,o",
        po::value<std::string>()->value_name("dex.sql"),
-       "path to output sql dump file (defaults to stdout)")
+       "path to output sql dump file (defaults to stdout), or to the output "
+       "directory with --format csv")
       ("table-prefix,t",
        po::value<std::string>()->value_name("pre_"),
        "prefix to use on all table names")
+      ("format,f",
+       po::value<std::string>()->value_name("sql|csv"),
+       "sql (the default) for a script of INSERT statements, csv for a CSV "
+       "file per table and a load.sql script to bulk-import them")
     ;
   }
 
   void run(const po::variables_map& options) override {
+    std::string format = options.count("format") ?
+      options["format"].as<std::string>() : "sql";
+    if (format != "sql" && format != "csv") {
+      fprintf(stderr, "Unknown format %s; terminating\n", format.c_str());
+      exit(EXIT_FAILURE);
+    }
+    if (format == "csv" && !options.count("output")) {
+      fprintf(stderr, "--format csv needs an --output directory\n");
+      exit(EXIT_FAILURE);
+    }
     auto stores = init(
       options["jars"].as<std::string>(),
       options["apkdir"].as<std::string>(),
       options["dexendir"].as<std::string>());
     ProguardMap pgmap(options.count("proguard-map") ?
       options["proguard-map"].as<std::string>() : "/dev/null");
-    const std::string& filename = options["output"].as<std::string>();
-    FILE* fdout = options.count("output") ?
-      fopen(filename.c_str(), "w") : stdout;
     std::string prefix = options.count("table-prefix") ?
       options["table-prefix"].as<std::string>() : "";
+    auto* pfx_cstr = prefix.c_str();
+    if (format == "csv") {
+      CsvWriter out(options["output"].as<std::string>(), pfx_cstr);
+      dump_sql(out, stores, pgmap);
+      if (!out.finish()) {
+        exit(EXIT_FAILURE);
+      }
+      return;
+    }
+    const std::string& filename = options.count("output") ?
+      options["output"].as<std::string>() : "";
+    FILE* fdout = options.count("output") ?
+      fopen(filename.c_str(), "w") : stdout;
     if (!fdout) {
       fprintf(stderr,
               "Could not open %s for writing; terminating\n",
               filename.c_str());
       exit(EXIT_FAILURE);
     }
-    auto* pfx_cstr = prefix.c_str();
-    dump_sql(fdout, stores, pgmap, pfx_cstr);
-    fclose(fdout);
+    SqlScriptWriter out(fdout, pfx_cstr);
+    dump_sql(out, stores, pgmap);
+    bool ok = !ferror(fdout);
+    ok = (fdout == stdout ? fflush(fdout) : fclose(fdout)) == 0 && ok;
+    if (!ok) {
+      fprintf(stderr,
+              "Failed to write %s\n",
+              filename.empty() ? "the dump" : filename.c_str());
+      exit(EXIT_FAILURE);
+    }
   }
 };
 
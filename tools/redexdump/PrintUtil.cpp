@@ -15,25 +15,67 @@ bool clean = false;
 bool raw = false;
 bool escape = false;
 
+namespace {
+
+thread_local std::string* t_out = nullptr;
+
+/*
+ * Formats straight into the end of t_out; most items fit in the first guess,
+ * the others are formatted a second time into the exact space they need.
+ */
+void vredump(const char* format, va_list va) {
+  if (t_out == nullptr) {
+    vprintf(format, va);
+    return;
+  }
+  const size_t kGuess = 256;
+  auto old_size = t_out->size();
+  t_out->resize(old_size + kGuess);
+  va_list va2;
+  va_copy(va2, va);
+  auto len = vsnprintf(&(*t_out)[old_size], kGuess, format, va);
+  if (len < 0) {
+    len = 0;
+  } else if ((size_t)len >= kGuess) {
+    t_out->resize(old_size + len + 1);
+    vsnprintf(&(*t_out)[old_size], len + 1, format, va2);
+  }
+  va_end(va2);
+  t_out->resize(old_size + len);
+}
+
+void fredump(const char* format, ...) {
+  va_list va;
+  va_start(va, format);
+  vredump(format, va);
+  va_end(va);
+}
+
+}
+
+void redump_to(std::string* out) {
+  t_out = out;
+}
+
 void redump(const char* format, ...) {
   va_list va;
   va_start(va, format);
-  vprintf(format, va);
+  vredump(format, va);
   va_end(va);
 }
 
 void redump(uint32_t off, const char* format, ...) {
   va_list va;
   va_start(va, format);
-  if (!clean) printf("[0x%x] ", off);
-  vprintf(format, va);
+  if (!clean) fredump("[0x%x] ", off);
+  vredump(format, va);
   va_end(va);
 }
 
 void redump(uint32_t pos, uint32_t off, const char* format, ...) {
   va_list va;
   va_start(va, format);
-  if (!clean) printf("(0x%x) [0x%x] ", pos, off);
-  vprintf(format, va);
+  if (!clean) fredump("(0x%x) [0x%x] ", pos, off);
+  vredump(format, va);
   va_end(va);
 }
@@ -10,11 +10,19 @@
 #pragma once
 
 #include <stdint.h>
+#include <string>
 
 extern bool clean;
 extern bool raw;
 extern bool escape;
 
+/*
+ * Makes redump append to :out on the calling thread instead of printing to
+ * stdout, so that dexes can be dumped concurrently and their dumps written
+ * out in one go. Pass nullptr to go back to stdout.
+ */
+void redump_to(std::string* out);
+
 void redump(const char* format, ...);
 void redump(uint32_t off, const char* format, ...);
 void redump(uint32_t pos, uint32_t off, const char* format, ...);
@@ -12,9 +12,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
 
 #include "PrintUtil.h"
 #include "Formatters.h"
+#include "Parallel.h"
 
 static const char ddump_usage_string[] =
     "ReDex, DEX Dump tool\n"
@@ -23,7 +29,7 @@ static const char ddump_usage_string[] =
     "\n"
     "Usage:\n"
     "\tredump [-h | --all | [[-string] [-type] [-proto] [-field] [-meth] "
-    "[-clsdef] [-clsdata] [-code] [-enarr] [-anno]] [-clean]"
+    "[-clsdef] [-clsdata] [-code] [-enarr] [-anno]] [-clean] [-j N] [--split]"
     " <classes.dex>...\n"
     "\n<classes.dex>: path to a dex file (not an APK!)\n"
     "\noptions:\n"
@@ -43,32 +49,239 @@ static const char ddump_usage_string[] =
     "-A, --anno: print items in the annotation section\n"
     "-d, --debug: print debug info items in the data section\n"
     "-D, --ddebug=<addr>: disassemble debug info item at <addr>\n"
+    "--sections=<list>: print the comma separated sections, named as the\n"
+    "    long options above, e.g. --sections=string,type,meth\n"
     "\n"
     "printing options:\n"
     "--clean: suppress indices and offsets\n"
     "--no-headers: suppress headers\n"
     "--raw: print all bytes, even control characters\n"
+    "--escape: escape control characters\n"
+    "--tsv: start every line with the dex file and the section it belongs\n"
+    "    to, tab separated; use with --escape so that strings stay on one line\n"
+    "\n"
+    "output options:\n"
+    "-j, --jobs=<n>: dump up to <n> dex files at once (default: one per core)\n"
+    "--split: write the dump of each dex file to <dexfile>.dump instead of\n"
+    "    stdout\n"
   ;
 
+namespace {
+
+struct Section {
+  char flag;
+  const char* name;
+  void (*dump)(ddump_data* rd, bool print_headers);
+  bool enabled;
+};
+
+Section s_sections[] = {
+  { 's', "string", dump_strings, false },
+  { 'S', "stringdata", dump_stringdata, false },
+  { 't', "type", [](ddump_data* rd, bool) { dump_types(rd); }, false },
+  { 'p', "proto", dump_protos, false },
+  { 'f', "field", dump_fields, false },
+  { 'm', "meth", dump_methods, false },
+  { 'c', "clsdef", dump_clsdefs, false },
+  { 'C', "clsdata", dump_clsdata, false },
+  { 'x', "code", [](ddump_data* rd, bool) { dump_code(rd); }, false },
+  { 'e', "enarr", [](ddump_data* rd, bool) { dump_enarr(rd); }, false },
+  { 'A', "anno", [](ddump_data* rd, bool) { dump_anno(rd); }, false },
+  { 'd', "debug", [](ddump_data* rd, bool) { dump_debug(rd); }, false },
+};
+
+Section* find_section(char flag) {
+  for (auto& section : s_sections) {
+    if (section.flag == flag) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
+
+bool enable_sections(const char* list) {
+  std::string names(list);
+  size_t pos = 0;
+  while (pos <= names.size()) {
+    auto comma = names.find(',', pos);
+    if (comma == std::string::npos) {
+      comma = names.size();
+    }
+    auto name = names.substr(pos, comma - pos);
+    pos = comma + 1;
+    if (name == "all") {
+      for (auto& section : s_sections) {
+        section.enabled = true;
+      }
+      continue;
+    }
+    bool found = false;
+    for (auto& section : s_sections) {
+      if (name == section.name) {
+        section.enabled = true;
+        found = true;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "Unknown section \"%s\"\n", name.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+struct DumpOptions {
+  bool print_headers;
+  bool tsv;
+  uint32_t ddebug_offset;
+};
+
+/*
+ * Appends every line of :text to :out, prefixed with :prefix.
+ */
+void tag_lines(const std::string& prefix,
+               const std::string& text,
+               std::string& out) {
+  size_t pos = 0;
+  while (pos < text.size()) {
+    auto eol = text.find('\n', pos);
+    auto end = eol == std::string::npos ? text.size() : eol + 1;
+    out += prefix;
+    out.append(text, pos, end - pos);
+    pos = end;
+  }
+  if (!text.empty() && text.back() != '\n') {
+    out += '\n';
+  }
+}
+
+void write_out(FILE* stream, std::string& out) {
+  fwrite(out.data(), 1, out.size(), stream);
+  out.clear();
+}
+
+/*
+ * Dumps :dexfile into :out. If :stream is given, the dump is written to it a
+ * section at a time instead of being held in memory whole. Returns false,
+ * having reported why, if the dex can't be read.
+ */
+bool dump_dex(const char* dexfile,
+              const DumpOptions& opts,
+              std::string& out,
+              FILE* stream) {
+  const size_t kFlushSize = 1 << 20;
+  ddump_data rd;
+  if (!try_open_dex_file(dexfile, &rd)) {
+    return false;
+  }
+  std::string text;
+  auto dump_section = [&](const char* name, const auto& dump) {
+    if (opts.tsv) {
+      text.clear();
+      redump_to(&text);
+      dump();
+      tag_lines(std::string(dexfile) + "\t" + name + "\t", text, out);
+    } else {
+      redump_to(&out);
+      dump();
+    }
+    redump_to(nullptr);
+    if (stream != nullptr && out.size() >= kFlushSize) {
+      write_out(stream, out);
+    }
+  };
+  if (opts.print_headers) {
+    dump_section("header", [&] { redump(format_map(&rd).c_str()); });
+  }
+  for (const auto& section : s_sections) {
+    if (section.enabled) {
+      dump_section(section.name,
+                   [&] { section.dump(&rd, opts.print_headers); });
+    }
+  }
+  if (opts.ddebug_offset != 0) {
+    dump_section("ddebug",
+                 [&] { disassemble_debug(&rd, opts.ddebug_offset); });
+  }
+  if (!opts.tsv) {
+    out += '\n';
+  }
+  if (stream != nullptr) {
+    write_out(stream, out);
+  }
+  munmap(rd.dexmmap, rd.dex_size);
+  return true;
+}
+
+/*
+ * Writes the dump of every dex next to it.
+ */
+bool dump_split(const std::vector<const char*>& dexfiles,
+                const DumpOptions& opts,
+                size_t jobs) {
+  std::vector<char> failed(dexfiles.size(), false);
+  parallel_for(dexfiles.size(), [&](size_t i) {
+    auto path = std::string(dexfiles[i]) + ".dump";
+    FILE* stream = fopen(path.c_str(), "w");
+    if (stream == nullptr) {
+      fprintf(stderr, "Cannot open %s for writing\n", path.c_str());
+      failed[i] = true;
+      return;
+    }
+    std::string out;
+    if (!dump_dex(dexfiles[i], opts, out, stream)) {
+      failed[i] = true;
+    }
+    bool write_failed = ferror(stream) != 0;
+    if (fclose(stream) != 0 || write_failed) {
+      fprintf(stderr, "Failed to write %s\n", path.c_str());
+      failed[i] = true;
+    }
+  }, jobs);
+  return std::find(failed.begin(), failed.end(), true) == failed.end();
+}
+
+/*
+ * Dumps the dexes concurrently to stdout, in the order they were given: each
+ * dump is held until the ones before it are out. Returns false if any dex
+ * couldn't be read.
+ */
+bool dump_ordered(const std::vector<const char*>& dexfiles,
+                  const DumpOptions& opts,
+                  size_t jobs) {
+  std::vector<std::string> dumps(dexfiles.size());
+  std::vector<char> done(dexfiles.size(), false);
+  std::vector<char> failed(dexfiles.size(), false);
+  size_t next = 0;
+  std::mutex mutex;
+  parallel_for(dexfiles.size(), [&](size_t i) {
+    std::string out;
+    if (!dump_dex(dexfiles[i], opts, out, nullptr)) {
+      failed[i] = true;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    dumps[i].swap(out);
+    done[i] = true;
+    for (; next < dexfiles.size() && done[next]; ++next) {
+      write_out(stdout, dumps[next]);
+      dumps[next].shrink_to_fit();
+    }
+  }, jobs);
+  return std::find(failed.begin(), failed.end(), true) == failed.end();
+}
+
+}
+
 int main(int argc, char* argv[]) {
 
   bool all = false;
-  bool string = false;
-  bool stringdata = false;
-  bool type = false;
-  bool proto = false;
-  bool field = false;
-  bool meth = false;
-  bool clsdef = false;
-  bool clsdata = false;
-  bool code = false;
-  bool enarr = false;
-  bool anno = false;
-  bool redexdump_debug = false;
+  bool split = false;
+  size_t jobs = 0;
   uint32_t ddebug_offset = 0;
   int no_headers = 0;
+  int tsv = 0;
 
-  char c;
+  int c;
   static const struct option options[] = {
     { "all", no_argument, nullptr, 'a' },
     { "string", no_argument, nullptr, 's' },
@@ -84,10 +297,14 @@ int main(int argc, char* argv[]) {
     { "anno", no_argument, nullptr, 'A' },
     { "debug", no_argument, nullptr, 'd' },
     { "ddebug", required_argument, nullptr, 'D' },
+    { "sections", required_argument, nullptr, 'l' },
+    { "jobs", required_argument, nullptr, 'j' },
+    { "split", no_argument, nullptr, 'o' },
     { "clean", no_argument, (int*)&clean, 1 },
     { "raw", no_argument, (int*)&raw, 1 },
     { "escape", no_argument, (int*)&escape, 1 },
     { "no-headers", no_argument, &no_headers, 1 },
+    { "tsv", no_argument, &tsv, 1 },
     { "help", no_argument, nullptr, 'h' },
     { nullptr, 0, nullptr, 0 },
   };
@@ -95,51 +312,26 @@ int main(int argc, char* argv[]) {
   while ((c = getopt_long(
             argc,
             argv,
-            "asStpfmcCxeAdDh",
+            "asStpfmcCxeAdD:j:h",
             &options[0],
             nullptr)) != -1) {
     switch (c) {
       case 'a':
         all = true;
         break;
-      case 's':
-        string = true;
-        break;
-      case 'S':
-        stringdata = true;
-        break;
-      case 't':
-        type = true;
-        break;
-      case 'p':
-        proto = true;
-        break;
-      case 'f':
-        field = true;
-        break;
-      case 'm':
-        meth = true;
-        break;
-      case 'c':
-        clsdef = true;
-        break;
-      case 'C':
-        clsdata = true;
-        break;
-      case 'x':
-        code = true;
-        break;
-      case 'e':
-        enarr = true;
+      case 'D':
+        sscanf(optarg, "%x", &ddebug_offset);
         break;
-      case 'A':
-        anno = true;
+      case 'l':
+        if (!enable_sections(optarg)) {
+          return 1;
+        }
         break;
-      case 'd':
-        redexdump_debug = true;
+      case 'j':
+        jobs = std::max(1, atoi(optarg));
         break;
-      case 'D':
-        sscanf(optarg, "%x", &ddebug_offset);
+      case 'o':
+        split = true;
         break;
       case 'h':
         puts(ddump_usage_string);
@@ -149,8 +341,14 @@ int main(int argc, char* argv[]) {
       case 0:
         // we're handling a long-only option
         break;
-      default:
-        abort();
+      default: {
+        auto section = find_section(c);
+        if (section == nullptr) {
+          abort();
+        }
+        section->enabled = true;
+        break;
+      }
     }
   }
 
@@ -158,56 +356,28 @@ int main(int argc, char* argv[]) {
     fprintf(stderr, "%s: no dex files given; use -h for help\n", argv[0]);
     return 1;
   }
-
-  while (optind < argc) {
-    const char* dexfile = argv[optind++];
-    ddump_data rd;
-    open_dex_file(dexfile, &rd);
-    if (!no_headers) {
-      redump(format_map(&rd).c_str());
-    }
-    if (string || all) {
-      dump_strings(&rd, !no_headers);
-    }
-    if (stringdata || all) {
-      dump_stringdata(&rd, !no_headers);
-    }
-    if (type || all) {
-      dump_types(&rd);
-    }
-    if (proto || all) {
-      dump_protos(&rd, !no_headers);
-    }
-    if (field || all) {
-      dump_fields(&rd, !no_headers);
-    }
-    if (meth || all) {
-      dump_methods(&rd, !no_headers);
+  if (all) {
+    for (auto& section : s_sections) {
+      section.enabled = true;
     }
-    if (clsdef || all) {
-      dump_clsdefs(&rd, !no_headers);
-    }
-    if (clsdata || all) {
-      dump_clsdata(&rd, !no_headers);
-    }
-    if (code || all) {
-      dump_code(&rd);
-    }
-    if (enarr || all) {
-      dump_enarr(&rd);
-    }
-    if (anno || all) {
-      dump_anno(&rd);
-    }
-    if (redexdump_debug || all) {
-      dump_debug(&rd);
-    }
-    if (ddebug_offset != 0) {
-      disassemble_debug(&rd, ddebug_offset);
-    }
-    fprintf(stdout, "\n");
-    fflush(stdout);
   }
 
-  return 0;
+  DumpOptions opts;
+  opts.print_headers = !no_headers;
+  opts.tsv = tsv;
+  opts.ddebug_offset = ddebug_offset;
+  std::vector<const char*> dexfiles(argv + optind, argv + argc);
+  if (split) {
+    return dump_split(dexfiles, opts, jobs) ? 0 : 1;
+  }
+  if (jobs == 1 || dexfiles.size() == 1) {
+    bool ok = true;
+    for (auto dexfile : dexfiles) {
+      std::string out;
+      ok &= dump_dex(dexfile, opts, out, stdout);
+      fflush(stdout);
+    }
+    return ok ? 0 : 1;
+  }
+  return dump_ordered(dexfiles, opts, jobs) ? 0 : 1;
 }